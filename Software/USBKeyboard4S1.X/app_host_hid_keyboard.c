@@ -31,8 +31,11 @@ please contact mla_licensing@microchip.com
 //#include <stdio.h>
 #include <string.h>
 #include "print_lcd.h"
+#include "boot_trace.h"
 #include "timer_1ms.h"
 #include "main.h"
+#include "interrupt.h"
+#include "isr_stat.h"
 
 // *****************************************************************************
 // *****************************************************************************
@@ -46,8 +49,6 @@ typedef enum _APP_STATE {
     DEVICE_CONNECTED, /* Device Enumerated  - Report Descriptor Parsed */
     GET_INPUT_REPORT, /* perform operation on received report */
     INPUT_REPORT_PENDING,
-    SEND_OUTPUT_REPORT, /* Not needed in case of mouse */
-    OUTPUT_REPORT_PENDING,
     ERROR_REPORTED
 } KEYBOARD_STATE;
 
@@ -55,6 +56,8 @@ typedef struct {
     uint8_t address;
     KEYBOARD_STATE state;
     bool inUse;
+    USB_HID_HANDLE keysHandle;  // input report
+    USB_HID_HANDLE ledsHandle;  // output report
 
     struct {
         uint16_t id;
@@ -67,7 +70,7 @@ typedef struct {
             struct {
                 HID_DATA_DETAILS details;
 //                HID_USER_DATA_SIZE newData[6];
-//                HID_USER_DATA_SIZE oldData[6];
+                HID_USER_DATA_SIZE oldData[6];
                 HID_USER_DATA_SIZE data[6];
             } parsed;
         } normal;
@@ -76,14 +79,19 @@ typedef struct {
 
             struct {
                 HID_USER_DATA_SIZE data[8];
+                HID_USER_DATA_SIZE oldData[8];
                 HID_DATA_DETAILS details;
             } parsed;
         } modifier;
     } keys;
 
     struct {
-        bool updated;
+        bool updated;   // report is changed by the S1
+        bool pending;   // transfer is in progress
+        bool synced;    // device shows the state in sent
+        uint8_t errors; // failed transfers of the state in sent
 
+        /* latest state from the S1, written in interrupt */
         union {
             uint8_t value;
 
@@ -96,6 +104,10 @@ uint8_t:
             } bits;
         } report;
 
+        uint8_t sending;    // state in the transfer
+        uint8_t sent;       // state in the last finished transfer
+        uint8_t buffer[8];  // report ID and data given to the transfer
+
         struct {
             HID_DATA_DETAILS details;
         } parsed;
@@ -110,6 +122,19 @@ typedef struct {
 
 #define MAX_ERROR_COUNTER               (10)
 
+// each change of the key matrix is shown on this number of S1 scans at least
+#define KEY_HOLD_SCANS                  (2)
+// size of key event queue (must be power of 2)
+#define KEY_QUEUE_SIZE                  (64)
+// maximum number of events made from one report (modifier 8 + released 6 + pressed 6)
+#define KEY_QUEUE_REPORT_EVENTS         (20)
+
+typedef struct {
+    uint8_t key;        // scancode
+    uint8_t pressed;    // 1:pressed 0:released
+    uint8_t seq;        // number of report which made this event
+} KEY_EVENT;
+
 // *****************************************************************************
 // *****************************************************************************
 // Local Variables
@@ -118,6 +143,16 @@ typedef struct {
 
 static KEYBOARD keyboard;
 
+// number of pressed USB keys on each scancode
+// some USB keys share one scancode (e.g. left and right CTRL)
+static uint8_t key_press_count[sizeof(key_onoff_flags) * 8];
+
+// key events waiting to be shown to the S1
+static KEY_EVENT key_queue[KEY_QUEUE_SIZE];
+static uint8_t key_queue_head;
+static uint8_t key_queue_tail;
+static uint8_t key_report_seq;
+
 // for Japanese keyboard
 // F9 -> Break key
 static const uint8_t key2scancodeTable[256] = {
@@ -161,6 +196,12 @@ static const uint8_t key2scancodeTable[256] = {
 // *****************************************************************************
 // *****************************************************************************
 static void App_ProcessInputReport(void);
+static void App_ClearKeyMatrix(void);
+static void App_KeyQueueTasks(void);
+static void App_LEDTasks(void);
+static bool App_RequestInputReport(void);
+static void App_InputReportDone(USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount);
+static void App_OutputReportDone(USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount);
 
 // *****************************************************************************
 // *****************************************************************************
@@ -168,6 +209,11 @@ static void App_ProcessInputReport(void);
 // *****************************************************************************
 // *****************************************************************************
 
+static void APP_LED_OK_Handler(void) {
+    led_hira_inv = (led_hira_inv ^ 0x04);
+}
+
+#ifdef APP_INPUT_REPORT_BY_TICK
 /*********************************************************************
  * Function: void APP_HostHIDTimerHandler(void);
  *
@@ -186,10 +232,7 @@ static void APP_HostHIDTimerHandler(void) {
         keyboard.state = GET_INPUT_REPORT;
     }
 }
-
-static void APP_LED_OK_Handler(void) {
-    led_hira_inv = (led_hira_inv ^ 0x04);
-}
+#endif
 
 /*********************************************************************
  * Function: void APP_HostHIDKeyboardInitialize(void);
@@ -234,9 +277,14 @@ void APP_HostHIDKeyboardTasks() {
             keyboard.state = DEVICE_NOT_CONNECTED;
             keyboard.address = 0;
             keyboard.inUse = false;
+            keyboard.keysHandle = NULL;
+            keyboard.ledsHandle = NULL;
+#ifdef APP_INPUT_REPORT_BY_TICK
+            TIMER_CancelTick(&APP_HostHIDTimerHandler);
+#endif
 
             if (keyboard.keys.buffer != NULL) {
-                free(keyboard.keys.buffer);
+                USB_FREE(keyboard.keys.buffer);
                 keyboard.keys.buffer = NULL;
             }
         }
@@ -248,7 +296,11 @@ void APP_HostHIDKeyboardTasks() {
             PRINT_String("Attach keyboard\r\n", 17);
 #endif
             memset(&keyboard.keys, 0x00, sizeof (keyboard.keys));
+            /* the S1 keeps its LED state over the attach */
+            count = keyboard.leds.report.value;
             memset(&keyboard.leds, 0x00, sizeof (keyboard.leds));
+            keyboard.leds.report.value = count;
+            App_ClearKeyMatrix();
             keyboard.state = WAITING_FOR_DEVICE;
             break;
 
@@ -259,73 +311,285 @@ void APP_HostHIDKeyboardTasks() {
 #ifdef DEBUG_ENABLE
                 PRINT_String("Connected\r\n", 11);
 #endif
+                /* resolve device, interface and endpoint only once */
+                keyboard.keysHandle = USBHostHIDOpen(false,
+                        keyboard.address,
+                        keyboard.keys.normal.parsed.details.interfaceNum);
+                keyboard.ledsHandle = USBHostHIDOpen(true,
+                        keyboard.address,
+                        keyboard.leds.parsed.details.interfaceNum);
+                USBHostHIDSetCallback(keyboard.keysHandle, &App_InputReportDone);
+                USBHostHIDSetCallback(keyboard.ledsHandle, &App_OutputReportDone);
+                /* show the current state of the S1 on the new keyboard */
+                keyboard.leds.updated = true;
                 keyboard.state = DEVICE_CONNECTED;
                 TIMER_RequestTick(&APP_LED_OK_Handler, 500, 6);
+#ifdef APP_INPUT_REPORT_BY_TICK
                 TIMER_RequestTick(&APP_HostHIDTimerHandler, 10, -1);
+#endif
             }
             break;
 
         case DEVICE_CONNECTED:
+#ifdef APP_INPUT_REPORT_BY_TICK
+            /* the next report is read at the next tick */
             break;
+#else
+            /* input report is read continuously. */
+            /* the host polls the interrupt IN endpoint at its bInterval */
+            /* and the device NAKs until keys change, so no timer is needed. */
+            keyboard.state = GET_INPUT_REPORT;
+            /* fall through */
+#endif
 
         case GET_INPUT_REPORT:
-            if (USBHostHIDReadWrite(false,
-                    keyboard.address,
-                    keyboard.keys.id,
-                    keyboard.keys.normal.parsed.details.interfaceNum,
-                    keyboard.keys.size,
-                    keyboard.keys.buffer
-                    )
-                    ) {
-                /* Host may be busy/error -- keep trying */
-            } else {
-                keyboard.state = INPUT_REPORT_PENDING;
-            }
+            App_RequestInputReport();
             break;
 
         case INPUT_REPORT_PENDING:
-            if (USBHostHIDReadWriteIsComplete(false, keyboard.address, &error, &count)) {
+            /* normally App_InputReportDone() finishes the report. */
+            /* this catches a transfer cancelled by a stall recovery. */
+            if (USBHostHIDTransferIsComplete(keyboard.keysHandle, &error, &count)) {
                 if (error || (count == 0)) {
                     keyboard.state = DEVICE_CONNECTED;
                 } else {
                     keyboard.state = DEVICE_CONNECTED;
 
                     App_ProcessInputReport();
-                    if (keyboard.leds.updated == true) {
-                        keyboard.state = SEND_OUTPUT_REPORT;
-                    }
                 }
             }
             break;
 
-        case SEND_OUTPUT_REPORT: /* Will be done while implementing Keyboard */
-            if (USBHostHIDReadWrite(true,
-                    keyboard.address,
-                    keyboard.leds.parsed.details.reportID,
-                    keyboard.leds.parsed.details.interfaceNum,
-                    keyboard.leds.parsed.details.reportLength,
-                    (uint8_t*) & keyboard.leds.report
-                    )
-                    ) {
-                /* Host may be busy/error -- keep trying */
-            } else {
-                keyboard.state = OUTPUT_REPORT_PENDING;
-            }
+        case ERROR_REPORTED:
             break;
 
-        case OUTPUT_REPORT_PENDING:
-            if (USBHostHIDReadWriteIsComplete(true, keyboard.address, &error, &count)) {
-                keyboard.leds.updated = false;
-                keyboard.state = DEVICE_CONNECTED;
-            }
+        default:
             break;
 
-        case ERROR_REPORTED:
+    }
+
+    App_KeyQueueTasks();
+
+    switch (keyboard.state) {
+        case DEVICE_CONNECTED:
+        case GET_INPUT_REPORT:
+        case INPUT_REPORT_PENDING:
+            /* LED report is sent while the input report is pending */
+            App_LEDTasks();
             break;
 
         default:
             break;
+    }
+
+#ifdef BOOT_TRACE_ENABLE
+    BOOT_TRACE_State(BOOT_TRACE_APP, 0, keyboard.state);
+#endif
+}
+
+/****************************************************************************
+  Function:
+    bool App_RequestInputReport(void)
+
+  Description:
+    This function starts reading the next input report.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    true  - The read is started
+    false - The key queue is full or the host is busy
+
+  Remarks:
+    The state is INPUT_REPORT_PENDING while reading.
+ ***************************************************************************/
+static bool App_RequestInputReport(void)
+{
+    if ((uint8_t)(KEY_QUEUE_SIZE - (uint8_t)(key_queue_tail - key_queue_head)) < KEY_QUEUE_REPORT_EVENTS) {
+        /* no room for the next report, wait for the S1 scan */
+        keyboard.state = GET_INPUT_REPORT;
+        return false;
+    }
+    if (USBHostHIDTransfer(keyboard.keysHandle,
+            keyboard.keys.id,
+            keyboard.keys.size,
+            keyboard.keys.buffer
+            )
+            ) {
+        /* Host may be busy/error -- keep trying */
+        keyboard.state = GET_INPUT_REPORT;
+        return false;
+    }
+    keyboard.state = INPUT_REPORT_PENDING;
+    return true;
+}
 
+/****************************************************************************
+  Function:
+    void App_InputReportDone(USB_HID_HANDLE handle, uint8_t errorCode,
+                             uint8_t *data, uint8_t byteCount)
+
+  Description:
+    This function is called by the HID client when the input report is
+    received. The report is converted to key events at once and the next
+    read is started without waiting for the next APP_HostHIDKeyboardTasks().
+    With APP_INPUT_REPORT_BY_TICK the next read waits for the 10ms tick.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle - Handle of the input report
+    uint8_t errorCode     - Error code of the transfer
+    uint8_t *data         - Received report
+    uint8_t byteCount     - Number of received bytes (0: NAK)
+
+  Return Values:
+    None
+
+  Remarks:
+    Called in USBHostTasks().
+ ***************************************************************************/
+static void App_InputReportDone(USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount)
+{
+    if (keyboard.state != INPUT_REPORT_PENDING) {
+        return;
+    }
+    if (!errorCode && byteCount != 0) {
+        App_ProcessInputReport();
+        App_KeyQueueTasks();
+    }
+#ifdef APP_INPUT_REPORT_BY_TICK
+    keyboard.state = DEVICE_CONNECTED;
+#else
+    App_RequestInputReport();
+#endif
+}
+
+/****************************************************************************
+  Function:
+    void App_OutputReportDone(USB_HID_HANDLE handle, uint8_t errorCode,
+                              uint8_t *data, uint8_t byteCount)
+
+  Description:
+    This function is called by the HID client when the LED report is sent.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle - Handle of the output report
+    uint8_t errorCode     - Error code of the transfer
+    uint8_t *data         - Sent report
+    uint8_t byteCount     - Number of sent bytes
+
+  Return Values:
+    None
+
+  Remarks:
+    Called in USBHostTasks().
+    A change made while the report is in flight is sent at once.
+    A failed report is sent again, up to MAX_ERROR_COUNTER times.
+ ***************************************************************************/
+static void App_OutputReportDone(USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount)
+{
+    keyboard.leds.pending = false;
+    keyboard.leds.sent = keyboard.leds.sending;
+    keyboard.leds.synced = (errorCode == USB_SUCCESS);
+    if (errorCode == USB_SUCCESS) {
+        keyboard.leds.errors = 0;
+    } else if (keyboard.leds.errors < MAX_ERROR_COUNTER) {
+        keyboard.leds.errors++;
+        keyboard.leds.updated = true;
+    }
+
+    App_LEDTasks();
+}
+
+/****************************************************************************
+  Function:
+    void App_LEDTasks(void)
+
+  Description:
+    This function sends output report for LEDs to HID device.
+    It runs beside the input report, because the input report is kept
+    pending until any key is pressed or released.
+    Changes made while a report is in flight are collapsed, and only the
+    latest state is sent. A state which the device already shows is not
+    sent again.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+
+  Remarks:
+    None
+ ***************************************************************************/
+static void App_LEDTasks(void)
+{
+    uint8_t error;
+    uint8_t count;
+    uint8_t value;
+    uint8_t *data;
+
+    if (keyboard.leds.pending == true) {
+        /* normally finished by App_OutputReportDone() */
+        if (USBHostHIDTransferIsComplete(keyboard.ledsHandle, &error, &count)) {
+            App_OutputReportDone(keyboard.ledsHandle, error, NULL, count);
+        }
+        return;
+    }
+    if (keyboard.leds.updated == false) {
+        return;
+    }
+
+    /* clear first, so that the update in interrupt is not lost */
+    keyboard.leds.updated = false;
+    value = keyboard.leds.report.value;
+    if (keyboard.leds.synced == true && keyboard.leds.sent == value) {
+        return;
+    }
+    /* a new state from the S1 gets its own retries */
+    if (keyboard.leds.sent != value) {
+        keyboard.leds.errors = 0;
+    }
+
+    count = keyboard.leds.parsed.details.reportLength;
+    if (count == 0 || count >= sizeof(keyboard.leds.buffer)) {
+        return;
+    }
+
+    /* the interrupt OUT endpoint takes the report ID in the data */
+    memset(keyboard.leds.buffer, 0x00, sizeof(keyboard.leds.buffer));
+    keyboard.leds.buffer[0] = keyboard.leds.parsed.details.reportID;
+    keyboard.leds.buffer[1] = value;
+    data = &keyboard.leds.buffer[1];
+    if (keyboard.leds.buffer[0] != 0
+     && !USBHostHIDTransferUsesControl(keyboard.ledsHandle)) {
+        data--;
+        count++;
+    }
+
+    if (USBHostHIDTransfer(keyboard.ledsHandle,
+            keyboard.leds.parsed.details.reportID,
+            count,
+            data
+            )
+            ) {
+        /* Host may be busy/error -- keep trying */
+        keyboard.leds.updated = true;
+    } else {
+        keyboard.leds.sending = value;
+        keyboard.leds.pending = true;
     }
 }
 
@@ -442,7 +706,7 @@ bool APP_HostHIDKeyboardReportParser(void) {
     if (pDeviceRptinfo->reports == 1) {
         keyboard.keys.id = 0;
         keyboard.keys.size = keyboard.keys.normal.parsed.details.reportLength;
-        keyboard.keys.buffer = (uint8_t*) malloc(keyboard.keys.size);
+        keyboard.keys.buffer = (uint8_t*) USB_MALLOC(keyboard.keys.size);
         keyboard.keys.pollRate = pDeviceRptinfo->reportPollingRate;
 
         if ((foundNormalKey == true) &&
@@ -456,12 +720,194 @@ bool APP_HostHIDKeyboardReportParser(void) {
     return (keyboard.inUse);
 }
 
+/****************************************************************************
+  Function:
+    void App_ClearKeyMatrix(void)
+
+  Description:
+    This function releases all keys in the key matrix.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+
+  Remarks:
+    The previous report is also cleared by caller, so that the matrix
+    and the report are kept in step.
+ ***************************************************************************/
+static void App_ClearKeyMatrix(void)
+{
+    key_queue_head = 0;
+    key_queue_tail = 0;
+    memset(key_press_count, 0, sizeof(key_press_count));
+    memset(key_onoff_flags, 0, sizeof(key_onoff_flags));
+    key_onoff_flags[0x71 >> 3] = (1 << (0x71 & 7));    // JIS Keyboard
+    INTR_UpdateScanTable(key_onoff_flags);
+}
+
+/****************************************************************************
+  Function:
+    void App_QueueKeyDelta(uint8_t usage, bool pressed)
+
+  Description:
+    This function puts a key press or release into the key event queue.
+
+  Precondition:
+    The queue has room for KEY_QUEUE_REPORT_EVENTS events.
+
+  Parameters:
+    uint8_t usage   - usage id of the key
+    bool pressed    - true if pressed, false if released
+
+  Return Values:
+    None
+
+  Remarks:
+    An event is queued only when the scancode itself is changed.
+ ***************************************************************************/
+static void App_QueueKeyDelta(uint8_t usage, bool pressed)
+{
+    uint8_t key;
+    KEY_EVENT *event;
+
+#ifdef ISR_STAT_ENABLE
+    if (usage == USB_HID_KEYBOARD_KEYPAD_KEYBOARD_SCROLL_LOCK && pressed) {
+        ISR_STAT_RequestDump();
+    }
+#endif
+#ifdef BOOT_TRACE_ENABLE
+    if (usage == USB_HID_KEYBOARD_KEYPAD_KEYBOARD_PAUSE && pressed) {
+        BOOT_TRACE_RequestDump();
+    }
+#endif
+
+    key = key2scancodeTable[usage];
+    if (key == 0xff) {
+        return;
+    }
+    if (pressed) {
+        if (key_press_count[key]++ != 0) {
+            return;
+        }
+    } else {
+        if (key_press_count[key] == 0 || --key_press_count[key] != 0) {
+            return;
+        }
+    }
+    event = &key_queue[key_queue_tail & (KEY_QUEUE_SIZE - 1)];
+    event->key = key;
+    event->pressed = (pressed ? 1 : 0);
+    event->seq = key_report_seq;
+    key_queue_tail++;
+#ifdef BOOT_TRACE_ENABLE
+    BOOT_TRACE_Mark(BOOT_TRACE_MARK_FIRST_KEY);
+#endif
+}
+
+/****************************************************************************
+  Function:
+    void App_KeyQueueTasks(void)
+
+  Description:
+    This function moves key events from the queue to the key matrix.
+    Events made from the same report are applied together, and the next
+    events wait until the S1 scans the matrix KEY_HOLD_SCANS times.
+    While the S1 does not scan the keyboard, events are applied at once
+    so that the queue does not block USB polling and BREAK key.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+
+  Remarks:
+    When the same key appears twice in the batch, the second event is
+    left for the next batch so that the S1 can see both of them.
+ ***************************************************************************/
+static void App_KeyQueueTasks(void)
+{
+    KEY_EVENT *event;
+    uint8_t seq;
+    uint8_t touched[sizeof(key_onoff_flags)];
+    uint8_t bits;
+
+    if (key_queue_head == key_queue_tail) {
+        return;
+    }
+    if (INTR_ScanIsActive() && !INTR_ScanTableSettled(KEY_HOLD_SCANS)) {
+        return;
+    }
+
+    memset(touched, 0, sizeof(touched));
+    seq = key_queue[key_queue_head & (KEY_QUEUE_SIZE - 1)].seq;
+    while(key_queue_head != key_queue_tail) {
+        event = &key_queue[key_queue_head & (KEY_QUEUE_SIZE - 1)];
+        bits = (1 << (event->key & 7));
+        if (event->seq != seq || (touched[event->key >> 3] & bits)) {
+            break;
+        }
+        touched[event->key >> 3] |= bits;
+        if (event->pressed) {
+            key_onoff_flags[event->key >> 3] |= bits;
+        } else {
+            key_onoff_flags[event->key >> 3] &= ~bits;
+        }
+        key_queue_head++;
+    }
+    INTR_UpdateScanTable(key_onoff_flags);
+}
+
+/****************************************************************************
+  Function:
+    bool App_FindUsage(const HID_USER_DATA_SIZE *data, uint8_t count, HID_USER_DATA_SIZE usage)
+
+  Description:
+    This function finds a usage id in the array of the report.
+
+  Precondition:
+    None
+
+  Parameters:
+    const HID_USER_DATA_SIZE *data  - usage ids in the report
+    uint8_t count                   - number of usage ids
+    HID_USER_DATA_SIZE usage        - usage id to find
+
+  Return Values:
+    true    - found
+    false   - not found
+
+  Remarks:
+    None
+ ***************************************************************************/
+static bool App_FindUsage(const HID_USER_DATA_SIZE *data, uint8_t count, HID_USER_DATA_SIZE usage)
+{
+    uint8_t i;
+
+    for (i = 0; i < count; i++) {
+        if (data[i] == usage) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /****************************************************************************
   Function:
     void App_ProcessInputReport(void)
 
   Description:
     This function processes input report received from HID device.
+    Only keys pressed or released since the previous report are put into
+    the key event queue. The same report as previous one is ignored.
 
   Precondition:
     None
@@ -473,13 +919,14 @@ bool APP_HostHIDKeyboardReportParser(void) {
     None
 
   Remarks:
-    None
+    If the report shows ErrorRollOver, keys in array are kept in the
+    previous state and only modifier keys are updated.
  ***************************************************************************/
 static void App_ProcessInputReport(void)
 {
-    int i;
-    uint8_t key;
-    uint8_t new_key_onoff_flags[20];
+    uint8_t i;
+    uint8_t count;
+    HID_USER_DATA_SIZE usage;
 
     /* process input report received from device */
     USBHostHID_ApiImportData(keyboard.keys.buffer,
@@ -494,33 +941,54 @@ static void App_ProcessInputReport(void)
             &keyboard.keys.normal.parsed.details
             );
 
-    memset(new_key_onoff_flags, 0, sizeof(new_key_onoff_flags));
-    new_key_onoff_flags[0x71 >> 3]=(1 << (0x71 & 7));
+    key_report_seq++;
 
+    /* modifier keys */
     for (i = 0; i < keyboard.keys.modifier.parsed.details.reportLength && i < 8; i++) {
-        if (keyboard.keys.modifier.parsed.data[i] == 1) {
-            key = key2scancodeTable[i + USB_HID_KEYBOARD_KEYPAD_KEYBOARD_LEFT_CONTROL];  
-            if (key != 0xff) {
-                new_key_onoff_flags[key >> 3] |= (1 << (key & 7));
-            }
+        if (keyboard.keys.modifier.parsed.data[i] != keyboard.keys.modifier.parsed.oldData[i]) {
+            App_QueueKeyDelta(i + USB_HID_KEYBOARD_KEYPAD_KEYBOARD_LEFT_CONTROL,
+                    keyboard.keys.modifier.parsed.data[i] == 1);
+            keyboard.keys.modifier.parsed.oldData[i] = keyboard.keys.modifier.parsed.data[i];
         }
     }
 
-    for (i = 0; i < keyboard.keys.normal.parsed.details.reportLength; i++) {
-        key = key2scancodeTable[keyboard.keys.normal.parsed.data[i]];
-        if (key != 0xff) {
-            new_key_onoff_flags[key >> 3] |= (1 << (key & 7));
+    /* normal keys */
+    count = keyboard.keys.normal.parsed.details.count;
+    if (count > 6) {
+        count = 6;
+    }
+    if (keyboard.keys.normal.parsed.data[0] != USB_HID_KEYBOARD_KEYPAD_KEYBOARD_ERROR_ROLL_OVER
+     && memcmp(keyboard.keys.normal.parsed.data, keyboard.keys.normal.parsed.oldData, count * sizeof(HID_USER_DATA_SIZE)) != 0) {
+        /* released keys */
+        for (i = 0; i < count; i++) {
+            usage = keyboard.keys.normal.parsed.oldData[i];
+            if (!App_FindUsage(keyboard.keys.normal.parsed.data, count, usage)
+             && !App_FindUsage(keyboard.keys.normal.parsed.oldData, i, usage)) {
+                App_QueueKeyDelta(usage, false);
+            }
         }
+        /* pressed keys */
+        for (i = 0; i < count; i++) {
+            usage = keyboard.keys.normal.parsed.data[i];
+            if (!App_FindUsage(keyboard.keys.normal.parsed.oldData, count, usage)
+             && !App_FindUsage(keyboard.keys.normal.parsed.data, i, usage)) {
+                App_QueueKeyDelta(usage, true);
+            }
+        }
+        memcpy(keyboard.keys.normal.parsed.oldData, keyboard.keys.normal.parsed.data, count * sizeof(HID_USER_DATA_SIZE));
     }
-    memcpy(key_onoff_flags, new_key_onoff_flags, sizeof(key_onoff_flags));
     
 //    UART_PutHexa(keyboard.keys.normal.parsed.data, keyboard.keys.normal.parsed.details.reportLength);
 }
 
 void APP_HostHIDUpdateLED(uint8_t led_status)
 {
-    keyboard.leds.report.bits.numLock = (led_status & 2 ? 1 : 0);
-    keyboard.leds.report.bits.scrollLock = (led_status & 4 ? 1 : 0);
-    keyboard.leds.report.bits.capsLock = (led_status & 8 ? 0 : 1);
+    uint8_t value = 0;
+
+    /* store at once, so that the main loop never reads a half state */
+    if (led_status & 2) value |= 0x01;      // numLock: katakana
+    if (!(led_status & 8)) value |= 0x02;   // capsLock
+    if (led_status & 4) value |= 0x04;      // scrollLock: hiragana
+    keyboard.leds.report.value = value;
     keyboard.leds.updated = true;
 }
\ No newline at end of file
@@ -20,7 +20,8 @@ please contact mla_licensing@microchip.com
  * Modified by Sasaji at 2018/02/10
  */
 
-#include "usb_host_hid.h"
+#include <stdint.h>
+#include <stdbool.h>
 
 /*********************************************************************
 * Function: void APP_HostHIDKeyboardInitialize(void);
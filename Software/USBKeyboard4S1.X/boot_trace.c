@@ -0,0 +1,139 @@
+/** @file   boot_trace.c
+ *
+ *  @author Sasaji
+ *  @date   2026/10/17
+ *
+ * 	@brief  milestone trace from reset to the first key
+ *
+ *  Each entry has the core timer count, which starts from zero at reset,
+ *  so the log tells the time from reset without any setup.
+ *  The USB host, hub and HID drivers report their state where it is set
+ *  (_USB_SetHostState, _USBHostHUB_SetState, _USBHostHID_SetState), so a
+ *  state held for less than a pass of the main loop is logged too; the
+ *  application reports its state once per pass. Only a changed state is
+ *  logged.
+ */
+
+#include <xc.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "common.h"
+#include "boot_trace.h"
+
+#ifdef BOOT_TRACE_ENABLE
+
+#include "uart.h"
+
+typedef struct {
+    uint32_t time;      // core timer count
+    uint8_t  source;    // BOOT_TRACE_*
+    uint8_t  index;
+    uint16_t value;
+} BOOT_TRACE_ENTRY;
+
+static BOOT_TRACE_ENTRY boot_trace_log[BOOT_TRACE_SIZE];
+static uint16_t boot_trace_count;
+static uint16_t boot_trace_dropped;
+static uint16_t boot_trace_last[BOOT_TRACE_SOURCES][BOOT_TRACE_INDEXES];
+static bool boot_trace_first_key;
+static volatile bool dump_requested;
+
+static const char *boot_trace_names[] = {
+    "HOST", "HUB ", "HID ", "APP ", "MARK"
+};
+
+/// add an entry
+static void BOOT_TRACE_Add(uint8_t source, uint8_t index, uint16_t value)
+{
+    BOOT_TRACE_ENTRY *entry;
+
+    if (boot_trace_count >= BOOT_TRACE_SIZE) {
+        boot_trace_dropped++;
+        return;
+    }
+    entry = &boot_trace_log[boot_trace_count++];
+    entry->time = _CP0_GET_COUNT();
+    entry->source = source;
+    entry->index = index;
+    entry->value = value;
+}
+
+void BOOT_TRACE_Init(void)
+{
+    boot_trace_count = 0;
+    boot_trace_dropped = 0;
+    boot_trace_first_key = false;
+    memset(boot_trace_last, 0xff, sizeof(boot_trace_last));
+    dump_requested = false;
+
+    BOOT_TRACE_Add(BOOT_TRACE_MARK, 0, BOOT_TRACE_MARK_MAIN);
+}
+
+/// log the state if it is changed
+/// called in main loop (the drivers set their states there)
+void BOOT_TRACE_State(uint8_t source, uint8_t index, uint16_t state)
+{
+    if (source >= BOOT_TRACE_SOURCES || index >= BOOT_TRACE_INDEXES) {
+        return;
+    }
+    if (boot_trace_last[source][index] == state) {
+        return;
+    }
+    boot_trace_last[source][index] = state;
+    BOOT_TRACE_Add(source, index, state);
+}
+
+/// log a milestone
+/// the first key is logged only once
+void BOOT_TRACE_Mark(uint16_t mark)
+{
+    if (mark == BOOT_TRACE_MARK_FIRST_KEY) {
+        if (boot_trace_first_key) {
+            return;
+        }
+        boot_trace_first_key = true;
+    }
+    BOOT_TRACE_Add(BOOT_TRACE_MARK, 0, mark);
+}
+
+/// request to print the log on UART
+void BOOT_TRACE_RequestDump(void)
+{
+    dump_requested = true;
+}
+
+/// print the log if requested
+/// called in main loop
+void BOOT_TRACE_Tasks(void)
+{
+    uint16_t n;
+    uint16_t value;
+    const BOOT_TRACE_ENTRY *entry;
+
+    if (!dump_requested) {
+        return;
+    }
+    dump_requested = false;
+
+    UART_PutString("Boot trace (us from reset)\r\n");
+    UART_Flush();
+    for(n = 0; n < boot_trace_count; n++) {
+        entry = &boot_trace_log[n];
+        UART_PutDecimal(entry->time / BOOT_TRACE_COUNT_PER_US, 10);
+        UART_PutString(" ");
+        UART_PutString((char *)boot_trace_names[entry->source]);
+        UART_PutString(" ");
+        UART_PutDecimal(entry->index, 0);
+        value = entry->value;
+        UART_PutHex16String(&value, 1);
+        UART_Flush();
+    }
+    UART_PutString("dropped=");
+    UART_PutDecimal(boot_trace_dropped, 0);
+    UART_PutString("\r\n");
+    UART_Flush();
+}
+
+#endif /* BOOT_TRACE_ENABLE */
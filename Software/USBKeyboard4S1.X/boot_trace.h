@@ -0,0 +1,56 @@
+/** @file   boot_trace.h
+ *
+ *  @author Sasaji
+ *  @date   2026/10/17
+ *
+ * 	@brief  milestone trace from reset to the first key
+ */
+
+#ifndef BOOT_TRACE_H
+#define	BOOT_TRACE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "common.h"
+
+#ifdef BOOT_TRACE_ENABLE
+
+// number of entries in the log (the later ones are dropped)
+#ifndef BOOT_TRACE_SIZE
+ #define BOOT_TRACE_SIZE    128
+#endif
+
+// core timer counts per microsecond (SYSCLK 48MHz / 2)
+#define BOOT_TRACE_COUNT_PER_US 24
+
+// sources of the entries
+#define BOOT_TRACE_HOST     0   // usbHostState
+#define BOOT_TRACE_HUB      1   // state of a hub (index: hub)
+#define BOOT_TRACE_HID      2   // state of a HID device (index: device)
+#define BOOT_TRACE_APP      3   // state of the keyboard application
+#define BOOT_TRACE_MARK     4   // milestone (value: BOOT_TRACE_MARK_*)
+#define BOOT_TRACE_SOURCES  4   // number of sources traced by state
+
+// number of instances traced per source
+#define BOOT_TRACE_INDEXES  4
+
+// milestones
+#define BOOT_TRACE_MARK_MAIN        0   // main() is entered
+#define BOOT_TRACE_MARK_FIRST_KEY   1   // the first key event is queued for the S1
+
+void BOOT_TRACE_Init(void);
+void BOOT_TRACE_State(uint8_t source, uint8_t index, uint16_t state);
+void BOOT_TRACE_Mark(uint16_t mark);
+void BOOT_TRACE_RequestDump(void);
+void BOOT_TRACE_Tasks(void);
+
+#endif /* BOOT_TRACE_ENABLE */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* BOOT_TRACE_H */
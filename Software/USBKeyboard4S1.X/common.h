@@ -9,7 +9,7 @@
 #ifndef COMMON_H
 #define	COMMON_H
 
-#include <xc.h>
+#include "hal.h"
 
 #if defined(__PIC32MX__)
  #ifndef __PIC32__
@@ -23,5 +23,47 @@
  #endif
 #endif
 
+// read the input report on a 10ms tick of timer_1ms.c instead of
+// continuously (the old way, to compare the latency with usb_host_sim -r tick)
+//#define APP_INPUT_REPORT_BY_TICK
+
+// count HPP pulses by Timer2 (external clock on RB4) instead of INT4 ISR
+//#define HPP_COUNT_BY_TIMER2
+
+// output Y_N by DMA triggered on HPP rise and fall instead of INT4/INT3 ISR,
+// LED is decoded on its change notice (tools/s1_scan_sim_dma runs it)
+//#define SCAN_OUTPUT_BY_DMA
+#if defined(SCAN_OUTPUT_BY_DMA) && defined(HPP_COUNT_BY_TIMER2)
+ #error "SCAN_OUTPUT_BY_DMA and HPP_COUNT_BY_TIMER2 cannot be used together"
+#endif
+
+// measure response time of HPP interrupts and time in USB interrupt,
+// print it by Scroll Lock key
+// (needs DEBUG_ENABLE, the host tools print it by themselves)
+//#define ISR_STAT_ENABLE
+#if !defined(DEBUG_ENABLE) && !defined(HAL_SIM)
+ #undef ISR_STAT_ENABLE
+#endif
+
+// process the interrupts of USB host in the USB ISR instead of the main
+// loop, as the original stack did (to compare the time in the ISR)
+//#define USB_HOST_TASKS_IN_ISR
+
+// log state changes of USB host, hubs, HID and the application with
+// the core timer count from reset, print it by Pause key
+// (needs DEBUG_ENABLE)
+//#define BOOT_TRACE_ENABLE
+#ifndef DEBUG_ENABLE
+ #undef BOOT_TRACE_ENABLE
+#endif
+
+// USB host stack takes memory from fixed size pools instead of the heap
+// (see usb/usb_pool.h, a device over the pools takes the rest from the heap)
+//#define USB_STATIC_POOL
+
+// descriptors of known devices are kept in flash, and are not read again
+// at the next attach (see usb/usb_enum_cache.h)
+//#define USB_ENUM_CACHE
+
 #endif	/* COMMON_H */
 
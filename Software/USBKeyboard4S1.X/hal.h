@@ -0,0 +1,44 @@
+/** @file hal.h
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Hardware abstraction of the scan, LED and timer path
+ *
+ *  The scan servicing (interrupt.c) and the tick scheduler (timer_1ms.c)
+ *  touch the hardware only through the macros defined here.
+ *  hal_pic32.h maps them to the SFRs when built with XC32.
+ *  hal_sim.h maps them to registers emulated in memory when built with
+ *  gcc on a host, so the logic can run and be measured off target.
+ *
+ *  Pins:
+ *    PORT_HPP_IS_HIGH, PORT_KRES1_IS_SET, PORT_KRES2_IS_SET, PORT_LED_IS_LOW
+ *    TRIS_Y_N, LAT_Y_N_SET, LAT_Y_N_CLR, LAT_Y_N_OUT(level)
+ *    LAT_BREAK_N_SET, LAT_BREAK_N_CLR
+ *    LAT_KATA_LED, LAT_HIRA_LED, LAT_CAPS_LED (assignable bits)
+ *    LAT_xxx_MASK
+ *  Core timer (SYSCLK / 2):
+ *    HAL_CORE_TIMER()
+ *  External interrupts INT4 (HPP rise) and INT3 (HPP fall):
+ *    HAL_SCAN_INT_INIT(), HAL_INTn_ENABLE(), HAL_INTn_DISABLE(), HAL_INTn_CLEAR()
+ *  Change notice of KRES1, KRES2 and LED (PORT_KRES_MASK, PORT_LED_MASK):
+ *    HAL_CNA_INIT(mask), HAL_CNA_ENABLE(), HAL_CNA_CLEAR()
+ *  DMA channels triggered by HAL_DMA_IRQ_INT4 / INT3, writing
+ *  HAL_DMA_TO_LATBCLR / LATBSET (SCAN_OUTPUT_BY_DMA):
+ *    HAL_DMA_ON(), HAL_DMA_CH_INIT(ch, irq, dst, size), HAL_DMA_CH_SOURCE(ch, src)
+ *    HAL_DMA_CH_ENABLE(ch), HAL_DMA_CH_DISABLE(ch), HAL_DMA_CH_SENT(ch)
+ *  Timer1:
+ *    HAL_T1_SET_PRIORITY(p), HAL_T1_START(period, config)
+ *    HAL_T1_ENABLE(), HAL_T1_DISABLE(), HAL_T1_CLEAR()
+ */
+
+#ifndef HAL_H
+#define	HAL_H
+
+#ifdef __XC32
+#include "hal_pic32.h"
+#else
+#include "hal_sim.h"
+#endif
+
+#endif	/* HAL_H */
@@ -0,0 +1,147 @@
+/** @file hal_pic32.h
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief HAL mapped to the SFRs of PIC32MX230F064B
+ *
+ *  Interrupt enable and flag bits are written through the SET/CLR
+ *  registers, so that a change never races with an ISR.
+ */
+
+#ifndef HAL_PIC32_H
+#define	HAL_PIC32_H
+
+#include <xc.h>
+#include <sys/attribs.h>
+#include <sys/kmem.h>
+
+// ---- pins ----
+
+#define PORT_HPP_IS_HIGH    ((PORTB & _PORTB_RB4_MASK) != 0)
+
+#define PORT_KRES1_IS_SET   ((PORTA & _PORTA_RA0_MASK) == 0)
+#define PORT_KRES2_IS_SET   ((PORTA & _PORTA_RA1_MASK) == 0)
+
+#define PORT_LED_IS_LOW     ((PORTA & _PORTA_RA4_MASK) == 0)
+
+#define PORT_KRES_MASK      (_PORTA_RA0_MASK | _PORTA_RA1_MASK)
+#define PORT_LED_MASK       _PORTA_RA4_MASK
+
+//#define COUNTER_IS_ODD      ((TMR2 & 1) != 0)
+//#define COUNTER_IS_EVEN     ((TMR2 & 1) == 0)
+
+#define TRIS_Y_N            TRISBCLR = _TRISB_TRISB7_MASK
+#define LAT_Y_N             LATBbits.LATB7
+#define LAT_Y_N_MASK        _LATB_LATB7_MASK
+#define LAT_Y_N_SET         LATBCLR = _LATB_LATB7_MASK
+#define LAT_Y_N_CLR         LATBSET = _LATB_LATB7_MASK
+// write a level taken from scan_output_table (0:LATBCLR 1:LATBSET)
+#define LAT_Y_N_OUT(level)  (&LATBCLR)[level] = _LATB_LATB7_MASK
+
+#define TRIS_BREAK_N        TRISBCLR = _TRISB_TRISB8_MASK
+#define LAT_BREAK_N_MASK    _LATB_LATB8_MASK
+#define LAT_BREAK_N_SET     LATBCLR = _LATB_LATB8_MASK
+#define LAT_BREAK_N_CLR     LATBSET = _LATB_LATB8_MASK
+
+#define LAT_KATA_LED        LATBbits.LATB9
+#define LAT_KATA_LED_MASK   _LATB_LATB9_MASK
+#define LAT_KATA_LED_SET    LATBCLR = _LATB_LATB9_MASK
+#define LAT_KATA_LED_CLR    LATBSET = _LATB_LATB9_MASK
+
+#define LAT_HIRA_LED        LATBbits.LATB13
+#define LAT_HIRA_LED_MASK   _LATB_LATB13_MASK
+#define LAT_HIRA_LED_SET    LATBCLR = _LATB_LATB13_MASK
+#define LAT_HIRA_LED_CLR    LATBSET = _LATB_LATB13_MASK
+
+#define LAT_CAPS_LED        LATBbits.LATB15
+#define LAT_CAPS_LED_MASK   _LATB_LATB15_MASK
+#define LAT_CAPS_LED_SET    LATBCLR = _LATB_LATB15_MASK
+#define LAT_CAPS_LED_CLR    LATBSET = _LATB_LATB15_MASK
+
+// ---- core timer ----
+
+#define HAL_CORE_TIMER()        _CP0_GET_COUNT()
+
+// ---- INT4 (HPP rise on RB4) and INT3 (HPP fall on RB5) ----
+
+#define HAL_SCAN_INT_INIT()     do {                        \
+                                    INT4R = 0b0010;         \
+                                    INT3R = 0b0001;         \
+                                    INTCONbits.INT4EP = 1;  \
+                                    INTCONbits.INT3EP = 0;  \
+                                    IPC4bits.INT4IP = 6;    \
+                                    IPC4bits.INT4IS = 3;    \
+                                    IPC3bits.INT3IP = 6;    \
+                                    IPC3bits.INT3IS = 2;    \
+                                } while(0)
+
+#define HAL_INT4_ENABLE()       IEC0SET = _IEC0_INT4IE_MASK
+#define HAL_INT4_DISABLE()      IEC0CLR = _IEC0_INT4IE_MASK
+#define HAL_INT4_CLEAR()        IFS0CLR = _IFS0_INT4IF_MASK
+
+#define HAL_INT3_ENABLE()       IEC0SET = _IEC0_INT3IE_MASK
+#define HAL_INT3_DISABLE()      IEC0CLR = _IEC0_INT3IE_MASK
+#define HAL_INT3_CLEAR()        IFS0CLR = _IFS0_INT3IF_MASK
+
+// ---- change notice of PORTA (the flag is set while a pin differs from the last read) ----
+
+#define HAL_CNA_INIT(mask)      do {                        \
+                                    CNCONAbits.ON = 1;      \
+                                    CNENA = (mask);         \
+                                    (void)PORTA;            \
+                                    IPC8bits.CNIP = 6;      \
+                                    IPC8bits.CNIS = 1;      \
+                                    IFS1CLR = _IFS1_CNAIF_MASK; \
+                                } while(0)
+#define HAL_CNA_ENABLE()        IEC1SET = _IEC1_CNAIE_MASK
+#define HAL_CNA_CLEAR()         do {                        \
+                                    (void)PORTA;            \
+                                    IFS1CLR = _IFS1_CNAIF_MASK; \
+                                } while(0)
+
+// ---- DMA (a byte to a SET/CLR register on each IRQ, see interrupt.c) ----
+
+#define HAL_DMA_IRQ_INT4        _EXTERNAL_4_IRQ
+#define HAL_DMA_IRQ_INT3        _EXTERNAL_3_IRQ
+#define HAL_DMA_TO_LATBCLR      (&LATBCLR)
+#define HAL_DMA_TO_LATBSET      (&LATBSET)
+
+#define HAL_DMA_ON()            DMACONSET = _DMACON_ON_MASK
+// the channel is enabled again at the end of the block (CHAEN)
+#define HAL_DMA_CH_INIT(ch, irq, dst, size)    do {                                     \
+                                    DCH##ch##CON = _DCH0CON_CHAEN_MASK | (3 << _DCH0CON_CHPRI_POSITION); \
+                                    DCH##ch##ECON = ((irq) << _DCH0ECON_CHSIRQ_POSITION) | _DCH0ECON_SIRQEN_MASK; \
+                                    DCH##ch##DSA = KVA_TO_PA(dst);                      \
+                                    DCH##ch##SSIZ = (size);                             \
+                                    DCH##ch##DSIZ = 1;                                  \
+                                    DCH##ch##CSIZ = 1;                                  \
+                                    DCH##ch##INT = 0;                                   \
+                                } while(0)
+// writing the source address also resets the source pointer
+#define HAL_DMA_CH_SOURCE(ch, src)  DCH##ch##SSA = KVA_TO_PA(src)
+#define HAL_DMA_CH_ENABLE(ch)   DCH##ch##CONSET = _DCH0CON_CHEN_MASK
+#define HAL_DMA_CH_DISABLE(ch)  do {                                    \
+                                    DCH##ch##CONCLR = _DCH0CON_CHEN_MASK; \
+                                    while (DCH##ch##CONbits.CHBUSY);    \
+                                } while(0)
+#define HAL_DMA_CH_SENT(ch)     DCH##ch##SPTR
+
+// ---- Timer1 ----
+
+#define HAL_T1_SET_PRIORITY(p)  IPC1bits.T1IP = (p)
+#define HAL_T1_START(period, config)    do {                    \
+                                            TMR1 = 0;           \
+                                            PR1 = (period);     \
+                                            T1CON = (config);   \
+                                        } while(0)
+#define HAL_T1_ENABLE()         IEC0SET = _IEC0_T1IE_MASK
+#define HAL_T1_DISABLE()        IEC0CLR = _IEC0_T1IE_MASK
+#define HAL_T1_CLEAR()          IFS0CLR = _IFS0_T1IF_MASK
+
+// ---- Timer2 (HPP rise on T2CK, see timer_2.c) ----
+
+#define HAL_T2_COUNT()          TMR2
+#define HAL_T2_CLEAR(bits)      TMR2CLR = (bits)
+
+#endif	/* HAL_PIC32_H */
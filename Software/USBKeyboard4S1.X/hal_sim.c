@@ -0,0 +1,117 @@
+/** @file hal_sim.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Registers emulated in memory (host build)
+ *
+ *  Nothing is built with XC32.
+ */
+
+#include "hal.h"
+
+#ifdef HAL_SIM
+
+#include <time.h>
+
+volatile HAL_SIM_REGS hal_sim;
+
+/// core timer count
+/// runs at SYSCLK / 2 (24MHz) on the host clock, so an interval measured
+/// by the logic is comparable with the target
+/// a simulation running on virtual time sets count_manual and count
+uint32_t HAL_SIM_CoreTimer(void)
+{
+    struct timespec ts;
+
+    if (hal_sim.count_manual) {
+        return hal_sim.count;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 24000000 + (uint64_t)ts.tv_nsec * 3 / 125);
+}
+
+/// the DMA channels triggered by the IRQ send a byte each
+static void HAL_SIM_DmaTrigger(uint32_t irq)
+{
+    volatile HAL_SIM_DMA *ch;
+    uint8_t data;
+    int n;
+
+    for (n = 0; n < HAL_SIM_DMA_CHANNELS; n++) {
+        ch = &hal_sim.dma[n];
+        if (!(ch->con & HAL_SIM_DMA_EN) || ch->irq != irq || ch->size == 0) {
+            continue;
+        }
+        data = ch->src[ch->sptr];
+        if (ch->dst == HAL_SIM_LATBSET) {
+            hal_sim.latb.w |= data;
+        } else {
+            hal_sim.latb.w &= ~(uint32_t)data;
+        }
+        if (++ch->sptr >= ch->size) {
+            ch->sptr = 0;
+        }
+    }
+}
+
+/// drive the HPP pin
+/// Timer2 counts the rise and DMA sends its byte at once, before INT4 or
+/// INT3 is taken; the flag is set even if the interrupt is disabled
+void HAL_SIM_SetHpp(bool high)
+{
+    if (high) {
+        if (!(hal_sim.portb & HAL_SIM_RB4)) {
+            hal_sim.tmr2 = (hal_sim.tmr2 + 1) & 0xff;
+            hal_sim.ifs0 |= HAL_SIM_INT4;
+            HAL_SIM_DmaTrigger(HAL_SIM_INT4);
+        }
+        hal_sim.portb |= HAL_SIM_RB4;
+    } else {
+        if (hal_sim.portb & HAL_SIM_RB4) {
+            hal_sim.ifs0 |= HAL_SIM_INT3;
+            HAL_SIM_DmaTrigger(HAL_SIM_INT3);
+        }
+        hal_sim.portb &= ~HAL_SIM_RB4;
+    }
+}
+
+/// drive the pins of PORTA
+/// the change notice is flagged while a pin differs from the last read
+void HAL_SIM_SetPortA(uint32_t porta)
+{
+    hal_sim.porta = porta;
+    if ((porta ^ hal_sim.cn_latch) & hal_sim.cnena) {
+        hal_sim.ifs1 |= HAL_SIM_CNA;
+    }
+}
+
+/// erase a page or program a word of the flash (NVMOP of NVMCON)
+/// the CPU stall is added to hal_sim.stall: 20ms to erase, 20us to program
+bool HAL_SIM_NvmOperation(uint32_t nvmop, const void *address, uint32_t data)
+{
+    uint32_t *word;
+    uint32_t n;
+
+    word = (uint32_t *)((uintptr_t)address & ~(uintptr_t)3);
+    switch (nvmop) {
+    case 0x0001:    // word program
+        if (*word != 0xFFFFFFFF) {
+            hal_sim.nvm_errors++;
+        }
+        *word &= data;
+        hal_sim.stall += 480;
+        return true;
+    case 0x0004:    // page erase
+        word = (uint32_t *)((uintptr_t)address & ~(uintptr_t)(HAL_SIM_NVM_PAGE_SIZE - 1));
+        for (n = 0; n < HAL_SIM_NVM_PAGE_SIZE / 4; n++) {
+            word[n] = 0xFFFFFFFF;
+        }
+        hal_sim.stall += 480000;
+        return true;
+    default:
+        return false;
+    }
+}
+
+#endif /* HAL_SIM */
@@ -0,0 +1,216 @@
+/** @file hal_sim.h
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief HAL mapped to registers emulated in memory (host build)
+ *
+ *  Only the registers used by the scan and the tick scheduler are emulated,
+ *  and the NVM operations of the enumeration cache on a RAM array.
+ *  The simulation drives the input pins in hal_sim.porta / portb, calls the
+ *  ISRs as plain functions, and reads the output latch in hal_sim.latb.
+ *  HAL_SIM_SetHpp() drives the HPP pin, counts its rise on Timer2, sets
+ *  the flags of INT4 / INT3 and runs the DMA channels triggered by them.
+ *  HAL_SIM_SetPortA() drives the pins of PORTA and sets the flag of the
+ *  change notice. The simulation calls an ISR when its flag and enable
+ *  bits are both set. The USB stack is emulated in usb/usb_hal_sim.c.
+ */
+
+#ifndef HAL_SIM_H
+#define	HAL_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HAL_SIM
+
+// bits of the emulated registers (same positions as PIC32MX230F064B)
+#define HAL_SIM_RA0     (1u << 0)   // KRES1
+#define HAL_SIM_RA1     (1u << 1)   // KRES2
+#define HAL_SIM_RA4     (1u << 4)   // LED
+#define HAL_SIM_RB4     (1u << 4)   // HPP
+#define HAL_SIM_RB7     (1u << 7)   // Y_N
+#define HAL_SIM_RB8     (1u << 8)   // BREAK_N
+#define HAL_SIM_RB9     (1u << 9)   // KATA LED
+#define HAL_SIM_RB13    (1u << 13)  // HIRA LED
+#define HAL_SIM_RB15    (1u << 15)  // CAPS LED
+
+#define HAL_SIM_T1      (1u << 4)   // IEC0 / IFS0
+#define HAL_SIM_INT3    (1u << 18)
+#define HAL_SIM_INT4    (1u << 23)
+#define HAL_SIM_CNA     (1u << 13)  // IEC1 / IFS1
+
+#define HAL_SIM_DMA_CHANNELS    3
+#define HAL_SIM_DMA_EN      (1u << 7)   // CHEN of DCHxCON
+#define HAL_SIM_LATBCLR     0           // destinations of DMA
+#define HAL_SIM_LATBSET     1
+
+/// DMA channel: a byte of the source to the destination on each IRQ,
+/// the channel stays enabled at the end of the block (CHAEN)
+typedef struct {
+    uint32_t con;
+    uint32_t irq;           // HAL_SIM_INT4 or HAL_SIM_INT3
+    uint32_t dst;           // HAL_SIM_LATBCLR or HAL_SIM_LATBSET
+    const uint8_t *src;
+    uint32_t size;
+    uint32_t sptr;          // bytes sent in the block
+} HAL_SIM_DMA;
+
+typedef struct {
+    uint32_t porta;         // input level, driven by the simulation
+    uint32_t portb;
+    uint32_t trisb;
+    union {
+        uint32_t w;
+        struct {
+            uint32_t        : 7;
+            uint32_t LATB7  : 1;
+            uint32_t LATB8  : 1;
+            uint32_t LATB9  : 1;
+            uint32_t        : 3;
+            uint32_t LATB13 : 1;
+            uint32_t        : 1;
+            uint32_t LATB15 : 1;
+        };
+    } latb;                 // output latch
+    uint32_t iec0;          // interrupt enable
+    uint32_t ifs0;          // interrupt flag
+    uint32_t iec1;
+    uint32_t ifs1;
+    uint32_t cnena;         // PORTA pins of the change notice
+    uint32_t cn_latch;      // PORTA at the last read of the change notice
+    HAL_SIM_DMA dma[HAL_SIM_DMA_CHANNELS];
+    uint32_t t1ip;          // priority of Timer1
+    uint32_t tmr1;
+    uint32_t pr1;
+    uint32_t t1con;
+    uint32_t tmr2;          // HPP rises counted on T2CK (PR2 is 0xff)
+    uint32_t count;         // core timer, used while count_manual is set
+    uint32_t count_manual;  // 1: the simulation drives the core timer
+    uint32_t stall;         // CPU stalled by the flash, taken by the simulation
+    uint32_t nvm_errors;    // word programmed twice without an erase
+} HAL_SIM_REGS;
+
+extern volatile HAL_SIM_REGS hal_sim;
+
+uint32_t HAL_SIM_CoreTimer(void);
+bool HAL_SIM_NvmOperation(uint32_t nvmop, const void *address, uint32_t data);
+void HAL_SIM_SetHpp(bool high);
+void HAL_SIM_SetPortA(uint32_t porta);
+
+// ISRs are plain functions called by the simulation
+#define __ISR(vector, ipl)
+
+// ---- pins ----
+
+#define PORT_HPP_IS_HIGH    ((hal_sim.portb & HAL_SIM_RB4) != 0)
+
+#define PORT_KRES1_IS_SET   ((hal_sim.porta & HAL_SIM_RA0) == 0)
+#define PORT_KRES2_IS_SET   ((hal_sim.porta & HAL_SIM_RA1) == 0)
+
+#define PORT_LED_IS_LOW     ((hal_sim.porta & HAL_SIM_RA4) == 0)
+
+#define PORT_KRES_MASK      (HAL_SIM_RA0 | HAL_SIM_RA1)
+#define PORT_LED_MASK       HAL_SIM_RA4
+
+#define TRIS_Y_N            hal_sim.trisb &= ~HAL_SIM_RB7
+#define LAT_Y_N             hal_sim.latb.LATB7
+#define LAT_Y_N_MASK        HAL_SIM_RB7
+#define LAT_Y_N_SET         hal_sim.latb.w &= ~HAL_SIM_RB7
+#define LAT_Y_N_CLR         hal_sim.latb.w |= HAL_SIM_RB7
+#define LAT_Y_N_OUT(level)  hal_sim.latb.LATB7 = ((level) ? 1 : 0)
+
+#define TRIS_BREAK_N        hal_sim.trisb &= ~HAL_SIM_RB8
+#define LAT_BREAK_N_MASK    HAL_SIM_RB8
+#define LAT_BREAK_N_SET     hal_sim.latb.w &= ~HAL_SIM_RB8
+#define LAT_BREAK_N_CLR     hal_sim.latb.w |= HAL_SIM_RB8
+
+#define LAT_KATA_LED        hal_sim.latb.LATB9
+#define LAT_KATA_LED_MASK   HAL_SIM_RB9
+#define LAT_KATA_LED_SET    hal_sim.latb.w &= ~HAL_SIM_RB9
+#define LAT_KATA_LED_CLR    hal_sim.latb.w |= HAL_SIM_RB9
+
+#define LAT_HIRA_LED        hal_sim.latb.LATB13
+#define LAT_HIRA_LED_MASK   HAL_SIM_RB13
+#define LAT_HIRA_LED_SET    hal_sim.latb.w &= ~HAL_SIM_RB13
+#define LAT_HIRA_LED_CLR    hal_sim.latb.w |= HAL_SIM_RB13
+
+#define LAT_CAPS_LED        hal_sim.latb.LATB15
+#define LAT_CAPS_LED_MASK   HAL_SIM_RB15
+#define LAT_CAPS_LED_SET    hal_sim.latb.w &= ~HAL_SIM_RB15
+#define LAT_CAPS_LED_CLR    hal_sim.latb.w |= HAL_SIM_RB15
+
+// ---- core timer ----
+
+#define HAL_CORE_TIMER()        HAL_SIM_CoreTimer()
+
+// ---- flash ----
+
+// the flash is a RAM array, there is no cache to bypass
+#define HAL_SIM_NVM_PAGE_SIZE   1024
+#define KVA0_TO_KVA1(v)         ((uintptr_t)(v))
+
+// ---- INT4 (HPP rise) and INT3 (HPP fall) ----
+
+#define HAL_SCAN_INT_INIT()     do { } while(0)
+
+#define HAL_INT4_ENABLE()       hal_sim.iec0 |= HAL_SIM_INT4
+#define HAL_INT4_DISABLE()      hal_sim.iec0 &= ~HAL_SIM_INT4
+#define HAL_INT4_CLEAR()        hal_sim.ifs0 &= ~HAL_SIM_INT4
+
+#define HAL_INT3_ENABLE()       hal_sim.iec0 |= HAL_SIM_INT3
+#define HAL_INT3_DISABLE()      hal_sim.iec0 &= ~HAL_SIM_INT3
+#define HAL_INT3_CLEAR()        hal_sim.ifs0 &= ~HAL_SIM_INT3
+
+// ---- change notice of PORTA ----
+
+#define HAL_CNA_INIT(mask)      do {                                \
+                                    hal_sim.cnena = (mask);         \
+                                    hal_sim.cn_latch = hal_sim.porta; \
+                                } while(0)
+#define HAL_CNA_ENABLE()        hal_sim.iec1 |= HAL_SIM_CNA
+#define HAL_CNA_CLEAR()         do {                                \
+                                    hal_sim.cn_latch = hal_sim.porta; \
+                                    hal_sim.ifs1 &= ~HAL_SIM_CNA;   \
+                                } while(0)
+
+// ---- DMA ----
+
+#define HAL_DMA_IRQ_INT4        HAL_SIM_INT4
+#define HAL_DMA_IRQ_INT3        HAL_SIM_INT3
+#define HAL_DMA_TO_LATBCLR      HAL_SIM_LATBCLR
+#define HAL_DMA_TO_LATBSET      HAL_SIM_LATBSET
+
+#define HAL_DMA_ON()            do { } while(0)
+#define HAL_DMA_CH_INIT(ch, irq_, dst_, size_)  do {                \
+                                    hal_sim.dma[ch].con = 0;        \
+                                    hal_sim.dma[ch].irq = (irq_);   \
+                                    hal_sim.dma[ch].dst = (dst_);   \
+                                    hal_sim.dma[ch].size = (size_); \
+                                } while(0)
+#define HAL_DMA_CH_SOURCE(ch, src_)     do {                        \
+                                    hal_sim.dma[ch].src = (src_);   \
+                                    hal_sim.dma[ch].sptr = 0;       \
+                                } while(0)
+#define HAL_DMA_CH_ENABLE(ch)   hal_sim.dma[ch].con |= HAL_SIM_DMA_EN
+#define HAL_DMA_CH_DISABLE(ch)  hal_sim.dma[ch].con &= ~HAL_SIM_DMA_EN
+#define HAL_DMA_CH_SENT(ch)     hal_sim.dma[ch].sptr
+
+// ---- Timer1 ----
+
+#define HAL_T1_SET_PRIORITY(p)  hal_sim.t1ip = (p)
+#define HAL_T1_START(period, config)    do {                        \
+                                            hal_sim.tmr1 = 0;       \
+                                            hal_sim.pr1 = (period); \
+                                            hal_sim.t1con = (config); \
+                                        } while(0)
+#define HAL_T1_ENABLE()         hal_sim.iec0 |= HAL_SIM_T1
+#define HAL_T1_DISABLE()        hal_sim.iec0 &= ~HAL_SIM_T1
+#define HAL_T1_CLEAR()          hal_sim.ifs0 &= ~HAL_SIM_T1
+
+// ---- Timer2 ----
+
+#define HAL_T2_COUNT()          hal_sim.tmr2
+#define HAL_T2_CLEAR(bits)      hal_sim.tmr2 &= ~(bits)
+
+#endif	/* HAL_SIM_H */
@@ -6,105 +6,446 @@
  * 	@brief  interrupt 
  */
 
-#include <xc.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <sys/attribs.h>
 
 #include "common.h"
+#include "hal.h"
 #include "main.h"
+#ifndef HAL_SIM
 #include "usb.h"
+#endif
 #include "interrupt.h"
 #include "app_host_hid_keyboard.h"
+#include "isr_stat.h"
 #ifdef DEBUG_ENABLE
 #include "uart.h"
 #endif
 
+#if defined(HPP_COUNT_BY_TIMER2)
+// HPP rise is counted by Timer2, so the counter is right even if ISR delays
+#define HPP_COUNTER             ((uint8_t)HAL_T2_COUNT())
+#define HPP_COUNTER_CLEAR(bits) HAL_T2_CLEAR(bits)
+#elif defined(SCAN_OUTPUT_BY_DMA)
+// HPP rise is counted by DMA channels, position is the last byte sent
+static volatile uint8_t dma_base;   // position sent at the first rise after re-arm
+static volatile uint8_t dma_last;   // position sent before re-arm
+#define HPP_COUNTER             INTR_DmaCounter()
+#else
 static uint8_t hpp_counter;
+#define HPP_COUNTER             hpp_counter
+#define HPP_COUNTER_CLEAR(bits) hpp_counter &= ~(bits)
+#endif
 static uint8_t led_status;
 static uint8_t led_status_prev;
 
+#ifdef SCAN_OUTPUT_BY_DMA
+// mask written to LATBCLR and LATBSET for each value of counter
+// the table is repeated twice, so that a block of 256 bytes started from
+// any position wraps to the same position
+// double buffered: DMA reads the front table and main loop writes the back one
+static uint8_t scan_dma_table[2][2][512];
+// mask written to LATBSET on each HPP fall (in RAM, read by DMA)
+static uint8_t scan_dma_release;
+#else
+// output level of Y_N for each value of hpp_counter
+// double buffered: ISR reads the front table and main loop writes the back one
+static uint8_t scan_output_table[2][256];
+#endif
+static volatile uint8_t scan_front;
+// set when the back table is ready, ISR flips it at reset of the scan
+static volatile uint8_t scan_published;
+// number of KRES seen, and the number when the table was flipped
+static volatile uint16_t scan_count;
+static volatile uint16_t scan_flip_count;
+static bool scan_reset_prev;
+
+#ifdef ISR_STAT_ENABLE
+static uint32_t int4_entry_prev;
+#endif
+
+// start time of the last scan, and running average of period and jitter
+// (core timer count, average over 8 scans)
+static volatile uint32_t scan_start_time;
+static volatile uint32_t scan_period;
+static volatile uint32_t scan_jitter;
+
+// a scan is 256 HPP pulses of 16us, 5ms with a margin (core timer count)
+#define SCAN_BUSY_TIME  (5 * 24000)
+
+/// build the output table from key matrix
+/// even counter selects a key in the matrix, odd counter is always released
+static void INTR_BuildScanTable(uint8_t buf, const uint8_t *flags)
+{
+    uint32_t pos;
+    uint8_t level;
+
+    for(pos = 0; pos < 256; pos++) {
+        level = SCAN_OUTPUT_RELEASED;
+        if ((pos & 1) == 0 && (flags[(pos >> 4) & 15] & (1 << ((pos >> 1) & 7)))) {
+            // key pressed
+            level = SCAN_OUTPUT_PRESSED;
+        }
+#ifdef SCAN_OUTPUT_BY_DMA
+        scan_dma_table[buf][level][pos] = LAT_Y_N_MASK;
+        scan_dma_table[buf][level][pos + 256] = LAT_Y_N_MASK;
+        scan_dma_table[buf][level ^ 1][pos] = 0;
+        scan_dma_table[buf][level ^ 1][pos + 256] = 0;
+#else
+        scan_output_table[buf][pos] = level;
+#endif
+    }
+}
+
+/// publish key matrix to the scan
+/// the new table is used from the next KRES, so that one scan never sees
+/// a mix of old and new matrix
+void INTR_UpdateScanTable(const uint8_t *flags)
+{
+    // withdraw the previous publish first, ISR never flips after this
+    scan_published = 0;
+    __sync_synchronize();
+
+    INTR_BuildScanTable(scan_front ^ 1, flags);
+
+    // publish the table after it is written
+    __sync_synchronize();
+    scan_published = 1;
+}
+
+/// check whether the current table was shown on the given number of scans
+/// the published table should be settled before the next change, so that
+/// the S1 can sample every key press and release
+bool INTR_ScanTableSettled(uint16_t scans)
+{
+    // while published, the table is not flipped yet
+    if (scan_published) {
+        return false;
+    }
+    // flip count never changes here because nothing is published
+    return ((uint16_t)(scan_count - scan_flip_count) >= scans);
+}
+
+/// period of S1 scan (core timer count)
+/// 0 if not measured yet
+uint32_t INTR_GetScanPeriod(void)
+{
+    return scan_period;
+}
+
+/// jitter of S1 scan period (core timer count)
+uint32_t INTR_GetScanJitter(void)
+{
+    return scan_jitter;
+}
+
+/// check whether the S1 is scanning the keyboard now
+/// the scan is stopped if no scan is seen in 4 periods
+bool INTR_ScanIsActive(void)
+{
+    uint32_t period;
+    uint32_t start;
+    uint32_t elapsed;
+
+    period = scan_period;
+    if (period == 0) {
+        return false;
+    }
+    // read the start before the timer, so that a scan started by the ISR
+    // in between never makes the elapsed time wrap around
+    start = scan_start_time;
+    elapsed = HAL_CORE_TIMER() - start;
+    return (elapsed < (period + scan_jitter) * 4);
+}
+
+/// check whether the CPU can stall for the given time (core timer count)
+/// without missing HPP pulses of a scan
+/// true if the S1 is not scanning, or the stall ends before the next scan
+bool INTR_ScanGapFits(uint32_t time)
+{
+    uint32_t period;
+    uint32_t start;
+    uint32_t elapsed;
+
+    if (!INTR_ScanIsActive()) {
+        return true;
+    }
+    period = scan_period;
+    start = scan_start_time;
+    elapsed = HAL_CORE_TIMER() - start;
+    if (elapsed < SCAN_BUSY_TIME || elapsed >= period) {
+        // scanning now, or the next scan is late
+        return false;
+    }
+    return (time + scan_jitter * 2 < period - elapsed);
+}
+
+/// a scan starts
+/// measure the period and switch to the newly published table
+static inline void INTR_ScanStart(void)
+{
+    uint32_t now;
+    uint32_t delta;
+
+    now = HAL_CORE_TIMER();
+    delta = now - scan_start_time;
+    scan_start_time = now;
+    if (scan_count == 0) {
+        // first scan, no period yet
+    } else if (scan_period == 0) {
+        scan_period = delta;
+    } else {
+        scan_jitter += (int32_t)((delta > scan_period ? delta - scan_period : scan_period - delta) - scan_jitter) / 8;
+        scan_period += (int32_t)(delta - scan_period) / 8;
+    }
+    scan_count++;
+    if (scan_published) {
+        scan_front ^= 1;
+        scan_published = 0;
+        scan_flip_count = scan_count;
+    }
+}
+
+#ifdef SCAN_OUTPUT_BY_DMA
+/// position sent on the last HPP rise
+/// the source pointer is 0 until the first rise after re-arm; a block of
+/// 256 is never sent without re-arm, because KRES comes on every scan
+static inline uint8_t INTR_DmaCounter(void)
+{
+    uint32_t sent;
+
+    sent = HAL_DMA_CH_SENT(0);
+    return (sent ? (uint8_t)(dma_base + sent - 1) : dma_last);
+}
+
+/// start DMA so that the next HPP rise sends the given position of the
+/// front table
+/// DMA channel 0 writes LATBCLR and channel 1 writes LATBSET on each HPP rise
+static void INTR_DmaRearm(uint8_t pos)
+{
+    uint8_t last;
+
+    last = HPP_COUNTER;
+    HAL_DMA_CH_DISABLE(0);
+    HAL_DMA_CH_DISABLE(1);
+
+    HAL_DMA_CH_SOURCE(0, &scan_dma_table[scan_front][SCAN_OUTPUT_PRESSED][pos]);
+    HAL_DMA_CH_SOURCE(1, &scan_dma_table[scan_front][SCAN_OUTPUT_RELEASED][pos]);
+    dma_base = pos;
+    dma_last = last;
+
+    HAL_DMA_CH_ENABLE(0);
+    HAL_DMA_CH_ENABLE(1);
+}
+
+/// set up DMA channels triggered by INT4 (HPP rise) and INT3 (HPP fall)
+static void INTR_DmaInit(void)
+{
+    HAL_DMA_ON();
+
+    // channel 0 : table -> LATBCLR (Y_N low)
+    HAL_DMA_CH_INIT(0, HAL_DMA_IRQ_INT4, HAL_DMA_TO_LATBCLR, 256);
+    // channel 1 : table -> LATBSET (Y_N high)
+    HAL_DMA_CH_INIT(1, HAL_DMA_IRQ_INT4, HAL_DMA_TO_LATBSET, 256);
+    // channel 2 : release -> LATBSET (Y_N high) on HPP fall
+    scan_dma_release = LAT_Y_N_MASK;
+    HAL_DMA_CH_INIT(2, HAL_DMA_IRQ_INT3, HAL_DMA_TO_LATBSET, 1);
+    HAL_DMA_CH_SOURCE(2, &scan_dma_release);
+    HAL_DMA_CH_ENABLE(2);
+
+    // first HPP rise sends position 1
+    dma_base = 0;
+    dma_last = 0;
+    INTR_DmaRearm(1);
+
+    // KRES1, KRES2 and LED change
+    HAL_CNA_INIT(PORT_KRES_MASK | PORT_LED_MASK);
+    HAL_CNA_ENABLE();
+}
+
+/// restart DMA from the position of the next HPP rise
+/// the counter is cleared at the rise while KRES is set
+static void INTR_DmaReset(void)
+{
+    uint8_t next;
+
+    next = HPP_COUNTER + 1;
+    if (PORT_KRES1_IS_SET) {
+        next &= 0xf0;
+    }
+    if (PORT_KRES2_IS_SET) {
+        next &= 0x0f;
+    }
+    INTR_DmaRearm(next);
+}
+#endif
+
+/// LED line is low, the S1 shows the LED state by the counter
+static inline void INTR_DecodeLed(void)
+{
+    led_status = ((HPP_COUNTER & 0xe) ^ led_hira_inv);
+    if (led_status != led_status_prev) {
+        LAT_KATA_LED = (led_status & 2 ? 0 : 1);
+        LAT_HIRA_LED = (led_status & 4 ? 0 : 1);
+        LAT_CAPS_LED = (led_status & 8 ? 1 : 0);
+        APP_HostHIDUpdateLED(led_status);
+        led_status_prev = led_status; 
+    }
+}
+
 void INTR_Init(void)
 {
-    INT4R = 0b0010; // RB4 HPP rise
-    INT3R = 0b0001; // RB5 HPP fall
+    // INT4 on HPP rise, INT3 on HPP fall
+    HAL_SCAN_INT_INIT();
 //    INT2R = 0b0010; // RA4 LED
-    INTCONbits.INT4EP = 1;  // rise
-    INTCONbits.INT3EP = 0;  // fall
 //    INTCONbits.INT2EP = 0;  // fall
-    
-    IPC4bits.INT4IP = 6;
-    IPC4bits.INT4IS = 3;
-    IPC3bits.INT3IP = 6;
-    IPC3bits.INT3IS = 2;
 //    IPC2bits.INT2IP = 6;
 //    IPC2bits.INT2IS = 0;
 
+#if !defined(HPP_COUNT_BY_TIMER2) && !defined(SCAN_OUTPUT_BY_DMA)
     hpp_counter = 0;
+#endif
     led_status = 0;
     led_status_prev = 1;
+
+    scan_front = 0;
+    scan_published = 0;
+    scan_count = 0;
+    scan_flip_count = 0;
+    scan_reset_prev = false;
+    scan_start_time = 0;
+    scan_period = 0;
+    scan_jitter = 0;
+
+#ifdef ISR_STAT_ENABLE
+    ISR_STAT_Init();
+    int4_entry_prev = HAL_CORE_TIMER();
+#endif
+    INTR_BuildScanTable(0, key_onoff_flags);
     
-    IFS0bits.INT4IF = 0;
-    IFS0bits.INT3IF = 0;
+    HAL_INT4_CLEAR();
+    HAL_INT3_CLEAR();
 //    IFS0bits.INT2IF = 0;
-    IEC0bits.INT4IE = 1;
-    IEC0bits.INT3IE = 1;
+#ifdef SCAN_OUTPUT_BY_DMA
+    // INT4 and INT3 trigger DMA, INT4 ISR runs only while KRES is set,
+    // and INT3 ISR never runs
+    INTR_DmaInit();
+#else
+    HAL_INT4_ENABLE();
+    HAL_INT3_ENABLE();
+#endif
 //    IEC0bits.INT2IE = 1;
 
     // LED
     LAT_CAPS_LED = 0;
 }
 
+#ifndef HAL_SIM
 /// USB 
 void __ISR(_USB_1_VECTOR, IPL4SOFT) _USB1Interrupt()
 {
+#ifdef ISR_STAT_ENABLE
+    uint32_t entry;
+
+    entry = HAL_CORE_TIMER();
+#endif
+
     USB_HostInterruptHandler();
+
+#ifdef ISR_STAT_ENABLE
+    ISR_STAT_AddUSB(entry, HAL_CORE_TIMER() - entry);
+#endif
+}
+#endif
+
+#ifdef SCAN_OUTPUT_BY_DMA
+// KRES1, KRES2 or LED changed
+void __ISR(_CHANGE_NOTICE_VECTOR, IPL6SOFT) _CNInterrupt()
+{
+    bool scan_reset;
+
+    HAL_CNA_CLEAR();
+
+    scan_reset = (PORT_KRES1_IS_SET || PORT_KRES2_IS_SET);
+    if (scan_reset != scan_reset_prev) {
+        if (scan_reset) {
+            INTR_ScanStart();
+            // follow HPP rise while KRES is set
+            HAL_INT4_CLEAR();
+            HAL_INT4_ENABLE();
+        } else {
+            HAL_INT4_DISABLE();
+        }
+        // cleared at next HPP rise while KRES is set, counted up after it
+        INTR_DmaReset();
+        scan_reset_prev = scan_reset;
+    }
+
+    if (PORT_LED_IS_LOW) {
+        INTR_DecodeLed();
+    }
 }
 
+// HPP signal rise up while KRES is set
+void __ISR(_EXTERNAL_4_VECTOR, IPL6SOFT) _INT4Interrupt()
+{
+    HAL_INT4_CLEAR();
+
+    // counter is cleared again at next HPP rise
+    INTR_DmaReset();
+}
+#else
 // HPP signal rise up
 void __ISR(_EXTERNAL_4_VECTOR, IPL6SOFT) _INT4Interrupt()
 {
-    uint32_t pos;
-    uint32_t bits;
-    uint8_t *key;
+    bool scan_reset = false;
+#ifdef ISR_STAT_ENABLE
+    uint32_t entry;
+
+    entry = HAL_CORE_TIMER();
+#endif
 
-    IEC0bits.INT3IE = 0;
-    IEC0bits.INT4IE = 0;
-    IFS0bits.INT4IF = 0;
+    HAL_INT3_DISABLE();
+    HAL_INT4_DISABLE();
+    HAL_INT4_CLEAR();
     
+#ifndef HPP_COUNT_BY_TIMER2
     hpp_counter++;
+#endif
 
     // if reset signal settle, clear counter
     if (PORT_KRES1_IS_SET) {
-        hpp_counter &= 0xf0;
+        HPP_COUNTER_CLEAR(0x0f);
+        scan_reset = true;
     }
     if (PORT_KRES2_IS_SET) {
-        hpp_counter &= 0x0f;
+        HPP_COUNTER_CLEAR(0xf0);
+        scan_reset = true;
+    }
+
+    // KRES may be kept on some HPP pulses, so count it at the first one
+    if (scan_reset && !scan_reset_prev) {
+        INTR_ScanStart();
     }
+    scan_reset_prev = scan_reset;
     
-    //
-    if ((hpp_counter & 1) == 0 && PORT_HPP_IS_HIGH) {
-        // counter even
-        pos = (hpp_counter >> 1);
-        bits = (1 << (pos & 7));
-        pos = ((pos >> 3) & 15);
-
-        key = &key_onoff_flags[pos];
-        
-        if (*key & bits) {
-            // key pressed
-            LAT_Y_N_SET;
-        } else {
-            LAT_Y_N_CLR;
-        }
+    // output level is already decided in the table
+    if (PORT_HPP_IS_HIGH) {
+        LAT_Y_N_OUT(scan_output_table[scan_front][HPP_COUNTER]);
     } else {
-        // counter odd
+        // HPP has already fallen
         LAT_Y_N_CLR;
     }
 
-    IFS0bits.INT3IF = 0;
-    IEC0bits.INT4IE = 1;
-    IEC0bits.INT3IE = 1;
+#ifdef ISR_STAT_ENABLE
+    ISR_STAT_Add(&isr_stat_int4, HAL_CORE_TIMER() - entry);
+    ISR_STAT_Add(&isr_stat_int4_interval, entry - int4_entry_prev);
+    int4_entry_prev = entry;
+#endif
+
+    HAL_INT3_CLEAR();
+    HAL_INT4_ENABLE();
+    HAL_INT3_ENABLE();
 
 #ifdef Simulator
     __asm__("nop");
@@ -114,31 +455,35 @@ void __ISR(_EXTERNAL_4_VECTOR, IPL6SOFT) _INT4Interrupt()
 // HPP signal fall down
 void __ISR(_EXTERNAL_3_VECTOR, IPL6SOFT) _INT3Interrupt()
 {
-    IEC0bits.INT4IE = 0;
-    IEC0bits.INT3IE = 0;
-    IFS0bits.INT3IF = 0;
+#ifdef ISR_STAT_ENABLE
+    uint32_t entry;
+
+    entry = HAL_CORE_TIMER();
+#endif
+
+    HAL_INT4_DISABLE();
+    HAL_INT3_DISABLE();
+    HAL_INT3_CLEAR();
 
     LAT_Y_N_CLR;
 
+#ifdef ISR_STAT_ENABLE
+    ISR_STAT_Add(&isr_stat_int3, HAL_CORE_TIMER() - entry);
+#endif
+
     if (PORT_LED_IS_LOW) {
-        led_status = ((hpp_counter & 0xe) ^ led_hira_inv);
-        if (led_status != led_status_prev) {
-            LAT_KATA_LED = (led_status & 2 ? 0 : 1);
-            LAT_HIRA_LED = (led_status & 4 ? 0 : 1);
-            LAT_CAPS_LED = (led_status & 8 ? 1 : 0);
-            APP_HostHIDUpdateLED(led_status);
-            led_status_prev = led_status; 
-        }
+        INTR_DecodeLed();
     }
 
-    IFS0bits.INT4IF = 0;
-    IEC0bits.INT3IE = 1;
-    IEC0bits.INT4IE = 1;
+    HAL_INT4_CLEAR();
+    HAL_INT3_ENABLE();
+    HAL_INT4_ENABLE();
 
 #ifdef Simulator
     __asm__("nop");
 #endif
 }
+#endif
 
 #if 0
 // LED signal fall down
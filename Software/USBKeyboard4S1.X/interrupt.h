@@ -13,7 +13,20 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+#include <stdbool.h>
+
+// output level of Y_N in scan_output_table (offset from LATBCLR)
+#define SCAN_OUTPUT_PRESSED     0   // LATBCLR : Y_N low
+#define SCAN_OUTPUT_RELEASED    1   // LATBSET : Y_N high
+
 void INTR_Init(void);
+void INTR_UpdateScanTable(const uint8_t *flags);
+bool INTR_ScanTableSettled(uint16_t scans);
+uint32_t INTR_GetScanPeriod(void);
+uint32_t INTR_GetScanJitter(void);
+bool INTR_ScanIsActive(void);
+bool INTR_ScanGapFits(uint32_t time);
 
 
 #ifdef	__cplusplus
@@ -0,0 +1,203 @@
+/** @file   isr_stat.c
+ *
+ *  @author Sasaji
+ *  @date   2026/10/17
+ *
+ * 	@brief  response time statistics of HPP and USB interrupts
+ *
+ *  Times are counted by the core timer (half of system clock).
+ *  The entry time is taken at the first statement of the ISR, so that
+ *  the prologue saving registers is not included.
+ *
+ *  In the host build the histograms are filled by the tools and printed
+ *  by them, the dump on UART is left out.
+ */
+
+#include "hal.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "common.h"
+#include "isr_stat.h"
+
+#ifdef ISR_STAT_ENABLE
+
+#ifndef HAL_SIM
+#include "uart.h"
+#include "usb.h"
+#include "usb_struct_queue.h"
+#endif
+
+// a millisecond in core timer count
+#define ISR_STAT_MS_TICKS   24000
+
+ISR_STAT_HIST isr_stat_int4;
+ISR_STAT_HIST isr_stat_int3;
+ISR_STAT_HIST isr_stat_int4_interval;
+ISR_STAT_HIST isr_stat_usb;
+ISR_STAT_HIST isr_stat_usb_ms;
+
+// start of the millisecond counted in isr_stat_usb_ms, and time in it
+static uint32_t usb_ms_start;
+static uint32_t usb_ms_ticks;
+
+static volatile bool dump_requested;
+
+/// clear a histogram
+static void ISR_STAT_Clear(ISR_STAT_HIST *hist, uint8_t shift)
+{
+    memset(hist, 0, sizeof(ISR_STAT_HIST));
+    hist->min = 0xffffffff;
+    hist->shift = shift;
+}
+
+void ISR_STAT_Init(void)
+{
+    ISR_STAT_Clear(&isr_stat_int4, 2);            // 4 counts per bin
+    ISR_STAT_Clear(&isr_stat_int3, 2);
+    ISR_STAT_Clear(&isr_stat_int4_interval, 6);   // 64 counts per bin
+    ISR_STAT_Clear(&isr_stat_usb, 4);             // 16 counts per bin
+    ISR_STAT_Clear(&isr_stat_usb_ms, 6);
+    usb_ms_start = HAL_CORE_TIMER();
+    usb_ms_ticks = 0;
+    dump_requested = false;
+}
+
+/// add a time into a histogram
+/// called in ISR
+void ISR_STAT_Add(ISR_STAT_HIST *hist, uint32_t ticks)
+{
+    uint32_t bin;
+
+    bin = (ticks >> hist->shift);
+    if (bin >= ISR_STAT_BINS) {
+        bin = ISR_STAT_BINS - 1;
+    }
+    hist->bins[bin]++;
+    hist->count++;
+    if (hist->min > ticks) {
+        hist->min = ticks;
+    }
+    if (hist->max < ticks) {
+        hist->max = ticks;
+    }
+}
+
+/// add a time in USB interrupt
+/// the times are also summed up in each millisecond from the first
+/// interrupt in it, a millisecond without interrupt is not counted
+/// called in ISR
+void ISR_STAT_AddUSB(uint32_t entry, uint32_t ticks)
+{
+    ISR_STAT_Add(&isr_stat_usb, ticks);
+    if (entry - usb_ms_start >= ISR_STAT_MS_TICKS) {
+        ISR_STAT_Add(&isr_stat_usb_ms, usb_ms_ticks);
+        usb_ms_start = entry;
+        usb_ms_ticks = 0;
+    }
+    usb_ms_ticks += ticks;
+}
+
+/// upper bound of the bin reaching the given per mille of samples
+uint32_t ISR_STAT_Percentile(const ISR_STAT_HIST *hist, uint32_t permille)
+{
+    uint32_t bin;
+    uint32_t sum = 0;
+    uint32_t limit;
+
+    limit = (uint32_t)(((uint64_t)hist->count * permille + 999) / 1000);
+    for(bin = 0; bin < ISR_STAT_BINS - 1; bin++) {
+        sum += hist->bins[bin];
+        if (sum >= limit) {
+            break;
+        }
+    }
+    if (bin == ISR_STAT_BINS - 1 || ((bin + 1) << hist->shift) - 1 > hist->max) {
+        // in overflow bin, or in the bin of the maximum
+        return hist->max;
+    }
+    return ((bin + 1) << hist->shift) - 1;
+}
+
+#ifndef HAL_SIM
+/// request to print histograms on UART
+void ISR_STAT_RequestDump(void)
+{
+    dump_requested = true;
+}
+
+/// print a histogram
+static void ISR_STAT_Print(const char *name, ISR_STAT_HIST *src)
+{
+    ISR_STAT_HIST hist;
+    uint32_t bin;
+
+    // take a copy, ISRs keep counting
+    __builtin_disable_interrupts();
+    memcpy(&hist, src, sizeof(hist));
+    __builtin_enable_interrupts();
+
+    UART_PutString((char *)name);
+    UART_PutString(" n=");
+    UART_PutDecimal(hist.count, 0);
+    if (hist.count == 0) {
+        UART_PutString("\r\n");
+        UART_Flush();
+        return;
+    }
+    UART_PutString(" min=");
+    UART_PutDecimal(hist.min, 0);
+    UART_PutString(" max=");
+    UART_PutDecimal(hist.max, 0);
+    UART_PutString(" p50=");
+    UART_PutDecimal(ISR_STAT_Percentile(&hist, 500), 0);
+    UART_PutString(" p99=");
+    UART_PutDecimal(ISR_STAT_Percentile(&hist, 990), 0);
+    UART_PutString(" p999=");
+    UART_PutDecimal(ISR_STAT_Percentile(&hist, 999), 0);
+    UART_PutString("\r\n");
+    UART_Flush();
+
+    for(bin = 0; bin < ISR_STAT_BINS; bin++) {
+        if (hist.bins[bin] == 0) {
+            continue;
+        }
+        UART_PutString(" ");
+        UART_PutDecimal(bin << hist.shift, 0);
+        UART_PutString(bin == ISR_STAT_BINS - 1 ? "-:" : ":");
+        UART_PutDecimal(hist.bins[bin], 0);
+        UART_PutString("\r\n");
+        UART_Flush();
+    }
+}
+
+/// print histograms if requested
+/// called in main loop
+void ISR_STAT_Tasks(void)
+{
+    if (!dump_requested) {
+        return;
+    }
+    dump_requested = false;
+
+    UART_PutString("ISR stat (core timer count)\r\n");
+    ISR_STAT_Print("INT4", &isr_stat_int4);
+    ISR_STAT_Print("INT3", &isr_stat_int3);
+    ISR_STAT_Print("INT4 interval", &isr_stat_int4_interval);
+    ISR_STAT_Print("USB", &isr_stat_usb);
+    ISR_STAT_Print("USB per ms", &isr_stat_usb_ms);
+
+    UART_PutString("USB event queue max=");
+    UART_PutDecimal(StructEventQueueHighWatermark(), 0);
+    UART_PutString(" overflow=");
+    UART_PutDecimal(StructEventQueueOverflows(), 0);
+    UART_PutString("\r\n");
+    UART_Flush();
+#ifdef USB_STATIC_POOL
+    USBPool_PutReport();
+#endif
+}
+#endif /* !HAL_SIM */
+
+#endif /* ISR_STAT_ENABLE */
@@ -0,0 +1,57 @@
+/** @file   isr_stat.h
+ *
+ *  @author Sasaji
+ *  @date   2026/10/17
+ *
+ * 	@brief  response time statistics of HPP and USB interrupts
+ */
+
+#ifndef ISR_STAT_H
+#define	ISR_STAT_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "common.h"
+
+#ifdef ISR_STAT_ENABLE
+
+// number of bins in a histogram (last bin counts all overflows)
+#define ISR_STAT_BINS   32
+
+typedef struct {
+    uint32_t bins[ISR_STAT_BINS];
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint8_t  shift;     // width of a bin is (1 << shift) core timer counts
+} ISR_STAT_HIST;
+
+// INT4 (HPP rise) entry to Y_N write
+extern ISR_STAT_HIST isr_stat_int4;
+// INT3 (HPP fall) entry to Y_N write
+extern ISR_STAT_HIST isr_stat_int3;
+// interval between INT4 entries
+extern ISR_STAT_HIST isr_stat_int4_interval;
+// USB interrupt entry to exit
+extern ISR_STAT_HIST isr_stat_usb;
+// time in USB interrupt in each millisecond
+extern ISR_STAT_HIST isr_stat_usb_ms;
+
+void ISR_STAT_Init(void);
+void ISR_STAT_Add(ISR_STAT_HIST *hist, uint32_t ticks);
+void ISR_STAT_AddUSB(uint32_t entry, uint32_t ticks);
+uint32_t ISR_STAT_Percentile(const ISR_STAT_HIST *hist, uint32_t permille);
+void ISR_STAT_RequestDump(void);
+void ISR_STAT_Tasks(void);
+
+#endif /* ISR_STAT_ENABLE */
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* ISR_STAT_H */
+
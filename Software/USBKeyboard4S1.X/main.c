@@ -32,6 +32,8 @@ please contact mla_licensing@microchip.com
 #include "timer_1ms.h"
 #include "timer_2.h"
 #include "interrupt.h"
+#include "isr_stat.h"
+#include "boot_trace.h"
 #include "print_lcd.h"
 #include "main.h"
 
@@ -67,6 +69,10 @@ int main(void)
 //    IPTMR = 50;
     __builtin_enable_interrupts();
 
+#ifdef BOOT_TRACE_ENABLE
+    BOOT_TRACE_Init();
+#endif
+
     memset(key_onoff_flags, 0, sizeof(key_onoff_flags));
     led_hira_inv = 0;
 //    key_onoff_flags[1] = 2;
@@ -95,7 +101,9 @@ int main(void)
 #endif
 
     TIMER_SetConfiguration(TIMER_CONFIGURATION_1MS);
-//    Timer2_Init();
+#ifdef HPP_COUNT_BY_TIMER2
+    Timer2_Init();
+#endif
     
     INTR_Init();
     
@@ -115,6 +123,12 @@ int main(void)
         
 #ifdef DEBUG_ENABLE
         UART_Tasks();
+#endif
+#ifdef ISR_STAT_ENABLE
+        ISR_STAT_Tasks();
+#endif
+#ifdef BOOT_TRACE_ENABLE
+        BOOT_TRACE_Tasks();
 #endif
         // BREAK key
         if (key_onoff_flags[16] & 1) {
@@ -17,13 +17,12 @@ limitations under the License.
  * Modified by Sasaji at 2018/02/10
  */
 
-#include <xc.h>
 #include "common.h"
+#include "hal.h"
 #include <stdbool.h>
 #include <stdint.h>
 //#include <stddef.h>
 #include <string.h>
-#include <sys/attribs.h>
 #include "uart.h"
 #include "timer_1ms.h"
 
@@ -32,10 +31,10 @@ limitations under the License.
 #pragma message "This module requires a definition for the peripheral clock frequency.  Assuming 8MHz Fcy (8MHz Fosc).  Define value if this is not correct."
 #endif
 
-#define T1SetPriority IPC1bits.T1IP = TIMER_INTERRUPT_PRIORITY;
-#define T1ClearInterruptFlag IFS0CLR = _IFS0_T1IF_MASK;
-#define T1EnableInterrupt IEC0bits.T1IE = 1;
-#define T1DisableInterrupt IEC0bits.T1IE = 0;
+#define T1SetPriority HAL_T1_SET_PRIORITY(TIMER_INTERRUPT_PRIORITY);
+#define T1ClearInterruptFlag HAL_T1_CLEAR();
+#define T1EnableInterrupt HAL_T1_ENABLE();
+#define T1DisableInterrupt HAL_T1_DISABLE();
 
 #define CLOCK_DIVIDER TIMER_PRESCALER_1
 #define PR1_SETTING (SYSTEM_PERIPHERAL_CLOCK/1000/1)
@@ -183,14 +182,12 @@ bool TIMER_SetConfiguration ( TIMER_CONFIGURATIONS configuration )
             T1SetPriority
             T1ClearInterruptFlag
 
-            TMR1 = 0 ;
-
-            PR1 = PR1_SETTING ;
-            T1CON = TIMER_ON |
+            HAL_T1_START(PR1_SETTING,
+                    TIMER_ON |
                     TIMER_SOURCE_INTERNAL |
                     GATED_TIME_DISABLED |
                     TIMER_16BIT_MODE |
-                    CLOCK_DIVIDER;
+                    CLOCK_DIVIDER);
 
             T1EnableInterrupt
 
@@ -249,10 +246,6 @@ void __ISR(_TIMER_1_VECTOR, IPL1SOFT) _T1Interrupt()
         }
     }
 
-#ifdef DEBUG_ENABLE
-    UART_Tasks();
-#endif
-    
 //    IFS0CLR = _IFS0_T1IF_MASK; //Clear T1IF
     T1ClearInterruptFlag
 }
@@ -14,7 +14,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 *******************************************************************************/
 
-#include <xc.h>
+#include "hal.h"
 
 #include <stdbool.h>
 #include <stdint.h>
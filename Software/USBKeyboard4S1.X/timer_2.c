@@ -11,16 +11,18 @@
 #include <stdbool.h>
 //#include <sys/attribs.h>
 
+#include "common.h"
 #include "timer_2.h"
 
-#if 0
+#ifdef HPP_COUNT_BY_TIMER2
+/// count HPP rise on Timer2
 void Timer2_Init(void)
 {
     // select RB4 as clock pin for timer2
     T2CKR = 0b0010; // RPB4
 
-    // 256 (8bit) counter
-    PR2 = 0x100;
+    // 256 (8bit) counter (0 - 0xff)
+    PR2 = 0xff;
     TMR2 = 0;
 
     // DIVIDE = (0x0 << _T2CON_TCKPS0_POSITION) |
@@ -32,6 +34,7 @@ void Timer2_Init(void)
 
 }
 
+/// clear bits of the counter
 void Timer2_Clear(uint8_t val)
 {
 //    IEC0bits.T2IE = 0;
@@ -13,7 +13,13 @@
 extern "C" {
 #endif
 
-//void Timer2_Init(void);
+#include <stdint.h>
+#include "common.h"
+
+#ifdef HPP_COUNT_BY_TIMER2
+void Timer2_Init(void);
+void Timer2_Clear(uint8_t val);
+#endif
 
 
 #ifdef	__cplusplus
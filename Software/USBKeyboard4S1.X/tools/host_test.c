@@ -0,0 +1,96 @@
+/** @file host_test.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Test runner of the host build
+ *
+ *  The firmware sources run on hal_sim.h; the tests call the ISRs as plain
+ *  functions and drive the emulated registers.
+ *
+ *  build and run (in this directory):
+ *    make test
+ *
+ *  usage: host_test [name...]
+ *    runs the tests whose names are given, or all of them.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host_test.h"
+
+// ---- called from interrupt.c ----
+
+uint8_t key_onoff_flags[20];
+uint8_t led_hira_inv;
+
+uint8_t host_test_led_status;
+uint32_t host_test_led_updates;
+
+void APP_HostHIDUpdateLED(uint8_t led_status)
+{
+    host_test_led_status = led_status;
+    host_test_led_updates++;
+}
+
+// ---- runner ----
+
+static const struct {
+    const char *name;
+    void (*func)(void);
+} tests[] = {
+    { "scan",   TEST_Scan },
+    { "timer",  TEST_Timer },
+    { "keyboard", TEST_Keyboard },
+};
+
+static uint32_t checks;
+static uint32_t failures;
+
+bool HOST_TEST_Check(bool ok, const char *expr, const char *file, int line)
+{
+    checks++;
+    if (!ok) {
+        failures++;
+        printf("  %s:%d: check failed: %s\n", file, line, expr);
+    }
+    return ok;
+}
+
+bool HOST_TEST_CheckEq(long long a, long long b, const char *ea, const char *eb,
+                       const char *file, int line)
+{
+    checks++;
+    if (a != b) {
+        failures++;
+        printf("  %s:%d: check failed: %s == %s (%lld != %lld)\n", file, line, ea, eb, a, b);
+    }
+    return (a == b);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t prev;
+    size_t i;
+    int j;
+    bool run;
+
+    for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        run = (argc < 2);
+        for (j = 1; j < argc; j++) {
+            if (strcmp(argv[j], tests[i].name) == 0) {
+                run = true;
+            }
+        }
+        if (!run) {
+            continue;
+        }
+        prev = failures;
+        printf("%s\n", tests[i].name);
+        tests[i].func();
+        printf("%s: %s\n", tests[i].name, failures == prev ? "ok" : "FAILED");
+    }
+    printf("%u checks, %u failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
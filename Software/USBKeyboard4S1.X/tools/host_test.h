@@ -0,0 +1,33 @@
+/** @file host_test.h
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Test runner of the host build
+ */
+
+#ifndef HOST_TEST_H
+#define	HOST_TEST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/// a failed check is printed and counted, the test goes on
+#define CHECK(cond)         HOST_TEST_Check((cond), #cond, __FILE__, __LINE__)
+#define CHECK_EQ(a, b)      HOST_TEST_CheckEq((long long)(a), (long long)(b), #a, #b, __FILE__, __LINE__)
+
+bool HOST_TEST_Check(bool ok, const char *expr, const char *file, int line);
+bool HOST_TEST_CheckEq(long long a, long long b, const char *ea, const char *eb,
+                       const char *file, int line);
+
+/// calls of APP_HostHIDUpdateLED() from the scan ISR
+extern uint8_t host_test_led_status;
+extern uint32_t host_test_led_updates;
+
+// ---- tests ----
+
+void TEST_Scan(void);
+void TEST_Timer(void);
+void TEST_Keyboard(void);
+
+#endif	/* HOST_TEST_H */
@@ -0,0 +1,287 @@
+/** @file isr_bench.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Comparison of the HPP rise ISR with the table and without it
+ *  (host build)
+ *
+ *  The INT4 ISR of the original firmware found the byte and the bit of the
+ *  key matrix from hpp_counter and branched on them at every HPP rise.
+ *  Its body is kept here as isr_old_int4() on the registers of hal_sim.h,
+ *  and it is run beside _INT4Interrupt() of interrupt.c, which writes the
+ *  level of the output table built by INTR_UpdateScanTable().
+ *
+ *  Both ISRs are given the same scans on random key matrices:
+ *    Y_N must be the same after every HPP rise,
+ *    the host time per call is measured over many scans, less the time of
+ *    a call to an empty function driven the same way; the TSC cycles are
+ *    also printed on x86.
+ *  The host time is not the cycles on the target; use it to compare the
+ *  two bodies, which are built by the same compiler with the same flags.
+ *
+ *  build (in this directory):
+ *    make isr_bench
+ *
+ *  usage: isr_bench [-n scans] [-s seed]
+ *  exit status is 1 if the ISRs put a different level on Y_N.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_TSC   1
+#endif
+
+#include "hal.h"
+#include "interrupt.h"
+
+#define BENCH_REPEAT    5       // the best of these runs is taken
+
+void _INT4Interrupt(void);
+void _INT3Interrupt(void);
+
+// ---- called from interrupt.c ----
+
+uint8_t key_onoff_flags[20];
+uint8_t led_hira_inv;
+
+void APP_HostHIDUpdateLED(uint8_t led_status)
+{
+}
+
+// ---- INT4 of the original firmware ----
+
+static uint8_t old_hpp_counter;
+
+__attribute__((noinline)) static void isr_old_int4(void)
+{
+    uint32_t pos;
+    uint32_t bits;
+    uint8_t *key;
+
+    HAL_INT3_DISABLE();
+    HAL_INT4_DISABLE();
+    HAL_INT4_CLEAR();
+
+    old_hpp_counter++;
+
+    // if reset signal settle, clear counter
+    if (PORT_KRES1_IS_SET) {
+        old_hpp_counter &= 0xf0;
+    }
+    if (PORT_KRES2_IS_SET) {
+        old_hpp_counter &= 0x0f;
+    }
+
+    if ((old_hpp_counter & 1) == 0 && PORT_HPP_IS_HIGH) {
+        // counter even
+        pos = (old_hpp_counter >> 1);
+        bits = (1 << (pos & 7));
+        pos = ((pos >> 3) & 15);
+
+        key = &key_onoff_flags[pos];
+
+        if (*key & bits) {
+            // key pressed
+            LAT_Y_N_SET;
+        } else {
+            LAT_Y_N_CLR;
+        }
+    } else {
+        // counter odd
+        LAT_Y_N_CLR;
+    }
+
+    HAL_INT3_CLEAR();
+    HAL_INT4_ENABLE();
+    HAL_INT3_ENABLE();
+}
+
+__attribute__((noinline)) static void isr_empty(void)
+{
+    __asm__ volatile("" ::: "memory");
+}
+
+// ---- scan ----
+
+static uint32_t bench_seed = 1;
+
+static uint32_t bench_rand(void)
+{
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 17;
+    bench_seed ^= bench_seed << 5;
+    return bench_seed;
+}
+
+static void bench_random_matrix(void)
+{
+    size_t i;
+
+    memset(key_onoff_flags, 0, sizeof(key_onoff_flags));
+    for (i = 0; i < 16; i++) {
+        key_onoff_flags[i] = (uint8_t)(bench_rand() & bench_rand());
+    }
+    INTR_UpdateScanTable(key_onoff_flags);
+}
+
+/// HPP rise of the counter, KRES is set at the top of the scan
+static inline void bench_hpp_rise(int counter)
+{
+    hal_sim.porta = (counter == 0 ? 0 : (HAL_SIM_RA0 | HAL_SIM_RA1)) | HAL_SIM_RA4;
+    hal_sim.portb |= HAL_SIM_RB4;
+}
+
+static void bench_hpp_fall(void)
+{
+    hal_sim.portb &= ~HAL_SIM_RB4;
+    _INT3Interrupt();
+}
+
+/// a scan with both ISRs, false if Y_N differs at a counter
+static bool bench_compare_scan(void)
+{
+    int c;
+    uint32_t old_level;
+    bool same = true;
+
+    for (c = 0; c < 256; c++) {
+        bench_hpp_rise(c);
+        isr_old_int4();
+        old_level = hal_sim.latb.LATB7;
+        _INT4Interrupt();
+        if (hal_sim.latb.LATB7 != old_level) {
+            printf("counter %02x: Y_N %u by the old ISR, %u by the new one\n",
+                   c, old_level, (uint32_t)hal_sim.latb.LATB7);
+            same = false;
+        }
+        bench_hpp_fall();
+    }
+    return same;
+}
+
+typedef struct {
+    double   ns;        // host time per call
+    double   cycles;    // TSC cycles per call
+} BENCH_TIME;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/// time of the scans driven with the ISR, per HPP rise
+static BENCH_TIME bench_time(void (*isr)(void), uint32_t scans)
+{
+    BENCH_TIME t = { 1e30, 1e30 };
+    double start;
+    double ns;
+#ifdef BENCH_TSC
+    uint64_t tsc;
+    double cycles;
+#endif
+    uint32_t s;
+    int r;
+    int c;
+
+    for (r = 0; r < BENCH_REPEAT; r++) {
+        start = bench_now();
+#ifdef BENCH_TSC
+        tsc = __rdtsc();
+#endif
+        for (s = 0; s < scans; s++) {
+            for (c = 0; c < 256; c++) {
+                bench_hpp_rise(c);
+                isr();
+                hal_sim.portb &= ~HAL_SIM_RB4;
+            }
+        }
+#ifdef BENCH_TSC
+        cycles = (double)(__rdtsc() - tsc) / ((double)scans * 256);
+        if (t.cycles > cycles) {
+            t.cycles = cycles;
+        }
+#endif
+        ns = (bench_now() - start) / ((double)scans * 256);
+        if (t.ns > ns) {
+            t.ns = ns;
+        }
+    }
+    return t;
+}
+
+static void bench_print(const char *name, BENCH_TIME t, BENCH_TIME empty)
+{
+    printf("%-10s %6.2fns", name, t.ns - empty.ns);
+#ifdef BENCH_TSC
+    printf("  %6.2f TSC cycles", t.cycles - empty.cycles);
+#endif
+    printf("\n");
+}
+
+static void usage(void)
+{
+    printf("usage: isr_bench [-n scans] [-s seed]\n"
+           "  -n scans   scans timed for each ISR (default 20000)\n"
+           "  -s seed    seed of the random key matrices\n");
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t scans = 20000;
+    uint32_t mismatches = 0;
+    BENCH_TIME empty;
+    BENCH_TIME old_isr;
+    BENCH_TIME new_isr;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            scans = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            bench_seed = (uint32_t)strtoul(optarg, NULL, 0);
+            if (bench_seed == 0) {
+                bench_seed = 1;
+            }
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+
+    hal_sim.count_manual = 1;
+    hal_sim.porta = HAL_SIM_RA0 | HAL_SIM_RA1 | HAL_SIM_RA4;
+    INTR_Init();
+    old_hpp_counter = 0;
+
+    // a table published before the top of a scan is shown in the scan
+    for (i = 0; i < 64; i++) {
+        bench_random_matrix();
+        if (!bench_compare_scan()) {
+            mismatches++;
+        }
+    }
+    printf("Y_N compared on %d matrices: %s\n", i, mismatches ? "DIFFERENT" : "same");
+
+    empty = bench_time(isr_empty, scans);
+    old_isr = bench_time(isr_old_int4, scans);
+    new_isr = bench_time(_INT4Interrupt, scans);
+    printf("time per HPP rise (host, less the empty call):\n");
+    bench_print("old INT4", old_isr, empty);
+    bench_print("new INT4", new_isr, empty);
+    return mismatches ? 1 : 0;
+}
@@ -0,0 +1,494 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""@file isr_wcet.py
+
+ @author Sasaji
+ @date 2026/10/17
+
+ @brief Static worst case execution time of the interrupt handlers
+
+ The ELF is disassembled with objdump, and a control flow graph is built
+ for each handler and each function called from it. Loops are bounded by
+ the expressions written in isr_wcet.cfg, which may use the constants
+ defined in the sources (e.g. TIMER_MAX_1MS_CLIENTS). The instruction and
+ cycle count on the longest path are printed.
+
+ The cycle model is the M4K core running from flash without a cache:
+ one cycle per instruction plus the flash wait states, and the multi-cycle
+ multiply/divide. Peripheral bus stalls and the interrupt latency are not
+ modeled, so the result is an estimate for finding regressions.
+
+ usage: isr_wcet.py [-c cfg] [-s srcdir] [-d disasm.txt] [elf]
+"""
+
+import argparse
+import ast
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+TOOL_DIR = os.path.dirname(os.path.abspath(__file__))
+PROJECT_DIR = os.path.dirname(TOOL_DIR)
+DEFAULT_ELF = os.path.join(PROJECT_DIR, 'dist', 'PIC32MX230F064B', 'production',
+                           'USBKeyboard4S1.X.production.elf')
+DEFAULT_CFG = os.path.join(TOOL_DIR, 'isr_wcet.cfg')
+
+# branches which have a delay slot
+COND_BRANCHES = {
+    'beq', 'bne', 'beqz', 'bnez', 'blez', 'bgtz', 'bltz', 'bgez',
+    'beql', 'bnel', 'beqzl', 'bnezl', 'blezl', 'bgtzl', 'bltzl', 'bgezl',
+}
+JUMPS = {'b', 'j'}
+CALLS = {'jal', 'bal', 'bgezal', 'bltzal'}
+INDIRECT_CALLS = {'jalr', 'jalr.hb'}
+INDIRECT_JUMPS = {'jr', 'jr.hb'}
+RETURNS = {'eret', 'deret'}
+RA_NAMES = {'$ra', 'ra', '$31'}
+
+# cycles taken by an instruction on M4K (1 if not listed)
+CYCLES = {
+    'div': 35, 'divu': 35,
+    'mul': 2, 'mult': 2, 'multu': 2,
+    'madd': 2, 'maddu': 2, 'msub': 2, 'msubu': 2,
+}
+
+RE_FUNC = re.compile(r'^([0-9a-f]{8}) <([^>]+)>:')
+RE_INSN = re.compile(r'^\s*([0-9a-f]+):\s*(?:(?:[0-9a-f]{2} ){3}[0-9a-f]{2}\s+|[0-9a-f]{8}\s+)?'
+                     r'([a-z<][\w.<>]*)\s*(.*)$')
+RE_TARGET = re.compile(r'<([^>+]+)(?:\+0x([0-9a-f]+))?>')
+RE_DEFINE = re.compile(r'^\s*#\s*define\s+([A-Za-z_]\w*)\s+([^/\n]+?)\s*(?://.*|/\*.*)?$')
+
+
+class WcetError(Exception):
+    pass
+
+
+class Insn:
+    def __init__(self, addr, op, args):
+        self.addr = addr
+        self.op = op
+        self.args = args
+
+
+# ---------------------------------------------------------------------------
+# input
+
+def find_objdump():
+    for name in ('xc32-objdump', 'llvm-objdump', 'mips-linux-gnu-objdump'):
+        path = shutil.which(name)
+        if path:
+            return path
+    raise WcetError('objdump is not found; use --objdump or --disasm')
+
+
+def read_disasm(args):
+    if args.disasm:
+        with open(args.disasm, encoding='utf-8', errors='replace') as f:
+            return f.read().splitlines()
+    objdump = args.objdump or find_objdump()
+    out = subprocess.run([objdump, '-d', args.elf], check=True,
+                         stdout=subprocess.PIPE, universal_newlines=True)
+    return out.stdout.splitlines()
+
+
+def parse_disasm(lines):
+    """returns {name: [Insn...]} and {name: address}"""
+    funcs = {}
+    addrs = {}
+    cur = None
+    for line in lines:
+        m = RE_FUNC.match(line)
+        if m:
+            cur = m.group(2)
+            addrs[cur] = int(m.group(1), 16)
+            funcs[cur] = []
+            continue
+        if cur is None:
+            continue
+        m = RE_INSN.match(line)
+        if m:
+            funcs[cur].append(Insn(int(m.group(1), 16), m.group(2), m.group(3)))
+    return funcs, addrs
+
+
+def read_defines(srcdir):
+    """#define NAME value in the sources; common.h is read first"""
+    files = [os.path.join(srcdir, 'common.h')]
+    for pattern in ('*.h', '*.c', 'usb/*.h', 'usb/*.c'):
+        files += sorted(glob.glob(os.path.join(srcdir, pattern)))
+    defines = {}
+    for path in files:
+        if not os.path.exists(path):
+            continue
+        with open(path, encoding='utf-8', errors='replace') as f:
+            for line in f:
+                m = RE_DEFINE.match(line)
+                if m and m.group(1) not in defines:
+                    defines[m.group(1)] = m.group(2)
+    return defines
+
+
+def evaluate(expr, defines, depth=0):
+    """evaluate an integer expression which may use the defines"""
+    if depth > 16:
+        raise WcetError('too deep macro: ' + expr)
+    expr = re.sub(r'\b(0x[0-9a-fA-F]+|\d+)[uUlL]+\b', r'\1', expr)
+
+    def node(n):
+        if isinstance(n, ast.Expression):
+            return node(n.body)
+        if isinstance(n, ast.Constant) and isinstance(n.value, int):
+            return n.value
+        if isinstance(n, ast.Name):
+            if n.id not in defines:
+                raise WcetError('unknown constant: ' + n.id)
+            return evaluate(defines[n.id], defines, depth + 1)
+        if isinstance(n, ast.UnaryOp) and isinstance(n.op, ast.USub):
+            return -node(n.operand)
+        if isinstance(n, ast.BinOp):
+            ops = {ast.Add: lambda a, b: a + b, ast.Sub: lambda a, b: a - b,
+                   ast.Mult: lambda a, b: a * b, ast.Div: lambda a, b: a // b,
+                   ast.FloorDiv: lambda a, b: a // b, ast.Mod: lambda a, b: a % b,
+                   ast.LShift: lambda a, b: a << b, ast.RShift: lambda a, b: a >> b}
+            if type(n.op) in ops:
+                return ops[type(n.op)](node(n.left), node(n.right))
+        raise WcetError('cannot evaluate: ' + expr)
+
+    try:
+        return node(ast.parse(expr.strip(), mode='eval'))
+    except SyntaxError:
+        raise WcetError('cannot evaluate: ' + expr)
+
+
+class Config:
+    def __init__(self, path, defines):
+        self.isrs = []
+        self.loops = {}     # func: {index or 0: bound}
+        self.icalls = {}    # func: [target...] or cycles
+        self.budgets = {}   # func: microseconds
+        with open(path, encoding='utf-8') as f:
+            for num, line in enumerate(f, 1):
+                words = line.split('#', 1)[0].split()
+                if not words:
+                    continue
+                try:
+                    self.parse(words, defines)
+                except (WcetError, IndexError, ValueError) as e:
+                    raise WcetError('%s:%d: %s' % (path, num, e))
+
+    def parse(self, words, defines):
+        key = words[0]
+        if key == 'isr':
+            self.isrs += words[1:]
+        elif key == 'loop':
+            index = 0
+            expr = ' '.join(words[2:])
+            if len(words) > 3 and words[2].isdigit():
+                index = int(words[2])
+                expr = ' '.join(words[3:])
+            self.loops.setdefault(words[1], {})[index] = evaluate(expr, defines)
+        elif key == 'icall':
+            self.icalls.setdefault(words[1], []).extend(words[2:])
+        elif key == 'budget':
+            self.budgets[words[1]] = float(words[2])
+        else:
+            raise WcetError('unknown keyword: ' + key)
+
+
+# ---------------------------------------------------------------------------
+# analysis
+
+def add(a, b):
+    return (a[0] + b[0], a[1] + b[1])
+
+
+def scale(a, n):
+    return (a[0] * n, a[1] * n)
+
+
+class Analyzer:
+    def __init__(self, funcs, addrs, cfg, flash_ws):
+        self.funcs = funcs
+        self.addrs = addrs
+        self.names = {v: k for k, v in addrs.items()}
+        self.cfg = cfg
+        self.flash_ws = flash_ws
+        self.result = {}    # name: (cycles, instructions)
+        self.loops = {}     # name: [(header, bound)]
+        self.active = set()
+
+    def cost(self, insn):
+        return (CYCLES.get(insn.op, 1) + self.flash_ws, 1)
+
+    def target(self, insn):
+        """absolute address of a direct branch"""
+        m = RE_TARGET.search(insn.args)
+        if m and m.group(1) in self.addrs:
+            return self.addrs[m.group(1)] + int(m.group(2) or '0', 16)
+        m = re.search(r'\b([0-9a-f]{8})\b', insn.args)
+        if m:
+            return int(m.group(1), 16)
+        raise WcetError('branch target unknown at %08x' % insn.addr)
+
+    def callee(self, addr):
+        if addr not in self.names:
+            raise WcetError('call into the middle of a function: %08x' % addr)
+        return self.wcet(self.names[addr])
+
+    def wcet(self, name):
+        if name in self.result:
+            return self.result[name]
+        if name in self.active:
+            raise WcetError('recursive call: ' + name)
+        if name not in self.funcs:
+            raise WcetError('function not found: ' + name)
+        self.active.add(name)
+        try:
+            self.result[name] = self.analyze(name)
+        finally:
+            self.active.discard(name)
+        return self.result[name]
+
+    def build(self, name):
+        """node per instruction; a branch node includes its delay slot"""
+        insns = self.funcs[name]
+        index = {insn.addr: k for k, insn in enumerate(insns)}
+        cost = {}
+        succ = {}
+        term = set()
+
+        def next_of(k, step):
+            if k + step < len(insns):
+                return [insns[k + step].addr]
+            term.add(insns[k].addr)
+            return []
+
+        for k, insn in enumerate(insns):
+            op = insn.op
+            c = self.cost(insn)
+            has_slot = (op in COND_BRANCHES or op in JUMPS or op in CALLS
+                        or op in INDIRECT_CALLS or op in INDIRECT_JUMPS)
+            if has_slot and k + 1 < len(insns):
+                c = add(c, self.cost(insns[k + 1]))
+            if op in COND_BRANCHES:
+                dest = self.target(insn)
+                if dest not in index:
+                    raise WcetError('branch out of %s at %08x' % (name, insn.addr))
+                succ[insn.addr] = [dest] + next_of(k, 2)
+            elif op in JUMPS:
+                dest = self.target(insn)
+                if dest in index:
+                    succ[insn.addr] = [dest]
+                else:
+                    # tail call
+                    c = add(c, self.callee(dest))
+                    succ[insn.addr] = []
+                    term.add(insn.addr)
+            elif op in CALLS:
+                c = add(c, self.callee(self.target(insn)))
+                succ[insn.addr] = next_of(k, 2)
+            elif op in INDIRECT_CALLS:
+                c = add(c, self.indirect(name, insn))
+                succ[insn.addr] = next_of(k, 2)
+            elif op in INDIRECT_JUMPS:
+                if insn.args.split(',')[0].strip() not in RA_NAMES:
+                    raise WcetError('indirect jump in %s at %08x' % (name, insn.addr))
+                succ[insn.addr] = []
+                term.add(insn.addr)
+            elif op in RETURNS:
+                succ[insn.addr] = []
+                term.add(insn.addr)
+            else:
+                succ[insn.addr] = next_of(k, 1)
+            cost[insn.addr] = c
+        return insns[0].addr, cost, succ, term
+
+    def indirect(self, name, insn):
+        targets = self.cfg.icalls.get(name)
+        if not targets:
+            raise WcetError('indirect call in %s at %08x; add icall to the config'
+                            % (name, insn.addr))
+        worst = (0, 0)
+        for t in targets:
+            if re.match(r'^\d+$', t):
+                c = (int(t), 0)
+            else:
+                c = self.wcet(t)
+            if c[0] > worst[0]:
+                worst = c
+        return worst
+
+    def analyze(self, name):
+        entry, cost, succ, term = self.build(name)
+
+        # back edges by depth first search
+        back = set()
+        state = {entry: 1}
+        stack = [(entry, iter(succ[entry]))]
+        while stack:
+            node, it = stack[-1]
+            nxt = next(it, None)
+            if nxt is None:
+                state[node] = 2
+                stack.pop()
+            elif nxt not in state:
+                state[nxt] = 1
+                stack.append((nxt, iter(succ[nxt])))
+            elif state[nxt] == 1:
+                back.add((node, nxt))
+        reach = set(state)
+
+        pred = {n: [] for n in reach}
+        for n in reach:
+            for s in succ[n]:
+                pred[s].append(n)
+
+        # natural loops, the inner loop first
+        loops = {}
+        for tail, head in back:
+            body = loops.setdefault(head, {head})
+            work = [tail]
+            while work:
+                n = work.pop()
+                if n not in body:
+                    body.add(n)
+                    work += pred[n]
+        for head, body in loops.items():
+            for n in body:
+                if n != head and any(p not in body for p in pred[n]):
+                    raise WcetError('loop in %s at %08x has several entries' % (name, head))
+        order = sorted(loops, key=lambda h: len(loops[h]))
+        numbers = {h: i + 1 for i, h in enumerate(sorted(loops))}
+
+        rep = {n: n for n in reach}
+        weight = dict(cost)
+        used = []
+        for head in order:
+            body = loops[head]
+            bound = self.bound(name, numbers[head], head)
+            used.append((head, bound))
+            nodes = {rep[n] for n in body}
+            edges = {}
+            exits = set()
+            for u in body:
+                if u in term:
+                    exits.add(rep[u])
+                for v in succ[u]:
+                    if v not in body:
+                        exits.add(rep[u])
+                    elif v != head and rep[u] != rep[v]:
+                        edges.setdefault(rep[u], set()).add(rep[v])
+            dist = self.longest(head, nodes, edges, weight)
+            tails = [rep[t] for t, h in back if h == head]
+            it = max((dist[t] for t in tails if t in dist), default=(0, 0))
+            out = max((dist[x] for x in exits if x in dist), default=(0, 0))
+            weight[head] = add(scale(it, bound), out)
+            for n in body:
+                rep[n] = head
+            if exits & nodes and any(n in term for n in body):
+                term.add(head)
+        self.loops[name] = sorted(used)
+
+        edges = {}
+        for u in reach:
+            for v in succ[u]:
+                if rep[u] != rep[v]:
+                    edges.setdefault(rep[u], set()).add(rep[v])
+        nodes = {rep[n] for n in reach}
+        dist = self.longest(entry, nodes, edges, weight)
+        ends = [dist[n] for n in nodes if n in dist and
+                (n in term or any(t in term for t in reach if rep[t] == n))]
+        if not ends:
+            raise WcetError('%s never returns' % name)
+        return max(ends)
+
+    def bound(self, name, number, head):
+        bounds = self.cfg.loops.get(name, {})
+        if number in bounds:
+            return bounds[number]
+        if 0 in bounds:
+            return bounds[0]
+        raise WcetError('loop %d in %s at %08x has no bound; add loop to the config'
+                        % (number, name, head))
+
+    @staticmethod
+    def longest(entry, nodes, edges, weight):
+        """longest path from entry in the acyclic graph, weights on nodes"""
+        order = []
+        seen = {entry}
+        stack = [(entry, iter(sorted(edges.get(entry, ()))))]
+        while stack:
+            node, it = stack[-1]
+            nxt = next(it, None)
+            if nxt is None:
+                order.append(node)
+                stack.pop()
+            elif nxt in nodes and nxt not in seen:
+                seen.add(nxt)
+                stack.append((nxt, iter(sorted(edges.get(nxt, ())))))
+        dist = {entry: weight[entry]}
+        for node in reversed(order):
+            if node not in dist:
+                continue
+            for nxt in edges.get(node, ()):
+                if nxt in nodes:
+                    d = add(dist[node], weight[nxt])
+                    if nxt not in dist or d[0] > dist[nxt][0]:
+                        dist[nxt] = d
+        return dist
+
+
+# ---------------------------------------------------------------------------
+
+def main():
+    parser = argparse.ArgumentParser(description='Worst case execution time of the ISRs')
+    parser.add_argument('elf', nargs='?', default=DEFAULT_ELF, help='ELF file')
+    parser.add_argument('-c', '--config', default=DEFAULT_CFG, help='loop bounds and ISR list')
+    parser.add_argument('-s', '--src', default=PROJECT_DIR, help='directory of the sources')
+    parser.add_argument('-d', '--disasm', help='output of objdump -d instead of the ELF')
+    parser.add_argument('--objdump', help='objdump command')
+    parser.add_argument('--flash-ws', type=int, default=1, help='flash wait states (default 1)')
+    parser.add_argument('--mhz', type=float, default=48.0, help='SYSCLK in MHz (default 48)')
+    parser.add_argument('-v', '--verbose', action='store_true', help='print callees and loops')
+    args = parser.parse_args()
+
+    try:
+        cfg = Config(args.config, read_defines(args.src))
+        funcs, addrs = parse_disasm(read_disasm(args))
+    except (WcetError, OSError, subprocess.CalledProcessError) as e:
+        print('isr_wcet: %s' % e, file=sys.stderr)
+        return 2
+
+    analyzer = Analyzer(funcs, addrs, cfg, args.flash_ws)
+    status = 0
+    print('%-24s %8s %8s %9s %9s' % ('function', 'insns', 'cycles', 'usec', 'budget'))
+    for isr in cfg.isrs:
+        try:
+            cycles, insns = analyzer.wcet(isr)
+        except WcetError as e:
+            print('%-24s UNBOUNDED: %s' % (isr, e))
+            status = 1
+            continue
+        usec = cycles / args.mhz
+        budget = cfg.budgets.get(isr)
+        mark = ''
+        if budget is not None and usec > budget:
+            mark = ' OVER'
+            status = 1
+        print('%-24s %8d %8d %9.2f %9s%s' % (isr, insns, cycles, usec,
+              '-' if budget is None else '%.2f' % budget, mark))
+
+    if args.verbose:
+        print()
+        for name in sorted(analyzer.result):
+            cycles, insns = analyzer.result[name]
+            loops = ' '.join('%08x*%d' % h for h in analyzer.loops.get(name, []))
+            print('  %-32s %8d %8d  %s' % (name, insns, cycles, loops))
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main())
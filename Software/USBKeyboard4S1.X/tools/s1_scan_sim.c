@@ -0,0 +1,652 @@
+/** @file s1_scan_sim.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief MB-S1 keyboard scan emulator for the host build
+ *
+ *  The S1 side of the connector is modeled on the core timer clock
+ *  (24MHz): HPP pulses, KRES1/KRES2 at the top of each scan, the LED line
+ *  and the Y_N sample. The scan ISRs of interrupt.c are called through
+ *  the emulated registers of hal_sim.h, with a given latency after each
+ *  HPP edge.
+ *
+ *  Key reports arrive at given times. The main loop is modeled as
+ *  App_KeyQueueTasks(): a report is put in the matrix when the previous
+ *  change has been scanned KEY_HOLD_SCANS times. The latency from the
+ *  arrival of a report to the first scan in which the S1 sees the new
+ *  state of the key is printed, and a change which the S1 never sees is
+ *  counted as dropped.
+ *
+ *  Every scan is also checked for a torn frame: the keys read by the S1 in
+ *  a scan must be the matrix last published before the top of the scan,
+ *  not a mix of the old and the new one. -H 0 publishes a change on every
+ *  pass of the main loop, also in the middle of a scan.
+ *
+ *  The throughput is the keys pressed and the reports seen by the S1 per
+ *  second, from the first report to the last change seen. Reports faster
+ *  than the S1 can show them (e.g. -g 48000) wait in the queue, so the
+ *  keys/s is the limit of the hold of KEY_HOLD_SCANS.
+ *
+ *  -x stalls the CPU in every 4th scan for some HPP pulses from counter
+ *  0x40, as a flash erase or a long ISR would: the ISRs of those pulses
+ *  are not run, and INT4 runs once before the next rise. The keys of the
+ *  stalled pulses are not checked. The counter of the ISR loses the
+ *  pulses; the one of Timer2 (s1_scan_sim_t2, built with
+ *  HPP_COUNT_BY_TIMER2) counts them, so the rest of the scan is right.
+ *
+ *  s1_scan_sim_dma is built with SCAN_OUTPUT_BY_DMA: the DMA channels of
+ *  hal_sim.c write Y_N at the HPP edges, and only the change notice of
+ *  KRES / LED and INT4 while KRES is set run on the CPU. The ISRs run per
+ *  scan are printed.
+ *
+ *  build (in this directory):
+ *    make s1_scan_sim
+ *
+ *  usage: s1_scan_sim [options] [script]
+ *    script: lines of "<cycle> <key> <1:press 0:release>", key is 0-127
+ *            (row * 8 + column); lines at the same cycle are one report.
+ *            Random typing is generated if no script is given.
+ *  exit status is 1 if a change was never seen by the S1, or a scan was
+ *  torn.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hal.h"
+#include "interrupt.h"
+
+#define SIM_KEYS            128     // keys in the scan (16 rows x 8 columns)
+#define SIM_MAX_EVENTS      65536
+#define SIM_QUEUE_SIZE      64      // same as KEY_QUEUE_SIZE
+#define SIM_QUEUE_REPORT_EVENTS 20  // same as KEY_QUEUE_REPORT_EVENTS
+#define SIM_CYCLES_PER_US   24
+#define SIM_STALL_SCANS     4       // a stall in every 4th scan
+#define SIM_STALL_COUNTER   0x40    // first pulse of the stall
+#ifdef SCAN_OUTPUT_BY_DMA
+#define SIM_FLIP_STEP       6       // change notice of KRES flips the table
+#else
+#define SIM_FLIP_STEP       1       // INT4 of the first pulse flips the table
+#endif
+
+// ---- called from interrupt.c ----
+
+uint8_t key_onoff_flags[20];
+uint8_t led_hira_inv;
+
+static uint8_t sim_led_status;
+static uint32_t sim_led_updates;
+
+void APP_HostHIDUpdateLED(uint8_t led_status)
+{
+    sim_led_status = led_status;
+    sim_led_updates++;
+}
+
+void _INT4Interrupt(void);
+void _INT3Interrupt(void);
+void _CNInterrupt(void);
+
+// ---- parameters (core timer cycles) ----
+
+static struct {
+    uint64_t hpp_period;        // HPP rise to rise
+    uint64_t hpp_high;          // HPP high width
+    uint64_t sample;            // Y_N sample after HPP rise
+    uint64_t int4_latency;      // HPP rise to INT4 ISR
+    uint64_t int3_latency;      // HPP fall to INT3 ISR
+    uint64_t scan_interval;     // top of a scan to the next
+    uint64_t main_period;       // main loop pass
+    uint16_t hold_scans;        // KEY_HOLD_SCANS
+    int      led_code;          // counter on which LED line is low (-1: none)
+    uint32_t events;            // random events
+    uint64_t report_gap;        // mean gap between random key presses
+    uint64_t hold_min;          // random key hold time
+    uint64_t hold_max;
+    uint32_t stall;             // HPP pulses without the ISRs
+    bool     verbose;
+} prm = {
+    384, 192, 96, 48, 48, 480000, 2400, 2, -1,
+    1000, 4800000, 720000, 2400000, 0, false
+};
+
+// ---- key events ----
+
+typedef struct {
+    uint64_t time;      // arrival of the report
+    uint64_t seen;      // scan sample which showed the new state
+    uint32_t seq;       // report number
+    int32_t  next;      // next event of the same key
+    uint8_t  key;
+    uint8_t  pressed;
+    uint8_t  applied;   // put in the matrix
+    uint8_t  result;    // 0: pending 1: seen 2: dropped
+} SIM_EVENT;
+
+static SIM_EVENT events[SIM_MAX_EVENTS];
+static uint32_t num_events;
+static int32_t key_head[SIM_KEYS];      // events waiting for the S1
+static int32_t key_tail[SIM_KEYS];
+static uint32_t queue[SIM_QUEUE_SIZE];  // events not put in the matrix yet
+static uint32_t queue_head;
+static uint32_t queue_tail;
+
+static int sim_compare_event(const void *a, const void *b)
+{
+    const SIM_EVENT *ea = a;
+    const SIM_EVENT *eb = b;
+
+    if (ea->time != eb->time) return (ea->time < eb->time) ? -1 : 1;
+    return (int)ea->seq - (int)eb->seq;
+}
+
+static bool sim_add_event(uint64_t time, uint8_t key, uint8_t pressed)
+{
+    if (num_events >= SIM_MAX_EVENTS || key >= SIM_KEYS) {
+        return false;
+    }
+    events[num_events].time = time;
+    events[num_events].key = key;
+    events[num_events].pressed = pressed;
+    events[num_events].seq = num_events;
+    num_events++;
+    return true;
+}
+
+static bool sim_read_script(const char *path)
+{
+    FILE *fp;
+    unsigned long long time;
+    unsigned key;
+    unsigned pressed;
+    char line[128];
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || sscanf(line, "%llu %u %u", &time, &key, &pressed) != 3) {
+            continue;
+        }
+        if (!sim_add_event(time, (uint8_t)key, pressed ? 1 : 0)) {
+            fprintf(stderr, "%s: bad or too many events\n", path);
+            fclose(fp);
+            return false;
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+/// random typing: a key is pressed and released, and never pressed again
+/// while it is held
+static void sim_random_events(void)
+{
+    uint64_t time = prm.scan_interval * 2;
+    uint64_t free_at[SIM_KEYS];
+    uint32_t n;
+    uint8_t key;
+
+    memset(free_at, 0, sizeof(free_at));
+    for (n = 0; n + 1 < prm.events && num_events + 2 <= SIM_MAX_EVENTS; n += 2) {
+        time += 1 + (uint64_t)rand() % (prm.report_gap * 2);
+        do {
+            key = (uint8_t)(rand() % SIM_KEYS);
+        } while (free_at[key] > time);
+        sim_add_event(time, key, 1);
+        free_at[key] = time + prm.hold_min + (uint64_t)rand() % (prm.hold_max - prm.hold_min + 1);
+        sim_add_event(free_at[key], key, 0);
+        free_at[key] += prm.scan_interval * (prm.hold_scans + 1);
+    }
+}
+
+// ---- main loop model ----
+
+static uint32_t sim_report;   // next report to arrive
+
+/// reports arrived by the time are queued
+static void sim_receive(uint64_t now)
+{
+    while (sim_report < num_events && events[sim_report].time <= now) {
+        SIM_EVENT *e = &events[sim_report];
+
+        if (SIM_QUEUE_SIZE - (queue_tail - queue_head) < SIM_QUEUE_REPORT_EVENTS) {
+            // the app stops reading reports while the queue is nearly full
+            break;
+        }
+        e->next = -1;
+        if (key_head[e->key] < 0) {
+            key_head[e->key] = (int32_t)sim_report;
+        } else {
+            events[key_tail[e->key]].next = (int32_t)sim_report;
+        }
+        key_tail[e->key] = (int32_t)sim_report;
+        queue[queue_tail++ & (SIM_QUEUE_SIZE - 1)] = sim_report;
+        sim_report++;
+    }
+}
+
+// ---- torn frame ----
+
+static uint8_t published[SIM_KEYS / 8]; // matrix of the last publish
+static uint8_t expected[SIM_KEYS / 8];  // matrix the current scan should show
+static uint8_t sampled[SIM_KEYS / 8];   // matrix the S1 read in the scan
+static uint32_t torn_scans;
+static uint32_t stalled_scans;
+static uint32_t isr_calls[3];           // INT4, INT3, change notice
+
+/// same as App_KeyQueueTasks()
+static void sim_main_loop(void)
+{
+    uint8_t touched[sizeof(key_onoff_flags)];
+    uint64_t report;
+    uint8_t bits;
+    int32_t h;
+
+    if (queue_head == queue_tail) {
+        return;
+    }
+    if (INTR_ScanIsActive() && !INTR_ScanTableSettled(prm.hold_scans)) {
+        return;
+    }
+    memset(touched, 0, sizeof(touched));
+    report = events[queue[queue_head & (SIM_QUEUE_SIZE - 1)]].time;
+    while (queue_head != queue_tail) {
+        SIM_EVENT *e = &events[queue[queue_head & (SIM_QUEUE_SIZE - 1)]];
+
+        bits = (1 << (e->key & 7));
+        if (e->time != report || (touched[e->key >> 3] & bits)) {
+            break;
+        }
+        touched[e->key >> 3] |= bits;
+        // the previous change of the key is replaced before the S1 saw it
+        while ((h = key_head[e->key]) >= 0 && &events[h] != e) {
+            events[h].result = 2;
+            key_head[e->key] = events[h].next;
+        }
+        e->applied = 1;
+        if (e->pressed) {
+            key_onoff_flags[e->key >> 3] |= bits;
+        } else {
+            key_onoff_flags[e->key >> 3] &= ~bits;
+        }
+        queue_head++;
+    }
+    INTR_UpdateScanTable(key_onoff_flags);
+    memcpy(published, key_onoff_flags, sizeof(published));
+}
+
+// ---- S1 model ----
+
+static uint64_t now;
+static uint64_t next_main;
+static uint8_t s1_seen[SIM_KEYS];
+static uint32_t scans;
+
+/// run the main loop and the reports until the time
+static void sim_advance(uint64_t until)
+{
+    while (next_main <= until) {
+        now = next_main;
+        hal_sim.count = (uint32_t)now;
+        sim_receive(now);
+        sim_main_loop();
+        next_main += prm.main_period;
+    }
+    now = until;
+    hal_sim.count = (uint32_t)now;
+}
+
+/// the S1 reads Y_N of the key selected by the counter
+static void sim_sample(uint8_t counter)
+{
+    uint8_t key;
+    uint8_t pressed;
+    int32_t h;
+
+    if (counter & 1) {
+        return;
+    }
+    key = (uint8_t)((counter >> 4) * 8 + ((counter >> 1) & 7));
+    pressed = (hal_sim.latb.LATB7 == 0);
+    if (prm.verbose && pressed != s1_seen[key]) {
+        printf("%12.1fus scan %u key %3u %s\n", (double)now / SIM_CYCLES_PER_US,
+               scans, key, pressed ? "down" : "up");
+    }
+    s1_seen[key] = pressed;
+    if (pressed) {
+        sampled[key >> 3] |= (1 << (key & 7));
+    }
+
+    h = key_head[key];
+    if (h >= 0 && events[h].applied && events[h].pressed == pressed) {
+        events[h].seen = now;
+        events[h].result = 1;
+        key_head[key] = events[h].next;
+    }
+}
+
+/// run the ISRs whose flag and enable bits are set, in the order of
+/// the sub priority (all are IPL6)
+static void sim_isr(void)
+{
+    if (hal_sim.ifs0 & hal_sim.iec0 & HAL_SIM_INT4) {
+        _INT4Interrupt();
+        isr_calls[0]++;
+    }
+#ifndef SCAN_OUTPUT_BY_DMA
+    if (hal_sim.ifs0 & hal_sim.iec0 & HAL_SIM_INT3) {
+        _INT3Interrupt();
+        isr_calls[1]++;
+    }
+#else
+    if (hal_sim.ifs1 & hal_sim.iec1 & HAL_SIM_CNA) {
+        _CNInterrupt();
+        isr_calls[2]++;
+    }
+#endif
+}
+
+/// one HPP pulse; the edges and ISRs are handled in time order
+/// KRES1/KRES2 go low in the gap before the first pulse of a scan and
+/// high at its fall
+static void sim_hpp(uint64_t rise, uint8_t counter, bool kres, bool stalled)
+{
+    struct {
+        uint64_t time;
+        int kind;
+    } step[7], tmp;
+    uint64_t kres_time = rise - (prm.hpp_period - prm.hpp_high) / 2;
+    int n = 0;
+    int i, j;
+
+    if (kres) {
+        step[n].time = kres_time;                         step[n++].kind = 5;
+        step[n].time = kres_time + prm.int4_latency;      step[n++].kind = 6;
+    }
+    step[n].time = rise;                                  step[n++].kind = 0;
+    step[n].time = rise + prm.int4_latency;               step[n++].kind = 1;
+    step[n].time = rise + prm.sample;                     step[n++].kind = 2;
+    step[n].time = rise + prm.hpp_high;                   step[n++].kind = 3;
+    step[n].time = rise + prm.hpp_high + prm.int3_latency; step[n++].kind = 4;
+    for (i = 1; i < n; i++) {
+        for (j = i; j > 0 && step[j - 1].time > step[j].time; j--) {
+            tmp = step[j]; step[j] = step[j - 1]; step[j - 1] = tmp;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        sim_advance(step[i].time);
+        if (stalled && (step[i].kind == 1 || step[i].kind == 4 || step[i].kind == 6)) {
+            // the flags are kept until the CPU runs again
+            continue;
+        }
+        switch (step[i].kind) {
+        case 0:
+            if (!stalled) {
+                // at the end of the stall INT4 runs before INT3, and clears it
+                sim_isr();
+            }
+            // the LED line goes back high
+            HAL_SIM_SetPortA(hal_sim.porta | HAL_SIM_RA4);
+            HAL_SIM_SetHpp(true);
+            break;
+        case 1:
+        case 4:
+        case 6:
+            sim_isr();
+            if (kres && step[i].kind == SIM_FLIP_STEP) {
+                // the table is switched at the top of the scan
+                memcpy(expected, published, sizeof(expected));
+            }
+            break;
+        case 2:
+            sim_sample(counter);
+            break;
+        case 3:
+            HAL_SIM_SetHpp(false);
+            if (kres) {
+                HAL_SIM_SetPortA(hal_sim.porta | HAL_SIM_RA0 | HAL_SIM_RA1);
+            }
+            if (prm.led_code >= 0 && counter == (uint8_t)prm.led_code) {
+                HAL_SIM_SetPortA(hal_sim.porta & ~HAL_SIM_RA4);
+            }
+            break;
+        case 5:
+            HAL_SIM_SetPortA(hal_sim.porta & ~(HAL_SIM_RA0 | HAL_SIM_RA1));
+            break;
+        }
+    }
+}
+
+static void sim_scan(uint64_t top)
+{
+    uint8_t mask[sizeof(sampled)];
+    bool stalled;
+    bool any_stall = false;
+    uint8_t key;
+    uint16_t c;
+    uint16_t i;
+
+    memset(sampled, 0, sizeof(sampled));
+    memset(mask, 0xff, sizeof(mask));
+    for (c = 0; c < 256; c++) {
+        stalled = (prm.stall && (scans % SIM_STALL_SCANS) == SIM_STALL_SCANS - 1
+                && c >= SIM_STALL_COUNTER && c < SIM_STALL_COUNTER + prm.stall);
+        any_stall |= stalled;
+        if (stalled && (c & 1) == 0) {
+            key = (uint8_t)((c >> 4) * 8 + ((c >> 1) & 7));
+            mask[key >> 3] &= ~(1 << (key & 7));
+        }
+        sim_hpp(top + c * prm.hpp_period, (uint8_t)c, c == 0, stalled);
+    }
+    if (any_stall) {
+        stalled_scans++;
+    }
+    for (i = 0; i < sizeof(sampled); i++) {
+        sampled[i] &= mask[i];
+        expected[i] &= mask[i];
+    }
+    if (memcmp(sampled, expected, sizeof(sampled)) != 0) {
+        torn_scans++;
+        if (prm.verbose) {
+            printf("%12.1fus scan %u torn\n", (double)now / SIM_CYCLES_PER_US, scans);
+        }
+    }
+    scans++;
+}
+
+// ---- result ----
+
+static bool sim_all_handled(void)
+{
+    int i;
+
+    if (sim_report < num_events || queue_head != queue_tail) {
+        return false;
+    }
+    for (i = 0; i < SIM_KEYS; i++) {
+        if (key_head[i] >= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int sim_compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void sim_report_result(void)
+{
+    uint64_t *lat;
+    uint32_t seen = 0;
+    uint32_t dropped = 0;
+    uint32_t missing = 0;
+    uint64_t sum = 0;
+    uint64_t last = 0;
+    uint32_t keys = 0;
+    uint32_t reports = 0;
+    double span;
+    uint32_t i;
+
+    lat = malloc(sizeof(uint64_t) * (num_events ? num_events : 1));
+    for (i = 0; i < num_events; i++) {
+        switch (events[i].result) {
+        case 1:
+            lat[seen++] = events[i].seen - events[i].time;
+            sum += events[i].seen - events[i].time;
+            if (last < events[i].seen) {
+                last = events[i].seen;
+            }
+            keys += events[i].pressed;
+            if (i == 0 || events[i].time != events[i - 1].time) {
+                reports++;
+            }
+            break;
+        case 2:
+            dropped++;
+            break;
+        default:
+            missing++;
+            break;
+        }
+    }
+    qsort(lat, seen, sizeof(uint64_t), sim_compare_u64);
+
+    printf("scans: %u  period: %.1fus (measured %.1fus)  led updates: %u (last %02x)\n",
+           scans, (double)prm.scan_interval / SIM_CYCLES_PER_US,
+           (double)INTR_GetScanPeriod() / SIM_CYCLES_PER_US, sim_led_updates, sim_led_status);
+    printf("isr calls per scan: INT4 %.2f  INT3 %.2f  change notice %.2f\n",
+           scans ? (double)isr_calls[0] / scans : 0.0, scans ? (double)isr_calls[1] / scans : 0.0,
+           scans ? (double)isr_calls[2] / scans : 0.0);
+    printf("events: %u  seen: %u  dropped: %u  not seen at end: %u  torn scans: %u\n",
+           num_events, seen, dropped, missing, torn_scans);
+    if (prm.stall) {
+        printf("stalled scans: %u (%u pulses each)  counter: %s\n", stalled_scans, prm.stall,
+#ifdef HPP_COUNT_BY_TIMER2
+               "Timer2"
+#else
+               "ISR"
+#endif
+               );
+    }
+    if (seen) {
+        printf("latency (us): min %.1f  avg %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+               (double)lat[0] / SIM_CYCLES_PER_US,
+               (double)sum / seen / SIM_CYCLES_PER_US,
+               (double)lat[seen / 2] / SIM_CYCLES_PER_US,
+               (double)lat[seen * 90 / 100] / SIM_CYCLES_PER_US,
+               (double)lat[seen * 99 / 100] / SIM_CYCLES_PER_US,
+               (double)lat[seen - 1] / SIM_CYCLES_PER_US);
+    }
+    free(lat);
+
+    // from the first report to the last change seen by the S1
+    if (seen && last > events[0].time) {
+        span = (double)(last - events[0].time) / (SIM_CYCLES_PER_US * 1e6);
+        printf("throughput: %.1f keys/s  %.1f reports/s over %.3fs  (%.2f scans per report)\n",
+               keys / span, reports / span, span,
+               span * SIM_CYCLES_PER_US * 1e6 / prm.scan_interval / reports);
+    }
+}
+
+static void sim_usage(void)
+{
+    fprintf(stderr,
+        "usage: s1_scan_sim [options] [script]\n"
+        "  times are core timer cycles (24 per us)\n"
+        "  -p n  HPP period (%llu)\n"
+        "  -w n  HPP high width (%llu)\n"
+        "  -s n  Y_N sample after HPP rise (%llu)\n"
+        "  -4 n  INT4 latency (%llu)\n"
+        "  -3 n  INT3 latency (%llu)\n"
+        "  -k n  scan interval (%llu)\n"
+        "  -m n  main loop period (%llu)\n"
+        "  -H n  scans a change is held (%u)\n"
+        "  -l n  counter on which the LED line is low (none)\n"
+        "  -n n  random events (%u)\n"
+        "  -g n  mean gap between random key presses (%llu)\n"
+        "  -d n  random seed\n"
+        "  -x n  HPP pulses the CPU stalls in every 4th scan (0)\n"
+        "  -v    print keys seen by the S1\n",
+        (unsigned long long)prm.hpp_period, (unsigned long long)prm.hpp_high,
+        (unsigned long long)prm.sample, (unsigned long long)prm.int4_latency,
+        (unsigned long long)prm.int3_latency, (unsigned long long)prm.scan_interval,
+        (unsigned long long)prm.main_period, prm.hold_scans, prm.events,
+        (unsigned long long)prm.report_gap);
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t top;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:w:s:4:3:k:m:H:l:n:g:d:x:vh")) != -1) {
+        switch (opt) {
+        case 'p': prm.hpp_period = strtoull(optarg, NULL, 0); break;
+        case 'w': prm.hpp_high = strtoull(optarg, NULL, 0); break;
+        case 's': prm.sample = strtoull(optarg, NULL, 0); break;
+        case '4': prm.int4_latency = strtoull(optarg, NULL, 0); break;
+        case '3': prm.int3_latency = strtoull(optarg, NULL, 0); break;
+        case 'k': prm.scan_interval = strtoull(optarg, NULL, 0); break;
+        case 'm': prm.main_period = strtoull(optarg, NULL, 0); break;
+        case 'H': prm.hold_scans = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'l': prm.led_code = (int)strtol(optarg, NULL, 0); break;
+        case 'n': prm.events = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'g': prm.report_gap = strtoull(optarg, NULL, 0); break;
+        case 'd': srand((unsigned)strtoul(optarg, NULL, 0)); break;
+        case 'x': prm.stall = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'v': prm.verbose = true; break;
+        default: sim_usage(); return 2;
+        }
+    }
+    if (prm.hpp_period == 0 || prm.main_period == 0 || prm.report_gap == 0
+     || prm.hpp_period * 256 > prm.scan_interval) {
+        fprintf(stderr, "s1_scan_sim: 256 HPP periods must fit in a scan interval\n");
+        return 2;
+    }
+
+    if (optind < argc) {
+        if (!sim_read_script(argv[optind])) {
+            return 2;
+        }
+    } else {
+        sim_random_events();
+    }
+    qsort(events, num_events, sizeof(SIM_EVENT), sim_compare_event);
+    for (uint32_t i = 0; i < num_events; i++) {
+        events[i].seq = i;
+    }
+    memset(key_head, 0xff, sizeof(key_head));
+
+    hal_sim.count_manual = 1;
+    hal_sim.porta = HAL_SIM_RA0 | HAL_SIM_RA1 | HAL_SIM_RA4;
+    INTR_Init();
+
+    // scan until every report is handled and seen
+    for (top = prm.scan_interval; ; top += prm.scan_interval) {
+        sim_scan(top);
+        if (sim_all_handled()) {
+            break;
+        }
+        // the counter of the core timer is 32 bits (about 179 seconds)
+        if (top > ((uint64_t)1 << 40)) {
+            break;
+        }
+    }
+
+    sim_report_result();
+    return (sim_all_handled() && torn_scans == 0) ? 0 : 1;
+}
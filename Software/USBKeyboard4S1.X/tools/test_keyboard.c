@@ -0,0 +1,302 @@
+/** @file test_keyboard.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Tests of the report diff in app_host_hid_keyboard.c (host build)
+ *
+ *  The source of the app is included, so that the boot reports are given to
+ *  App_ProcessInputReport() and the events are moved to the key matrix by
+ *  App_KeyQueueTasks() directly. The S1 does not scan in these tests, so each
+ *  batch of events is applied at once.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+// the scan tests record the calls of APP_HostHIDUpdateLED() from the ISR
+#define APP_HostHIDUpdateLED    APP_HostHIDUpdateLED_Keyboard
+#include "../app_host_hid_keyboard.c"
+#undef APP_HostHIDUpdateLED
+
+#include "hal.h"
+#include "host_test.h"
+
+// ---- called from app_host_hid_keyboard.c ----
+
+USB_HID_DEVICE_RPT_INFO deviceRptInfo;
+USB_HID_ITEM_LIST       itemListPtrs;
+
+uint8_t USBHostHIDDeviceDetect(void)
+{
+    return 0;
+}
+
+uint8_t USBHostHIDDeviceStatus(uint8_t deviceAddress)
+{
+    return USB_HID_DEVICE_NOT_FOUND;
+}
+
+USB_HID_HANDLE USBHostHIDOpen(bool is_write, uint8_t deviceAddress, uint8_t interface)
+{
+    return NULL;
+}
+
+void USBHostHIDSetCallback(USB_HID_HANDLE handle, USB_HID_TRANSFER_CALLBACK callback)
+{
+}
+
+uint8_t USBHostHIDTransfer(USB_HID_HANDLE handle, uint8_t reportid, uint8_t size, uint8_t *data)
+{
+    return USB_HID_DEVICE_NOT_FOUND;
+}
+
+bool USBHostHIDTransferUsesControl(USB_HID_HANDLE handle)
+{
+    return false;
+}
+
+bool USBHostHIDTransferIsComplete(USB_HID_HANDLE handle, uint8_t *errorCode, uint8_t *byteCount)
+{
+    return false;
+}
+
+uint8_t USBHostHID_ApiGetCurrentInterfaceNum(void)
+{
+    return 0;
+}
+
+/// the fields are picked up in the report without sign extension
+bool USBHostHID_ApiImportData(uint8_t *report, uint16_t reportLength,
+                              HID_USER_DATA_SIZE *buffer, HID_DATA_DETAILS *pDataDetails)
+{
+    uint16_t bit;
+    uint8_t i;
+    uint8_t j;
+
+    if (pDataDetails->reportLength != reportLength) {
+        return false;
+    }
+    bit = pDataDetails->bitOffset;
+    for (i = 0; i < pDataDetails->count; i++) {
+        buffer[i] = 0;
+        for (j = 0; j < pDataDetails->bitLength; j++, bit++) {
+            if (report[bit >> 3] & (1 << (bit & 7))) {
+                buffer[i] |= (1 << j);
+            }
+        }
+    }
+    return true;
+}
+
+// ---- boot reports ----
+
+#define MOD_LCTRL       0x01
+#define MOD_LSHIFT      0x02
+#define MOD_RCTRL       0x10
+
+// usage ids and their scancodes
+#define USAGE_A         0x04
+#define USAGE_B         0x05
+#define USAGE_C         0x06
+#define USAGE_D         0x07
+#define USAGE_E         0x08
+#define USAGE_F         0x09
+#define USAGE_G         0x0a
+#define KEY_A           0x38
+#define KEY_B           0x49
+#define KEY_C           0x4b
+#define KEY_D           0x3b
+#define KEY_E           0x2b
+#define KEY_F           0x31
+#define KEY_G           0x39
+#define KEY_CTRL        0x06
+#define KEY_SHIFT       0x07
+
+static uint8_t report[8];
+
+static void kbd_reset(void)
+{
+    memset((void *)&hal_sim, 0, sizeof(hal_sim));
+    hal_sim.count_manual = 1;
+    INTR_Init();
+
+    memset(&keyboard, 0, sizeof(keyboard));
+    keyboard.keys.size = sizeof(report);
+    keyboard.keys.buffer = report;
+    keyboard.keys.modifier.parsed.details.reportLength = sizeof(report);
+    keyboard.keys.modifier.parsed.details.bitOffset = 0;
+    keyboard.keys.modifier.parsed.details.bitLength = 1;
+    keyboard.keys.modifier.parsed.details.count = 8;
+    keyboard.keys.normal.parsed.details.reportLength = sizeof(report);
+    keyboard.keys.normal.parsed.details.bitOffset = 16;
+    keyboard.keys.normal.parsed.details.bitLength = 8;
+    keyboard.keys.normal.parsed.details.count = 6;
+    key_report_seq = 0;
+    App_ClearKeyMatrix();
+}
+
+/// a report of the modifier byte and up to 6 usages (0: end), returns the events made
+static int kbd_report(uint8_t modifier, const uint8_t *usages)
+{
+    uint8_t before = key_queue_tail;
+    int i;
+
+    memset(report, 0, sizeof(report));
+    report[0] = modifier;
+    for (i = 0; i < 6 && usages[i] != 0; i++) {
+        report[2 + i] = usages[i];
+    }
+    App_ProcessInputReport();
+    return (uint8_t)(key_queue_tail - before);
+}
+
+/// the events are moved to the matrix, returns the number of batches
+static int kbd_apply(void)
+{
+    int batches = 0;
+
+    while (key_queue_head != key_queue_tail) {
+        App_KeyQueueTasks();
+        batches++;
+    }
+    return batches;
+}
+
+static bool kbd_key(uint8_t key)
+{
+    return (key_onoff_flags[key >> 3] & (1 << (key & 7))) != 0;
+}
+
+/// count the keys pressed in the matrix, except the JIS key
+static int kbd_pressed(void)
+{
+    int n = 0;
+    int k;
+
+    for (k = 0; k < (int)sizeof(key_onoff_flags) * 8; k++) {
+        if (k != 0x71 && kbd_key((uint8_t)k)) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/// only the keys changed from the previous report make events
+static void test_keyboard_delta(void)
+{
+    kbd_reset();
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_A, 0 }), 1);
+    CHECK_EQ(kbd_apply(), 1);
+    CHECK(kbd_key(KEY_A));
+
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_A, USAGE_B, 0 }), 1);
+    kbd_apply();
+    CHECK(kbd_key(KEY_A));
+    CHECK(kbd_key(KEY_B));
+
+    // the same keys in the other order
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_B, USAGE_A, 0 }), 0);
+    // the same report again
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_B, USAGE_A, 0 }), 0);
+
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_B, 0 }), 1);
+    kbd_apply();
+    CHECK(!kbd_key(KEY_A));
+    CHECK(kbd_key(KEY_B));
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ 0 }), 1);
+    kbd_apply();
+    CHECK_EQ(kbd_pressed(), 0);
+    CHECK(kbd_key(0x71));
+}
+
+/// 6 keys and the rollover past them
+static void test_keyboard_rollover(void)
+{
+    static const uint8_t six[] = { USAGE_A, USAGE_B, USAGE_C, USAGE_D, USAGE_E, USAGE_F, 0 };
+    static const uint8_t rollover[] = { 1, 1, 1, 1, 1, 1, 0 };
+
+    kbd_reset();
+    CHECK_EQ(kbd_report(0, six), 6);
+    CHECK_EQ(kbd_apply(), 1);
+    CHECK_EQ(kbd_pressed(), 6);
+
+    // a 7th key: ErrorRollOver keeps the keys of the last report
+    CHECK_EQ(kbd_report(0, rollover), 0);
+    CHECK_EQ(kbd_pressed(), 6);
+    CHECK(!kbd_key(KEY_G));
+    CHECK_EQ(kbd_report(0, rollover), 0);
+
+    // back under 7 keys: the diff is taken against the report before rollover
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_A, USAGE_B, USAGE_C, USAGE_D, USAGE_E, USAGE_G, 0 }), 2);
+    kbd_apply();
+    CHECK(!kbd_key(KEY_F));
+    CHECK(kbd_key(KEY_G));
+    CHECK_EQ(kbd_pressed(), 6);
+
+    // all released while the report showed rollover
+    CHECK_EQ(kbd_report(0, rollover), 0);
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ 0 }), 6);
+    kbd_apply();
+    CHECK_EQ(kbd_pressed(), 0);
+}
+
+/// the modifier keys are taken also from a report of rollover
+static void test_keyboard_modifier(void)
+{
+    kbd_reset();
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_A, 0 }), 1);
+    kbd_apply();
+
+    // a change of the modifier byte only
+    CHECK_EQ(kbd_report(MOD_LSHIFT, (const uint8_t[]){ USAGE_A, 0 }), 1);
+    kbd_apply();
+    CHECK(kbd_key(KEY_SHIFT));
+    CHECK(kbd_key(KEY_A));
+
+    CHECK_EQ(kbd_report(MOD_LSHIFT | MOD_LCTRL, (const uint8_t[]){ 1, 1, 1, 1, 1, 1, 0 }), 1);
+    kbd_apply();
+    CHECK(kbd_key(KEY_CTRL));
+    CHECK(kbd_key(KEY_A));
+
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ USAGE_A, 0 }), 2);
+    kbd_apply();
+    CHECK(!kbd_key(KEY_SHIFT));
+    CHECK(!kbd_key(KEY_CTRL));
+    CHECK(kbd_key(KEY_A));
+}
+
+/// left and right CTRL share a scancode, released when both are up
+static void test_keyboard_shared(void)
+{
+    kbd_reset();
+    CHECK_EQ(kbd_report(MOD_LCTRL, (const uint8_t[]){ 0 }), 1);
+    CHECK_EQ(kbd_report(MOD_LCTRL | MOD_RCTRL, (const uint8_t[]){ 0 }), 0);
+    CHECK_EQ(kbd_report(MOD_RCTRL, (const uint8_t[]){ 0 }), 0);
+    kbd_apply();
+    CHECK(kbd_key(KEY_CTRL));
+    CHECK_EQ(kbd_report(0, (const uint8_t[]){ 0 }), 1);
+    kbd_apply();
+    CHECK(!kbd_key(KEY_CTRL));
+}
+
+/// a key pressed and released in two reports is shown in two batches
+static void test_keyboard_batch(void)
+{
+    kbd_reset();
+    kbd_report(0, (const uint8_t[]){ USAGE_A, 0 });
+    kbd_report(0, (const uint8_t[]){ 0 });
+    kbd_report(0, (const uint8_t[]){ USAGE_A, USAGE_B, 0 });
+    CHECK_EQ(kbd_apply(), 3);
+    CHECK(kbd_key(KEY_A));
+    CHECK(kbd_key(KEY_B));
+}
+
+void TEST_Keyboard(void)
+{
+    test_keyboard_delta();
+    test_keyboard_rollover();
+    test_keyboard_modifier();
+    test_keyboard_shared();
+    test_keyboard_batch();
+}
@@ -0,0 +1,248 @@
+/** @file test_scan.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Tests of the scan ISRs in interrupt.c (host build)
+ *
+ *  The S1 is driven at the default timing of s1_scan_sim.c: HPP period 16us,
+ *  a scan every 20ms, and the ISRs run 2us after each edge.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hal.h"
+#include "main.h"
+#include "interrupt.h"
+#include "host_test.h"
+
+#define HPP_PERIOD      384     // core timer cycles
+#define HPP_HIGH        192
+#define ISR_LATENCY     48
+#define SAMPLE          96      // Y_N sample after HPP rise
+#define SCAN_INTERVAL   480000
+
+void _INT4Interrupt(void);
+void _INT3Interrupt(void);
+
+static uint64_t now;
+static uint64_t top;
+static uint8_t seen[256];       // Y_N sampled at each counter, 1: pressed
+static uint32_t not_released;   // Y_N left low after HPP fall
+
+static void scan_set_time(uint64_t time)
+{
+    now = time;
+    hal_sim.count = (uint32_t)time;
+}
+
+/// one HPP pulse of the counter
+static void scan_hpp(uint8_t counter, int led_code)
+{
+    uint64_t rise = top + (uint64_t)counter * HPP_PERIOD;
+
+    scan_set_time(rise);
+    hal_sim.porta = (counter == 0 ? 0 : (HAL_SIM_RA0 | HAL_SIM_RA1)) | HAL_SIM_RA4;
+    HAL_SIM_SetHpp(true);
+    scan_set_time(rise + ISR_LATENCY);
+    _INT4Interrupt();
+    scan_set_time(rise + SAMPLE);
+    seen[counter] = (hal_sim.latb.LATB7 == 0);
+    scan_set_time(rise + HPP_HIGH);
+    HAL_SIM_SetHpp(false);
+    if (led_code == counter) {
+        hal_sim.porta &= ~HAL_SIM_RA4;
+    }
+    scan_set_time(rise + HPP_HIGH + ISR_LATENCY);
+    _INT3Interrupt();
+    if (hal_sim.latb.LATB7 == 0) {
+        not_released++;
+    }
+}
+
+/// pulses [from, to) of the current scan
+static void scan_part(int from, int to, int led_code)
+{
+    int c;
+
+    for (c = from; c < to; c++) {
+        scan_hpp((uint8_t)c, led_code);
+    }
+    if (to == 256) {
+        top += SCAN_INTERVAL;
+    }
+}
+
+static void scan_full(int led_code)
+{
+    scan_part(0, 256, led_code);
+}
+
+static void scan_reset(void)
+{
+    memset((void *)&hal_sim, 0, sizeof(hal_sim));
+    memset(key_onoff_flags, 0, sizeof(key_onoff_flags));
+    memset(seen, 0, sizeof(seen));
+    led_hira_inv = 0;
+    not_released = 0;
+    host_test_led_updates = 0;
+    top = SCAN_INTERVAL;
+    hal_sim.count_manual = 1;
+    hal_sim.porta = HAL_SIM_RA0 | HAL_SIM_RA1 | HAL_SIM_RA4;
+    scan_set_time(0);
+    INTR_Init();
+}
+
+static void scan_set_key(uint8_t key, bool pressed)
+{
+    if (pressed) {
+        key_onoff_flags[key >> 3] |= (1 << (key & 7));
+    } else {
+        key_onoff_flags[key >> 3] &= ~(1 << (key & 7));
+    }
+}
+
+/// count the counters where the S1 saw other than the keys of the matrix
+static int scan_mismatch(const uint8_t *flags)
+{
+    int c;
+    int n = 0;
+    bool pressed;
+
+    for (c = 0; c < 256; c++) {
+        pressed = ((c & 1) == 0 && (flags[c >> 4] & (1 << ((c >> 1) & 7))));
+        if (seen[c] != pressed) {
+            n++;
+        }
+    }
+    return n;
+}
+
+/// each key of the matrix is shown on its counter, odd counters are released
+static void test_scan_table(void)
+{
+    scan_reset();
+    scan_set_key(0, true);
+    scan_set_key(9, true);
+    scan_set_key(127, true);
+    INTR_UpdateScanTable(key_onoff_flags);
+    scan_full(-1);
+    CHECK_EQ(scan_mismatch(key_onoff_flags), 0);
+    CHECK_EQ(not_released, 0);
+}
+
+/// a table published while scanning is used from the next scan
+static void test_scan_publish(void)
+{
+    uint8_t old_flags[sizeof(key_onoff_flags)];
+
+    scan_reset();
+    scan_set_key(1, true);
+    INTR_UpdateScanTable(key_onoff_flags);
+    scan_full(-1);
+    // a scan is counted when the next one starts
+    CHECK(!INTR_ScanTableSettled(1));
+
+    memcpy(old_flags, key_onoff_flags, sizeof(old_flags));
+    scan_part(0, 128, -1);
+    CHECK(INTR_ScanTableSettled(1));
+    scan_set_key(1, false);
+    scan_set_key(2, true);
+    scan_set_key(126, true);
+    INTR_UpdateScanTable(key_onoff_flags);
+    CHECK(!INTR_ScanTableSettled(0));
+    scan_part(128, 256, -1);
+    CHECK_EQ(scan_mismatch(old_flags), 0);
+
+    scan_full(-1);
+    CHECK_EQ(scan_mismatch(key_onoff_flags), 0);
+    scan_part(0, 1, -1);
+    CHECK(INTR_ScanTableSettled(1));
+    CHECK(!INTR_ScanTableSettled(2));
+    scan_part(1, 256, -1);
+    scan_part(0, 1, -1);
+    CHECK(INTR_ScanTableSettled(2));
+    CHECK_EQ(not_released, 0);
+}
+
+/// the period of scans is measured, and the scan stops after 4 periods
+static void test_scan_period(void)
+{
+    int i;
+
+    scan_reset();
+    CHECK(!INTR_ScanIsActive());
+    for (i = 0; i < 10; i++) {
+        scan_full(-1);
+    }
+    CHECK_EQ(INTR_GetScanPeriod(), SCAN_INTERVAL);
+    CHECK_EQ(INTR_GetScanJitter(), 0);
+    CHECK(INTR_ScanIsActive());
+
+    // the scan starts at INT4 of the first pulse
+    scan_set_time(top - SCAN_INTERVAL + ISR_LATENCY + SCAN_INTERVAL * 4 - 1);
+    CHECK(INTR_ScanIsActive());
+    scan_set_time(top - SCAN_INTERVAL + ISR_LATENCY + SCAN_INTERVAL * 4);
+    CHECK(!INTR_ScanIsActive());
+}
+
+/// a stall of the CPU fits only in the gap between the scans
+static void test_scan_gap(void)
+{
+    uint64_t start;
+    int i;
+
+    scan_reset();
+    CHECK(INTR_ScanGapFits(SCAN_INTERVAL * 2));
+    for (i = 0; i < 10; i++) {
+        scan_full(-1);
+    }
+    start = top - SCAN_INTERVAL + ISR_LATENCY;
+
+    // scanning
+    scan_set_time(start + HPP_PERIOD * 255);
+    CHECK(!INTR_ScanGapFits(1));
+    // after the scan, a word program fits and a page erase never does
+    scan_set_time(start + 24000 * 6);
+    CHECK(INTR_ScanGapFits(2400));
+    CHECK(!INTR_ScanGapFits(24000 * 20));
+    scan_set_time(start + SCAN_INTERVAL - 2400);
+    CHECK(!INTR_ScanGapFits(2400));
+    // the next scan is late
+    scan_set_time(start + SCAN_INTERVAL + 24000 * 6);
+    CHECK(!INTR_ScanGapFits(2400));
+
+    // the S1 stopped scanning
+    scan_set_time(start + SCAN_INTERVAL * 4);
+    CHECK(INTR_ScanGapFits(24000 * 20));
+}
+
+/// the LED line low on a counter sets the LEDs once
+static void test_scan_led(void)
+{
+    scan_reset();
+    scan_full(0x0a);
+    CHECK_EQ(host_test_led_updates, 1);
+    CHECK_EQ(host_test_led_status, 0x0a);
+    CHECK_EQ(hal_sim.latb.LATB9, 0);    // KATA on
+    CHECK_EQ(hal_sim.latb.LATB13, 1);   // HIRA off
+    CHECK_EQ(hal_sim.latb.LATB15, 1);   // CAPS on
+    scan_full(0x0a);
+    CHECK_EQ(host_test_led_updates, 1);
+
+    led_hira_inv = 4;
+    scan_full(0x0a);
+    CHECK_EQ(host_test_led_updates, 2);
+    CHECK_EQ(host_test_led_status, 0x0e);
+    CHECK_EQ(hal_sim.latb.LATB13, 0);   // HIRA on
+}
+
+void TEST_Scan(void)
+{
+    test_scan_table();
+    test_scan_publish();
+    test_scan_period();
+    test_scan_gap();
+    test_scan_led();
+}
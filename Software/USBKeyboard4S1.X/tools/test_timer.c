@@ -0,0 +1,94 @@
+/** @file test_timer.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Tests of the tick scheduler in timer_1ms.c (host build)
+ */
+
+#include <stdio.h>
+
+#include "hal.h"
+#include "timer_1ms.h"
+#include "host_test.h"
+
+void _T1Interrupt(void);
+
+static uint32_t ticks_a;
+static uint32_t ticks_b;
+static uint32_t ticks_c;
+static uint32_t ticks_d;
+
+static void timer_tick_a(void) { ticks_a++; }
+static void timer_tick_b(void) { ticks_b++; }
+static void timer_tick_c(void) { ticks_c++; }
+static void timer_tick_d(void) { ticks_d++; }
+
+static void timer_run(int ms)
+{
+    while (ms-- > 0) {
+        hal_sim.ifs0 |= HAL_SIM_T1;
+        _T1Interrupt();
+    }
+}
+
+/// the requests are refused until the timer is configured
+static void test_timer_config(void)
+{
+    TIMER_SetConfiguration(TIMER_CONFIGURATION_OFF);
+    CHECK(!TIMER_RequestTick(timer_tick_a, 1, -1));
+
+    CHECK(TIMER_SetConfiguration(TIMER_CONFIGURATION_1MS));
+    CHECK(hal_sim.iec0 & HAL_SIM_T1);
+    CHECK(hal_sim.pr1 != 0);
+}
+
+/// a handler is called every rate ticks, loop times or forever
+static void test_timer_rate(void)
+{
+    TIMER_SetConfiguration(TIMER_CONFIGURATION_1MS);
+    ticks_a = ticks_b = 0;
+    CHECK(TIMER_RequestTick(timer_tick_a, 3, 2));
+    CHECK(TIMER_RequestTick(timer_tick_b, 5, -1));
+
+    timer_run(2);
+    CHECK_EQ(ticks_a, 0);
+    timer_run(1);
+    CHECK_EQ(ticks_a, 1);
+    timer_run(27);
+    CHECK_EQ(ticks_a, 2);
+    CHECK_EQ(ticks_b, 6);
+    CHECK((hal_sim.ifs0 & HAL_SIM_T1) == 0);
+
+    TIMER_CancelTick(timer_tick_b);
+    timer_run(10);
+    CHECK_EQ(ticks_b, 6);
+}
+
+/// the slots are freed by the end of the loop and by cancel
+static void test_timer_slots(void)
+{
+    TIMER_SetConfiguration(TIMER_CONFIGURATION_1MS);
+    ticks_a = ticks_b = ticks_c = ticks_d = 0;
+    CHECK(TIMER_RequestTick(timer_tick_a, 1, 1));
+    CHECK(TIMER_RequestTick(timer_tick_b, 1, -1));
+    CHECK(TIMER_RequestTick(timer_tick_c, 1, -1));
+    CHECK(!TIMER_RequestTick(timer_tick_d, 1, -1));
+
+    timer_run(1);
+    CHECK(TIMER_RequestTick(timer_tick_d, 1, -1));
+    TIMER_CancelTick(timer_tick_b);
+    CHECK(TIMER_RequestTick(timer_tick_a, 1, -1));
+    timer_run(1);
+    CHECK_EQ(ticks_a, 2);
+    CHECK_EQ(ticks_b, 1);
+    CHECK_EQ(ticks_c, 2);
+    CHECK_EQ(ticks_d, 1);
+}
+
+void TEST_Timer(void)
+{
+    test_timer_config();
+    test_timer_rate();
+    test_timer_slots();
+}
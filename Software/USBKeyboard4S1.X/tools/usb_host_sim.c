@@ -0,0 +1,1619 @@
+/** @file usb_host_sim.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Benchmark of the USB host stack on the SIE model (host build)
+ *
+ *  The USB host stack in ../usb runs on the SIE model of usb_hal_sim.c
+ *  with virtual devices:
+ *    keyboard  low speed boot keyboard on the root port
+ *    hub       full speed hub with the keyboard on port 1
+ *    nak       keyboard with an interrupt OUT endpoint for the LEDs, which
+ *              NAKs the control data and status stages and the interrupt
+ *              endpoints at random; the client writes the LEDs on each report
+ *    alt       keyboard with two alternate settings of 5 interrupt endpoints
+ *              each, more than the slots of the periodic schedule
+ *    kbd3      keyboard with two more HID interfaces (consumer control and
+ *              vendor), more than a device of usb_pool.h is sized for
+ *
+ *  The main loop is the same as main.c (USBHostTasks, USBHostHUBTasks,
+ *  USBHostHIDTasks), the HID client reads the input report the same way as
+ *  app_host_hid_keyboard.c, and a pass of the loop takes a given time.
+ *  The keyboard is plugged in, sends reports, and is unplugged again for
+ *  the given cycles (on the port of the hub in the hub test, or with -u).
+ *  With -r tick the client reads the next report at the next 10ms tick
+ *  after a report, as the app does with APP_INPUT_REPORT_BY_TICK.
+ *
+ *  Printed for each cycle:
+ *    time from the attach to the first report seen by the client,
+ *    latency and frames from a key change to the report seen by the client,
+ *    IN tokens and NAKs on the interrupt endpoint per report.
+ *  Printed for the whole run:
+ *    distribution of the latency over all cycles,
+ *    time from the attach to the device found by the client, host time in
+ *    USBHostTasks() until then and its longest pass (the least of the
+ *    cycles), and bytes of the pool blocks taken by the device,
+ *    tokens and results on the bus, bus time used,
+ *    LED reports written and NAK'd on the interrupt OUT endpoint,
+ *    calls of the USB ISR per frame and host time spent in it.
+ *  The ISR work is the host time of the C code, not the cycles on the
+ *  target; use it to compare versions of the stack. With ISR_STAT_ENABLE
+ *  the time of each call and the time in each millisecond are also put in
+ *  the histograms of isr_stat.c (in ns of the host). usb_host_sim_isr
+ *  is built with USB_HOST_TASKS_IN_ISR, so that the interrupts are
+ *  processed in the ISR as the original stack did. usb_host_sim_pool is
+ *  built with USB_STATIC_POOL; the blocks used after each unplug must be
+ *  the same as after the first one (attach and detach soak).
+ *  usb_host_sim_pool_tight has smaller pools, the kbd3 device on the hub
+ *  takes a block from the heap at each attach and must give it back.
+ *  usb_host_sim_cache is built with USB_ENUM_CACHE; the first cycle writes
+ *  the descriptors to the flash and the next ones read them from it, the
+ *  CPU stall of the flash is added to the pass of the loop.
+ *  usb_host_sim_small has one slot in the periodic schedule and one entry
+ *  in the active endpoint index; on the hub the keyboard finds neither, and
+ *  is polled by its interval count, which is counted by the list walk.
+ *
+ *  build (in this directory):
+ *    make usb_host_sim
+ *
+ *  usage: usb_host_sim [options] [script]
+ *    script: lines of "<ms> <command> [usage]", command is one of
+ *            attach, detach (root port), plug, unplug (port 1 of the hub),
+ *            key (press the usage and release the others), up (release).
+ *  exit status is 1 if the SIE model found an error, a change made in
+ *  the plug cycles was not seen by the client, a NAK'd OUT was tried
+ *  again in the same frame, or a cycle leaked blocks
+ *  of the pools, or a word of the flash was programmed twice.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "hal.h"
+#include "usb.h"
+#include "usb_host_hid.h"
+#include "usb_host_hub.h"
+#include "isr_stat.h"
+
+#define SIM_MAX_EVENTS      4096
+#define SIM_MAX_REPORTS     4096
+#define SIM_MAX_CYCLES      1024
+#define SIM_CYCLES_PER_MS   USB_SIM_CYCLES_PER_MS
+#define SIM_HUB_PORTS       4
+#define SIM_PORT_RESET_MS   10
+#define SIM_SETUP_TYPE_MASK 0x60
+#define SIM_JITTER_MS       16
+#define SIM_TICK_MS         10
+
+// ---- parameters ----
+
+static struct {
+    const char *device;         // keyboard, hub, nak, alt or kbd3
+    uint32_t loop_cycles;       // main loop pass (core timer cycles)
+    uint32_t reports;           // key changes in a cycle
+    uint32_t report_gap;        // ms between key changes (+ 0 to 16ms)
+    uint32_t cycles;            // plug cycles
+    uint32_t unplug_wait;       // ms between unplug and plug
+    uint32_t timeout;           // ms to wait for a report
+    uint32_t nak_percent;       // NAK rate of the nak device
+    bool     by_tick;           // read on a 10ms tick (APP_INPUT_REPORT_BY_TICK)
+    bool     on_hub;            // the device is on port 1 of the hub
+    bool     verbose;
+} prm = {
+    "keyboard", 240, 20, 30, 3, 200, 3000, 50, false, false, false
+};
+
+static uint32_t sim_seed = 1;
+
+static uint32_t sim_rand(void)
+{
+    sim_seed ^= sim_seed << 13;
+    sim_seed ^= sim_seed >> 17;
+    sim_seed ^= sim_seed << 5;
+    return sim_seed;
+}
+
+static double sim_ms(uint64_t cycles)
+{
+    return (double)cycles / SIM_CYCLES_PER_MS;
+}
+
+// ---- virtual device with a control endpoint ----
+
+enum {
+    EP0_IDLE,
+    EP0_DATA_IN,
+    EP0_DATA_OUT,
+    EP0_STATUS_IN,
+    EP0_STATUS_OUT,
+    EP0_STALL,
+};
+
+typedef struct _SIM_DEVICE SIM_DEVICE;
+
+struct _SIM_DEVICE {
+    USB_SIM_DEVICE  usb;                // must be first
+    uint8_t         max_packet0;
+    const uint8_t  *device_desc;
+    const uint8_t  *config_desc;
+    uint16_t        config_len;
+    /// class and interface requests, and descriptors of the class
+    bool          (*request)(SIM_DEVICE *d, const uint8_t *setup, const uint8_t **data, uint16_t *len);
+    /// IN token to an endpoint other than EP0
+    uint8_t       (*endpoint_in)(SIM_DEVICE *d, uint8_t ep, uint8_t *data, uint16_t *len);
+    /// OUT token to an endpoint other than EP0
+    uint8_t       (*endpoint_out)(SIM_DEVICE *d, uint8_t ep, const uint8_t *data, uint16_t len);
+    void          (*reset)(SIM_DEVICE *d);
+    uint32_t        nak_percent;
+    uint32_t        in_tokens;          // IN tokens to the other endpoints
+    uint32_t        in_naks;
+    uint32_t        out_tokens;         // OUT tokens to the other endpoints
+    uint32_t        out_naks;
+    uint32_t        out_nak_frame;      // frame of the last NAK to OUT
+    uint32_t        out_retries;        // OUT tried again in the frame of its NAK
+
+    // control endpoint
+    uint8_t         setup[8];
+    uint8_t         stage;
+    const uint8_t  *in;
+    uint16_t        in_len;
+    uint16_t        in_pos;
+    uint8_t         in_toggle;
+    uint16_t        out_len;
+    uint8_t         new_address;
+    uint8_t         configuration;
+    uint8_t         status[2];
+};
+
+static bool sim_std_request(SIM_DEVICE *d, const uint8_t *setup, const uint8_t **data, uint16_t *len)
+{
+    uint16_t value = setup[2] | (setup[3] << 8);
+
+    switch (setup[1]) {
+    case USB_REQUEST_GET_DESCRIPTOR:
+        if ((setup[0] & 0x1F) != USB_SETUP_RECIPIENT_DEVICE) {
+            break;
+        }
+        if ((value >> 8) == USB_DESCRIPTOR_DEVICE) {
+            *data = d->device_desc;
+            *len = d->device_desc[0];
+            return true;
+        }
+        if ((value >> 8) == USB_DESCRIPTOR_CONFIGURATION) {
+            *data = d->config_desc;
+            *len = d->config_len;
+            return true;
+        }
+        return false;
+    case USB_REQUEST_SET_ADDRESS:
+        d->new_address = value & 0x7F;
+        return true;
+    case USB_REQUEST_SET_CONFIGURATION:
+        d->configuration = value & 0xFF;
+        return true;
+    case USB_REQUEST_GET_CONFIGURATION:
+        *data = &d->configuration;
+        *len = 1;
+        return true;
+    case USB_REQUEST_GET_STATUS:
+        d->status[0] = 0;
+        d->status[1] = 0;
+        *data = d->status;
+        *len = 2;
+        return true;
+    case USB_REQUEST_CLEAR_FEATURE:
+    case USB_REQUEST_SET_FEATURE:
+    case USB_REQUEST_SET_INTERFACE:
+        return true;
+    default:
+        break;
+    }
+    return d->request ? d->request(d, setup, data, len) : false;
+}
+
+static uint8_t sim_ep0_setup(SIM_DEVICE *d, const uint8_t *data, uint16_t len)
+{
+    uint16_t length;
+
+    if (len != 8) {
+        return 0;
+    }
+    memcpy(d->setup, data, 8);
+    length = d->setup[6] | (d->setup[7] << 8);
+    d->in = NULL;
+    d->in_len = 0;
+    d->in_pos = 0;
+    d->in_toggle = 1;
+    d->out_len = 0;
+
+    if ((d->setup[0] & SIM_SETUP_TYPE_MASK) == USB_SETUP_TYPE_STANDARD) {
+        if (!sim_std_request(d, d->setup, &d->in, &d->in_len)) {
+            d->stage = EP0_STALL;
+            return PID_ACK;
+        }
+    } else if (!d->request || !d->request(d, d->setup, &d->in, &d->in_len)) {
+        d->stage = EP0_STALL;
+        return PID_ACK;
+    }
+
+    if (d->setup[0] & USB_SETUP_DEVICE_TO_HOST) {
+        if (d->in_len > length) {
+            d->in_len = length;
+        }
+        d->stage = EP0_DATA_IN;
+    } else if (length > 0) {
+        d->stage = EP0_DATA_OUT;
+    } else {
+        d->stage = EP0_STATUS_IN;
+    }
+    // SETUP is always ACK'd
+    return PID_ACK;
+}
+
+static uint8_t sim_ep0_in(SIM_DEVICE *d, uint8_t *data, uint16_t *len)
+{
+    uint16_t n;
+    uint8_t pid;
+
+    switch (d->stage) {
+    case EP0_DATA_IN:
+        n = d->in_len - d->in_pos;
+        if (n > d->max_packet0) n = d->max_packet0;
+        if (n > *len) n = *len;
+        memcpy(data, d->in + d->in_pos, n);
+        d->in_pos += n;
+        *len = n;
+        pid = d->in_toggle ? PID_DATA1 : PID_DATA0;
+        d->in_toggle ^= 1;
+        if (d->in_pos >= d->in_len) {
+            d->stage = EP0_STATUS_OUT;
+        }
+        return pid;
+    case EP0_STATUS_OUT:
+        // the host reads more than the device has
+        *len = 0;
+        pid = d->in_toggle ? PID_DATA1 : PID_DATA0;
+        d->in_toggle ^= 1;
+        return pid;
+    case EP0_STATUS_IN:
+        *len = 0;
+        d->stage = EP0_IDLE;
+        if (d->setup[1] == USB_REQUEST_SET_ADDRESS && (d->setup[0] & SIM_SETUP_TYPE_MASK) == USB_SETUP_TYPE_STANDARD) {
+            d->usb.address = d->new_address;
+        }
+        return PID_DATA1;
+    default:
+        return PID_STALL;
+    }
+}
+
+static uint8_t sim_ep0_out(SIM_DEVICE *d, uint16_t len)
+{
+    switch (d->stage) {
+    case EP0_DATA_OUT:
+        d->out_len += len;
+        if (d->out_len >= (d->setup[6] | (d->setup[7] << 8))) {
+            d->stage = EP0_STATUS_IN;
+        }
+        return PID_ACK;
+    case EP0_STATUS_OUT:
+        d->stage = EP0_IDLE;
+        return PID_ACK;
+    default:
+        return PID_STALL;
+    }
+}
+
+static uint8_t sim_device_transaction(USB_SIM_DEVICE *dev, uint8_t pid, uint8_t ep, uint8_t *data, uint16_t *len)
+{
+    SIM_DEVICE *d = (SIM_DEVICE *)dev;
+    uint8_t result;
+
+    if (ep != 0 && pid == PID_OUT && d->endpoint_out) {
+        d->out_tokens++;
+        if (d->out_nak_frame == usb_sim_stat.frames) {
+            d->out_retries++;
+        }
+        if (d->nak_percent && (sim_rand() % 100) < d->nak_percent) {
+            result = PID_NAK;
+        } else {
+            result = d->endpoint_out(d, ep, data, *len);
+        }
+        if (result == PID_NAK) {
+            d->out_naks++;
+            d->out_nak_frame = usb_sim_stat.frames;
+        }
+        return result;
+    }
+    if (ep != 0) {
+        if (pid != PID_IN || !d->endpoint_in) {
+            return PID_STALL;
+        }
+        d->in_tokens++;
+        if (d->nak_percent && (sim_rand() % 100) < d->nak_percent) {
+            result = PID_NAK;
+        } else {
+            result = d->endpoint_in(d, ep, data, len);
+        }
+        if (result == PID_NAK) {
+            d->in_naks++;
+        }
+        return result;
+    }
+    if (pid != PID_SETUP && d->nak_percent && (sim_rand() % 100) < d->nak_percent) {
+        return PID_NAK;
+    }
+    switch (pid) {
+    case PID_SETUP:
+        return sim_ep0_setup(d, data, *len);
+    case PID_IN:
+        return sim_ep0_in(d, data, len);
+    case PID_OUT:
+        return sim_ep0_out(d, *len);
+    default:
+        return 0;
+    }
+}
+
+static void sim_device_reset(USB_SIM_DEVICE *dev)
+{
+    SIM_DEVICE *d = (SIM_DEVICE *)dev;
+
+    d->stage = EP0_IDLE;
+    d->configuration = 0;
+    d->usb.address = 0;
+    d->out_nak_frame = UINT32_MAX;
+    if (d->reset) {
+        d->reset(d);
+    }
+}
+
+static void sim_device_init(SIM_DEVICE *d, const char *name, bool low_speed)
+{
+    d->usb.name = name;
+    d->usb.low_speed = low_speed;
+    d->usb.transaction = sim_device_transaction;
+    d->usb.reset = sim_device_reset;
+    d->usb.context = d;
+    d->out_nak_frame = UINT32_MAX;
+}
+
+// ---- keyboard ----
+
+#define SIM_EP_INT_IN(addr) 7, USB_DESCRIPTOR_ENDPOINT, (addr), 0x03, 8, 0, 10
+
+static const uint8_t kbd_report_desc[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,             // Generic Desktop, Keyboard
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7,             // modifiers
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x95, 0x01, 0x75, 0x08, 0x81, 0x01,             // reserved
+    0x95, 0x05, 0x75, 0x01, 0x05, 0x08,             // LEDs
+    0x19, 0x01, 0x29, 0x05, 0x91, 0x02,
+    0x95, 0x01, 0x75, 0x03, 0x91, 0x01,
+    0x95, 0x06, 0x75, 0x08, 0x15, 0x00, 0x25, 0x65, // keys
+    0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00,
+    0xC0
+};
+
+// the other interfaces of kbd3
+static const uint8_t kbd3_consumer_report_desc[] = {
+    0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01,             // Consumer, Consumer Control
+    0x15, 0x00, 0x26, 0x9C, 0x02, 0x19, 0x00, 0x2A, 0x9C, 0x02,
+    0x75, 0x10, 0x95, 0x01, 0x81, 0x00,
+    0xC0
+};
+
+static const uint8_t kbd3_vendor_report_desc[] = {
+    0x06, 0x00, 0xFF, 0x09, 0x01, 0xA1, 0x01,       // Vendor
+    0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08, 0x95, 0x08,
+    0x09, 0x01, 0x81, 0x02,
+    0xC0
+};
+
+static const uint8_t kbd_device_desc[] = {
+    18, USB_DESCRIPTOR_DEVICE, 0x10, 0x01, 0x00, 0x00, 0x00, 8,
+    0x34, 0x12, 0x01, 0x00, 0x00, 0x01, 0, 0, 0, 1
+};
+
+static const uint8_t kbd_config_desc[] = {
+    9, USB_DESCRIPTOR_CONFIGURATION, 34, 0, 1, 1, 0, 0xA0, 50,
+    9, USB_DESCRIPTOR_INTERFACE, 0, 0, 1, 3, 1, 1, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd_report_desc), 0,
+    7, USB_DESCRIPTOR_ENDPOINT, 0x81, 0x03, 8, 0, 10
+};
+
+// the same with the interrupt OUT endpoint for the LEDs
+static const uint8_t kbd_out_config_desc[] = {
+    9, USB_DESCRIPTOR_CONFIGURATION, 41, 0, 1, 1, 0, 0xA0, 50,
+    9, USB_DESCRIPTOR_INTERFACE, 0, 0, 2, 3, 1, 1, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd_report_desc), 0,
+    7, USB_DESCRIPTOR_ENDPOINT, 0x81, 0x03, 8, 0, 10,
+    7, USB_DESCRIPTOR_ENDPOINT, 0x02, 0x03, 8, 0, 10
+};
+
+// the same with alternate settings which are never selected
+static const uint8_t kbd_alt_config_desc[] = {
+    9, USB_DESCRIPTOR_CONFIGURATION, 140, 0, 1, 1, 0, 0xA0, 50,
+    9, USB_DESCRIPTOR_INTERFACE, 0, 0, 1, 3, 1, 1, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd_report_desc), 0,
+    7, USB_DESCRIPTOR_ENDPOINT, 0x81, 0x03, 8, 0, 10,
+    9, USB_DESCRIPTOR_INTERFACE, 0, 1, 5, 3, 1, 1, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd_report_desc), 0,
+    SIM_EP_INT_IN(0x82), SIM_EP_INT_IN(0x83), SIM_EP_INT_IN(0x84), SIM_EP_INT_IN(0x85), SIM_EP_INT_IN(0x86),
+    9, USB_DESCRIPTOR_INTERFACE, 0, 2, 5, 3, 1, 1, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd_report_desc), 0,
+    SIM_EP_INT_IN(0x87), SIM_EP_INT_IN(0x88), SIM_EP_INT_IN(0x89), SIM_EP_INT_IN(0x8A), SIM_EP_INT_IN(0x8B),
+};
+
+// the same with two more HID interfaces, which never send a report
+static const uint8_t kbd3_config_desc[] = {
+    9, USB_DESCRIPTOR_CONFIGURATION, 84, 0, 3, 1, 0, 0xA0, 50,
+    9, USB_DESCRIPTOR_INTERFACE, 0, 0, 1, 3, 1, 1, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd_report_desc), 0,
+    SIM_EP_INT_IN(0x81),
+    9, USB_DESCRIPTOR_INTERFACE, 1, 0, 1, 3, 0, 0, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd3_consumer_report_desc), 0,
+    SIM_EP_INT_IN(0x82),
+    9, USB_DESCRIPTOR_INTERFACE, 2, 0, 1, 3, 0, 0, 0,
+    9, 0x21, 0x11, 0x01, 0, 1, 0x22, sizeof(kbd3_vendor_report_desc), 0,
+    SIM_EP_INT_IN(0x83),
+};
+
+typedef struct {
+    uint64_t ready;     // key change
+    uint64_t seen;      // report seen by the client
+    uint32_t ready_frame;
+    uint32_t seen_frame;
+    uint8_t  usage;
+} SIM_REPORT;
+
+static struct {
+    SIM_DEVICE  dev;
+    uint8_t     report[8];
+    uint8_t     led;
+    uint32_t    leds_set;       // LED reports received
+    uint8_t     toggle;
+    bool        changed;        // report not read by the host yet
+    uint32_t    pending;        // report number of the change
+    SIM_REPORT  reports[SIM_MAX_REPORTS];
+    uint32_t    num_reports;    // changes made
+    uint32_t    sent;           // changes sent to the host
+} kbd;
+
+static bool kbd_request(SIM_DEVICE *d, const uint8_t *setup, const uint8_t **data, uint16_t *len)
+{
+    if (setup[0] == (USB_SETUP_DEVICE_TO_HOST | USB_SETUP_RECIPIENT_INTERFACE)
+     && setup[1] == USB_REQUEST_GET_DESCRIPTOR) {
+        if (setup[3] == 0x22) {
+            // wIndex is the interface
+            if (d->config_desc == kbd3_config_desc && setup[4] == 1) {
+                *data = kbd3_consumer_report_desc;
+                *len = sizeof(kbd3_consumer_report_desc);
+            } else if (d->config_desc == kbd3_config_desc && setup[4] == 2) {
+                *data = kbd3_vendor_report_desc;
+                *len = sizeof(kbd3_vendor_report_desc);
+            } else {
+                *data = kbd_report_desc;
+                *len = sizeof(kbd_report_desc);
+            }
+            return true;
+        }
+        if (setup[3] == 0x21) {
+            *data = &d->config_desc[18];
+            *len = 9;
+            return true;
+        }
+        return false;
+    }
+    if ((setup[0] & SIM_SETUP_TYPE_MASK) != USB_SETUP_TYPE_CLASS) {
+        return false;
+    }
+    switch (setup[1]) {
+    case 0x01:  // GET_REPORT
+        *data = kbd.report;
+        *len = sizeof(kbd.report);
+        return true;
+    case 0x09:  // SET_REPORT (LEDs)
+    case 0x0A:  // SET_IDLE
+    case 0x0B:  // SET_PROTOCOL
+        return true;
+    default:
+        return false;
+    }
+}
+
+static uint8_t kbd_endpoint_in(SIM_DEVICE *d, uint8_t ep, uint8_t *data, uint16_t *len)
+{
+    uint8_t pid;
+
+    if (d->config_desc == kbd3_config_desc && (ep == 2 || ep == 3) && d->configuration) {
+        return PID_NAK;
+    }
+    if (ep != 1 || !d->configuration) {
+        return PID_STALL;
+    }
+    if (!kbd.changed) {
+        return PID_NAK;
+    }
+    *len = (*len < sizeof(kbd.report)) ? *len : sizeof(kbd.report);
+    memcpy(data, kbd.report, *len);
+    kbd.changed = false;
+    kbd.sent = kbd.pending + 1;
+    pid = kbd.toggle ? PID_DATA1 : PID_DATA0;
+    kbd.toggle ^= 1;
+    return pid;
+}
+
+static uint8_t kbd_endpoint_out(SIM_DEVICE *d, uint8_t ep, const uint8_t *data, uint16_t len)
+{
+    if (ep != 2 || !d->configuration || len != 1) {
+        return PID_STALL;
+    }
+    kbd.led = data[0];
+    kbd.leds_set++;
+    return PID_ACK;
+}
+
+static void kbd_reset(SIM_DEVICE *d)
+{
+    kbd.toggle = 0;
+}
+
+/// change the keys, a later change overwrites one not read yet
+static void kbd_change(uint8_t usage)
+{
+    SIM_REPORT *r;
+
+    if (kbd.num_reports >= SIM_MAX_REPORTS) {
+        return;
+    }
+    memset(kbd.report, 0, sizeof(kbd.report));
+    kbd.report[2] = usage;
+    r = &kbd.reports[kbd.num_reports];
+    r->ready = USBSIM_Now();
+    r->ready_frame = usb_sim_stat.frames;
+    r->usage = usage;
+    kbd.pending = kbd.num_reports++;
+    kbd.changed = true;
+}
+
+static void kbd_init(bool low_speed, uint32_t nak_percent, const uint8_t *config_desc, uint16_t config_len)
+{
+    memset(&kbd, 0, sizeof(kbd));
+    sim_device_init(&kbd.dev, "keyboard", low_speed);
+    kbd.dev.max_packet0 = 8;
+    kbd.dev.device_desc = kbd_device_desc;
+    kbd.dev.config_desc = kbd_config_desc;
+    kbd.dev.config_len = sizeof(kbd_config_desc);
+    kbd.dev.request = kbd_request;
+    kbd.dev.endpoint_in = kbd_endpoint_in;
+    kbd.dev.reset = kbd_reset;
+    kbd.dev.nak_percent = nak_percent;
+    if (nak_percent) {
+        kbd.dev.config_desc = kbd_out_config_desc;
+        kbd.dev.config_len = sizeof(kbd_out_config_desc);
+        kbd.dev.endpoint_out = kbd_endpoint_out;
+    }
+    if (config_desc) {
+        kbd.dev.config_desc = config_desc;
+        kbd.dev.config_len = config_len;
+    }
+}
+
+// ---- hub ----
+
+static const uint8_t hub_device_desc[] = {
+    18, USB_DESCRIPTOR_DEVICE, 0x10, 0x01, 0x09, 0x00, 0x00, 64,
+    0x34, 0x12, 0x02, 0x00, 0x00, 0x01, 0, 0, 0, 1
+};
+
+static const uint8_t hub_config_desc[] = {
+    9, USB_DESCRIPTOR_CONFIGURATION, 25, 0, 1, 1, 0, 0xE0, 50,
+    9, USB_DESCRIPTOR_INTERFACE, 0, 0, 1, 9, 0, 0, 0,
+    7, USB_DESCRIPTOR_ENDPOINT, 0x81, 0x03, 1, 0, 12
+};
+
+static const uint8_t hub_desc[] = {
+    9, 0x29, SIM_HUB_PORTS, 0x09, 0x00, 50, 100, 0x00, 0xFF
+};
+
+typedef struct {
+    uint16_t        status;
+    uint16_t        change;
+    uint64_t        reset_done;
+    SIM_DEVICE     *child;
+    bool            plugged;
+} SIM_HUB_PORT;
+
+static struct {
+    SIM_DEVICE      dev;
+    SIM_HUB_PORT    port[SIM_HUB_PORTS + 1];
+    uint8_t         toggle;
+    uint8_t         buffer[4];
+} hub;
+
+// port status bits (USB 2.0 11.24.2.7)
+#define HUB_PS_CONNECTION   0x0001
+#define HUB_PS_ENABLE       0x0002
+#define HUB_PS_RESET        0x0010
+#define HUB_PS_POWER        0x0100
+#define HUB_PS_LOW_SPEED    0x0200
+
+static void hub_port_connect(SIM_HUB_PORT *p)
+{
+    if (p->plugged && (p->status & HUB_PS_POWER) && !(p->status & HUB_PS_CONNECTION)) {
+        p->status |= HUB_PS_CONNECTION;
+        if (p->child->usb.low_speed) {
+            p->status |= HUB_PS_LOW_SPEED;
+        }
+        p->change |= HUB_PS_CONNECTION;
+    }
+}
+
+static void hub_port_disconnect(SIM_HUB_PORT *p)
+{
+    if (p->status & HUB_PS_CONNECTION) {
+        p->change |= HUB_PS_CONNECTION;
+    }
+    p->status &= ~(HUB_PS_CONNECTION | HUB_PS_ENABLE | HUB_PS_RESET | HUB_PS_LOW_SPEED);
+    if (p->child) {
+        USBSIM_Disconnect(&p->child->usb);
+    }
+}
+
+/// end of the port reset
+static void hub_update(void)
+{
+    int i;
+    SIM_HUB_PORT *p;
+
+    for (i = 1; i <= SIM_HUB_PORTS; i++) {
+        p = &hub.port[i];
+        if ((p->status & HUB_PS_RESET) && USBSIM_Now() >= p->reset_done) {
+            p->status &= ~HUB_PS_RESET;
+            p->change |= HUB_PS_RESET;
+            if (p->status & HUB_PS_CONNECTION) {
+                p->status |= HUB_PS_ENABLE;
+                sim_device_reset(&p->child->usb);
+                USBSIM_Connect(&p->child->usb, &hub.dev.usb);
+            }
+        }
+    }
+}
+
+static bool hub_request(SIM_DEVICE *d, const uint8_t *setup, const uint8_t **data, uint16_t *len)
+{
+    uint16_t feature = setup[2] | (setup[3] << 8);
+    uint8_t index = setup[4];
+    SIM_HUB_PORT *p;
+
+    hub_update();
+    if ((setup[0] & SIM_SETUP_TYPE_MASK) != USB_SETUP_TYPE_CLASS) {
+        return false;
+    }
+    if ((setup[0] & 0x1F) == USB_SETUP_RECIPIENT_DEVICE) {
+        switch (setup[1]) {
+        case USB_REQUEST_GET_DESCRIPTOR:
+            *data = hub_desc;
+            *len = sizeof(hub_desc);
+            return true;
+        case USB_REQUEST_GET_STATUS:
+            memset(hub.buffer, 0, sizeof(hub.buffer));
+            *data = hub.buffer;
+            *len = 4;
+            return true;
+        case USB_REQUEST_CLEAR_FEATURE:
+        case USB_REQUEST_SET_FEATURE:
+            return true;
+        default:
+            return false;
+        }
+    }
+    if (index < 1 || index > SIM_HUB_PORTS) {
+        return false;
+    }
+    p = &hub.port[index];
+    switch (setup[1]) {
+    case USB_REQUEST_GET_STATUS:
+        hub.buffer[0] = p->status & 0xFF;
+        hub.buffer[1] = p->status >> 8;
+        hub.buffer[2] = p->change & 0xFF;
+        hub.buffer[3] = p->change >> 8;
+        *data = hub.buffer;
+        *len = 4;
+        return true;
+    case USB_REQUEST_SET_FEATURE:
+        switch (feature) {
+        case 4:     // PORT_RESET
+            if (p->status & HUB_PS_CONNECTION) {
+                if (p->child) {
+                    USBSIM_Disconnect(&p->child->usb);
+                }
+                p->status |= HUB_PS_RESET;
+                p->status &= ~HUB_PS_ENABLE;
+                p->reset_done = USBSIM_Now() + SIM_PORT_RESET_MS * SIM_CYCLES_PER_MS;
+            }
+            return true;
+        case 8:     // PORT_POWER
+            p->status |= HUB_PS_POWER;
+            hub_port_connect(p);
+            return true;
+        default:
+            return true;
+        }
+    case USB_REQUEST_CLEAR_FEATURE:
+        switch (feature) {
+        case 1:     // PORT_ENABLE
+            p->status &= ~HUB_PS_ENABLE;
+            if (p->child) {
+                USBSIM_Disconnect(&p->child->usb);
+            }
+            return true;
+        case 8:     // PORT_POWER
+            hub_port_disconnect(p);
+            p->status &= ~HUB_PS_POWER;
+            return true;
+        case 16:    // C_PORT_CONNECTION
+        case 17:    // C_PORT_ENABLE
+        case 18:    // C_PORT_SUSPEND
+        case 19:    // C_PORT_OVER_CURRENT
+        case 20:    // C_PORT_RESET
+            p->change &= ~(1 << (feature - 16));
+            return true;
+        default:
+            return true;
+        }
+    default:
+        return false;
+    }
+}
+
+/// status change endpoint
+static uint8_t hub_endpoint_in(SIM_DEVICE *d, uint8_t ep, uint8_t *data, uint16_t *len)
+{
+    uint8_t bitmap = 0;
+    uint8_t pid;
+    int i;
+
+    if (ep != 1 || !d->configuration) {
+        return PID_STALL;
+    }
+    hub_update();
+    for (i = 1; i <= SIM_HUB_PORTS; i++) {
+        if (hub.port[i].change) {
+            bitmap |= (1 << i);
+        }
+    }
+    if (!bitmap || *len < 1) {
+        return PID_NAK;
+    }
+    data[0] = bitmap;
+    *len = 1;
+    pid = hub.toggle ? PID_DATA1 : PID_DATA0;
+    hub.toggle ^= 1;
+    return pid;
+}
+
+/// bus reset or power off, the ports are off
+static void hub_reset(SIM_DEVICE *d)
+{
+    int i;
+
+    hub.toggle = 0;
+    for (i = 1; i <= SIM_HUB_PORTS; i++) {
+        hub_port_disconnect(&hub.port[i]);
+        hub.port[i].status = 0;
+        hub.port[i].change = 0;
+    }
+}
+
+static void hub_init(void)
+{
+    memset(&hub, 0, sizeof(hub));
+    sim_device_init(&hub.dev, "hub", false);
+    hub.dev.max_packet0 = 64;
+    hub.dev.device_desc = hub_device_desc;
+    hub.dev.config_desc = hub_config_desc;
+    hub.dev.config_len = sizeof(hub_config_desc);
+    hub.dev.request = hub_request;
+    hub.dev.endpoint_in = hub_endpoint_in;
+    hub.dev.reset = hub_reset;
+    hub.port[1].child = &kbd.dev;
+}
+
+static void hub_plug(bool plugged)
+{
+    SIM_HUB_PORT *p = &hub.port[1];
+
+    hub_update();
+    p->plugged = plugged;
+    if (plugged) {
+        hub_port_connect(p);
+    } else {
+        hub_port_disconnect(p);
+    }
+}
+
+// ---- HID client (same as app_host_hid_keyboard.c) ----
+
+static struct {
+    uint8_t         address;
+    uint8_t         interface;
+    USB_HID_HANDLE  keys;
+    USB_HID_HANDLE  leds;
+    uint8_t         buffer[8];
+    uint8_t         led;
+    bool            led_pending;
+    uint32_t        led_writes;     // LED reports written
+    uint32_t        reports;        // reports seen
+    uint32_t        errors;
+    uint64_t        first;          // first report seen
+    bool            idle;           // waiting for the tick to read
+    uint64_t        next_tick;
+} client;
+
+static void sim_report_done(USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount);
+static void sim_cycle_detected(void);
+
+static void sim_client_request(void)
+{
+    USBHostHIDTransfer(client.keys, 0, sizeof(client.buffer), client.buffer);
+}
+
+/// the LEDs are written on the interrupt OUT endpoint only, not to change
+/// the control transfers of the other devices
+static void sim_client_write_led(void)
+{
+    if (!client.leds || client.led_pending || USBHostHIDTransferUsesControl(client.leds)) {
+        return;
+    }
+    client.led = (client.led + 2) & 0x0e;
+    if (USBHostHIDTransfer(client.leds, 0, 1, &client.led) == USB_SUCCESS) {
+        client.led_pending = true;
+    }
+}
+
+static void sim_led_done(USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount)
+{
+    client.led_pending = false;
+    if (errorCode) {
+        client.errors++;
+    } else {
+        client.led_writes++;
+    }
+}
+
+static void sim_report_done(USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount)
+{
+    SIM_REPORT *r;
+    uint32_t i;
+
+    if (errorCode) {
+        client.errors++;
+    } else if (byteCount != 0) {
+        if (!client.reports) {
+            client.first = USBSIM_Now();
+        }
+        client.reports++;
+        // a change overwritten before the host read it is seen with the last one
+        for (i = 0; i < kbd.sent; i++) {
+            r = &kbd.reports[i];
+            if (!r->seen) {
+                r->seen = USBSIM_Now();
+                r->seen_frame = usb_sim_stat.frames;
+            }
+        }
+        if (prm.verbose) {
+            printf("%10.3fms report %02x\n", sim_ms(USBSIM_Now()), data[2]);
+        }
+        sim_client_write_led();
+    }
+    if (prm.by_tick) {
+        client.idle = true;
+    } else {
+        sim_client_request();
+    }
+}
+
+/// the tick of timer_1ms.c starts the next read, as APP_HostHIDTimerHandler()
+static void sim_client_tick(void)
+{
+    bool tick = false;
+
+    while (USBSIM_Now() >= client.next_tick) {
+        client.next_tick += (uint64_t)SIM_TICK_MS * SIM_CYCLES_PER_MS;
+        tick = true;
+    }
+    if (tick && client.idle) {
+        client.idle = false;
+        sim_client_request();
+    }
+}
+
+static void sim_client_tasks(void)
+{
+    if (client.address == 0) {
+        client.address = USBHostHIDDeviceDetect();
+        if (client.address != 0) {
+            sim_cycle_detected();
+            client.keys = USBHostHIDOpen(false, client.address, client.interface);
+            client.leds = USBHostHIDOpen(true, client.address, client.interface);
+            USBHostHIDSetCallback(client.keys, &sim_report_done);
+            USBHostHIDSetCallback(client.leds, &sim_led_done);
+            client.led_pending = false;
+            if (prm.by_tick) {
+                client.idle = true;
+                client.next_tick = USBSIM_Now() + (uint64_t)SIM_TICK_MS * SIM_CYCLES_PER_MS;
+            } else {
+                sim_client_request();
+            }
+        }
+    } else if (USBHostHIDDeviceStatus(client.address) == USB_HID_DEVICE_NOT_FOUND) {
+        client.address = 0;
+        client.keys = NULL;
+        client.leds = NULL;
+    } else if (prm.by_tick) {
+        sim_client_tick();
+    }
+}
+
+/// the parsed report descriptor has an input of the keyboard page
+static bool sim_report_has_keys(void)
+{
+    USB_HID_DEVICE_RPT_INFO *info = USBHostHID_GetCurrentReportInfo();
+    USB_HID_ITEM_LIST *items = USBHostHID_GetItemListPointers();
+    uint8_t i;
+
+    for (i = 0; i < info->reportItems; i++) {
+        if (items->reportItemList[i].reportType == hidReportInput
+         && items->reportItemList[i].globals.usagePage == USB_HID_USAGE_PAGE_KEYBOARD_KEYPAD) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool USB_ApplicationEventHandler(uint8_t address, USB_EVENT event, void *data, uint32_t size)
+{
+    switch ((int)event) {
+    case EVENT_VBUS_REQUEST_POWER:
+    case EVENT_VBUS_RELEASE_POWER:
+    case EVENT_UNSUPPORTED_DEVICE:
+    case EVENT_CANNOT_ENUMERATE:
+    case EVENT_CLIENT_INIT_ERROR:
+    case EVENT_OUT_OF_MEMORY:
+    case EVENT_UNSPECIFIED_ERROR:
+    case EVENT_HUB_ATTACH:
+        return true;
+    case EVENT_HID_RPT_DESC_PARSED:
+        // the interface with the keys, as APP_HostHIDKeyboardReportParser() finds it
+        if (sim_report_has_keys()) {
+            client.interface = USBHostHID_ApiGetCurrentInterfaceNum();
+            return true;
+        }
+        break;
+    default:
+        break;
+    }
+    return false;
+}
+
+// ---- pool soak ----
+
+#ifdef USB_STATIC_POOL
+#define SIM_MAX_POOLS       4
+
+static uint8_t pool_idle[SIM_MAX_POOLS];    // used blocks after the first unplug
+static uint32_t pool_checks;
+static uint32_t pool_leaks;                 // cycles not returning the blocks
+
+/// compare the blocks used after the unplug with the first cycle
+static void sim_pool_check(void)
+{
+    USB_POOL_USAGE usage;
+    bool leaked = false;
+    uint8_t i;
+
+    for (i = 0; i < SIM_MAX_POOLS && USBPool_GetUsage(i, &usage); i++) {
+        if (pool_checks == 0) {
+            pool_idle[i] = usage.used;
+        } else if (usage.used != pool_idle[i]) {
+            leaked = true;
+            if (prm.verbose) {
+                printf("%10.3fms pool %u: %u blocks used, %u after the first cycle\n",
+                       sim_ms(USBSIM_Now()), usage.size, usage.used, pool_idle[i]);
+            }
+        }
+    }
+    if (leaked) {
+        pool_leaks++;
+    }
+    pool_checks++;
+}
+
+/// bytes of the blocks used in the pools
+static uint32_t sim_pool_bytes(void)
+{
+    USB_POOL_USAGE usage;
+    uint32_t bytes = 0;
+    uint8_t i;
+
+    for (i = 0; USBPool_GetUsage(i, &usage); i++) {
+        bytes += (uint32_t)usage.size * usage.used;
+    }
+    return bytes;
+}
+
+static void sim_print_pool(void)
+{
+    USB_POOL_USAGE usage;
+    uint8_t i;
+
+    printf("pool: total %u bytes ", (unsigned)USB_POOL_TOTAL_SIZE);
+    for (i = 0; USBPool_GetUsage(i, &usage); i++) {
+        if (usage.count == 0) {
+            printf(" [heap: used %u peak %u]", usage.used, usage.peak);
+        } else {
+            printf(" [%u x %u: used %u peak %u]", usage.size, usage.count, usage.used, usage.peak);
+        }
+    }
+    printf("  leaks: %u of %u cycles\n", pool_leaks, pool_checks);
+}
+#else
+static uint32_t sim_pool_bytes(void)
+{
+    return 0;
+}
+#endif
+
+// ---- scenario ----
+
+enum {
+    CMD_ATTACH,
+    CMD_DETACH,
+    CMD_PLUG,
+    CMD_UNPLUG,
+    CMD_KEY,
+    CMD_UP,
+};
+
+typedef struct {
+    uint32_t ms;
+    uint8_t  cmd;
+    uint8_t  usage;
+} SIM_EVENT;
+
+static SIM_EVENT events[SIM_MAX_EVENTS];
+static uint32_t num_events;
+
+static bool sim_load_script(const char *path)
+{
+    static const char *names[] = { "attach", "detach", "plug", "unplug", "key", "up" };
+    FILE *fp;
+    char line[128];
+    char name[16];
+    unsigned ms;
+    unsigned usage;
+    int n;
+    uint8_t cmd;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return false;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        usage = 0;
+        n = sscanf(line, "%u %15s %x", &ms, name, &usage);
+        for (cmd = 0; n >= 2 && cmd < sizeof(names) / sizeof(names[0]); cmd++) {
+            if (strcmp(name, names[cmd]) == 0) {
+                break;
+            }
+        }
+        if (n < 2 || cmd >= sizeof(names) / sizeof(names[0]) || num_events >= SIM_MAX_EVENTS
+         || (num_events > 0 && ms < events[num_events - 1].ms)) {
+            fprintf(stderr, "%s: bad line: %s", path, line);
+            fclose(fp);
+            return false;
+        }
+        events[num_events].ms = ms;
+        events[num_events].cmd = cmd;
+        events[num_events].usage = (uint8_t)usage;
+        num_events++;
+    }
+    fclose(fp);
+    return true;
+}
+
+// ---- run ----
+
+typedef struct {
+    uint64_t plugged;           // attach or plug
+    uint32_t first_report;      // first change of the cycle
+    uint32_t reports;           // changes in the cycle
+    uint32_t in_tokens;
+    uint32_t in_naks;
+    uint64_t detected;          // the client found the device
+    uint64_t enum_ns;           // host time in USBHostTasks() until then
+    uint32_t enum_max_ns;       // longest pass of USBHostTasks() until then
+    uint32_t enum_bytes;        // bytes of the blocks taken from the pools until then
+} SIM_CYCLE;
+
+static SIM_CYCLE cycles[SIM_MAX_CYCLES];
+static uint32_t num_cycles;
+
+/// called from usb_enum_cache.c, the S1 is not scanning
+bool INTR_ScanGapFits(uint32_t time)
+{
+    return true;
+}
+
+static void sim_loop(void)
+{
+    struct timespec t0;
+    struct timespec t1;
+    uint32_t ns;
+    uint32_t stall;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    USBHostTasks();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    // the enumeration is counted until the client finds the device
+    if (num_cycles > 0 && !cycles[num_cycles - 1].detected) {
+        ns = (uint32_t)((t1.tv_sec - t0.tv_sec) * 1000000000 + (t1.tv_nsec - t0.tv_nsec));
+        cycles[num_cycles - 1].enum_ns += ns;
+        if (cycles[num_cycles - 1].enum_max_ns < ns) {
+            cycles[num_cycles - 1].enum_max_ns = ns;
+        }
+    }
+    USBHostHUBTasks();
+    USBHostHIDTasks();
+    sim_client_tasks();
+    // the CPU stalled while the flash was written (the SIE goes on)
+    stall = hal_sim.stall;
+    hal_sim.stall = 0;
+    USBSIM_Run(prm.loop_cycles + stall);
+}
+
+static void sim_run_until(uint64_t time)
+{
+    while (USBSIM_Now() < time) {
+        sim_loop();
+    }
+}
+
+static void sim_cycle_start(void)
+{
+    if (num_cycles >= SIM_MAX_CYCLES) {
+        return;
+    }
+    cycles[num_cycles].plugged = USBSIM_Now();
+    cycles[num_cycles].first_report = kbd.num_reports;
+    cycles[num_cycles].in_tokens = kbd.dev.in_tokens;
+    cycles[num_cycles].in_naks = kbd.dev.in_naks;
+    cycles[num_cycles].detected = 0;
+    cycles[num_cycles].enum_ns = 0;
+    cycles[num_cycles].enum_max_ns = 0;
+    cycles[num_cycles].enum_bytes = sim_pool_bytes();
+    num_cycles++;
+}
+
+static void sim_cycle_detected(void)
+{
+    SIM_CYCLE *c;
+
+    if (num_cycles == 0) {
+        return;
+    }
+    c = &cycles[num_cycles - 1];
+    if (!c->detected) {
+        c->detected = USBSIM_Now();
+        c->enum_bytes = sim_pool_bytes() - c->enum_bytes;
+    }
+}
+
+static void sim_cycle_end(void)
+{
+    SIM_CYCLE *c;
+
+    if (num_cycles == 0) {
+        return;
+    }
+    c = &cycles[num_cycles - 1];
+    c->reports = kbd.num_reports - c->first_report;
+    c->in_tokens = kbd.dev.in_tokens - c->in_tokens;
+    c->in_naks = kbd.dev.in_naks - c->in_naks;
+}
+
+static void sim_event(const SIM_EVENT *e)
+{
+    bool on_hub = prm.on_hub;
+
+    switch (e->cmd) {
+    case CMD_ATTACH:
+        USBSIM_Attach(on_hub ? &hub.dev.usb : &kbd.dev.usb);
+        if (!on_hub) {
+            sim_cycle_start();
+        }
+        break;
+    case CMD_DETACH:
+        if (!on_hub) {
+            sim_cycle_end();
+        }
+        USBSIM_Detach();
+        break;
+    case CMD_PLUG:
+        hub_plug(true);
+        sim_cycle_start();
+        break;
+    case CMD_UNPLUG:
+        sim_cycle_end();
+        hub_plug(false);
+        break;
+    case CMD_KEY:
+        kbd_change(e->usage);
+        break;
+    case CMD_UP:
+        kbd_change(0);
+        break;
+    }
+}
+
+static void sim_run_script(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < num_events; i++) {
+        sim_run_until((uint64_t)events[i].ms * SIM_CYCLES_PER_MS);
+        sim_event(&events[i]);
+    }
+    sim_run_until(USBSIM_Now() + (uint64_t)prm.timeout * SIM_CYCLES_PER_MS);
+    sim_cycle_end();
+}
+
+/// wait until the client sees the last change
+static bool sim_wait_report(void)
+{
+    uint64_t limit = USBSIM_Now() + (uint64_t)prm.timeout * SIM_CYCLES_PER_MS;
+
+    while (USBSIM_Now() < limit) {
+        if (kbd.num_reports > 0 && kbd.reports[kbd.num_reports - 1].seen) {
+            return true;
+        }
+        sim_loop();
+    }
+    return false;
+}
+
+static void sim_run_cycles(void)
+{
+    bool on_hub = prm.on_hub;
+    SIM_EVENT e;
+    uint32_t c;
+    uint32_t r;
+
+    memset(&e, 0, sizeof(e));
+    if (on_hub) {
+        e.cmd = CMD_ATTACH;
+        sim_event(&e);
+    }
+    for (c = 0; c < prm.cycles; c++) {
+        // the first change is made at the attach
+        e.cmd = on_hub ? CMD_PLUG : CMD_ATTACH;
+        sim_event(&e);
+        for (r = 0; r < prm.reports; r++) {
+            e.cmd = (r & 1) ? CMD_UP : CMD_KEY;
+            e.usage = 0x04 + (r / 2) % 26;
+            sim_event(&e);
+            if (!sim_wait_report()) {
+                break;
+            }
+            // vary the phase to the polling interval
+            sim_run_until(USBSIM_Now() + (uint64_t)prm.report_gap * SIM_CYCLES_PER_MS
+                + sim_rand() % (SIM_JITTER_MS * SIM_CYCLES_PER_MS));
+        }
+        e.cmd = on_hub ? CMD_UNPLUG : CMD_DETACH;
+        sim_event(&e);
+        sim_run_until(USBSIM_Now() + (uint64_t)prm.unplug_wait * SIM_CYCLES_PER_MS);
+#ifdef USB_STATIC_POOL
+        sim_pool_check();
+#endif
+    }
+}
+
+// ---- result ----
+
+#ifdef ISR_STAT_ENABLE
+static void sim_print_hist(const char *name, const ISR_STAT_HIST *hist)
+{
+    if (hist->count == 0) {
+        return;
+    }
+    printf("%s (ns): n %u  p50 %u  p99 %u  p99.9 %u  max %u\n", name, hist->count,
+           ISR_STAT_Percentile(hist, 500), ISR_STAT_Percentile(hist, 990),
+           ISR_STAT_Percentile(hist, 999), hist->max);
+}
+#endif
+
+/// false if the model found an error, a change was not seen, blocks leaked,
+/// a NAK'd OUT was tried again in the frame, or a word of the flash was
+/// programmed twice
+static bool sim_check_result(bool all_seen)
+{
+    uint32_t i;
+
+    if (usb_sim_stat.overruns || usb_sim_stat.bd_errors || usb_sim_stat.speed_errors || usb_sim_stat.isr_stuck) {
+        return false;
+    }
+    if (hal_sim.nvm_errors || kbd.dev.out_retries) {
+        return false;
+    }
+#ifdef USB_STATIC_POOL
+    if (pool_leaks) {
+        return false;
+    }
+#endif
+    for (i = 0; all_seen && i < kbd.num_reports; i++) {
+        if (!kbd.reports[i].seen) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int sim_compare_latency(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/// distribution of the latency over all cycles, the first change of a cycle
+/// waits for the enumeration and is left out
+static void sim_print_latency(void)
+{
+    static uint64_t latency[SIM_MAX_REPORTS];
+    SIM_CYCLE *c;
+    SIM_REPORT *r;
+    uint32_t n = 0;
+    uint32_t i;
+    uint32_t j;
+
+    for (i = 0; i < num_cycles; i++) {
+        c = &cycles[i];
+        for (j = c->first_report + 1; j < c->first_report + c->reports; j++) {
+            r = &kbd.reports[j];
+            if (r->seen) {
+                latency[n++] = r->seen - r->ready;
+            }
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+    qsort(latency, n, sizeof(latency[0]), sim_compare_latency);
+    printf("latency (ms, read %s): n %u  min %.2f  p50 %.2f  p90 %.2f  p99 %.2f  max %.2f\n",
+           prm.by_tick ? "on the 10ms tick" : "continuously", n,
+           sim_ms(latency[0]), sim_ms(latency[n / 2]), sim_ms(latency[n * 9 / 10]),
+           sim_ms(latency[n * 99 / 100]), sim_ms(latency[n - 1]));
+}
+
+/// time to the client, host time of the enumeration in USBHostTasks() (the
+/// longest pass is the one parsing the configuration descriptor), and the
+/// blocks of the pools held by the device
+static void sim_print_enumeration(void)
+{
+    SIM_CYCLE *c;
+    uint32_t i;
+    uint32_t n = 0;
+    uint64_t time = 0;
+    uint64_t ns = 0;
+    uint32_t max_ns = UINT32_MAX;
+    uint32_t bytes = 0;
+
+    for (i = 0; i < num_cycles; i++) {
+        c = &cycles[i];
+        if (!c->detected) {
+            continue;
+        }
+        n++;
+        time += c->detected - c->plugged;
+        ns += c->enum_ns;
+        // the least of the cycles, a pass preempted by the host is longer
+        if (max_ns > c->enum_max_ns) max_ns = c->enum_max_ns;
+        if (bytes < c->enum_bytes) bytes = c->enum_bytes;
+    }
+    if (n == 0) {
+        return;
+    }
+    printf("enumeration: n %u  to the client %.1fms  host time in USBHostTasks %.1fus  longest pass %.2fus",
+           n, sim_ms(time) / n, (double)ns / n / 1000, (double)max_ns / 1000);
+#ifdef USB_STATIC_POOL
+    printf("  pool bytes taken %u", bytes);
+#endif
+    printf("\n");
+}
+
+static void sim_print_result(void)
+{
+    static const char *pids[16] = {
+        "timeout", "OUT", "ACK", "DATA0", "", "", "", "", "",
+        "IN", "NAK", "DATA1", "", "SETUP", "STALL", "DATAERR"
+    };
+    SIM_CYCLE *c;
+    SIM_REPORT *r;
+    uint32_t i;
+    uint32_t j;
+    uint32_t seen;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t frames;
+    double isr_per_frame;
+
+    for (i = 0; i < num_cycles; i++) {
+        c = &cycles[i];
+        seen = 0;
+        sum = 0;
+        max = 0;
+        frames = 0;
+        for (j = c->first_report; j < c->first_report + c->reports; j++) {
+            r = &kbd.reports[j];
+            if (!r->seen) {
+                continue;
+            }
+            if (seen > 0 || j > c->first_report) {
+                sum += r->seen - r->ready;
+                if (r->seen - r->ready > max) max = r->seen - r->ready;
+                frames += r->seen_frame - r->ready_frame;
+            }
+            seen++;
+        }
+        printf("cycle %u: ", i + 1);
+        r = &kbd.reports[c->first_report];
+        if (c->reports > 0 && r->seen) {
+            printf("first report %.1fms after the attach\n", sim_ms(r->seen - c->plugged));
+        } else {
+            printf("no report seen\n");
+        }
+        printf("  changes: %u  seen: %u", c->reports, seen);
+        if (seen > 1) {
+            printf("  latency (ms): avg %.2f  max %.2f  frames per report: %.2f",
+                   sim_ms(sum) / (seen - 1), sim_ms(max), (double)frames / (seen - 1));
+        }
+        printf("\n");
+        if (seen > 0) {
+            printf("  EP1 IN tokens per report: %.1f  NAKs per report: %.1f\n",
+                   (double)c->in_tokens / seen, (double)c->in_naks / seen);
+        }
+    }
+
+    sim_print_latency();
+    sim_print_enumeration();
+    printf("bus: %.1fms  frames: %u  used: %.1f%%  deferred by U1SOF: %u\n",
+           sim_ms(USBSIM_Now()), usb_sim_stat.frames,
+           usb_sim_stat.frames ? (double)usb_sim_stat.bit_times * 100 / ((double)usb_sim_stat.frames * 12000) : 0.0,
+           usb_sim_stat.deferred);
+    printf("tokens: SETUP %u  OUT %u  IN %u  results:",
+           usb_sim_stat.tokens[PID_SETUP], usb_sim_stat.tokens[PID_OUT], usb_sim_stat.tokens[PID_IN]);
+    for (i = 0; i < 16; i++) {
+        if (usb_sim_stat.results[i]) {
+            printf(" %s %u", pids[i], usb_sim_stat.results[i]);
+        }
+    }
+    printf("\n");
+    isr_per_frame = usb_sim_stat.frames ? (double)usb_sim_stat.isr_calls / usb_sim_stat.frames : 0.0;
+    printf("isr: calls %u  per frame %.2f  host time per call %.0fns  per frame %.0fns\n",
+           usb_sim_stat.isr_calls, isr_per_frame,
+           usb_sim_stat.isr_calls ? (double)usb_sim_stat.isr_ns / usb_sim_stat.isr_calls : 0.0,
+           usb_sim_stat.frames ? (double)usb_sim_stat.isr_ns / usb_sim_stat.frames : 0.0);
+#ifdef ISR_STAT_ENABLE
+    sim_print_hist("isr time per call", &isr_stat_usb);
+    sim_print_hist("isr time per ms", &isr_stat_usb_ms);
+#endif
+#ifdef USB_STATIC_POOL
+    sim_print_pool();
+#endif
+    printf("client: reports %u  errors %u\n", client.reports, client.errors);
+    if (kbd.dev.endpoint_out) {
+        printf("LEDs: written %u  set %u  EP2 OUT tokens %u  NAKs %u  tried again in the frame %u\n",
+               client.led_writes, kbd.leds_set, kbd.dev.out_tokens, kbd.dev.out_naks, kbd.dev.out_retries);
+    }
+    if (usb_sim_stat.overruns || usb_sim_stat.bd_errors || usb_sim_stat.speed_errors || usb_sim_stat.isr_stuck) {
+        printf("model errors: overruns %u  BD not owned %u  speed %u  ISR stuck %u\n",
+               usb_sim_stat.overruns, usb_sim_stat.bd_errors, usb_sim_stat.speed_errors, usb_sim_stat.isr_stuck);
+    }
+}
+
+static void sim_usage(void)
+{
+    fprintf(stderr,
+        "usage: usb_host_sim [options] [script]\n"
+        "  -d s  device: keyboard, hub, nak, alt or kbd3 (%s)\n"
+        "  -m n  main loop pass in core timer cycles (%u)\n"
+        "  -n n  key changes in a plug cycle (%u)\n"
+        "  -g n  ms between key changes, plus 0 to 16ms (%u)\n"
+        "  -c n  plug cycles (%u)\n"
+        "  -w n  ms between unplug and plug (%u)\n"
+        "  -t n  ms to wait for a report (%u)\n"
+        "  -p n  NAK rate of the nak device in %% (%u)\n"
+        "  -r s  read of the input report: cont or tick (10ms tick, the old way)\n"
+        "  -s n  random seed\n"
+        "  -u    plug the device into port 1 of the hub (-d hub is the keyboard there)\n"
+        "  -v    print reports seen by the client\n",
+        prm.device, prm.loop_cycles, prm.reports, prm.report_gap, prm.cycles,
+        prm.unplug_wait, prm.timeout, prm.nak_percent);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:m:n:g:c:w:t:p:r:s:uvh")) != -1) {
+        switch (opt) {
+        case 'd': prm.device = optarg; break;
+        case 'm': prm.loop_cycles = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'n': prm.reports = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'g': prm.report_gap = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'c': prm.cycles = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'w': prm.unplug_wait = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 't': prm.timeout = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'p': prm.nak_percent = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'r': prm.by_tick = (strcmp(optarg, "tick") == 0); break;
+        case 's': sim_seed = (uint32_t)strtoul(optarg, NULL, 0) | 1; break;
+        case 'u': prm.on_hub = true; break;
+        case 'v': prm.verbose = true; break;
+        default: sim_usage(); return 2;
+        }
+    }
+    if (strcmp(prm.device, "keyboard") != 0 && strcmp(prm.device, "hub") != 0
+     && strcmp(prm.device, "nak") != 0 && strcmp(prm.device, "alt") != 0
+     && strcmp(prm.device, "kbd3") != 0) {
+        sim_usage();
+        return 2;
+    }
+    if (strcmp(prm.device, "hub") == 0) {
+        prm.on_hub = true;
+    }
+    if (prm.loop_cycles == 0 || prm.cycles > SIM_MAX_CYCLES) {
+        fprintf(stderr, "usb_host_sim: bad main loop pass or too many cycles\n");
+        return 2;
+    }
+    if (optind < argc && !sim_load_script(argv[optind])) {
+        return 1;
+    }
+
+    USBSIM_Init();
+#ifdef ISR_STAT_ENABLE
+    ISR_STAT_Init();
+#endif
+    if (strcmp(prm.device, "alt") == 0) {
+        kbd_init(true, 0, kbd_alt_config_desc, sizeof(kbd_alt_config_desc));
+    } else if (strcmp(prm.device, "kbd3") == 0) {
+        kbd_init(true, 0, kbd3_config_desc, sizeof(kbd3_config_desc));
+    } else {
+        kbd_init(true, strcmp(prm.device, "nak") == 0 ? prm.nak_percent : 0, NULL, 0);
+    }
+    hub_init();
+
+    // same as main()
+    USBHost();
+
+    if (num_events > 0) {
+        sim_run_script();
+    } else {
+        sim_run_cycles();
+    }
+
+    sim_print_result();
+    return sim_check_result(num_events == 0) ? 0 : 1;
+}
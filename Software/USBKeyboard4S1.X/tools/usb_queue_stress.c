@@ -0,0 +1,233 @@
+/** @file usb_queue_stress.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Stress test of the USB event ring in usb_struct_queue.c (host build)
+ *
+ *  The producer of the ring is the transfer completion in
+ *  USB_HostInterruptTasks(), and the consumer is StructEventQueueProcess();
+ *  both run in the main loop, or the producer runs in the USB ISR with
+ *  USB_HOST_TASKS_IN_ISR. Here they run on two threads at once, which is
+ *  harder on the ring than an ISR preempting the main loop.
+ *
+ *  The producer runs at the worst case rate of the stack: each of the
+ *  endpoints (USB_EVENT_QUEUE_MIN by default, the periodic endpoints of the
+ *  active endpoint index and EP0) completes a transfer as soon as the client
+ *  has restarted it, that is, as soon as the consumer has called the client
+ *  back with the previous event of the endpoint. The producer never waits
+ *  for room in the ring and never puts an event again; an event refused by
+ *  a full ring (USB_EVENT_QUEUE_FULL in the endpoint) is lost.
+ *  The consumer is _USB_NotifyClients() called by StructEventQueueProcess(),
+ *  and checks that every event arrives once, in order, with all its fields.
+ *  The consumer waits at random, so that the ring fills up; a side which
+ *  finds nothing to do gives the CPU up, so that the test also runs on a
+ *  single CPU.
+ *
+ *  build (in this directory):
+ *    make usb_queue_stress
+ *
+ *  usage: usb_queue_stress [-n events] [-e endpoints | -x] [-s seed]
+ *  exit status is 1 if an event was lost by a full ring, repeated or torn.
+ *  With -x there is one endpoint more than the ring holds, and the test
+ *  must fail.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "usb.h"
+#include "usb_host_local.h"
+#include "usb_struct_queue.h"
+
+#define STRESS_WAIT_MAX     64      // spins of a random wait
+#define STRESS_EP_MAX       129     // endpoints with a transfer in flight (-x at depth 128)
+
+static uint32_t stress_events = 1000000;
+static uint32_t stress_endpoints = USB_EVENT_QUEUE_MIN;
+static volatile bool stress_done;
+
+/// the transfer of the endpoint is in flight or its event is in the ring
+static volatile uint8_t stress_busy[STRESS_EP_MAX];
+
+// ---- consumer ----
+
+static uint32_t received;
+static uint32_t errors;
+
+static void stress_wait(uint32_t *seed)
+{
+    volatile uint32_t n;
+
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    for (n = *seed % STRESS_WAIT_MAX; n > 0; n--) {
+    }
+}
+
+/// every field other than the endpoint is made from the number of the event
+void _USB_NotifyClients(USB_DEVICE_INFO *deviceInfo, USB_EVENT event, void *data, unsigned int size)
+{
+    HOST_TRANSFER_DATA *t = data;
+    uint32_t seq = received;
+    uint8_t ep = (uint8_t)(t->bEndpointAddress - 0x81);
+    bool ok;
+
+    ok = (size == sizeof(HOST_TRANSFER_DATA)
+       && deviceInfo == (USB_DEVICE_INFO *)(uintptr_t)(0x1000 + (seq & 0xff0))
+       && ep < stress_endpoints && stress_busy[ep]
+       && t->clientDriver == (uint8_t)(seq >> 8)
+       && t->bmAttributes.val == (uint8_t)(seq & 0x70));
+    if (seq & 1) {
+        ok = ok && event == EVENT_BUS_ERROR && t->dataCount == 0
+                && t->pUserData == NULL && t->bErrorCode == (uint8_t)(seq >> 1);
+    } else {
+        ok = ok && event == EVENT_TRANSFER && t->dataCount == seq
+                && t->pUserData == (uint8_t *)(uintptr_t)(seq * 4 + 4)
+                && t->bErrorCode == USB_SUCCESS;
+    }
+    if (!ok) {
+        if (errors < 10) {
+            printf("event %u: wrong data (event %u, count %u, EP %02x)\n", seq, (unsigned)event,
+                   (unsigned)t->dataCount, t->bEndpointAddress);
+        }
+        errors++;
+    }
+    received++;
+
+    // the client restarts the transfer
+    if (ep < stress_endpoints) {
+        __sync_synchronize();
+        stress_busy[ep] = 0;
+    }
+}
+
+static void *stress_consumer(void *arg)
+{
+    uint32_t seed = *(uint32_t *)arg;
+    uint32_t prev;
+
+    while (!stress_done) {
+        prev = received;
+        StructEventQueueProcess();
+        if (received == prev) {
+            sched_yield();
+        }
+        stress_wait(&seed);
+    }
+    // the last events are put before the producer is done
+    StructEventQueueProcess();
+    return NULL;
+}
+
+// ---- producer ----
+
+static uint32_t lost;
+
+static void *stress_producer(void *arg)
+{
+    USB_DEVICE_INFO *deviceInfo;
+    USB_ENDPOINT_INFO endpointInfo;
+    uint32_t seq = 0;
+    uint32_t ep = 0;
+    uint32_t idle = 0;
+
+    while (seq < stress_events) {
+        ep = (ep + 1) % stress_endpoints;
+        if (stress_busy[ep]) {
+            // no transfer restarted yet
+            if (++idle >= stress_endpoints) {
+                idle = 0;
+                sched_yield();
+            }
+            continue;
+        }
+        idle = 0;
+        stress_busy[ep] = 1;
+        deviceInfo = (USB_DEVICE_INFO *)(uintptr_t)(0x1000 + (seq & 0xff0));
+        memset(&endpointInfo, 0, sizeof(endpointInfo));
+        endpointInfo.pUserData = (uint8_t *)(uintptr_t)(seq * 4 + 4);
+        endpointInfo.bEndpointAddress = (uint8_t)(0x81 + ep);
+        endpointInfo.clientDriver = (uint8_t)(seq >> 8);
+        endpointInfo.bmAttributes.val = (uint8_t)(seq & 0x70);
+        if (seq & 1) {
+            endpointInfo.bErrorCode = (uint8_t)(seq >> 1);
+            StructEventQueueAdd_Error(deviceInfo, &endpointInfo);
+        } else {
+            endpointInfo.dataCount = seq;
+            StructEventQueueAdd_Success(deviceInfo, &endpointInfo);
+        }
+        if (endpointInfo.bmAttributes.val == USB_EVENT_QUEUE_FULL) {
+            // the event is lost, the test fails; go on with the next number
+            // so that the consumer sees the hole
+            lost++;
+            stress_busy[ep] = 0;
+        }
+        seq++;
+    }
+    __sync_synchronize();
+    stress_done = true;
+    return NULL;
+}
+
+static void usage(void)
+{
+    printf("usage: usb_queue_stress [-n events] [-e endpoints | -x] [-s seed]\n"
+           "  -n events     events put through the ring (default %u)\n"
+           "  -e endpoints  endpoints with a transfer in flight (default %u, ring depth %u)\n"
+           "  -x            one endpoint more than the ring depth\n"
+           "  -s seed       seed of the random waits\n",
+           stress_events, stress_endpoints, USB_EVENT_QUEUE_DEPTH);
+}
+
+int main(int argc, char *argv[])
+{
+    pthread_t producer;
+    pthread_t consumer;
+    uint32_t seed = 2;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:e:xs:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            stress_events = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'e':
+            stress_endpoints = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'x':
+            stress_endpoints = USB_EVENT_QUEUE_DEPTH + 1;
+            break;
+        case 's':
+            seed = (uint32_t)strtoul(optarg, NULL, 0) | 1;
+            break;
+        default:
+            usage();
+            return 2;
+        }
+    }
+    if (stress_endpoints < 1 || stress_endpoints > STRESS_EP_MAX) {
+        usage();
+        return 2;
+    }
+
+    StructEventQueueInit();
+    pthread_create(&consumer, NULL, stress_consumer, &seed);
+    pthread_create(&producer, NULL, stress_producer, NULL);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    printf("endpoints: %u  ring depth: %u\n", stress_endpoints, USB_EVENT_QUEUE_DEPTH);
+    printf("events: %u  received: %u  wrong: %u\n", stress_events, received, errors);
+    printf("lost by a full ring: %u  overflows counted (16 bits): %u  high watermark: %u\n",
+           lost, StructEventQueueOverflows(), StructEventQueueHighWatermark());
+    return (lost == 0 && StructEventQueueOverflows() == 0
+         && received == stress_events && errors == 0) ? 0 : 1;
+}
@@ -326,6 +326,23 @@ void UART_PutStringHexU16(char *str, uint16_t val)
     UART_PutHexU16(val);
 }
 
+/// put an unsigned decimal number, right aligned in width characters
+void UART_PutDecimal(uint32_t val, int width)
+{
+    char str[11];
+    int pos = sizeof(str) - 1;
+
+    str[pos] = 0;
+    do {
+        str[--pos] = '0' + (val % 10);
+        val /= 10;
+    } while(val != 0 && pos > 0);
+    while(pos > 0 && (int)(sizeof(str) - 1 - pos) < width) {
+        str[--pos] = ' ';
+    }
+    UART_PutString(&str[pos]);
+}
+
 void UART_PutHexaDirect(uint8_t *vals, int size)
 {
     int i;
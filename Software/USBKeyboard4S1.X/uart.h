@@ -136,6 +136,7 @@ void UART_PutHex16String(uint16_t *vals, int size);
 void UART_PutHexU8(uint8_t val);
 void UART_PutStringHexU8(char *str, uint8_t val);
 void UART_PutStringHexU16(char *str, uint16_t val);
+void UART_PutDecimal(uint32_t val, int width);
 void UART_PutHexaDirect(uint8_t *vals, int size);
 
 #endif /* UART_H */
@@ -56,7 +56,14 @@ please contact mla_licensing@microchip.com
 //******************************************************************************
 //******************************************************************************
 
+#ifdef USB_STATIC_POOL
+    #include "usb_pool.h"
+    #define USB_MALLOC(size) USBPool_Alloc(size)
+    #define USB_FREE(ptr) USBPool_Free(ptr)
+#endif
+
 #ifndef USB_MALLOC
+    #include <stdlib.h>
     #define USB_MALLOC(size) malloc(size)
 #endif
 
@@ -98,6 +105,7 @@ please contact mla_licensing@microchip.com
 #define USB_ENDPOINT_NAK_TIMEOUT                0x17    // Too many NAK's occurred while waiting for the current transaction.
 #define USB_ENDPOINT_ILLEGAL_TYPE               0x18    // Transfer type must match endpoint description.
 #define USB_ENDPOINT_UNRESOLVED_STATE           0x19    // Endpoint is in an unknown state after completing a transaction.
+#define USB_ENDPOINT_NOT_SCHEDULED              0x1A    // Interrupt request could not be queued.
 #define USB_ENDPOINT_ERROR_BIT_STUFF            0x20    // USB Module - Bit stuff error.
 #define USB_ENDPOINT_ERROR_DMA                  0x21    // USB Module - DMA error.
 #define USB_ENDPOINT_ERROR_TIMEOUT              0x22    // USB Module - Bus timeout.
@@ -22,7 +22,7 @@ please contact mla_licensing@microchip.com
 #ifndef _usb_config_h_
 #define _usb_config_h_
 
-#include <xc.h>
+#include "hal.h"
         
 // Supported USB Configurations
 
@@ -0,0 +1,572 @@
+/** @file usb_enum_cache.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Enumeration cache of known devices kept in flash
+ *
+ *  A record uses a flash page. It is written while a new HID device is
+ *  enumerated: the page is erased and the configuration descriptor is
+ *  programmed, then each report descriptor parsed without error, and the
+ *  checksum and the signature last. A record without the signature is
+ *  never used, so a device detached halfway leaves no broken record.
+ *
+ *  The CPU stalls and the scan ISRs cannot run while the flash is written,
+ *  so each word is programmed in the gap between the scans of the S1.
+ *  A page erase (20ms) is longer than the gap; it is done only while the
+ *  S1 is not scanning, otherwise a blank page is used or nothing is cached.
+ */
+
+#include "common.h"
+#include "hal.h"
+#include "interrupt.h"
+#include "usb_config.h"
+#include <stddef.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_hid.h"
+#include "usb_enum_cache.h"
+#include "uart.h"
+
+#ifdef USB_ENUM_CACHE
+
+#define USB_ENUM_CACHE_SIGNATURE    0x31534345  // "ECS1"
+#define USB_ENUM_CACHE_ERASED       0xFFFFFFFF
+
+#if USB_ENUM_CACHE_RECORDS > 8
+    #error "USB_ENUM_CACHE_RECORDS must be 8 or less (stale is a bit per record)."
+#endif
+
+#define USB_ENUM_CACHE_NVMOP_WORD_PGM   0x0001
+#define USB_ENUM_CACHE_NVMOP_PAGE_ERASE 0x0004
+
+// Time the CPU may stall (core timer count), with a margin
+#define USB_ENUM_CACHE_WORD_TIME        (24000 / 10)    // 100us, 20us to program
+#define USB_ENUM_CACHE_ERASE_TIME       (24000 * 25)    // 25ms, 20ms to erase
+// Give up programming if no gap is found in this time
+#define USB_ENUM_CACHE_GAP_WAIT         (24000 * 50)
+
+#ifndef KVA0_TO_KVA1
+    #define KVA0_TO_KVA1(v) ((uint32_t)(v) | 0x20000000)
+#endif
+
+// Place of a report descriptor in the data area (all bits set: none)
+typedef struct _USB_ENUM_CACHE_REPORT
+{
+    uint16_t    offset;
+    uint16_t    length;
+} USB_ENUM_CACHE_REPORT;
+
+// Record of a device. Each word is programmed only once after the erase.
+typedef struct _USB_ENUM_CACHE_RECORD
+{
+    uint32_t                signature;          // USB_ENUM_CACHE_SIGNATURE when completed
+    uint32_t                checksum;           // Sum of the descriptor bytes
+    uint32_t                sequence;           // The smallest one is replaced first
+    uint16_t                idVendor;
+    uint16_t                idProduct;
+    uint16_t                bcdDevice;
+    uint16_t                configLength;       // wTotalLength of the configuration descriptor
+    USB_ENUM_CACHE_REPORT   report[USB_ENUM_CACHE_REPORTS]; // Indexed by interface number
+    uint8_t                 data[USB_ENUM_CACHE_PAGE_SIZE - 20 - 4 * USB_ENUM_CACHE_REPORTS];
+} USB_ENUM_CACHE_RECORD;
+
+_Static_assert(sizeof(USB_ENUM_CACHE_RECORD) == USB_ENUM_CACHE_PAGE_SIZE, "USB_ENUM_CACHE_RECORD must fill a flash page.");
+
+#define USB_ENUM_CACHE_IDLE     0   // No device
+#define USB_ENUM_CACHE_HIT      1   // The device is found in the cache
+#define USB_ENUM_CACHE_MISS     2   // The device is not found
+#define USB_ENUM_CACHE_WRITING  3   // The record of the device is being written
+
+// Erased pages in program memory. Programming the chip clears the cache.
+#ifdef HAL_SIM
+// a RAM array in the host build, written by HAL_SIM_NvmOperation()
+static uint32_t usbEnumCacheFlash[USB_ENUM_CACHE_RECORDS][USB_ENUM_CACHE_PAGE_SIZE / 4]
+    __attribute__((aligned(USB_ENUM_CACHE_PAGE_SIZE))) = {
+#else
+static const uint32_t usbEnumCacheFlash[USB_ENUM_CACHE_RECORDS][USB_ENUM_CACHE_PAGE_SIZE / 4]
+    __attribute__((aligned(USB_ENUM_CACHE_PAGE_SIZE), space(prog))) = {
+#endif
+    [0 ... USB_ENUM_CACHE_RECORDS - 1] = { [0 ... USB_ENUM_CACHE_PAGE_SIZE / 4 - 1] = USB_ENUM_CACHE_ERASED }
+};
+
+static struct
+{
+    uint8_t     state;
+    uint8_t     address;    // Device being enumerated
+    uint8_t     record;     // Index of the record
+    uint8_t     stale;      // Records to be erased (bit per record)
+    uint16_t    idVendor;
+    uint16_t    idProduct;
+    uint16_t    bcdDevice;
+    uint16_t    offset;     // Next free offset in the data area
+    uint32_t    checksum;
+} usbEnumCache;
+
+/****************************************************************************/
+static const USB_ENUM_CACHE_RECORD *_USBEnumCache_Record( uint8_t n )
+{
+    // read through KSEG1, not to get stale data from the prefetch cache
+    return (const USB_ENUM_CACHE_RECORD *)KVA0_TO_KVA1(usbEnumCacheFlash[n]);
+}
+
+/****************************************************************************/
+static uint32_t _USBEnumCache_Sum( const uint8_t *data, uint16_t length )
+{
+    uint32_t sum = 0;
+
+    while(length--) {
+        sum += *data++;
+    }
+    return sum;
+}
+
+/****************************************************************************
+  Function:
+    bool _USBEnumCache_NVMOperation( uint32_t nvmop, const void *address, uint32_t data )
+
+  Description:
+    This function erases a flash page or programs a word.
+
+  Precondition:
+    None
+
+  Parameters:
+    uint32_t nvmop        - USB_ENUM_CACHE_NVMOP_*
+    const void *address   - address in the flash
+    uint32_t data         - data to program
+
+  Returns:
+    true if succeeded
+
+  Remarks:
+    The CPU stalls until the operation finishes (about 20ms to erase a page),
+    and interrupts are disabled meanwhile. The caller makes sure that the
+    stall falls in the gap between the scans.
+  ***************************************************************************/
+static bool _USBEnumCache_NVMOperation( uint32_t nvmop, const void *address, uint32_t data )
+{
+#ifdef HAL_SIM
+    LAT_Y_N_CLR;
+    return HAL_SIM_NvmOperation( nvmop, address, data );
+#else
+    uint32_t status;
+    uint32_t t0;
+
+    status = __builtin_disable_interrupts();
+
+    // nothing drives Y_N until the interrupts are enabled again,
+    // so never leave a key pressed on it over the stall
+    LAT_Y_N_CLR;
+
+    NVMADDR = KVA_TO_PA(address);
+    NVMDATA = data;
+    NVMCON = _NVMCON_WREN_MASK | nvmop;
+
+    /* wait at least 6 us for LVD start-up
+    assume we're running at max frequency
+    (50 MHz) so we're always safe */
+    t0 = _CP0_GET_COUNT();
+    while (_CP0_GET_COUNT() - t0 < (50/2)*6);
+
+    NVMKEY    = 0xAA996655;
+    NVMKEY    = 0x556699AA;     /* unlock sequence */
+    NVMCONSET = _NVMCON_WR_MASK;
+    while(NVMCON & _NVMCON_WR_MASK);  /* wait on write to finish */
+    NVMCONCLR = _NVMCON_WREN_MASK;
+
+    if (status & 0x00000001) {
+        __builtin_enable_interrupts();
+    }
+
+    return ((NVMCON & (_NVMCON_WRERR_MASK | _NVMCON_LVDERR_MASK)) == 0);
+#endif
+}
+
+/****************************************************************************/
+static bool _USBEnumCache_WaitScanGap( uint32_t time, uint32_t wait )
+{
+    uint32_t t0;
+
+    t0 = HAL_CORE_TIMER();
+    while(!INTR_ScanGapFits(time)) {
+        if (HAL_CORE_TIMER() - t0 >= wait) return false;
+    }
+    return true;
+}
+
+/****************************************************************************/
+static bool _USBEnumCache_ErasePage( uint8_t n )
+{
+    // the erase fits only while the S1 is not scanning, never wait for it
+    if (!_USBEnumCache_WaitScanGap( USB_ENUM_CACHE_ERASE_TIME, 0 )) return false;
+
+    usbEnumCache.stale &= ~(1 << n);
+    return _USBEnumCache_NVMOperation( USB_ENUM_CACHE_NVMOP_PAGE_ERASE, usbEnumCacheFlash[n], 0 );
+}
+
+/****************************************************************************/
+static bool _USBEnumCache_IsBlank( uint8_t n )
+{
+    const uint32_t *word;
+    uint16_t i;
+
+    word = (const uint32_t *)_USBEnumCache_Record(n);
+    for(i=0; i<USB_ENUM_CACHE_PAGE_SIZE / 4; i++) {
+        if (word[i] != USB_ENUM_CACHE_ERASED) return false;
+    }
+    return true;
+}
+
+/****************************************************************************/
+static bool _USBEnumCache_ProgramWord( const void *address, uint32_t data )
+{
+    if (data == USB_ENUM_CACHE_ERASED) return true;
+    if (!_USBEnumCache_WaitScanGap( USB_ENUM_CACHE_WORD_TIME, USB_ENUM_CACHE_GAP_WAIT )) return false;
+
+    return _USBEnumCache_NVMOperation( USB_ENUM_CACHE_NVMOP_WORD_PGM, address, data );
+}
+
+/****************************************************************************/
+static bool _USBEnumCache_ProgramData( uint16_t offset, const uint8_t *data, uint16_t length )
+{
+    const uint8_t *dst;
+    uint32_t word;
+    uint8_t n;
+
+    dst = (const uint8_t *)usbEnumCacheFlash[usbEnumCache.record] + offsetof(USB_ENUM_CACHE_RECORD, data) + offset;
+    while(length) {
+        // pad the last word with erased bytes
+        word = USB_ENUM_CACHE_ERASED;
+        for(n=0; n<4 && length; n++, length--) {
+            word &= ~((uint32_t)0xFF << (n * 8));
+            word |= ((uint32_t)*data++ << (n * 8));
+        }
+        if (!_USBEnumCache_ProgramWord( dst, word )) return false;
+        dst += 4;
+    }
+    return true;
+}
+
+/****************************************************************************/
+static bool _USBEnumCache_Verify( const USB_ENUM_CACHE_RECORD *rec )
+{
+    uint32_t sum;
+    uint8_t i;
+
+    if (rec->configLength > sizeof(rec->data)) return false;
+
+    sum = _USBEnumCache_Sum( rec->data, rec->configLength );
+    for(i=0; i<USB_ENUM_CACHE_REPORTS; i++) {
+        if (rec->report[i].length == 0xFFFF) continue;
+        if ((uint32_t)rec->report[i].offset + rec->report[i].length > sizeof(rec->data)) return false;
+        sum += _USBEnumCache_Sum( rec->data + rec->report[i].offset, rec->report[i].length );
+    }
+    return (sum == rec->checksum);
+}
+
+/****************************************************************************/
+static bool _USBEnumCache_HasHIDInterface( const uint8_t *config, uint16_t length )
+{
+    uint16_t i = 0;
+
+    while(i + 5 < length && config[i] != 0) {
+        if (config[i + 1] == USB_DESCRIPTOR_INTERFACE && config[i + 5] == USB_HID_CLASS_CODE) {
+            return true;
+        }
+        i += config[i];
+    }
+    return false;
+}
+
+/****************************************************************************
+  Function:
+    const uint8_t *USBEnumCache_FindConfig( uint8_t address,
+                        const USB_DEVICE_DESCRIPTOR *dd, uint16_t *length )
+
+  Description:
+    This function looks for the configuration descriptor of the device
+    in the cache.
+
+  Precondition:
+    The device descriptor has been read.
+
+  Parameters:
+    uint8_t address                 - Address of the device
+    const USB_DEVICE_DESCRIPTOR *dd - Device descriptor
+    uint16_t *length                - Set length of the descriptor
+
+  Returns:
+    Configuration descriptor in the flash, or NULL if not found
+
+  Remarks:
+    Only a device which has one configuration is cached.
+    This starts the enumeration of the device in the cache.
+  ***************************************************************************/
+const uint8_t *USBEnumCache_FindConfig( uint8_t address, const USB_DEVICE_DESCRIPTOR *dd, uint16_t *length )
+{
+    const USB_ENUM_CACHE_RECORD *rec;
+    uint8_t n;
+
+    usbEnumCache.state      = USB_ENUM_CACHE_IDLE;
+    usbEnumCache.address    = address;
+    usbEnumCache.idVendor   = dd->idVendor;
+    usbEnumCache.idProduct  = dd->idProduct;
+    usbEnumCache.bcdDevice  = dd->bcdDevice;
+
+    if (dd->bNumConfigurations != 1) return NULL;
+
+    for(n=0; n<USB_ENUM_CACHE_RECORDS; n++) {
+        rec = _USBEnumCache_Record(n);
+        if (rec->signature != USB_ENUM_CACHE_SIGNATURE) continue;
+        if (usbEnumCache.stale & (1 << n)) continue;
+        if (rec->idVendor != dd->idVendor || rec->idProduct != dd->idProduct || rec->bcdDevice != dd->bcdDevice) continue;
+        if (!_USBEnumCache_Verify(rec)) continue;
+
+#if defined (DEBUG_ENABLE)
+        UART_PutStringHexU8( "CACHE: Found: ", n );
+#endif
+        usbEnumCache.state  = USB_ENUM_CACHE_HIT;
+        usbEnumCache.record = n;
+        *length = rec->configLength;
+        return rec->data;
+    }
+
+    usbEnumCache.state = USB_ENUM_CACHE_MISS;
+    return NULL;
+}
+
+/****************************************************************************
+  Function:
+    void USBEnumCache_PutConfig( uint8_t address, const uint8_t *config, uint16_t length )
+
+  Description:
+    This function starts writing the record of the device not found
+    in the cache.
+
+  Precondition:
+    USBEnumCache_FindConfig() returned NULL for the device.
+
+  Parameters:
+    uint8_t address        - Address of the device
+    const uint8_t *config  - Configuration descriptor
+    uint16_t length        - Length of the descriptor
+
+  Returns:
+    None
+
+  Remarks:
+    Only a device which has a HID interface is written, and the record is
+    completed by USBEnumCache_Commit(). While the S1 is scanning, the
+    device is written only if a blank page is left.
+  ***************************************************************************/
+void USBEnumCache_PutConfig( uint8_t address, const uint8_t *config, uint16_t length )
+{
+    const USB_ENUM_CACHE_RECORD *rec;
+    uint32_t sequence = 0;
+    uint32_t oldest = USB_ENUM_CACHE_ERASED;
+    bool blank = false;
+    uint8_t n;
+
+    if (usbEnumCache.state != USB_ENUM_CACHE_MISS || usbEnumCache.address != address) return;
+    usbEnumCache.state = USB_ENUM_CACHE_IDLE;
+
+    if (length > sizeof(rec->data)) return;
+    if (!_USBEnumCache_HasHIDInterface(config, length)) return;
+
+    // use a blank record, or replace an unused one or the oldest one
+    usbEnumCache.record = 0;
+    for(n=0; n<USB_ENUM_CACHE_RECORDS; n++) {
+        rec = _USBEnumCache_Record(n);
+        if (rec->signature == USB_ENUM_CACHE_SIGNATURE) {
+            if (sequence < rec->sequence + 1) sequence = rec->sequence + 1;
+        }
+        if (blank) continue;
+        if (_USBEnumCache_IsBlank(n)) {
+            usbEnumCache.record = n;
+            blank = true;
+        } else if (rec->signature != USB_ENUM_CACHE_SIGNATURE || (usbEnumCache.stale & (1 << n))) {
+            usbEnumCache.record = n;
+            oldest = 0;
+        } else if (oldest > rec->sequence) {
+            usbEnumCache.record = n;
+            oldest = rec->sequence;
+        }
+    }
+
+    // a page is erased only while the S1 is not scanning
+    if (!blank && !_USBEnumCache_ErasePage( usbEnumCache.record )) {
+#if defined (DEBUG_ENABLE)
+        UART_PutStringHexU8( "CACHE: Busy: ", usbEnumCache.record );
+#endif
+        return;
+    }
+#if defined (DEBUG_ENABLE)
+    UART_PutStringHexU8( "CACHE: Write: ", usbEnumCache.record );
+#endif
+    rec = (const USB_ENUM_CACHE_RECORD *)usbEnumCacheFlash[usbEnumCache.record];
+
+    if (!_USBEnumCache_ProgramWord( &rec->sequence, sequence )) return;
+    if (!_USBEnumCache_ProgramWord( &rec->idVendor, usbEnumCache.idVendor | ((uint32_t)usbEnumCache.idProduct << 16) )) return;
+    if (!_USBEnumCache_ProgramWord( &rec->bcdDevice, usbEnumCache.bcdDevice | ((uint32_t)length << 16) )) return;
+    if (!_USBEnumCache_ProgramData( 0, config, length )) return;
+
+    usbEnumCache.offset     = (length + 3) & ~3;
+    usbEnumCache.checksum   = _USBEnumCache_Sum( config, length );
+    usbEnumCache.state      = USB_ENUM_CACHE_WRITING;
+}
+
+/****************************************************************************
+  Function:
+    const uint8_t *USBEnumCache_FindReport( uint8_t address, uint8_t interface, uint16_t length )
+
+  Description:
+    This function looks for the report descriptor of the interface
+    in the cache.
+
+  Precondition:
+    USBEnumCache_FindConfig() found the device.
+
+  Parameters:
+    uint8_t address    - Address of the device
+    uint8_t interface  - Interface number
+    uint16_t length    - Length of the descriptor in the HID descriptor
+
+  Returns:
+    Report descriptor in the flash, or NULL if not found
+
+  Remarks:
+    None
+  ***************************************************************************/
+const uint8_t *USBEnumCache_FindReport( uint8_t address, uint8_t interface, uint16_t length )
+{
+    const USB_ENUM_CACHE_RECORD *rec;
+
+    if (usbEnumCache.state != USB_ENUM_CACHE_HIT || usbEnumCache.address != address) return NULL;
+    if (interface >= USB_ENUM_CACHE_REPORTS) return NULL;
+
+    rec = _USBEnumCache_Record(usbEnumCache.record);
+    if (rec->report[interface].length != length) return NULL;
+
+    return rec->data + rec->report[interface].offset;
+}
+
+/****************************************************************************
+  Function:
+    void USBEnumCache_PutReport( uint8_t address, uint8_t interface,
+                                 const uint8_t *report, uint16_t length )
+
+  Description:
+    This function adds the report descriptor of the interface to the record
+    being written.
+
+  Precondition:
+    USBEnumCache_PutConfig() started the record.
+
+  Parameters:
+    uint8_t address        - Address of the device
+    uint8_t interface      - Interface number
+    const uint8_t *report  - Report descriptor parsed without error
+    uint16_t length        - Length of the descriptor
+
+  Returns:
+    None
+
+  Remarks:
+    A report that does not fit is not cached, it is read from the device
+    every time.
+  ***************************************************************************/
+void USBEnumCache_PutReport( uint8_t address, uint8_t interface, const uint8_t *report, uint16_t length )
+{
+    const USB_ENUM_CACHE_RECORD *rec;
+
+    if (usbEnumCache.state != USB_ENUM_CACHE_WRITING || usbEnumCache.address != address) return;
+    if (interface >= USB_ENUM_CACHE_REPORTS) return;
+
+    rec = (const USB_ENUM_CACHE_RECORD *)usbEnumCacheFlash[usbEnumCache.record];
+    if (_USBEnumCache_Record(usbEnumCache.record)->report[interface].offset != 0xFFFF
+     || _USBEnumCache_Record(usbEnumCache.record)->report[interface].length != 0xFFFF) return;
+    if ((uint32_t)usbEnumCache.offset + length > sizeof(rec->data)) return;
+
+    if (!_USBEnumCache_ProgramData( usbEnumCache.offset, report, length )
+     || !_USBEnumCache_ProgramWord( &rec->report[interface], usbEnumCache.offset | ((uint32_t)length << 16) )) {
+        usbEnumCache.state = USB_ENUM_CACHE_IDLE;
+        return;
+    }
+
+    usbEnumCache.offset    += (length + 3) & ~3;
+    usbEnumCache.checksum  += _USBEnumCache_Sum( report, length );
+}
+
+/****************************************************************************
+  Function:
+    void USBEnumCache_Commit( uint8_t address )
+
+  Description:
+    This function finishes the enumeration of the device.
+    The record being written becomes valid.
+
+  Precondition:
+    None
+
+  Parameters:
+    uint8_t address - Address of the device
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+void USBEnumCache_Commit( uint8_t address )
+{
+    const USB_ENUM_CACHE_RECORD *rec;
+
+    if (usbEnumCache.address != address) return;
+
+    if (usbEnumCache.state == USB_ENUM_CACHE_WRITING) {
+        rec = (const USB_ENUM_CACHE_RECORD *)usbEnumCacheFlash[usbEnumCache.record];
+        if (_USBEnumCache_ProgramWord( &rec->checksum, usbEnumCache.checksum )) {
+            _USBEnumCache_ProgramWord( &rec->signature, USB_ENUM_CACHE_SIGNATURE );
+        }
+#if defined (DEBUG_ENABLE)
+        UART_PutStringHexU8( "CACHE: Commit: ", usbEnumCache.record );
+#endif
+    }
+    usbEnumCache.state = USB_ENUM_CACHE_IDLE;
+}
+
+/****************************************************************************
+  Function:
+    void USBEnumCache_Forget( uint8_t address )
+
+  Description:
+    This function erases the record of the device.
+
+  Precondition:
+    None
+
+  Parameters:
+    uint8_t address - Address of the device
+
+  Returns:
+    None
+
+  Remarks:
+    Called when the cached descriptors cannot be used, so the next attach
+    reads them from the device again. While the S1 is scanning, the record
+    is only marked stale until it is erased or replaced.
+  ***************************************************************************/
+void USBEnumCache_Forget( uint8_t address )
+{
+    if (usbEnumCache.address != address) return;
+
+    if (usbEnumCache.state == USB_ENUM_CACHE_HIT || usbEnumCache.state == USB_ENUM_CACHE_WRITING) {
+        if (!_USBEnumCache_ErasePage( usbEnumCache.record )) {
+            usbEnumCache.stale |= (1 << usbEnumCache.record);
+        }
+    }
+    usbEnumCache.state = USB_ENUM_CACHE_IDLE;
+}
+
+#endif /* USB_ENUM_CACHE */
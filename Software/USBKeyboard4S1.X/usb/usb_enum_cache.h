@@ -0,0 +1,43 @@
+/** @file usb_enum_cache.h
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Enumeration cache of known devices kept in flash
+ *
+ *  Enabled by USB_ENUM_CACHE in common.h.
+ *  The configuration descriptor and the HID report descriptors of a device
+ *  are stored in a flash page per VID/PID, so the next attach skips
+ *  GET_DESCRIPTOR requests for them.
+ */
+
+#ifndef USB_ENUM_CACHE_H
+#define	USB_ENUM_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "usb_ch9.h"
+
+#ifdef USB_ENUM_CACHE
+
+// Number of devices remembered (a flash page is used per device)
+#ifndef USB_ENUM_CACHE_RECORDS
+    #define USB_ENUM_CACHE_RECORDS      2
+#endif
+
+// Size of a flash page on PIC32MX1xx/2xx
+#define USB_ENUM_CACHE_PAGE_SIZE        1024
+
+// Report descriptors of interface 0 to (n - 1) are stored
+#define USB_ENUM_CACHE_REPORTS          4
+
+const uint8_t *USBEnumCache_FindConfig( uint8_t address, const USB_DEVICE_DESCRIPTOR *dd, uint16_t *length );
+void USBEnumCache_PutConfig( uint8_t address, const uint8_t *config, uint16_t length );
+const uint8_t *USBEnumCache_FindReport( uint8_t address, uint8_t interface, uint16_t length );
+void USBEnumCache_PutReport( uint8_t address, uint8_t interface, const uint8_t *report, uint16_t length );
+void USBEnumCache_Commit( uint8_t address );
+void USBEnumCache_Forget( uint8_t address );
+
+#endif /* USB_ENUM_CACHE */
+
+#endif	/* USB_ENUM_CACHE_H */
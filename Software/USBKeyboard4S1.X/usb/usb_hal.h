@@ -51,6 +51,8 @@ please contact mla_licensing@microchip.com
     #else
         #error "Silicon Platform not defined"
     #endif
+#elif defined(HAL_SIM)
+    #include "usb_hal_sim.h"
 #else
     #error "Silicon Platform not defined"
 #endif
@@ -32,6 +32,8 @@ please contact mla_licensing@microchip.com
     #endif
 #elif defined (__PIC32MX__) || defined (__PIC32MM__)
     #include <p32xxxx.h> 
+#elif defined (HAL_SIM)
+    // registers are emulated by usb_hal_sim.h
 #else
     #error "Error!  Unsupported processor"
 #endif
@@ -200,6 +202,8 @@ typedef union _BDT_SETUP
     {
         #if defined(__18CXX) || defined(__XC8)
         unsigned short BC_MSB:  2;
+        #elif defined(HAL_SIM)
+        unsigned short      :   2;  // gcc does not allow the same names twice
         #else
         unsigned short spare:   2;
         #endif
@@ -207,9 +211,13 @@ typedef union _BDT_SETUP
         unsigned short DTS:     1;  // Require data-toggle sync
         unsigned short NINC:    1;  // No Increment of DMA address
         unsigned short KEEP:    1;  // HW Keeps this buffer & descriptor
+        #if defined(HAL_SIM)
+        unsigned short      :   2;  // DAT01 and UOWN of the status entry
+        #else
         unsigned short DAT01:   1;  // Data-toggle number (0 or 1)
         unsigned short UOWN:    1;  // Descriptor owner: 0=SW, 1=HW
-        #if !defined(__18CXX) && !defined(__XC8)
+        #endif
+        #if !defined(__18CXX) && !defined(__XC8) && !defined(HAL_SIM)
         unsigned short resvd:   8;
         #endif
      };
@@ -255,7 +263,9 @@ typedef union _uint8_tCOUNT
     struct  // Byte-count field
     {
         unsigned short BC:      10; // Number of bytes in data buffer
+        #if !defined(HAL_SIM)
         unsigned short resvd:   6;
+        #endif
     };
     #endif
 
@@ -480,7 +490,32 @@ typedef union
 
  ******************************************************************************/
 
+#if defined (HAL_SIM)
+#define USBHALClearStatus(s) (U1IR &= ~(s))
+#else
 #define USBHALClearStatus(s) (U1IR = (s))
+#endif
+
+/******************************************************************************
+    Function:
+        USBHALClearOTGStatus
+    Summary:
+        This routine clears the OTG status
+    PreCondition:
+        None
+    Parameters:
+        status  Bitmap of U1OTGIR bits to clear (caller sets bits it
+        wishes to be cleared).
+    Return Values:
+        None
+    Remarks:
+        The status indicated have been cleared.
+ ******************************************************************************/
+#if defined (HAL_SIM)
+#define USBHALClearOTGStatus(s) (U1OTGIR &= ~(s))
+#else
+#define USBHALClearOTGStatus(s) (U1OTGIR = (s))
+#endif
 
 
 /******************************************************************************
@@ -554,7 +589,32 @@ typedef union
         None
 
  ******************************************************************************/
+#if defined (HAL_SIM)
+#define USBHALClearErrors(e) (U1EIR &= ~(e))
+#else
 #define USBHALClearErrors(e) (U1EIR = (e))
+#endif
+
+/******************************************************************************
+    Function:
+        USBHALSendToken
+    Summary:
+        This routine starts a transaction on the bus.
+    PreCondition:
+        The BDT entry for the transaction is given to the SIE, and U1ADDR
+        and U1EP0 are set.
+    Parameters:
+        token   PID in bits 7-4 and endpoint number in bits 3-0.
+    Return Values:
+        None
+    Remarks:
+        TRNIF is set when the transaction is done.
+ ******************************************************************************/
+#if defined (HAL_SIM)
+#define USBHALSendToken(t) USBSIM_SendToken(t)
+#else
+#define USBHALSendToken(t) (U1TOK = (t))
+#endif
 
 
 #endif  // _USB_HAL_LOCAL_H_
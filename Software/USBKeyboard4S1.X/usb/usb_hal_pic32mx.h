@@ -26,7 +26,7 @@ please contact mla_licensing@microchip.com
 /****** include files ********************************************************/
 /*****************************************************************************/
 
-#include <xc.h>
+#include "hal.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include "usb_config.h"
@@ -38,7 +38,7 @@ please contact mla_licensing@microchip.com
 
 //Device specific IECx register count.  Useful during interrupt context save and 
 //restore operations (such as prior to and after entering sleep on suspend).
-#if defined(__PIC32MX__)
+#if defined(__PIC32MX__) || defined(HAL_SIM)
 
     #define DEVICE_SPECIFIC_IEC_REGISTER_COUNT 2   //Number of IECx registers implemented in the microcontroller (varies from device to device, make sure this is set correctly for the intended CPU)
     #define USB_HAL_VBUSTristate()
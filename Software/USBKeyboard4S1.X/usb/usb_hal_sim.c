@@ -0,0 +1,436 @@
+/** @file usb_hal_sim.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Model of the USB SIE of PIC32MX in host mode (host build)
+ *
+ *  Nothing is built with XC32.
+ *
+ *  The model runs on virtual time counted in core timer cycles. The time
+ *  advances only in USBSIM_Run(), which sends SOFs, raises T1MSECIF, ends
+ *  the transaction on the bus and calls USB_HostInterruptHandler() while
+ *  an enabled flag is set. A token written by USBHALSendToken() takes the
+ *  BD of EP0 pointed by the own ping-pong bits of the SIE, is given to
+ *  the virtual device at the address in U1ADDR, and is written back to the
+ *  BD with TRNIF when the bus time of the transaction is over.
+ */
+
+#include "usb.h"
+#include "isr_stat.h"
+
+#ifdef HAL_SIM
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SIM_FRAME_CYCLES        USB_SIM_CYCLES_PER_MS
+#define SIM_SOF_BIT_TIMES       48      // SOF packet and the gap after it
+#define SIM_ISR_CALLS_MAX       8       // calls per event before the flags are stuck
+
+USB_SIM_REGS usb_sim;
+USB_SIM_STAT usb_sim_stat;
+
+static struct {
+    uint64_t        now;                // virtual time in core timer cycles
+    uint64_t        next_frame;         // start of the next frame
+
+    // write to a SET/CLR register, applied at the next access
+    volatile uint32_t *wreg;
+    uint32_t        wval;
+    bool            wset;
+
+    uint32_t        con;                // U1CON seen at the last access
+    uint8_t         ppbi[2];            // ping-pong of EP0, [0]:RX (IN) [1]:TX
+
+    // transaction on the bus
+    bool            busy;
+    uint64_t        done;               // end of the transaction
+    uint8_t         token;
+    uint8_t         result;             // PID written back to the BD
+    uint16_t        count;
+    BDT_ENTRY      *bd;
+    uint8_t         dir;
+    uint8_t         data[1024];
+
+    USB_SIM_DEVICE *root;               // device on the root port
+    USB_SIM_DEVICE *devices;            // devices reachable by tokens
+} sie;
+
+/// physical address put in the BDT
+uint32_t USBSIM_ToPhysical(uintptr_t p)
+{
+    if (p > UINT32_MAX) {
+        fprintf(stderr, "usb_hal_sim: address %p does not fit in the BDT, link with -no-pie\n", (void *)p);
+        abort();
+    }
+    return (uint32_t)p;
+}
+
+/// apply the write to a SET/CLR register
+static void sim_commit(void)
+{
+    if (sie.wreg) {
+        if (sie.wset) {
+            *sie.wreg |= sie.wval;
+        } else {
+            *sie.wreg &= ~sie.wval;
+        }
+        sie.wreg = NULL;
+    }
+}
+
+/// bus reset of the devices reachable from the root port
+static void sim_bus_reset(void)
+{
+    if (sie.root && sie.root->reset) {
+        sie.root->reset(sie.root);
+    }
+    if (sie.root) {
+        sie.root->address = 0;
+    }
+}
+
+/// follow the writes of the stack and update the read only bits
+static void sim_sync(void)
+{
+    uint32_t con;
+
+    sim_commit();
+
+    con = usb_sim.con;
+    if (con & _U1CON_PPBRST_MASK) {
+        sie.ppbi[0] = 0;
+        sie.ppbi[1] = 0;
+    }
+    if ((con & ~sie.con) & _U1CON_USBRST_MASK) {
+        sim_bus_reset();
+    }
+
+    // J state of the root port (D+ pulled up by a full speed device)
+    con &= ~(_U1CON_JSTATE_MASK | _U1CON_SE0_MASK | _U1CON_PKTDIS_TOKBUSY_MASK);
+    if (sie.root) {
+        if (!sie.root->low_speed) {
+            con |= _U1CON_JSTATE_MASK;
+        }
+    } else {
+        con |= _U1CON_SE0_MASK;
+    }
+    if (sie.busy) {
+        con |= _U1CON_PKTDIS_TOKBUSY_MASK;
+    }
+    usb_sim.con = con;
+    sie.con = con;
+
+    // the attach interrupt is level triggered
+    if (sie.root && (con & _U1CON_HOSTEN_MASK)) {
+        usb_sim.ir |= (1 << _U1IR_ATTACHIF_POSITION);
+    }
+}
+
+volatile uint32_t *USBSIM_Reg(volatile uint32_t *reg)
+{
+    sim_sync();
+    return reg;
+}
+
+volatile uint32_t *USBSIM_Set(volatile uint32_t *reg)
+{
+    sim_sync();
+    sie.wreg = reg;
+    sie.wval = 0;
+    sie.wset = true;
+    return &sie.wval;
+}
+
+volatile uint32_t *USBSIM_Clr(volatile uint32_t *reg)
+{
+    sim_sync();
+    sie.wreg = reg;
+    sie.wval = 0;
+    sie.wset = false;
+    return &sie.wval;
+}
+
+/// device at the address
+static USB_SIM_DEVICE *sim_find_device(uint8_t address)
+{
+    USB_SIM_DEVICE *dev;
+
+    for (dev = sie.devices; dev != NULL; dev = dev->next) {
+        if (dev->address == address) {
+            return dev;
+        }
+    }
+    return NULL;
+}
+
+/// bus time of a transaction in FS bit times (same as usb_host_trans.c)
+static uint32_t sim_bit_times(bool low_speed, uint16_t count)
+{
+    if (low_speed) {
+        return 800 + (uint32_t)count * 76;
+    }
+    return 112 + ((uint32_t)count * 28) / 3;
+}
+
+/// start a transaction
+void USBSIM_SendToken(uint8_t token)
+{
+    uint8_t pid;
+    uint8_t ep;
+    uint8_t addr;
+    uint8_t ep0;
+    bool low_speed;
+    uint64_t start;
+    uint64_t frame_end;
+    uint32_t bits;
+    USB_SIM_DEVICE *dev;
+    BDT_ENTRY *bdt;
+
+    sim_sync();
+    usb_sim.tok = token;
+    if (sie.busy) {
+        usb_sim_stat.overruns++;
+        return;
+    }
+
+    pid = token >> 4;
+    ep = token & 0x0F;
+    addr = (uint8_t)usb_sim.addr;
+    ep0 = (uint8_t)usb_sim.ep[0][0];
+    low_speed = (addr & 0x80) != 0;
+    usb_sim_stat.tokens[pid]++;
+
+    // in host mode, every transaction uses the BDs of EP0
+    bdt = (BDT_ENTRY *)PA_TO_KVA1((usb_sim.bdtp3 << 24) | (usb_sim.bdtp2 << 16) | (usb_sim.bdtp1 << 8));
+    sie.dir = (pid == PID_IN) ? 0 : 1;
+    sie.bd = &bdt[sie.dir * 2 + sie.ppbi[sie.dir]];
+    sie.token = token;
+    sie.count = 0;
+    sie.result = 0;
+
+    dev = sim_find_device(addr & 0x7F);
+    if (!sie.bd->STAT.UOWN) {
+        usb_sim_stat.bd_errors++;
+        dev = NULL;
+    } else if (dev && ((dev->low_speed != low_speed)
+        || (low_speed && ((dev->parent == NULL) != ((ep0 & 0x80) != 0))))) {
+        // low speed: LSPD is set on the root port, and PRE is sent via a hub
+        usb_sim_stat.speed_errors++;
+        dev = NULL;
+    }
+
+    if (dev) {
+        if (pid == PID_IN) {
+            sie.count = sie.bd->count;
+            sie.result = dev->transaction(dev, pid, ep, sie.data, &sie.count);
+            if (sie.result != PID_DATA0 && sie.result != PID_DATA1) {
+                sie.count = 0;
+            }
+        } else {
+            sie.count = sie.bd->count;
+            memcpy(sie.data, (void *)PA_TO_KVA1(sie.bd->ADR), sie.count);
+            sie.result = dev->transaction(dev, pid, ep, sie.data, &sie.count);
+            sie.count = sie.bd->count;
+        }
+    }
+
+    // the SIE does not start a token in the last U1SOF bytes of the frame
+    // and waits for the end of the SOF packet
+    start = sie.now;
+    if (usb_sim.con & _U1CON_USBEN_SOFEN_MASK) {
+        frame_end = sie.next_frame - (uint64_t)(usb_sim.sof & 0xFF) * 8 * USB_SIM_CYCLES_PER_BIT;
+        if (start > frame_end) {
+            start = sie.next_frame + SIM_SOF_BIT_TIMES * USB_SIM_CYCLES_PER_BIT;
+            usb_sim_stat.deferred++;
+        } else if (start < sie.next_frame - SIM_FRAME_CYCLES + SIM_SOF_BIT_TIMES * USB_SIM_CYCLES_PER_BIT) {
+            start = sie.next_frame - SIM_FRAME_CYCLES + SIM_SOF_BIT_TIMES * USB_SIM_CYCLES_PER_BIT;
+        }
+    }
+    bits = sim_bit_times(low_speed, (sie.result == PID_NAK || sie.result == PID_STALL) && pid == PID_IN ? 0 : sie.count);
+    usb_sim_stat.bit_times += bits;
+    sie.done = start + (uint64_t)bits * USB_SIM_CYCLES_PER_BIT;
+    sie.busy = true;
+}
+
+/// end the transaction and write back the BD
+static void sim_transaction_done(void)
+{
+    BDT_ENTRY *bd = sie.bd;
+
+    sie.busy = false;
+    usb_sim_stat.results[sie.result & 0x0F]++;
+
+    if (bd->STAT.UOWN) {
+        if (sie.dir == 0 && sie.count > 0) {
+            memcpy((void *)PA_TO_KVA1(bd->ADR), sie.data, sie.count);
+        }
+        bd->count = sie.count;
+        bd->STAT.Val = 0;
+        bd->STAT.PID = sie.result;
+    }
+    if (sie.result == 0) {
+        // no response from the device
+        usb_sim.eir |= _U1EIR_BTOEF_MASK;
+        if (usb_sim.eie & _U1EIR_BTOEF_MASK) {
+            usb_sim.ir |= (1 << _U1IR_UERRIF_POSITION);
+        }
+    }
+
+    usb_sim.stat = ((sie.token & 0x0F) << 4) | (sie.dir << 3) | (sie.ppbi[sie.dir] << 2);
+    sie.ppbi[sie.dir] ^= 1;
+    usb_sim.ir |= (1 << _U1IR_TRNIF_POSITION);
+}
+
+/// start of a frame
+static void sim_frame(void)
+{
+    uint32_t frame;
+
+    sie.next_frame += SIM_FRAME_CYCLES;
+    usb_sim.otgir |= (1 << _U1OTGIR_T1MSECIF_POSITION);
+
+    if ((usb_sim.con & (_U1CON_USBEN_SOFEN_MASK | _U1CON_USBRST_MASK)) == _U1CON_USBEN_SOFEN_MASK) {
+        frame = ((usb_sim.frmh << 8) | usb_sim.frml) + 1;
+        usb_sim.frml = frame & 0xFF;
+        usb_sim.frmh = (frame >> 8) & 0x07;
+        usb_sim.ir |= (1 << _U1IR_SOFIF_POSITION);
+        usb_sim_stat.frames++;
+    }
+}
+
+/// call the ISR while an enabled flag is set
+static void sim_interrupt(void)
+{
+    struct timespec t0, t1;
+    uint64_t ns;
+    int calls;
+
+    for (calls = 0; ; calls++) {
+        sim_sync();
+        if (!(usb_sim.iec1 & _IEC1_USBIE_MASK)) {
+            break;
+        }
+        if (!((usb_sim.ir & usb_sim.ie) || (usb_sim.otgir & usb_sim.otgie))) {
+            break;
+        }
+        if (calls >= SIM_ISR_CALLS_MAX) {
+            usb_sim_stat.isr_stuck++;
+            break;
+        }
+        usb_sim.ifs1 |= _IFS1_USBIF_MASK;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        USB_HostInterruptHandler();
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = (uint64_t)(t1.tv_sec - t0.tv_sec) * 1000000000 + t1.tv_nsec - t0.tv_nsec;
+        usb_sim_stat.isr_calls++;
+        usb_sim_stat.isr_ns += ns;
+#ifdef ISR_STAT_ENABLE
+        // the host is much faster than the target, so the histograms
+        // count the host time in ns, at the virtual time of the call
+        ISR_STAT_AddUSB(hal_sim.count, (uint32_t)ns);
+#endif
+    }
+}
+
+/// advance the virtual time
+void USBSIM_Run(uint32_t cycles)
+{
+    uint64_t end = sie.now + cycles;
+    uint64_t next;
+
+    sim_interrupt();
+    for (;;) {
+        next = sie.next_frame;
+        if (sie.busy && sie.done < next) {
+            next = sie.done;
+        }
+        if (next > end) {
+            break;
+        }
+        sie.now = next;
+        hal_sim.count = (uint32_t)sie.now;
+        if (sie.busy && sie.done == next) {
+            sim_transaction_done();
+        } else {
+            sim_frame();
+        }
+        sim_interrupt();
+    }
+    sie.now = end;
+    hal_sim.count = (uint32_t)sie.now;
+}
+
+uint64_t USBSIM_Now(void)
+{
+    return sie.now;
+}
+
+/// reset the SIE, the devices are removed
+void USBSIM_Init(void)
+{
+    memset(&usb_sim, 0, sizeof(usb_sim));
+    memset(&usb_sim_stat, 0, sizeof(usb_sim_stat));
+    memset(&sie, 0, sizeof(sie));
+    sie.next_frame = SIM_FRAME_CYCLES;
+    hal_sim.count_manual = 1;
+    hal_sim.count = 0;
+}
+
+/// add a device to the devices reachable by tokens
+void USBSIM_Connect(USB_SIM_DEVICE *dev, USB_SIM_DEVICE *parent)
+{
+    USBSIM_Disconnect(dev);
+    dev->parent = parent;
+    dev->address = 0;
+    dev->next = sie.devices;
+    sie.devices = dev;
+}
+
+void USBSIM_Disconnect(USB_SIM_DEVICE *dev)
+{
+    USB_SIM_DEVICE **p;
+
+    for (p = &sie.devices; *p != NULL; p = &(*p)->next) {
+        if (*p == dev) {
+            *p = dev->next;
+            break;
+        }
+    }
+    dev->next = NULL;
+}
+
+/// plug a device in the root port
+void USBSIM_Attach(USB_SIM_DEVICE *dev)
+{
+    USBSIM_Detach();
+    if (dev->reset) {
+        dev->reset(dev);
+    }
+    USBSIM_Connect(dev, NULL);
+    sie.root = dev;
+    sim_sync();
+}
+
+/// unplug the device in the root port
+void USBSIM_Detach(void)
+{
+    USB_SIM_DEVICE *dev = sie.root;
+
+    if (!dev) {
+        return;
+    }
+    sie.root = NULL;
+    USBSIM_Disconnect(dev);
+    if (dev->reset) {
+        dev->reset(dev);
+    }
+    usb_sim.ir &= ~(1 << _U1IR_ATTACHIF_POSITION);
+    usb_sim.ir |= (1 << _U1IR_URSTIF_POSITION);    // DETACHIF
+    sim_sync();
+}
+
+#endif /* HAL_SIM */
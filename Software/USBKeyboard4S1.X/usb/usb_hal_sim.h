@@ -0,0 +1,460 @@
+/** @file usb_hal_sim.h
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief USB OTG module of PIC32MX emulated in memory (host build)
+ *
+ *  Selected by usb_hal.h when HAL_SIM is defined (see hal.h).
+ *  The registers used by the host stack are defined here with the same
+ *  names as in the XC32 device header, and usb_hal_pic32mx.h is used on
+ *  top of them, so the BDT and the stack are the same as on the target.
+ *
+ *  Each access goes through USBSIM_Reg(), so that a write to a SET/CLR
+ *  register is applied before the next access, and the SIE model in
+ *  usb_hal_sim.c sees pulses like U1CONbits.PPBRST.
+ *  Flags which are cleared by writing '1' and the token register are
+ *  written through USBHALClearStatus(), USBHALClearErrors(),
+ *  USBHALClearOTGStatus() and USBHALSendToken() (usb_hal_local.h).
+ *
+ *  Buffer addresses in the BDT are 32 bits, so the simulation must be
+ *  linked with -no-pie to keep static data and the heap under 4GB.
+ */
+
+#ifndef USB_HAL_SIM_H
+#define	USB_HAL_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef __PIC32__
+#define __PIC32__ 1
+#endif
+
+// ---- register block ----
+
+typedef struct {
+    volatile uint32_t otgir;
+    volatile uint32_t otgie;
+    volatile uint32_t otgstat;
+    volatile uint32_t otgcon;
+    volatile uint32_t pwrc;
+    volatile uint32_t ir;
+    volatile uint32_t ie;
+    volatile uint32_t eir;
+    volatile uint32_t eie;
+    volatile uint32_t stat;
+    volatile uint32_t con;
+    volatile uint32_t addr;
+    volatile uint32_t bdtp1;
+    volatile uint32_t frml;
+    volatile uint32_t frmh;
+    volatile uint32_t tok;
+    volatile uint32_t sof;
+    volatile uint32_t bdtp2;
+    volatile uint32_t bdtp3;
+    volatile uint32_t cnfg1;
+    volatile uint32_t ep[16][4];    // U1EPn, SET, CLR and INV like the SFR map
+    volatile uint32_t iec1;
+    volatile uint32_t ifs1;
+    volatile uint32_t ipc7;
+    volatile uint32_t syskey;
+    volatile uint32_t osccon;
+} USB_SIM_REGS;
+
+extern USB_SIM_REGS usb_sim;
+
+volatile uint32_t *USBSIM_Reg(volatile uint32_t *reg);
+volatile uint32_t *USBSIM_Set(volatile uint32_t *reg);
+volatile uint32_t *USBSIM_Clr(volatile uint32_t *reg);
+void USBSIM_SendToken(uint8_t token);
+uint32_t USBSIM_ToPhysical(uintptr_t p);
+
+#define USB_SIM_REG(r)              (*USBSIM_Reg(&usb_sim.r))
+#define USB_SIM_BITS(type, r)       (*(volatile type *)USBSIM_Reg(&usb_sim.r))
+
+// ---- bit layouts ----
+
+typedef union {
+    struct {
+        unsigned VBUSVDIF:1;
+        unsigned :1;
+        unsigned SESENDIF:1;
+        unsigned SESVDIF:1;
+        unsigned ACTVIF:1;
+        unsigned LSTATEIF:1;
+        unsigned T1MSECIF:1;
+        unsigned IDIF:1;
+    };
+    uint32_t w;
+} __U1OTGIRbits_t;
+
+typedef union {
+    struct {
+        unsigned VBUSVDIE:1;
+        unsigned :1;
+        unsigned SESENDIE:1;
+        unsigned SESVDIE:1;
+        unsigned ACTVIE:1;
+        unsigned LSTATEIE:1;
+        unsigned T1MSECIE:1;
+        unsigned IDIE:1;
+    };
+    uint32_t w;
+} __U1OTGIEbits_t;
+
+typedef union {
+    struct {
+        unsigned VBUSVD:1;
+        unsigned :1;
+        unsigned SESEND:1;
+        unsigned SESVD:1;
+        unsigned :1;
+        unsigned LSTATE:1;
+        unsigned :1;
+        unsigned ID:1;
+    };
+    uint32_t w;
+} __U1OTGSTATbits_t;
+
+typedef union {
+    struct {
+        unsigned USBPWR:1;
+        unsigned USUSPEND:1;
+        unsigned :1;
+        unsigned USBBUSY:1;
+        unsigned USLPGRD:1;
+        unsigned :2;
+        unsigned UACTPND:1;
+    };
+    struct {
+        unsigned :1;
+        unsigned USUSPND:1;
+    };
+    uint32_t w;
+} __U1PWRCbits_t;
+
+typedef union {
+    struct {
+        unsigned URSTIF:1;
+        unsigned UERRIF:1;
+        unsigned SOFIF:1;
+        unsigned TRNIF:1;
+        unsigned IDLEIF:1;
+        unsigned RESUMEIF:1;
+        unsigned ATTACHIF:1;
+        unsigned STALLIF:1;
+    };
+    struct {
+        unsigned DETACHIF:1;
+    };
+    uint32_t w;
+} __U1IRbits_t;
+
+typedef union {
+    struct {
+        unsigned URSTIE:1;
+        unsigned UERRIE:1;
+        unsigned SOFIE:1;
+        unsigned TRNIE:1;
+        unsigned IDLEIE:1;
+        unsigned RESUMEIE:1;
+        unsigned ATTACHIE:1;
+        unsigned STALLIE:1;
+    };
+    struct {
+        unsigned DETACHIE:1;
+    };
+    uint32_t w;
+} __U1IEbits_t;
+
+typedef union {
+    struct {
+        unsigned :2;
+        unsigned PPBI:1;
+        unsigned DIR:1;
+        unsigned ENDPT:4;
+    };
+    uint32_t w;
+} __U1STATbits_t;
+
+typedef union {
+    struct {
+        unsigned USBEN:1;
+        unsigned PPBRST:1;
+        unsigned RESUME:1;
+        unsigned HOSTEN:1;
+        unsigned USBRST:1;
+        unsigned PKTDIS:1;
+        unsigned SE0:1;
+        unsigned JSTATE:1;
+    };
+    struct {
+        unsigned SOFEN:1;
+        unsigned :4;
+        unsigned TOKBUSY:1;
+    };
+    uint32_t w;
+} __U1CONbits_t;
+
+typedef union {
+    struct {
+        unsigned DEVADDR:7;
+        unsigned LSPDEN:1;
+    };
+    uint32_t w;
+} __U1ADDRbits_t;
+
+typedef union {
+    struct {
+        unsigned EPHSHK:1;
+        unsigned EPSTALL:1;
+        unsigned EPTXEN:1;
+        unsigned EPRXEN:1;
+        unsigned EPCONDIS:1;
+        unsigned :1;
+        unsigned RETRYDIS:1;
+        unsigned LSPD:1;
+    };
+    uint32_t w;
+} __U1EP0bits_t;
+
+typedef union {
+    struct {
+        unsigned :3;
+        unsigned USBIE:1;
+    };
+    uint32_t w;
+} __IEC1bits_t;
+
+typedef union {
+    struct {
+        unsigned :3;
+        unsigned USBIF:1;
+    };
+    uint32_t w;
+} __IFS1bits_t;
+
+typedef union {
+    struct {
+        unsigned :16;
+        unsigned USBIS:2;
+        unsigned USBIP:3;
+    };
+    uint32_t w;
+} __IPC7bits_t;
+
+// ---- registers ----
+
+#define U1OTGIR         USB_SIM_REG(otgir)
+#define U1OTGIRbits     USB_SIM_BITS(__U1OTGIRbits_t, otgir)
+#define U1OTGIE         USB_SIM_REG(otgie)
+#define U1OTGIEbits     USB_SIM_BITS(__U1OTGIEbits_t, otgie)
+#define U1OTGIESET      (*USBSIM_Set(&usb_sim.otgie))
+#define U1OTGIECLR      (*USBSIM_Clr(&usb_sim.otgie))
+#define U1OTGSTAT       USB_SIM_REG(otgstat)
+#define U1OTGSTATbits   USB_SIM_BITS(__U1OTGSTATbits_t, otgstat)
+#define U1OTGCON        USB_SIM_REG(otgcon)
+#define U1OTGCONSET     (*USBSIM_Set(&usb_sim.otgcon))
+#define U1OTGCONCLR     (*USBSIM_Clr(&usb_sim.otgcon))
+#define U1PWRC          USB_SIM_REG(pwrc)
+#define U1PWRCbits      USB_SIM_BITS(__U1PWRCbits_t, pwrc)
+#define U1IR            USB_SIM_REG(ir)
+#define U1IRbits        USB_SIM_BITS(__U1IRbits_t, ir)
+#define U1IE            USB_SIM_REG(ie)
+#define U1IEbits        USB_SIM_BITS(__U1IEbits_t, ie)
+#define U1IESET         (*USBSIM_Set(&usb_sim.ie))
+#define U1IECLR         (*USBSIM_Clr(&usb_sim.ie))
+#define U1EIR           USB_SIM_REG(eir)
+#define U1EIE           USB_SIM_REG(eie)
+#define U1STAT          USB_SIM_REG(stat)
+#define U1STATbits      USB_SIM_BITS(__U1STATbits_t, stat)
+#define U1CON           USB_SIM_REG(con)
+#define U1CONbits       USB_SIM_BITS(__U1CONbits_t, con)
+#define U1ADDR          USB_SIM_REG(addr)
+#define U1ADDRbits      USB_SIM_BITS(__U1ADDRbits_t, addr)
+#define U1BDTP1         USB_SIM_REG(bdtp1)
+#define U1BDTP2         USB_SIM_REG(bdtp2)
+#define U1BDTP3         USB_SIM_REG(bdtp3)
+#define U1FRML          USB_SIM_REG(frml)
+#define U1FRMH          USB_SIM_REG(frmh)
+#define U1TOK           USB_SIM_REG(tok)
+#define U1SOF           USB_SIM_REG(sof)
+#define U1CNFG1         USB_SIM_REG(cnfg1)
+#define U1EP0           USB_SIM_REG(ep[0][0])
+#define U1EP0bits       USB_SIM_BITS(__U1EP0bits_t, ep[0][0])
+#define U1EP1           USB_SIM_REG(ep[1][0])
+#define U1EP2           USB_SIM_REG(ep[2][0])
+#define U1EP3           USB_SIM_REG(ep[3][0])
+#define U1EP4           USB_SIM_REG(ep[4][0])
+#define U1EP5           USB_SIM_REG(ep[5][0])
+#define U1EP6           USB_SIM_REG(ep[6][0])
+#define U1EP7           USB_SIM_REG(ep[7][0])
+#define U1EP8           USB_SIM_REG(ep[8][0])
+#define U1EP9           USB_SIM_REG(ep[9][0])
+#define U1EP10          USB_SIM_REG(ep[10][0])
+#define U1EP11          USB_SIM_REG(ep[11][0])
+#define U1EP12          USB_SIM_REG(ep[12][0])
+#define U1EP13          USB_SIM_REG(ep[13][0])
+#define U1EP14          USB_SIM_REG(ep[14][0])
+#define U1EP15          USB_SIM_REG(ep[15][0])
+
+#define IEC1            USB_SIM_REG(iec1)
+#define IEC1bits        USB_SIM_BITS(__IEC1bits_t, iec1)
+#define IEC1SET         (*USBSIM_Set(&usb_sim.iec1))
+#define IEC1CLR         (*USBSIM_Clr(&usb_sim.iec1))
+#define IFS1            USB_SIM_REG(ifs1)
+#define IFS1bits        USB_SIM_BITS(__IFS1bits_t, ifs1)
+#define IFS1SET         (*USBSIM_Set(&usb_sim.ifs1))
+#define IFS1CLR         (*USBSIM_Clr(&usb_sim.ifs1))
+#define IPC7            USB_SIM_REG(ipc7)
+#define IPC7bits        USB_SIM_BITS(__IPC7bits_t, ipc7)
+#define IPC7SET         (*USBSIM_Set(&usb_sim.ipc7))
+#define IPC7CLR         (*USBSIM_Clr(&usb_sim.ipc7))
+#define SYSKEY          USB_SIM_REG(syskey)
+#define OSCCON          USB_SIM_REG(osccon)
+
+// ---- bit masks (same as PIC32MX230F064B) ----
+
+#define _U1OTGIR_VBUSVDIF_POSITION  0
+#define _U1OTGIR_SESENDIF_POSITION  2
+#define _U1OTGIR_SESVDIF_POSITION   3
+#define _U1OTGIR_ACTVIF_POSITION    4
+#define _U1OTGIR_LSTATEIF_POSITION  5
+#define _U1OTGIR_T1MSECIF_POSITION  6
+#define _U1OTGIR_IDIF_POSITION      7
+
+#define _U1OTGIE_VBUSVDIE_MASK      0x01
+#define _U1OTGIE_SESENDIE_MASK      0x04
+#define _U1OTGIE_SESVDIE_MASK       0x08
+#define _U1OTGIE_ACTVIE_MASK        0x10
+#define _U1OTGIE_LSTATEIE_MASK      0x20
+#define _U1OTGIE_T1MSECIE_MASK      0x40
+#define _U1OTGIE_IDIE_MASK          0x80
+
+#define _U1OTGCON_VBUSDIS_MASK      0x01
+#define _U1OTGCON_VBUSCHG_MASK      0x02
+#define _U1OTGCON_OTGEN_MASK        0x04
+#define _U1OTGCON_VBUSON_MASK       0x08
+#define _U1OTGCON_DMPULDWN_MASK     0x10
+#define _U1OTGCON_DPPULDWN_MASK     0x20
+#define _U1OTGCON_DMPULUP_MASK      0x40
+#define _U1OTGCON_DPPULUP_MASK      0x80
+
+#define _U1PWRC_USBPWR_MASK         0x01
+#define _U1PWRC_USUSPEND_MASK       0x02
+
+#define _U1IR_URSTIF_POSITION       0
+#define _U1IR_UERRIF_POSITION       1
+#define _U1IR_SOFIF_POSITION        2
+#define _U1IR_TRNIF_POSITION        3
+#define _U1IR_IDLEIF_POSITION       4
+#define _U1IR_RESUMEIF_POSITION     5
+#define _U1IR_ATTACHIF_POSITION     6
+#define _U1IR_STALLIF_POSITION      7
+
+#define _U1IE_URSTIE_DETACHIE_MASK  0x01
+#define _U1IE_DETACHIE_MASK         0x01
+#define _U1IE_UERRIE_MASK           0x02
+#define _U1IE_SOFIE_MASK            0x04
+#define _U1IE_TRNIE_MASK            0x08
+#define _U1IE_IDLEIE_MASK           0x10
+#define _U1IE_RESUMEIE_MASK         0x20
+#define _U1IE_ATTACHIE_MASK         0x40
+#define _U1IE_STALLIE_MASK          0x80
+
+#define _U1EIR_PIDEF_MASK           0x01
+#define _U1EIR_EOFEF_MASK           0x02
+#define _U1EIR_CRC16EF_MASK         0x04
+#define _U1EIR_DFN8EF_MASK          0x08
+#define _U1EIR_BTOEF_MASK           0x10
+#define _U1EIR_DMAEF_MASK           0x20
+#define _U1EIR_BMXEF_MASK           0x40
+#define _U1EIR_BTSEF_MASK           0x80
+
+#define _U1EIE_PIDEE_MASK           0x01
+#define _U1EIE_CRC5EE_EOFEE_MASK    0x02
+#define _U1EIE_CRC16EE_MASK         0x04
+#define _U1EIE_DFN8EE_MASK          0x08
+#define _U1EIE_BTOEE_MASK           0x10
+#define _U1EIE_BTSEE_MASK           0x80
+
+#define _U1CON_USBEN_SOFEN_MASK     0x01
+#define _U1CON_PPBRST_MASK          0x02
+#define _U1CON_RESUME_MASK          0x04
+#define _U1CON_HOSTEN_MASK          0x08
+#define _U1CON_USBRST_MASK          0x10
+#define _U1CON_PKTDIS_TOKBUSY_MASK  0x20
+#define _U1CON_SE0_MASK             0x40
+#define _U1CON_JSTATE_MASK          0x80
+
+#define _IEC1_USBIE_MASK            0x00000008
+#define _IFS1_USBIF_MASK            0x00000008
+#define _IPC7_USBIS_MASK            0x00030000
+#define _IPC7_USBIP_MASK            0x001C0000
+#define _IPC7_USBIP_POSITION        18
+
+// physical address of a buffer in the BDT
+#define KVA_TO_PA(kva)              USBSIM_ToPhysical((uintptr_t)(kva))
+#define PA_TO_KVA1(pa)              ((uintptr_t)(pa))
+
+#define __builtin_enable_interrupts()   0
+#define __builtin_disable_interrupts()  0
+#define _wait()
+
+// ---- SIE model (usb_hal_sim.c) ----
+
+// time is counted in core timer cycles (24MHz), 2 cycles per FS bit
+#define USB_SIM_CYCLES_PER_MS       24000
+#define USB_SIM_CYCLES_PER_BIT      2
+
+typedef struct _USB_SIM_DEVICE USB_SIM_DEVICE;
+
+/// virtual device on the bus
+struct _USB_SIM_DEVICE {
+    const char     *name;
+    uint8_t         address;        // 0 after a bus reset
+    bool            low_speed;
+    /// one transaction of the device
+    /// pid: PID_SETUP, PID_OUT or PID_IN
+    /// data, len: data sent by the host, or the buffer for IN
+    ///            (len is the max size on entry and the sent size on exit)
+    /// returns the handshake (PID_ACK, PID_NAK, PID_STALL), the data PID
+    /// for IN (PID_DATA0, PID_DATA1), or 0 for no response
+    uint8_t       (*transaction)(USB_SIM_DEVICE *dev, uint8_t pid, uint8_t ep, uint8_t *data, uint16_t *len);
+    /// bus reset or power off
+    void          (*reset)(USB_SIM_DEVICE *dev);
+    void           *context;
+    // used by the SIE model
+    USB_SIM_DEVICE *parent;         // hub, or NULL on the root port
+    USB_SIM_DEVICE *next;           // list of the devices reachable by tokens
+};
+
+/// counters of the SIE model
+typedef struct {
+    uint32_t    frames;             // SOFs sent
+    uint32_t    tokens[16];         // tokens by PID (PID_SETUP, PID_OUT, PID_IN)
+    uint32_t    results[16];        // results by the PID written back to the BD
+    uint32_t    deferred;           // tokens held to the next frame by U1SOF
+    uint32_t    overruns;           // tokens written while the SIE was busy
+    uint32_t    bd_errors;          // BD not owned by the SIE (ping-pong mismatch)
+    uint32_t    speed_errors;       // LSPDEN / LSPD do not match the device
+    uint64_t    bit_times;          // bus time used by the transactions
+    uint32_t    isr_calls;          // calls of USB_HostInterruptHandler()
+    uint32_t    isr_stuck;          // flags left pending after the ISR
+    uint64_t    isr_ns;             // host time spent in the ISR
+} USB_SIM_STAT;
+
+extern USB_SIM_STAT usb_sim_stat;
+
+void USBSIM_Init(void);
+void USBSIM_Attach(USB_SIM_DEVICE *dev);
+void USBSIM_Detach(void);
+void USBSIM_Connect(USB_SIM_DEVICE *dev, USB_SIM_DEVICE *parent);
+void USBSIM_Disconnect(USB_SIM_DEVICE *dev);
+void USBSIM_Run(uint32_t cycles);
+uint64_t USBSIM_Now(void);
+
+#include "usb_hal_pic32mx.h"
+
+#endif	/* USB_HAL_SIM_H */
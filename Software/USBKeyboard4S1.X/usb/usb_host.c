@@ -33,8 +33,10 @@ please contact mla_licensing@microchip.com
 #include "usb_host_hub.h"
 #include "usb_struct_config_list.h"
 #include "usb_struct_interface.h"
+#include "usb_enum_cache.h"
 
 #include "../uart.h"
+#include "../boot_trace.h"
 
 #define USB_HUB_SUPPORT_INCLUDED 1
 
@@ -65,6 +67,10 @@ please contact mla_licensing@microchip.com
 #define USB_EP0DATA_DEFAULT_SIZE            64
 #define USB_DEVICE_DESCRIPTOR_DEFAULT_SIZE  18
 
+#ifdef USB_STATIC_POOL
+_Static_assert(USB_EP0DATA_DEFAULT_SIZE <= USB_POOL_MEDIUM_SIZE, "USB_EP0DATA_DEFAULT_SIZE does not fit in a medium block.");
+#endif
+
 //******************************************************************************
 //******************************************************************************
 // Section: Host Global Variables
@@ -77,6 +83,19 @@ typedef struct ST_USB_HOST_TIMER {
 
 static USB_HOST_TIMER           usbHostTimer;
 
+typedef struct ST_USB_INTR_PENDING {
+    uint16_t                    msecCount;                                  // The number of 1ms timer interrupts not processed yet.
+    uint16_t                    sofCount;                                   // The number of SOF interrupts not processed yet.
+    uint8_t                     trnPending;                                 // Transfer done interrupt is not processed yet.
+    uint8_t                     errPending;                                 // Error interrupt is not processed yet.
+#if defined(__PIC32__)
+    __U1STATbits_t              stat;                                       // U1STAT at transfer done.
+#endif
+    uint8_t                     eir;                                        // U1EIR at error.
+} USB_INTR_PENDING;
+
+static volatile USB_INTR_PENDING usbIntrPending;                            // Interrupts captured by USB_HostInterruptHandler.
+
 // These should all be moved into the USB_HOST_INFO structure.
 static uint8_t                  numCommandTries;                            // The number of times the current command has been tried.
 static uint8_t                  numEnumerationTries;                        // The number of times enumeration has been attempted on the attached device.
@@ -234,10 +253,12 @@ void *USBHost_GetDeviceInfo(uint8_t address)
 /***************************************************************************/
 void USBHost_DecreaseInterval( void )
 {
+    // Decrease interval count of endpoints in use
+    if (USB_ActiveEndpoints_DecreaseInterval()) return;
+
+    // The index is full, walk the lists of all devices.
     for(int i=1; i<USB_DEVICE_MAX_INFOS; i++) {
-        // Decrease interval count
-        USB_DEVICE_INFO *p = &usbDeviceInfos[i];
-        USB_InterfaceList_DecreaseInterval(p->pInterfaceList);
+        USB_InterfaceList_DecreaseInterval(usbDeviceInfos[i].pInterfaceList);
     }
 }
 
@@ -247,7 +268,7 @@ static void _USBHost_ClearTimer()
     usbHostTimer.numTimerInterrupts = 0;
     usbHostTimer.handler = NULL;
     U1OTGIECLR = U1OTGIE_INTERRUPT_T1MSECIF;
-    U1OTGIR = U1OTGIE_INTERRUPT_T1MSECIF;
+    USBHALClearOTGStatus( U1OTGIE_INTERRUPT_T1MSECIF );
 }
 
 /****************************************************************************/
@@ -255,7 +276,7 @@ void USBHost_StartTimer(uint8_t ms, USB_TIMER_HANDLER handler)
 {
     usbHostTimer.numTimerInterrupts = ms;
     usbHostTimer.handler = handler;
-    U1OTGIR                 = U1OTGIE_INTERRUPT_T1MSECIF; // The interrupt is cleared by writing a '1' to the flag.
+    USBHALClearOTGStatus( U1OTGIE_INTERRUPT_T1MSECIF ); // The interrupt is cleared by writing a '1' to the flag.
     U1OTGIESET              = U1OTGIE_INTERRUPT_T1MSECIF;
 }
 
@@ -534,7 +555,7 @@ bool USBHostInit(  unsigned long flags  )
 
     // Initialize other variables.
 //    pCurrentEndpoint                        = usbHostInfo.pEndpoint0;
-    usbHostState                            = STATE_DETACHED;
+    _USB_SetHostState(STATE_DETACHED);
     usbOverrideHostState                    = NO_STATE;
 //    usbDeviceInfo.deviceAddressAndSpeed     = 0;
 //    usbDeviceInfo.deviceAddress             = 0;
@@ -788,6 +809,7 @@ uint8_t USBHostIssueDeviceRequest( USB_DEVICE_INFO *deviceInfo
         {
             return USB_ILLEGAL_REQUEST;
         }
+        USB_InterfaceList_MapEndpoints(deviceInfo->pInterfaceList, deviceInfo->pEndpointMap);
     }
 
     // If the user is doing a CLEAR FEATURE(ENDPOINT_HALT), we must reset DATA0 for that endpoint.
@@ -945,6 +967,9 @@ uint8_t USBHostIssueDeviceRequestEx( USB_DEVICE_INFO *deviceInfo
                                         cleared by the application.
     USB_ENDPOINT_BUSY               - A Read is already in progress.
     USB_ENDPOINT_NOT_FOUND          - Invalid endpoint.
+    USB_ENDPOINT_NOT_SCHEDULED      - Interrupt request could not be queued,
+                                        the endpoint has no slot in the periodic
+                                        schedule and the unscheduled queue is full.
 
   Remarks:
     None
@@ -1002,9 +1027,7 @@ uint8_t USBHostReadWrite( bool is_write, USB_DEVICE_INFO *deviceInfo, USB_ENDPOI
             return USB_ENDPOINT_BUSY;
         }
 
-        USB_InitReadWrite( is_write, deviceInfo, endpointInfo, pData, size );
-
-        return USB_SUCCESS;
+        return USB_InitReadWrite( is_write, deviceInfo, endpointInfo, pData, size );
     }
     return USB_ENDPOINT_NOT_FOUND;   // Endpoint not found
 }
@@ -1052,7 +1075,7 @@ uint8_t USBHostResetDevice( uint8_t deviceAddress )
         return USB_ILLEGAL_REQUEST;
     }
 
-    usbHostState = STATE_DETACHED;
+    _USB_SetHostState(STATE_DETACHED);
 
     return USB_SUCCESS;
 }
@@ -1200,7 +1223,7 @@ uint8_t USBHostSetDeviceConfiguration( uint8_t deviceAddress, uint8_t configurat
     // the configuration, so we can jump into the Select Configuration state.
     // If the configuration value is invalid, the state machine will error and
     // put the device into a holding state.
-    usbHostState = STATE_CONFIGURING | SUBSTATE_SELECT_CONFIGURATION;
+    _USB_SetHostState(STATE_CONFIGURING | SUBSTATE_SELECT_CONFIGURATION);
 
     return USB_SUCCESS;
 }
@@ -1370,7 +1393,7 @@ uint8_t USBHostSuspendDevice( uint8_t deviceAddress )
     U1CONbits.SOFEN = 0;
 
     // Put the state machine in suspend mode.
-    usbHostState = STATE_RUNNING | SUBSTATE_SUSPEND_AND_RESUME | SUBSUBSTATE_SUSPEND;
+    _USB_SetHostState(STATE_RUNNING | SUBSTATE_SUSPEND_AND_RESUME | SUBSUBSTATE_SUSPEND);
 
     return USB_SUCCESS;
 }
@@ -1416,11 +1439,11 @@ static __inline__ void USBHostTask_Detached_Initialize(void)
 
     // Set up the hardware.
     U1IE                = 0;        // Clear and turn off interrupts.
-    U1IR                = 0xFF;
+    USBHALClearStatus( 0xFF );
     U1OTGIE             &= 0x8C;
-    U1OTGIR             = 0x7D;
+    USBHALClearOTGStatus( 0x7D );
     U1EIE               = 0;
-    U1EIR               = 0xFF;
+    USBHALClearErrors( 0xFF );
 
     _USBHost_ClearTimer();
     
@@ -1526,7 +1549,7 @@ static __inline__ void USBHostTask_Detached_TurnOnPower(void)
         U1IEbits.ATTACHIE = 1;
 
 #if defined(USB_ENABLE_1MS_EVENT)
-        U1OTGIR                 = USB_INTERRUPT_T1MSECIF; // The interrupt is cleared by writing a '1' to the flag.
+        USBHALClearOTGStatus( USB_INTERRUPT_T1MSECIF ); // The interrupt is cleared by writing a '1' to the flag.
         U1OTGIEbits.T1MSECIE    = 1;
 #endif
     }
@@ -1534,7 +1557,7 @@ static __inline__ void USBHostTask_Detached_TurnOnPower(void)
     else
     {
         usbRootHubInfo.flags.bPowerGoodPort0 = 0;
-        usbHostState = STATE_DETACHED | SUBSTATE_WAIT_FOR_POWER;
+        _USB_SetHostState(STATE_DETACHED | SUBSTATE_WAIT_FOR_POWER);
     }
 #endif
 }
@@ -1560,7 +1583,7 @@ static __inline__ void USBHostTask_Attached_Settle(void)
             UART_PutString( "HOST: Wait..." );
 #endif
             // Clear and turn on the DETACH interrupt.
-            U1IR                    = U1IE_INTERRUPT_DETACH;   // The interrupt is cleared by writing a '1' to the flag.
+            USBHALClearStatus( U1IE_INTERRUPT_DETACH );   // The interrupt is cleared by writing a '1' to the flag.
             U1IESET                 = U1IE_INTERRUPT_DETACH;
 
             // Configure and turn on the settling timer - 100ms.
@@ -1952,10 +1975,18 @@ static void USBHostTask_GetSetRequest(void)
                 if (usbHostInfo.tempCountConfigurations)
                 {
                     // There are more descriptors that we need to get.
-                    usbHostState = STATE_CONFIGURING | SUBSTATE_GET_CONFIG_DESCRIPTOR_SIZE;
+                    _USB_SetHostState(STATE_CONFIGURING | SUBSTATE_GET_CONFIG_DESCRIPTOR_SIZE);
                 }
                 else
                 {
+#ifdef USB_ENUM_CACHE
+                    if (deviceInfo->countConfigurations == 1)
+                    {
+                        USBEnumCache_PutConfig( deviceInfo->deviceAddress
+                            , deviceInfo->pConfigurationDescriptorList->descriptor->b
+                            , deviceInfo->pConfigurationDescriptorList->descriptor->wTotalLength );
+                    }
+#endif
                     // Start configuring the device.
                     _USB_SetNextSubState();
                 }
@@ -2119,11 +2150,33 @@ static __inline__ void USBHostTask_Configuring_InitConfiguration(void)
     {
         _USB_SetErrorCode( usbHostInfo, USB_HOLDING_CLIENT_INIT_ERROR );
         _USB_SetHoldState();
+        return;
     }
-    else
+
+#ifdef USB_ENUM_CACHE
     {
-        _USB_SetNextSubState();
+        const uint8_t *cached;
+        uint16_t length;
+
+        // A known device: take the configuration descriptor from the cache
+        // instead of GET_DESCRIPTOR, and select it at once.
+        cached = USBEnumCache_FindConfig( deviceInfo->deviceAddress, deviceInfo->deviceDescriptor, &length );
+        if (cached != NULL && USBStructConfigList_PushFront(&deviceInfo->pConfigurationDescriptorList
+                , usbHostInfo.tempCountConfigurations, length))
+        {
+#if defined (DEBUG_ENABLE)
+            UART_PutString( "HOST: Config desc in cache.\r\n" );
+#endif
+            memcpy(deviceInfo->pConfigurationDescriptorList->descriptor, cached, length);
+            deviceInfo->currentConfigurationDescriptor = deviceInfo->pConfigurationDescriptorList->descriptor;
+            usbHostInfo.tempCountConfigurations = 0;
+            _USB_SetHostState(STATE_CONFIGURING | SUBSTATE_SELECT_CONFIGURATION);
+            return;
+        }
     }
+#endif
+
+    _USB_SetNextSubState();
 }
 
 /****************************************************************************/
@@ -2142,6 +2195,7 @@ static __inline__ void USBHostTask_Configuring_SelectConfigration(void)
 #endif
             // Free the old configuration (if any)
             USB_InterfaceList_Clear(&deviceInfo->pInterfaceList);
+            USB_InterfaceList_MapEndpoints(deviceInfo->pInterfaceList, deviceInfo->pEndpointMap);
 //            pCurrentEndpoint = usbHostInfo.pEndpoint0;
 
             // If the configuration wasn't selected based on the VID & PID
@@ -2161,6 +2215,7 @@ static __inline__ void USBHostTask_Configuring_SelectConfigration(void)
                         // Free the memory allocated and
                         // advance to  next configuration
                         USB_InterfaceList_Clear(&deviceInfo->pInterfaceList);
+                        USB_InterfaceList_MapEndpoints(deviceInfo->pInterfaceList, deviceInfo->pEndpointMap);
 //                        pCurrentEndpoint = usbHostInfo.pEndpoint0;
                         pCurrentConfigurationNode = pCurrentConfigurationNode->next;
                     }
@@ -2178,6 +2233,7 @@ static __inline__ void USBHostTask_Configuring_SelectConfigration(void)
                 {
                     // Free the memory allocated, config attempt failed.
                     USB_InterfaceList_Clear(&deviceInfo->pInterfaceList);
+                    USB_InterfaceList_MapEndpoints(deviceInfo->pInterfaceList, deviceInfo->pEndpointMap);
 //                    pCurrentEndpoint = usbHostInfo.pEndpoint0;
                     pCurrentConfigurationNode = NULL;
                 }
@@ -2430,7 +2486,7 @@ static __inline__ void USBHostTask_Running_SuspendAndResume(void)
 
         case SUBSUBSTATE_RESUME_COMPLETE:
             // Go back to normal running.
-            usbHostState = STATE_RUNNING | SUBSTATE_NORMAL_RUN;
+            _USB_SetHostState(STATE_RUNNING | SUBSTATE_NORMAL_RUN);
             break;
     }
 }
@@ -2451,15 +2507,15 @@ static __inline__ void USBHostTask_Holding_HoldInit(void)
 
     U1CON               = U1CON_HOST_MODE_ENABLE | U1CON_SOF_DISABLE;                       // Turn of SOF's to cut down noise
     U1IE                = 0;
-    U1IR                = 0xFF;
+    USBHALClearStatus( 0xFF );
     U1OTGIE             &= 0x8C;
-    U1OTGIR             = 0x7D;
+    USBHALClearOTGStatus( 0x7D );
     U1EIE               = 0;
-    U1EIR               = 0xFF;
+    USBHALClearErrors( 0xFF );
     U1IEbits.DETACHIE   = 1;
 
 #if defined(USB_ENABLE_1MS_EVENT)
-    U1OTGIR                 = USB_INTERRUPT_T1MSECIF; // The interrupt is cleared by writing a '1' to the flag.
+    USBHALClearOTGStatus( USB_INTERRUPT_T1MSECIF ); // The interrupt is cleared by writing a '1' to the flag.
     U1OTGIEbits.T1MSECIE    = 1;
 #endif
 
@@ -2560,6 +2616,11 @@ static __inline__ void USBHostTask_Holding_HoldInit(void)
 
 void USBHostTasks( void )
 {
+#ifndef USB_HOST_TASKS_IN_ISR
+    // Process the interrupts captured by USB_HostInterruptHandler.
+    USB_HostInterruptTasks();
+#endif
+
     // The PIC32MX detach interrupt is not reliable.  If we are not in one of
     // the detached states, we'll do a check here to see if we've detached.
     // If the ATTACH bit is 0, we have detached.
@@ -2572,7 +2633,7 @@ void USBHostTasks( void )
             DEBUG_PutChar( ']' );
 #endif
 
-            usbHostState = STATE_DETACHED;
+            _USB_SetHostState(STATE_DETACHED);
         }
     #endif
 #endif
@@ -2588,7 +2649,7 @@ void USBHostTasks( void )
 #if defined (DEBUG_ENABLE)
         DEBUG_PutChar('>');
 #endif
-        usbHostState = usbOverrideHostState;
+        _USB_SetHostState(usbOverrideHostState);
         usbOverrideHostState = NO_STATE;
     }
 
@@ -2867,7 +2928,7 @@ void _USB_CheckCommandAndEnumerationAttempts( void )
     if (numCommandTries != 0)
     {
         // We still have retries left on this command.  Try again.
-        usbHostState &= ~SUBSUBSTATE_MASK;
+        _USB_SetHostState(usbHostState & ~SUBSUBSTATE_MASK);
     }
     else
     {
@@ -2877,7 +2938,7 @@ void _USB_CheckCommandAndEnumerationAttempts( void )
         if (numEnumerationTries != 0)
         {
             // We still have retries left to try to enumerate.  Reset and try again.
-            usbHostState = STATE_ATTACHED | SUBSTATE_RESET_DEVICE;
+            _USB_SetHostState(STATE_ATTACHED | SUBSTATE_RESET_DEVICE);
         }
         else
         {
@@ -3105,7 +3166,7 @@ bool _USB_FindDeviceLevelClientDriver( USB_DEVICE_DESCRIPTOR *pDesc )
 
   Description:
     This function searches the list of interfaces to try to find the specified
-    endpoint.
+    endpoint.  Endpoints in the endpoint map are found without the search.
 
   Precondition:
     None
@@ -3128,6 +3189,11 @@ USB_ENDPOINT_INFO * _USB_FindEndpoint( USB_DEVICE_INFO *deviceInfo, uint8_t endp
         return usbHostInfo.pEndpoint0;
     }
 
+    if (USB_ENDPOINT_MAP_HAS(endpoint))
+    {
+        return deviceInfo->pEndpointMap[USB_ENDPOINT_MAP_INDEX(endpoint)];
+    }
+
     return USB_InterfaceList_FindEndpoint( deviceInfo->pInterfaceList, endpoint );
 }
 
@@ -3163,6 +3229,7 @@ void _USB_FreeMemory( void )
     USB_FREE_AND_CLEAR( usbHostInfo.pEP0Data );
 
     USB_InterfaceList_Clear(&deviceInfo->pInterfaceList);
+    USB_InterfaceList_MapEndpoints(deviceInfo->pInterfaceList, deviceInfo->pEndpointMap);
 
 //    pCurrentEndpoint = usbHostInfo.pEndpoint0;
 }
@@ -3377,6 +3444,7 @@ bool _USB_ParseConfigurationDescriptor( uint8_t *descriptor )
     uint16_t                       wTotalLength;
 
     uint8_t                        bInterfaceNumber;
+    uint8_t                        bInterfaceClass;
     uint8_t                        bClientDriver;
 
     uint8_t                        currentAlternateSetting;
@@ -3486,6 +3554,7 @@ bool _USB_ParseConfigurationDescriptor( uint8_t *descriptor )
             bInterfaceNumber  = ptr->id.bInterfaceNumber;
             bAlternateSetting = ptr->id.bAlternateSetting;
             bNumEndpoints     = ptr->id.bNumEndpoints;
+            bInterfaceClass   = ptr->id.bInterfaceClass;
 
             // Get client driver index
             if (deviceInfo->flags.bfUseDeviceClientDriver)
@@ -3618,6 +3687,13 @@ bool _USB_ParseConfigurationDescriptor( uint8_t *descriptor )
                         // Initialize interval count
                         newEndpointInfo->wIntervalCount = newEndpointInfo->wInterval;
 
+                        // Interrupt endpoints are put on the periodic schedule
+                        // when their setting becomes the current one.
+                        // Hub status change is polled after the other devices.
+                        newEndpointInfo->bPeriod        = 0;
+                        newEndpointInfo->bPriority      = (bInterfaceClass == USB_HUB_CLASSCODE) ? USB_PERIODIC_PRIORITY_LOW : USB_PERIODIC_PRIORITY_HIGH;
+                        newEndpointInfo->bIndexed       = USB_ENDPOINT_INDEX_NONE;
+
                         // Put the new endpoint in the list.
                         newEndpointInfo->next           = newSettingInfo->pEndpointList;
                         newSettingInfo->pEndpointList   = newEndpointInfo;
@@ -3679,6 +3755,10 @@ bool _USB_ParseConfigurationDescriptor( uint8_t *descriptor )
 #endif
 
         deviceInfo->pInterfaceList = pTempInterfaceList;
+        USB_InterfaceList_MapEndpoints(pTempInterfaceList, deviceInfo->pEndpointMap);
+
+        // Put the periodic endpoints in the index walked every frame.
+        USB_InterfaceList_Activate(pTempInterfaceList);
         return true;
     }    
 }
@@ -3868,6 +3948,7 @@ void USBHost_DetachDeviceOnHUB( uint8_t hubAddress, uint8_t deviceAddress )
             sizeof(uint8_t)
         );
 
+        USBTrans_DropDeviceTransfers(deviceInfo);
         USBHostDeviceInfos_Clear(deviceAddress);
     }
 
@@ -3891,9 +3972,6 @@ void USBHost_DetachDeviceOnHUB( uint8_t hubAddress, uint8_t deviceAddress )
 /****************************************************************************/
 static __inline__ void USB_HostInterrupt_Timer(void)
 {
-    // The interrupt is cleared by writing a '1' to it.
-    U1OTGIR = U1OTGIE_INTERRUPT_T1MSECIF;
-
 #if defined(USB_ENABLE_1MS_EVENT) && defined(USB_HOST_APP_DATA_EVENT_HANDLER)
     msec_count++;
 
@@ -3965,7 +4043,7 @@ static void USB_HostInterrupt_Attach(void)
     // The attach interrupt is level, not edge, triggered.  If we clear it, it just
     // comes right back.  So clear the enable instead
     U1IEbits.ATTACHIE   = 0;
-    U1IR                = U1IE_INTERRUPT_ATTACH;
+    USBHALClearStatus( U1IE_INTERRUPT_ATTACH );
 
     if (usbHostState == (STATE_DETACHED | SUBSTATE_WAIT_FOR_DEVICE))
     {
@@ -3991,7 +4069,7 @@ static void USB_HostInterrupt_Detach(void)
     DEBUG_PutString( "Detach\r\n" );
 #endif
 
-    U1IR                    = U1IE_INTERRUPT_DETACH;
+    USBHALClearStatus( U1IE_INTERRUPT_DETACH );
     U1IEbits.DETACHIE       = 0;
     usbOverrideHostState    = STATE_DETACHED;
 
@@ -4050,7 +4128,12 @@ void USB_HostInterruptHandler(void)
     // One Millisecond Timer ISR
     if (U1OTGIEbits.T1MSECIE && U1OTGIRbits.T1MSECIF)
     {
-        USB_HostInterrupt_Timer();
+        // The interrupt is cleared by writing a '1' to it.
+        USBHALClearOTGStatus( U1OTGIE_INTERRUPT_T1MSECIF );
+        if (usbIntrPending.msecCount < 0xFFFF)
+        {
+            usbIntrPending.msecCount++;
+        }
     }
 
     // -------------------------------------------------------------------------
@@ -4079,7 +4162,7 @@ void USB_HostInterruptHandler(void)
          USBOTGInitialize();
 
          //Clear Interrupt Flag
-         U1OTGIR = 0x80;
+         USBHALClearOTGStatus( 0x80 );
     }
 
     // -------------------------------------------------------------------------
@@ -4094,7 +4177,7 @@ void USB_HostInterruptHandler(void)
         }
 
         //Clear Interrupt Flag
-        U1OTGIR = 0x04;
+        USBHALClearOTGStatus( 0x04 );
     }
 
     // -------------------------------------------------------------------------
@@ -4119,7 +4202,7 @@ void USB_HostInterruptHandler(void)
             }
         }
 
-        U1OTGIR = 0x08;
+        USBHALClearOTGStatus( 0x08 );
     }
 
     // -------------------------------------------------------------------------
@@ -4130,31 +4213,32 @@ void USB_HostInterruptHandler(void)
         USB_OTGEventHandler (0, OTG_EVENT_RESUME_SIGNALING,0, 0 );
 
         //Clear Resume Interrupt Flag
-        U1IR = 0x20;
+        USBHALClearStatus( 0x20 );
     }
 #endif
 
 
     // -------------------------------------------------------------------------
-    // Transfer Done ISR - only process if there was no error
-
-    if ((U1IEbits.TRNIE && U1IRbits.TRNIF) &&
-        (!(U1IEbits.UERRIE && U1IRbits.UERRIF)
-#ifdef USB_SUPPORT_ISOCHRONOUS_TRANSFERS
-            || (pCurrentEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS)
-#endif
-        )
-    ) {
-        USB_HostInterrupt_Transfer();
-    } // U1IRbits.TRNIF
+    // Transfer Done ISR
+    // Only one token is on the bus at a time, so one status is enough.
 
+    if (U1IEbits.TRNIE && U1IRbits.TRNIF)
+    {
+        usbIntrPending.stat = U1STATbits;   // Read the status register before clearing the flag.
+        usbIntrPending.trnPending = 1;
+        USBHALClearStatus( U1IE_INTERRUPT_TRANSFER );     // Clear the interrupt by writing a '1' to the flag.
+    }
 
     // -------------------------------------------------------------------------
     // Start-of-Frame ISR
 
     if (U1IEbits.SOFIE && U1IRbits.SOFIF)
     {
-        USB_HostInterrupt_SOF();
+        USBHALClearStatus( U1IE_INTERRUPT_SOF );          // Clear the interrupt by writing a '1' to the flag.
+        if (usbIntrPending.sofCount < 0xFFFF)
+        {
+            usbIntrPending.sofCount++;
+        }
     }
 
     // -------------------------------------------------------------------------
@@ -4162,7 +4246,10 @@ void USB_HostInterruptHandler(void)
 
     if (U1IEbits.UERRIE && U1IRbits.UERRIF)
     {
-        USB_HostInterrupt_Error();
+        usbIntrPending.eir = (uint8_t)U1EIR;
+        usbIntrPending.errPending = 1;
+        USBHALClearErrors( 0xFF );                       // Clear the interrupts by writing '1' to the flags.
+        USBHALClearStatus( U1IE_INTERRUPT_ERROR );        // Clear the interrupt by writing a '1' to the flag.
     }
 
 #ifdef DEBUG_ENABLE
@@ -4170,6 +4257,88 @@ void USB_HostInterruptHandler(void)
         DEBUG_PutStringHexU8( "Intr: ", U1IE & U1IR );
     }
 #endif
+
+#ifdef USB_HOST_TASKS_IN_ISR
+    USB_HostInterruptTasks();
+#endif
+}
+
+/****************************************************************************
+  Function:
+    void USB_HostInterruptTasks( void )
+
+  Summary:
+    This routine processes the interrupts captured by
+    USB_HostInterruptHandler().
+
+  Description:
+    The interrupt handler only clears the flags and keeps the status
+    registers.  Transfer done, error, start of frame and 1ms timer are
+    processed here in the main loop, so that the time spent in the USB
+    interrupt stays short.  The pending counts are 16 bits and saturate,
+    so a long stall of the main loop (flash erase, UART dump) does not
+    lose frames.
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    None
+
+  Remarks:
+    This is called from USBHostTasks(), or at the end of the interrupt
+    handler when USB_HOST_TASKS_IN_ISR is defined.
+  ***************************************************************************/
+void USB_HostInterruptTasks( void )
+{
+    uint32_t        usbIE;
+    uint16_t        msecCount;
+    uint16_t        sofCount;
+    uint8_t         trnPending;
+    uint8_t         errPending;
+#if defined(__PIC32__)
+    __U1STATbits_t  stat;
+#endif
+    uint8_t         eir;
+
+    // Take the captured interrupts.
+    usbIE = IEC1 & _IEC1_USBIE_MASK;
+    IEC1CLR = _IEC1_USBIE_MASK;
+    msecCount   = usbIntrPending.msecCount;
+    sofCount    = usbIntrPending.sofCount;
+    trnPending  = usbIntrPending.trnPending;
+    errPending  = usbIntrPending.errPending;
+    stat        = usbIntrPending.stat;
+    eir         = usbIntrPending.eir;
+    usbIntrPending.msecCount    = 0;
+    usbIntrPending.sofCount     = 0;
+    usbIntrPending.trnPending   = 0;
+    usbIntrPending.errPending   = 0;
+    IEC1SET = usbIE;
+
+    while (msecCount--)
+    {
+        USB_HostInterrupt_Timer();
+    }
+
+    // The error is processed first, then the transfer done comes after.
+    if (errPending)
+    {
+        USB_HostInterrupt_Error(eir);
+    }
+
+    if (trnPending)
+    {
+        USB_HostInterrupt_Transfer(stat);
+    }
+
+    if (sofCount)
+    {
+        USB_HostInterrupt_SOF(sofCount);
+    }
 }
 
 /*************************************************************************
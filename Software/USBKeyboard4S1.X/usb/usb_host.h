@@ -280,6 +280,8 @@ typedef struct _USB_DEVICE_INFO
     USB_CONFIGURATION_DESCRIPTOR *currentConfigurationDescriptor; // Descriptor of the current Configuration.
 
     USB_INTERFACE_INFO    *pInterfaceList;                     // List of interfaces on the attached device.
+
+    USB_ENDPOINT_INFO     *pEndpointMap[USB_ENDPOINT_MAP_SIZE]; // Endpoints of the current settings indexed by address.
 } USB_DEVICE_INFO;
 
 
@@ -1056,6 +1058,9 @@ uint8_t    USBHostIssueDeviceRequestEx( USB_DEVICE_INFO *deviceInfo
                                         cleared by the application.
     USB_ENDPOINT_BUSY               - A Read is already in progress.
     USB_ENDPOINT_NOT_FOUND          - Invalid endpoint.
+    USB_ENDPOINT_NOT_SCHEDULED      - Interrupt request could not be queued,
+                                        the endpoint has no slot in the periodic
+                                        schedule and the unscheduled queue is full.
 
   Remarks:
     None
@@ -1376,6 +1381,30 @@ void USBHost_DetachDeviceOnHUB( uint8_t hubAddress, uint8_t deviceAddress );
   ***************************************************************************/
 void USB_HostInterruptHandler(void);
 
+/****************************************************************************
+  Function:
+    void USB_HostInterruptTasks(void);
+
+  Summary:
+   This function processes the interrupts captured by
+   USB_HostInterruptHandler().
+
+  Description:
+   Transfer done, error, start of frame and 1ms timer interrupts are
+   processed in the main loop by this function.  It is called from
+   USBHostTasks().
+
+  Precondition:
+    Should only be called when in host mode.
+
+  Parameters:
+    None
+
+  Return Values:
+    None
+  ***************************************************************************/
+void USB_HostInterruptTasks(void);
+
 #endif /* __USBHOST_H__ */
 
 // *****************************************************************************
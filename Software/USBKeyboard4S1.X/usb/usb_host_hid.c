@@ -28,7 +28,9 @@ please contact mla_licensing@microchip.com
 #include "usb_host_local.h"
 #include "usb_host_hid.h"
 #include "usb_host_hid_parser.h"
+#include "usb_enum_cache.h"
 #include "uart.h"
+#include "boot_trace.h"
 
 // *****************************************************************************
 // *****************************************************************************
@@ -123,6 +125,10 @@ typedef struct _USB_HID_INTERFACE_DETAILS
     uint8_t                             endpointPollInterval; // Polling rate of corresponding interface.
 }   USB_HID_INTERFACE_DETAILS;
 
+#ifdef USB_STATIC_POOL
+_Static_assert(sizeof(USB_HID_INTERFACE_DETAILS) <= USB_POOL_SMALL_SIZE, "USB_HID_INTERFACE_DETAILS does not fit in a small block.");
+#endif
+
 //------------------------------------------------------------------------------
 /*  USB HID Transfer Information
 
@@ -131,6 +137,7 @@ typedef struct _USB_HID_INTERFACE_DETAILS
 typedef struct _USB_HID_TRANSFER_INFO
 {
     uint8_t                             state;                 // State of the endpoint.
+    uint8_t                             errorCode;             // Error code of the last transfer.
     uint8_t                             bytesTransferred;      // Number of bytes transferred to/from the user's data buffer.
     uint16_t                            reportId;              // Report ID of the current transfer.
     uint8_t                             *userData;              // Data pointer to application buffer.
@@ -168,7 +175,7 @@ typedef struct _USB_HID_DEVICE_INFO
         uint8_t                         val;
     }                                   flags;
     uint8_t                             driverSupported;        // If HID driver supports requested Class,Subclass & Protocol.
-    uint8_t                             errorCode;              // Error code of last error.
+    uint8_t                             errorCode;              // Error code of last device error (transfer errors are in transferIN/OUT).
     uint8_t                             state;                  // State machine state of the device.
     uint8_t                             returnState;            // State to return to after performing error handling.
     uint8_t                             noOfInterfaces;         // Total number of interfaces in the device.
@@ -177,6 +184,22 @@ typedef struct _USB_HID_DEVICE_INFO
     USB_HID_TRANSFER_INFO               transferOUT;            // OUT transfer information
 } USB_HID_DEVICE_INFO;
 
+//------------------------------------------------------------------------------
+/*  USB HID Transfer Handle
+
+   This structure holds the device, interface and endpoint resolved by
+   USBHostHIDOpen().
+*/
+typedef struct _USB_HID_HANDLE_INFO
+{
+    USB_HID_DEVICE_INFO                *device;                 // Device of the handle (NULL: closed).
+    USB_HID_TRANSFER_INFO              *transfer;               // Transfer information of the direction.
+    USB_ENDPOINT_INFO                  *endpoint;               // Endpoint (NULL: control transfer).
+    USB_HID_TRANSFER_CALLBACK           callback;               // Called when a transfer is finished.
+    uint8_t                             interface;              // Interface number.
+    bool                                is_write;               // Direction (true: OUT).
+} USB_HID_HANDLE_INFO;
+
 
 //******************************************************************************
 //******************************************************************************
@@ -186,6 +209,10 @@ typedef struct _USB_HID_DEVICE_INFO
 
 static void _USBHostHID_FreeRptDecriptorDataMem(uint8_t deviceAddress);
 static void _USBHostHID_ResetStateJump( uint8_t i );
+static void _USBHostHID_NotifyCallback( uint8_t i, bool is_write );
+#ifdef USB_ENUM_CACHE
+static bool _USBHostHID_ReadCachedReportDescriptor( uint8_t i );
+#endif
 
 
 //******************************************************************************
@@ -194,36 +221,47 @@ static void _USBHostHID_ResetStateJump( uint8_t i );
 //******************************************************************************
 //******************************************************************************
 
+// Set the state of a HID device; the boot trace logs each change of it.
+#ifdef BOOT_TRACE_ENABLE
+    #define _USBHostHID_SetState(i, x)              { deviceInfoHID[i].state = (x); BOOT_TRACE_State(BOOT_TRACE_HID, (i), deviceInfoHID[i].state); }
+#else
+    #define _USBHostHID_SetState(i, x)              { deviceInfoHID[i].state = (x); }
+#endif
+
 #define _USBHostHID_LockDevice(x)                   {                                                   \
                                                         deviceInfoHID[i].errorCode  = x;                \
-                                                        deviceInfoHID[i].state      = STATE_HID_HOLDING;    \
+                                                        _USBHostHID_SetState(i, STATE_HID_HOLDING);    \
                                                     }
 
 #ifdef USB_HID_ENABLE_TRANSFER_EVENT
     #define _USBHostHID_TerminateReadTransfer( error )  {                                                                                   \
-                                                            deviceInfoHID[i].errorCode          = error;                                    \
-                                                            deviceInfoHID[i].state              = STATE_HID_RUNNING;                            \
+                                                            deviceInfoHID[i].transferIN.errorCode   = error;                                \
+                                                            _USBHostHID_SetState(i, STATE_HID_RUNNING);                            \
                                                             deviceInfoHID[i].transferIN.state   = STATE_HID_TRANSFER_WAITING;                   \
                                                             USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress,                  \
                                                                     EVENT_HID_READ_DONE, &transferEventData, sizeof(HID_TRANSFER_DATA) );   \
+                                                            _USBHostHID_NotifyCallback( i, false );                                         \
                                                         }
     #define _USBHostHID_TerminateWriteTransfer( error ) {                                                                                   \
-                                                            deviceInfoHID[i].errorCode          = error;                                    \
-                                                            deviceInfoHID[i].state              = STATE_HID_RUNNING;                            \
+                                                            deviceInfoHID[i].transferOUT.errorCode  = error;                                \
+                                                            _USBHostHID_SetState(i, STATE_HID_RUNNING);                            \
                                                             deviceInfoHID[i].transferOUT.state  = STATE_HID_TRANSFER_WAITING;                   \
                                                             USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress,                  \
                                                                     EVENT_HID_WRITE_DONE, &transferEventData, sizeof(HID_TRANSFER_DATA) );  \
+                                                            _USBHostHID_NotifyCallback( i, true );                                          \
                                                         }
 #else
     #define _USBHostHID_TerminateReadTransfer( error )  {                                                                   \
-                                                            deviceInfoHID[i].errorCode          = error;                    \
-                                                            deviceInfoHID[i].state              = STATE_HID_RUNNING;            \
+                                                            deviceInfoHID[i].transferIN.errorCode   = error;                \
+                                                            _USBHostHID_SetState(i, STATE_HID_RUNNING);            \
                                                             deviceInfoHID[i].transferIN.state   = STATE_HID_TRANSFER_WAITING;   \
+                                                            _USBHostHID_NotifyCallback( i, false );                         \
                                                         }
     #define _USBHostHID_TerminateWriteTransfer( error ) {                                                                   \
-                                                            deviceInfoHID[i].errorCode          = error;                    \
-                                                            deviceInfoHID[i].state              = STATE_HID_RUNNING;            \
+                                                            deviceInfoHID[i].transferOUT.errorCode  = error;                \
+                                                            _USBHostHID_SetState(i, STATE_HID_RUNNING);            \
                                                             deviceInfoHID[i].transferOUT.state  = STATE_HID_TRANSFER_WAITING;   \
+                                                            _USBHostHID_NotifyCallback( i, true );                          \
                                                         }
 #endif
 
@@ -236,6 +274,7 @@ static void _USBHostHID_ResetStateJump( uint8_t i );
 static USB_HID_DEVICE_INFO          deviceInfoHID[USB_MAX_HID_DEVICES] __attribute__ ((aligned));
 static USB_HID_INTERFACE_DETAILS*   pInterfaceDetails = NULL;
 static USB_HID_INTERFACE_DETAILS*   pCurrInterfaceDetails = NULL;
+static USB_HID_HANDLE_INFO          handleInfoHID[USB_MAX_HID_DEVICES][2];
 
 #ifdef USB_HID_ENABLE_TRANSFER_EVENT
     static HID_TRANSFER_DATA            transferEventData;
@@ -381,88 +420,165 @@ uint8_t    USBHostHIDDeviceStatus( uint8_t deviceAddress )
 
 /*******************************************************************************
   Function:
-    uint8_t USBHostHIDRead( uint8_t deviceAddress,uint8_t reportid, uint8_t interface,
-                uint8_t size, uint8_t *data)
+    USB_HID_HANDLE USBHostHIDOpen( bool is_write, uint8_t deviceAddress, uint8_t interface )
 
   Summary:
-     This function starts a Get report transfer request from the device.
+    This function gets the handle for reading or writing reports.
 
   Precondition:
-    None
+    The report descriptor of the device has been parsed.
 
   Parameters:
+    bool is_write              - true: output report  false: input report
     uint8_t deviceAddress      - Device address
-    uint8_t reportid           - Report ID of the requested report
     uint8_t interface          - Interface number
+
+  Return Values:
+    handle  - handle of the transfer
+    NULL    - No device or interface is found
+
+  Remarks:
+    The device and the interface are searched only here. The callback set
+    on the handle is kept until the device is detached.
+*******************************************************************************/
+USB_HID_HANDLE USBHostHIDOpen( bool is_write, uint8_t deviceAddress, uint8_t interface )
+{
+    uint8_t    i;
+    USB_HID_INTERFACE_DETAILS *pDetails;
+    USB_HID_HANDLE_INFO *handle;
+
+    // Find the correct device.
+    for (i=0; (i<USB_MAX_HID_DEVICES) && (deviceInfoHID[i].ID.deviceAddress != deviceAddress); i++);
+    if ((i == USB_MAX_HID_DEVICES) || (deviceAddress == 0))
+    {
+        return NULL;
+    }
+
+    // Find the interface.
+    pDetails = pInterfaceDetails;
+    while((pDetails != NULL) && (pDetails->interfaceNumber != interface))
+    {
+        pDetails = pDetails->next;
+    }
+    if (pDetails == NULL)
+    {
+        return NULL;
+    }
+
+    handle = &handleInfoHID[i][is_write ? 1 : 0];
+    handle->device      = &deviceInfoHID[i];
+    handle->is_write    = is_write;
+    handle->interface   = interface;
+    if (is_write) {
+        handle->transfer = &deviceInfoHID[i].transferOUT;
+        handle->endpoint = pDetails->endpointOUT;
+    } else {
+        handle->transfer = &deviceInfoHID[i].transferIN;
+        handle->endpoint = pDetails->endpointIN;
+    }
+    return handle;
+}
+
+/*******************************************************************************
+  Function:
+    void USBHostHIDSetCallback( USB_HID_HANDLE handle, USB_HID_TRANSFER_CALLBACK callback )
+
+  Summary:
+    This function registers the function called when a transfer on the
+    handle is finished.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle               - Handle got by USBHostHIDOpen()
+    USB_HID_TRANSFER_CALLBACK callback  - Function to call (NULL: none)
+
+  Returns:
+    None
+
+  Remarks:
+    The callback is called in the transfer event of USBHostTasks(), as soon
+    as the completion is taken from the event queue.
+*******************************************************************************/
+void USBHostHIDSetCallback( USB_HID_HANDLE handle, USB_HID_TRANSFER_CALLBACK callback )
+{
+    if (handle != NULL)
+    {
+        handle->callback = callback;
+    }
+}
+
+/*******************************************************************************
+  Function:
+    uint8_t USBHostHIDTransfer( USB_HID_HANDLE handle, uint8_t reportid,
+                uint8_t size, uint8_t *data )
+
+  Summary:
+    This function starts a report transfer on the opened handle.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle      - Handle got by USBHostHIDOpen()
+    uint8_t reportid           - Report ID of the report
     uint8_t size               - Byte size of the data buffer
     uint8_t *data              - Pointer to the data buffer
 
   Return Values:
     USB_SUCCESS                 - Request started successfully
-    USB_HID_DEVICE_NOT_FOUND    - No device with specified address
+    USB_HID_DEVICE_NOT_FOUND    - Handle is closed
     USB_HID_DEVICE_BUSY         - Device not in proper state for
                                   performing a transfer
-    Others                      - Return values from USBHostRead()
+    Others                      - Return values from USBHostReadWrite()
 
   Remarks:
-    None
+    An output report is sent by SET_REPORT request if the interface has
+    no interrupt OUT endpoint.
 *******************************************************************************/
-uint8_t USBHostHIDReadWrite( bool is_write, uint8_t deviceAddress, uint8_t reportid, uint8_t interface,
+uint8_t USBHostHIDTransfer( USB_HID_HANDLE handle, uint8_t reportid,
                 uint8_t size, uint8_t *data )
 {
-    uint8_t    i;
     uint8_t    errorCode;
+    USB_HID_DEVICE_INFO *device;
     USB_HID_TRANSFER_INFO *transfer;
 
-    // Find the correct device.
-    for (i=0; (i<USB_MAX_HID_DEVICES) && (deviceInfoHID[i].ID.deviceAddress != deviceAddress); i++);
-    if (i == USB_MAX_HID_DEVICES)
+    if ((handle == NULL) || (handle->device == NULL))
     {
         return USB_HID_DEVICE_NOT_FOUND;
     }
+    device = handle->device;
+    transfer = handle->transfer;
 
-    pCurrInterfaceDetails = pInterfaceDetails;
-    while((pCurrInterfaceDetails != NULL) && (pCurrInterfaceDetails->interfaceNumber != interface))
-    {
-        pCurrInterfaceDetails = pCurrInterfaceDetails->next;
-    }
     // Make sure the device is in a state ready to read/write.
-    if (is_write) {
-        transfer = &deviceInfoHID[i].transferOUT;
-        transfer->endpoint = pCurrInterfaceDetails->endpointOUT;
-    } else {
-        transfer = &deviceInfoHID[i].transferIN;
-        transfer->endpoint = pCurrInterfaceDetails->endpointIN;
-    }
-    
-    if ( ! ( ( deviceInfoHID[i].state == STATE_HID_RUNNING ) &&
+    if ( ! ( ( device->state == STATE_HID_RUNNING ) &&
              ( transfer->state == STATE_HID_TRANSFER_WAITING ) ) )
     {
         return USB_HID_DEVICE_BUSY;
     }
 
     // Initialize the transfer information.
+    transfer->endpoint          = handle->endpoint;
     transfer->bytesTransferred  = 0;
     transfer->userData          = data;
     transfer->reportSize        = size;
     transfer->reportId          = reportid;
-    transfer->interface         = interface;
-    deviceInfoHID[i].errorCode  = USB_SUCCESS;
-    if (is_write && transfer->endpoint == 0x00) {
+    transfer->interface         = handle->interface;
+    transfer->errorCode         = USB_SUCCESS;
+    if (handle->is_write && transfer->endpoint == NULL) {
         transfer->reportId |= ((uint16_t)USB_HID_OUTPUT_REPORT << 8);
         // endpoint 0 is control
-        errorCode = USBHostIssueDeviceRequestEx( deviceInfoHID[i].pDeviceInfo, USB_SETUP_HOST_TO_DEVICE | USB_SETUP_TYPE_CLASS | USB_SETUP_RECIPIENT_INTERFACE,
+        errorCode = USBHostIssueDeviceRequestEx( device->pDeviceInfo, USB_SETUP_HOST_TO_DEVICE | USB_SETUP_TYPE_CLASS | USB_SETUP_RECIPIENT_INTERFACE,
                         USB_HID_SET_REPORT, transfer->reportId, transfer->interface, transfer->reportSize,
-                        transfer->userData, deviceInfoHID[i].ID.clientDriverID
+                        transfer->userData, device->ID.clientDriverID
 #ifdef DEBUG_ENABLE
                         ,0x0301
 #endif
                     );
 
     } else {
-//        errorCode = USBHostReadWrite( is_write, deviceInfoHID[i].ID.deviceAddress, transfer->endpoint,
-//                                 transfer->userData, transfer->reportSize );
-        errorCode = USBHostReadWrite( is_write, deviceInfoHID[i].pDeviceInfo, transfer->endpoint,
+        errorCode = USBHostReadWrite( handle->is_write, device->pDeviceInfo, transfer->endpoint,
                                 transfer->userData, transfer->reportSize );
 
     }
@@ -472,12 +588,128 @@ uint8_t USBHostHIDReadWrite( bool is_write, uint8_t deviceAddress, uint8_t repor
     }
     else
     {
-        deviceInfoHID[i].errorCode = errorCode;
+        transfer->errorCode = errorCode;
     }
 
     return errorCode;
 }
 
+/*******************************************************************************
+  Function:
+    bool USBHostHIDTransferUsesControl( USB_HID_HANDLE handle )
+
+  Summary:
+    This function indicates whether or not a report on the handle is sent
+    by SET_REPORT request on endpoint 0.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle  - Handle got by USBHostHIDOpen()
+
+  Return Values:
+    true    - Report is sent on endpoint 0
+    false   - Report is sent on the interrupt endpoint
+
+  Remarks:
+    Only a write handle can use endpoint 0.
+*******************************************************************************/
+bool USBHostHIDTransferUsesControl( USB_HID_HANDLE handle )
+{
+    return ((handle != NULL) && handle->is_write && (handle->endpoint == NULL));
+}
+
+/*******************************************************************************
+  Function:
+    bool USBHostHIDTransferIsComplete( USB_HID_HANDLE handle, uint8_t *errorCode, uint8_t *byteCount )
+
+  Summary:
+    This function indicates whether or not the last transfer on the handle
+    is complete.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle  - Handle got by USBHostHIDOpen()
+    uint8_t *errorCode     - Error code from last transfer
+    uint8_t *byteCount     - Number of bytes transferred
+
+  Return Values:
+    true    - Transfer is complete, errorCode and byteCount are valid
+    false   - Transfer is not complete, errorCode and byteCount are not valid
+*******************************************************************************/
+bool USBHostHIDTransferIsComplete ( USB_HID_HANDLE handle, uint8_t *errorCode, uint8_t *byteCount )
+{
+    if ((handle == NULL) || (handle->device == NULL) || (handle->device->state == STATE_HID_DETACHED))
+    {
+        *errorCode = USB_HID_DEVICE_NOT_FOUND;
+        *byteCount = 0;
+        return true;
+    }
+
+    *errorCode = handle->transfer->errorCode;
+    *byteCount = handle->transfer->bytesTransferred;
+
+    return (handle->transfer->state == STATE_HID_TRANSFER_WAITING);
+}
+
+/*******************************************************************************/
+static void _USBHostHID_NotifyCallback( uint8_t i, bool is_write )
+{
+    USB_HID_HANDLE_INFO *handle = &handleInfoHID[i][is_write ? 1 : 0];
+    USB_HID_TRANSFER_INFO *transfer = handle->transfer;
+
+    if ((handle->device == NULL) || (handle->callback == NULL))
+    {
+        return;
+    }
+    handle->callback( handle, transfer->errorCode, transfer->userData, transfer->bytesTransferred );
+}
+
+/*******************************************************************************
+  Function:
+    uint8_t USBHostHIDRead( uint8_t deviceAddress,uint8_t reportid, uint8_t interface,
+                uint8_t size, uint8_t *data)
+
+  Summary:
+     This function starts a Get report transfer request from the device.
+
+  Precondition:
+    None
+
+  Parameters:
+    uint8_t deviceAddress      - Device address
+    uint8_t reportid           - Report ID of the requested report
+    uint8_t interface          - Interface number
+    uint8_t size               - Byte size of the data buffer
+    uint8_t *data              - Pointer to the data buffer
+
+  Return Values:
+    USB_SUCCESS                 - Request started successfully
+    USB_HID_DEVICE_NOT_FOUND    - No device with specified address
+    USB_HID_DEVICE_BUSY         - Device not in proper state for
+                                  performing a transfer
+    Others                      - Return values from USBHostRead()
+
+  Remarks:
+    This searches the device and the interface on every call.
+    Use USBHostHIDOpen() and USBHostHIDTransfer() on the hot path.
+*******************************************************************************/
+uint8_t USBHostHIDReadWrite( bool is_write, uint8_t deviceAddress, uint8_t reportid, uint8_t interface,
+                uint8_t size, uint8_t *data )
+{
+    USB_HID_HANDLE handle;
+
+    handle = USBHostHIDOpen( is_write, deviceAddress, interface );
+    if (handle == NULL)
+    {
+        return USB_HID_DEVICE_NOT_FOUND;
+    }
+    return USBHostHIDTransfer( handle, reportid, size, data );
+}
+
 /*******************************************************************************
   Function:
     bool USBHostHIDReadIsComplete( uint8_t deviceAddress, uint8_t *errorCode, uint32_t *byteCount )
@@ -517,23 +749,17 @@ bool USBHostHIDReadWriteIsComplete ( bool is_write, uint8_t deviceAddress, uint8
         *byteCount = 0;
         return true;
     }
+
     if (is_write) {
         transfer = &deviceInfoHID[i].transferOUT;
     } else {
         transfer = &deviceInfoHID[i].transferIN;
     }
 
-    *errorCode = deviceInfoHID[i].errorCode;
+    *errorCode = transfer->errorCode;
     *byteCount = transfer->bytesTransferred;
 
-    if(transfer->state == STATE_HID_TRANSFER_WAITING)
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    return (transfer->state == STATE_HID_TRANSFER_WAITING);
 }
 
 #if 0
@@ -1310,9 +1536,14 @@ static __inline__ bool USBHostHIDEvent_Detach( uint8_t address )
 #endif
         /* Free the memory used by the HID device */
         _USBHostHID_FreeRptDecriptorDataMem(address);
+        // Close the handles
+        handleInfoHID[i][0].device          = NULL;
+        handleInfoHID[i][0].callback        = NULL;
+        handleInfoHID[i][1].device          = NULL;
+        handleInfoHID[i][1].callback        = NULL;
         deviceInfoHID[i].ID.deviceAddress   = 0;
         deviceInfoHID[i].pDeviceInfo        = NULL;
-        deviceInfoHID[i].state              = STATE_HID_DETACHED;
+        _USBHostHID_SetState(i, STATE_HID_DETACHED);
     }
     return true;
 }
@@ -1340,6 +1571,9 @@ static __inline__ bool USBHostHIDEvent_Transfer_WaitForReportDescriptor( uint8_t
             UART2PutHex(deviceInfoHID[i].HIDparserError);
 #endif
 
+#ifdef USB_ENUM_CACHE
+            USBEnumCache_Forget(deviceInfoHID[i].ID.deviceAddress);
+#endif
             _USBHostHID_FreeRptDecriptorDataMem(deviceInfoHID[i].ID.deviceAddress);
             _USBHostHID_LockDevice( USB_HID_REPORT_DESCRIPTOR_BAD );
 #ifdef USE_EVENT_HID_BAD_REPORT_DESCRIPTOR
@@ -1348,6 +1582,10 @@ static __inline__ bool USBHostHIDEvent_Transfer_WaitForReportDescriptor( uint8_t
         }
         else
         {
+#ifdef USB_ENUM_CACHE
+            USBEnumCache_PutReport(deviceInfoHID[i].ID.deviceAddress, pCurrInterfaceDetails->interfaceNumber,
+                                   deviceInfoHID[i].rptDescriptor, pCurrInterfaceDetails->sizeOfRptDescriptor);
+#endif
             /* Inform Application layer of new device attached */
 #ifdef DEBUG_MODE
             UART2PrintString( "HID: Sending Report Descriptor Parsed event\r\n" );
@@ -1387,6 +1625,12 @@ static __inline__ bool USBHostHIDEvent_Transfer_WaitForReportDescriptor( uint8_t
                         return true;
                     }
                 }
+#ifdef USB_ENUM_CACHE
+                if (_USBHostHID_ReadCachedReportDescriptor( i ))
+                {
+                    return true;
+                }
+#endif
                 if(USBHostIssueDeviceRequestEx( deviceInfoHID[i].pDeviceInfo, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
                         USB_REQUEST_GET_DESCRIPTOR, DSC_RPT_wValue, pCurrInterfaceDetails->interfaceNumber, pCurrInterfaceDetails->sizeOfRptDescriptor, deviceInfoHID[i].rptDescriptor,
                         deviceInfoHID[i].ID.clientDriverID
@@ -1400,7 +1644,7 @@ static __inline__ bool USBHostHIDEvent_Transfer_WaitForReportDescriptor( uint8_t
                     USB_FREE_AND_CLEAR(deviceInfoHID[i].rptDescriptor);
                     return true;
                 }
-                deviceInfoHID[i].state = STATE_HID_WAIT_FOR_REPORT_DSC;
+                _USBHostHID_SetState(i, STATE_HID_WAIT_FOR_REPORT_DSC);
             }
             else
             {
@@ -1420,7 +1664,10 @@ static __inline__ bool USBHostHIDEvent_Transfer_WaitForReportDescriptor( uint8_t
                     #ifdef DEBUG_MODE
                         UART2PrintString( "HID: Proceeding to run state\r\n" );
                     #endif
-                    deviceInfoHID[i].state = STATE_HID_RUNNING;
+                    _USBHostHID_SetState(i, STATE_HID_RUNNING);
+#ifdef USB_ENUM_CACHE
+                    USBEnumCache_Commit(deviceInfoHID[i].ID.deviceAddress);
+#endif
 
 #ifdef USE_EVENT_HID_ATTACH
                     // Tell the application layer that we have a device.
@@ -1439,6 +1686,54 @@ static __inline__ bool USBHostHIDEvent_Transfer_WaitForReportDescriptor( uint8_t
     return true;
 }
 
+#ifdef USB_ENUM_CACHE
+/*******************************************************************************
+  Function:
+    bool _USBHostHID_ReadCachedReportDescriptor( uint8_t i )
+
+  Description:
+    This function takes the report descriptor of the current interface from
+    the enumeration cache, and processes it as if it was read from the device.
+
+  Precondition:
+    rptDescriptor has been allocated for pCurrInterfaceDetails.
+
+  Parameters:
+    uint8_t i - Index of the device
+
+  Return Values:
+    true  - The descriptor is found in the cache and processed
+    false - Not found, read it from the device
+
+  Remarks:
+    The next interface is processed in the same way, so this is called
+    recursively as many times as the interfaces.
+*******************************************************************************/
+static bool _USBHostHID_ReadCachedReportDescriptor( uint8_t i )
+{
+    HOST_TRANSFER_DATA data;
+    const uint8_t *cached;
+
+    if (deviceInfoHID[i].rptDescriptor == NULL) return false;
+
+    cached = USBEnumCache_FindReport(deviceInfoHID[i].ID.deviceAddress, pCurrInterfaceDetails->interfaceNumber,
+                                     pCurrInterfaceDetails->sizeOfRptDescriptor);
+    if (cached == NULL) return false;
+
+#ifdef DEBUG_ENABLE
+    DEBUG_PutString( "HID: Report descriptor in cache\r\n" );
+#endif
+    memcpy(deviceInfoHID[i].rptDescriptor, cached, pCurrInterfaceDetails->sizeOfRptDescriptor);
+    memset(&data, 0, sizeof(data));
+    data.dataCount  = pCurrInterfaceDetails->sizeOfRptDescriptor;
+    data.bErrorCode = USB_SUCCESS;
+    _USBHostHID_SetState(i, STATE_HID_WAIT_FOR_REPORT_DSC);
+
+    USBHostHIDEvent_Transfer_WaitForReportDescriptor( i, deviceInfoHID[i].ID.deviceAddress, &data, sizeof(data) );
+    return true;
+}
+#endif
+
 /*******************************************************************************/
 static __inline__ bool USBHostHIDEvent_Transfer_Running( uint8_t i, uint8_t address, void *data, uint32_t size )
 {
@@ -1937,6 +2232,14 @@ bool USBHostHIDInitialize( uint8_t address, uint32_t flags, uint8_t clientDriver
                 return false;
             }
         }
+        deviceInfoHID[device].transferIN.state  = STATE_HID_TRANSFER_WAITING;
+        deviceInfoHID[device].transferOUT.state = STATE_HID_TRANSFER_WAITING;
+#ifdef USB_ENUM_CACHE
+        if (_USBHostHID_ReadCachedReportDescriptor( device ))
+        {
+            return true;
+        }
+#endif
         if (USBHostIssueDeviceRequestEx( deviceInfoHID[device].pDeviceInfo, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
              USB_REQUEST_GET_DESCRIPTOR, DSC_RPT_wValue, pCurrInterfaceDetails->interfaceNumber, pCurrInterfaceDetails->sizeOfRptDescriptor, deviceInfoHID[device].rptDescriptor,
              deviceInfoHID[device].ID.clientDriverID
@@ -1947,10 +2250,7 @@ bool USBHostHIDInitialize( uint8_t address, uint32_t flags, uint8_t clientDriver
             USB_FREE_AND_CLEAR(deviceInfoHID[device].rptDescriptor);
             return false;
         }
-        deviceInfoHID[device].state             = STATE_HID_WAIT_FOR_REPORT_DSC;
-
-        deviceInfoHID[device].transferIN.state  = STATE_HID_TRANSFER_WAITING;
-        deviceInfoHID[device].transferOUT.state = STATE_HID_TRANSFER_WAITING;
+        _USBHostHID_SetState(device, STATE_HID_WAIT_FOR_REPORT_DSC);
 
         return true;
     }
@@ -2053,14 +2353,14 @@ static void _USBHostHID_ResetStateJump( uint8_t i )
         if (errorCode)
         {
             deviceInfoHID[i].errorCode    = USB_HID_RESET_ERROR;
-            deviceInfoHID[i].state        = STATE_HID_RUNNING;
+            _USBHostHID_SetState(i, STATE_HID_RUNNING);
 #ifdef USE_EVENT_HID_RESET_ERROR
             USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_RESET_ERROR, NULL, 0 );
 #endif
         }
         else
         {
-            deviceInfoHID[i].state = STATE_HID_WAIT_FOR_RESET;
+            _USBHostHID_SetState(i, STATE_HID_WAIT_FOR_RESET);
         }
     }
     else
@@ -2078,7 +2378,7 @@ static void _USBHostHID_ResetStateJump( uint8_t i )
 #endif
         }
 
-        deviceInfoHID[i].state = deviceInfoHID[i].returnState;
+        _USBHostHID_SetState(i, deviceInfoHID[i].returnState);
     }
 }
 
@@ -196,6 +196,21 @@ typedef struct _HID_TRANSFER_DATA
 } HID_TRANSFER_DATA;
 
 
+// *****************************************************************************
+/* HID Transfer Handle
+
+This handle is returned by USBHostHIDOpen().  It holds the device, interface
+and endpoint of the transfer, so that the per-report functions do not search
+them.  It is closed when the device is detached.
+*/
+
+typedef struct _USB_HID_HANDLE_INFO *USB_HID_HANDLE;
+
+// Function called when a transfer on the handle is finished.
+// It is called from USBHostTasks(), and may start the next transfer.
+typedef void (*USB_HID_TRANSFER_CALLBACK)( USB_HID_HANDLE handle, uint8_t errorCode, uint8_t *data, uint8_t byteCount );
+
+
 // *****************************************************************************
 // *****************************************************************************
 // Section: Function Prototypes 
@@ -336,6 +351,152 @@ bool USBHostHIDReadWriteIsComplete
     uint8_t *byteCount 
 );
 
+/*******************************************************************************
+  Function:
+    USB_HID_HANDLE USBHostHIDOpen( bool is_write, uint8_t deviceAddress, uint8_t interface )
+
+  Summary:
+    This function gets the handle for reading or writing reports.
+
+  Precondition:
+    The report descriptor of the device has been parsed.
+
+  Parameters:
+    bool is_write              - true: output report  false: input report
+    uint8_t deviceAddress      - Device address
+    uint8_t interface          - Interface number
+
+  Return Values:
+    handle  - handle of the transfer
+    NULL    - No device or interface is found
+
+  Remarks:
+    One handle is prepared for each direction of each device.  Opening the
+    same direction again replaces the interface of the handle, and keeps
+    the callback set by USBHostHIDSetCallback() until the device is
+    detached.
+*******************************************************************************/
+USB_HID_HANDLE USBHostHIDOpen
+(
+    bool is_write,
+    uint8_t deviceAddress,
+    uint8_t interface
+);
+
+/*******************************************************************************
+  Function:
+    void USBHostHIDSetCallback( USB_HID_HANDLE handle, USB_HID_TRANSFER_CALLBACK callback )
+
+  Summary:
+    This function registers the function called when a transfer on the
+    handle is finished.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle               - Handle got by USBHostHIDOpen()
+    USB_HID_TRANSFER_CALLBACK callback  - Function to call (NULL: none)
+
+  Returns:
+    None
+
+  Remarks:
+    The callback is not called if the transfer is cancelled by a reset or a
+    detach, so USBHostHIDTransferIsComplete() is still valid.
+*******************************************************************************/
+void USBHostHIDSetCallback
+(
+    USB_HID_HANDLE handle,
+    USB_HID_TRANSFER_CALLBACK callback
+);
+
+/*******************************************************************************
+  Function:
+    uint8_t USBHostHIDTransfer( USB_HID_HANDLE handle, uint8_t reportid,
+                uint8_t size, uint8_t *data )
+
+  Summary:
+    This function starts a report transfer on the opened handle.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle      - Handle got by USBHostHIDOpen()
+    uint8_t reportid           - Report ID of the report
+    uint8_t size               - Byte size of the data buffer
+    uint8_t *data              - Pointer to the data buffer
+
+  Return Values:
+    USB_SUCCESS                 - Request started successfully
+    USB_HID_DEVICE_NOT_FOUND    - Handle is closed
+    USB_HID_DEVICE_BUSY         - Device not in proper state for
+                                  performing a transfer
+    Others                      - Return values from USBHostReadWrite()
+
+  Remarks:
+    None
+*******************************************************************************/
+uint8_t USBHostHIDTransfer
+(
+    USB_HID_HANDLE handle,
+    uint8_t reportid,
+    uint8_t size,
+    uint8_t *data
+);
+
+/*******************************************************************************
+  Function:
+    bool USBHostHIDTransferUsesControl( USB_HID_HANDLE handle )
+
+  Summary:
+    This function indicates whether or not a report on the handle is sent
+    by SET_REPORT request on endpoint 0.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle  - Handle got by USBHostHIDOpen()
+
+  Return Values:
+    true    - Report is sent on endpoint 0, report ID is put in wValue
+    false   - Report is sent on the interrupt endpoint, so the data buffer
+              must begin with the report ID if the report has one
+*******************************************************************************/
+bool USBHostHIDTransferUsesControl
+(
+    USB_HID_HANDLE handle
+);
+
+/*******************************************************************************
+  Function:
+    bool USBHostHIDTransferIsComplete( USB_HID_HANDLE handle, uint8_t *errorCode, uint8_t *byteCount )
+
+  Summary:
+    This function indicates whether or not the last transfer on the handle
+    is complete.
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_HID_HANDLE handle  - Handle got by USBHostHIDOpen()
+    uint8_t *errorCode     - Error code from last transfer
+    uint8_t *byteCount     - Number of bytes transferred
+
+  Return Values:
+    true    - Transfer is complete, errorCode and byteCount are valid
+    false   - Transfer is not complete, errorCode and byteCount are not valid
+*******************************************************************************/
+bool USBHostHIDTransferIsComplete
+(
+    USB_HID_HANDLE handle,
+    uint8_t *errorCode,
+    uint8_t *byteCount
+);
+
 #if 0
 /*******************************************************************************
   Function:
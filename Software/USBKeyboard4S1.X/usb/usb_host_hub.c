@@ -6,7 +6,7 @@
  * 	@brief  Treat HUB class 
  */
 
-#include <xc.h>
+#include "hal.h"
 #include "../common.h"
 #include "usb_ch9.h"
 #include "usb_common.h"
@@ -17,6 +17,7 @@
 #include "system.h"
 #include <string.h>
 #include "../uart.h"
+#include "../boot_trace.h"
 
 //------------------------------------------------------------------------------
 // state machine on the HUB class
@@ -121,6 +122,13 @@ typedef struct _USB_HUB_TRANS_PARAMETER
 
 #define USB_HUB_BUFFER_SIZE         64
 
+#ifdef USB_STATIC_POOL
+// the port table has 32 entries at most (portStatusMask)
+_Static_assert(sizeof(USB_HUB_INTERFACE_DETAILS) <= USB_POOL_SMALL_SIZE, "USB_HUB_INTERFACE_DETAILS does not fit in a small block.");
+_Static_assert(sizeof(USB_HUB_PORT_INFO) * 32 <= USB_POOL_SMALL_SIZE, "The port table does not fit in a small block.");
+_Static_assert(USB_HUB_BUFFER_SIZE <= USB_POOL_MEDIUM_SIZE, "USB_HUB_BUFFER_SIZE does not fit in a medium block.");
+#endif
+
 /*  USB HUB Device Information
 
    This structure is used to hold information about the entire device.
@@ -154,6 +162,13 @@ typedef struct _USB_HUB_DEVICE_INFO
 
 static USB_HUB_DEVICE_INFO          deviceInfoHUB[USB_MAX_HUB_DEVICES] __attribute__ ((aligned));
 
+// Set the state of a hub; the boot trace logs each change of it.
+#ifdef BOOT_TRACE_ENABLE
+#define _USBHostHUB_SetState(info, x)   { (info)->state = (x); BOOT_TRACE_State(BOOT_TRACE_HUB, (uint8_t)((info) - deviceInfoHUB), (info)->state); }
+#else
+#define _USBHostHUB_SetState(info, x)   { (info)->state = (x); }
+#endif
+
 #define P_PORT_STATUS(x) ((USB_HUB_PORT_STATUS *)(x))
 
 /*******************************************************************************
@@ -210,7 +225,7 @@ static void USBHostHUBClearFeature(USB_HUB_DEVICE_INFO *infoHUB, uint16_t featur
     infoHUB->param.packet.wLength = 0;
     infoHUB->param.nextState = next;
 
-    infoHUB->state = STATE_HUB_REQ_COMMAND;
+    _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_COMMAND);
 }
 
 // *****************************************************************************
@@ -226,7 +241,7 @@ static void USBHostHUBSetFeature(USB_HUB_DEVICE_INFO *infoHUB, uint16_t feature,
     infoHUB->param.packet.wLength = 0;
     infoHUB->param.nextState = next;
 
-    infoHUB->state = STATE_HUB_REQ_COMMAND;
+    _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_COMMAND);
 }
 
 // *****************************************************************************
@@ -242,7 +257,7 @@ static void USBHostHUBGetStatus(USB_HUB_DEVICE_INFO *infoHUB, uint16_t port, USB
     infoHUB->param.packet.wLength = 4;
     infoHUB->param.nextState = next;
 
-    infoHUB->state = STATE_HUB_REQ_COMMAND;
+    _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_COMMAND);
 }
 
 /*******************************************************************************
@@ -411,7 +426,7 @@ bool USBHostHUBInitialize( uint8_t address, uint32_t flags, uint8_t clientDriver
 #ifdef DEBUG_ENABLE
         DEBUG_PutStringHexU8( "Valid: ", infoHUB->clientDriverID );
 #endif
-        infoHUB->state = STATE_HUB_WAIT_GET_HUB_DESCRIPTOR;
+        _USBHostHUB_SetState(infoHUB, STATE_HUB_WAIT_GET_HUB_DESCRIPTOR);
 
         return true;
     }
@@ -433,6 +448,7 @@ static __inline__ bool USBHostHUBEvent_Detach( uint8_t address )
         USB_FREE(infoHUB->pInterfaceDetails);
         USB_FREE(infoHUB->buffer);
         memset(infoHUB, 0, sizeof(USB_HUB_DEVICE_INFO));
+        _USBHostHUB_SetState(infoHUB, STATE_HUB_NONE);
     }
     return true;
 }
@@ -509,7 +525,7 @@ void USBHostHUBTasks( void )
                     , detail->endpointIN
                     , infoHUB->buffer, size )) {
                     // goto next state
-                    infoHUB->state = STATE_HUB_WAIT_GET_STATUS_CHANGE;
+                    _USBHostHUB_SetState(infoHUB, STATE_HUB_WAIT_GET_STATUS_CHANGE);
                 }
                 break;
 
@@ -525,7 +541,7 @@ void USBHostHUBTasks( void )
                     , (0x0980 | infoHUB->param.packet.bRequest)
 #endif
                 )) {
-                    infoHUB->state = STATE_HUB_WAIT_COMMAND;
+                    _USBHostHUB_SetState(infoHUB, STATE_HUB_WAIT_COMMAND);
                 }
                 break;
 
@@ -537,7 +553,7 @@ void USBHostHUBTasks( void )
                     , infoHUB->currentPortNumber
                     , (infoHUB->currentPortStatus & PS_PORT_LOW_SPEED) ? 0x80 : 0) != 0
                 ) {
-                    infoHUB->state = STATE_HUB_WAIT_PORT_SETTING_DEVICE;
+                    _USBHostHUB_SetState(infoHUB, STATE_HUB_WAIT_PORT_SETTING_DEVICE);
                 }
                 break;
 
@@ -546,7 +562,7 @@ void USBHostHUBTasks( void )
                 // Wait for the device is configured 
                 //
                 if (USBHostDeviceStatus(&infoHUB->portInfo[infoHUB->currentPortNumber].deviceAddress) == USB_DEVICE_ATTACHED) {
-                    infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+                    _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
                 }
                 break;
 
@@ -554,6 +570,7 @@ void USBHostHUBTasks( void )
                 break;
         }
     }
+
 }
 
 // *****************************************************************************
@@ -576,7 +593,7 @@ static __inline__ void USBHostHUBEvent_Transfer_GotHubDescriptor( USB_HUB_DEVICE
         if (!infoHUB->portInfo) {
             // malloc error
             USBHost_SetError( USB_MEMORY_ALLOCATION_ERROR );
-            infoHUB->state = STATE_HUB_NONE;
+            _USBHostHUB_SetState(infoHUB, STATE_HUB_NONE);
          }
         memset(infoHUB->portInfo, 0, sizeof(USB_HUB_PORT_INFO) * (infoHUB->numOfPorts + 1));
 
@@ -585,7 +602,7 @@ static __inline__ void USBHostHUBEvent_Transfer_GotHubDescriptor( USB_HUB_DEVICE
 
     } else {
         // no exists port ???
-        infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+        _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
     }
 }
 
@@ -602,7 +619,7 @@ static __inline__ void USBHostHUBEvent_Transfer_PowerOnNextPort( USB_HUB_DEVICE_
         USBHostHUBSetFeature(infoHUB, FS_PORT_POWER, infoHUB->currentPortNumber, STATE_HUB_WAIT_PORT_POWER_ON);
     } else {
         // check status on each ports
-        infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+        _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
     }
 }
 
@@ -638,7 +655,7 @@ static __inline__ void USBHostHUBEvent_Transfer_GotStatusChange( USB_HUB_DEVICE_
         USBHostHUBGetStatus(infoHUB, infoHUB->currentPortNumber, STATE_HUB_WAIT_GET_PORT_STATUS);
     } else {
         // no change status on the HUB
-        infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+        _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
     }
 }
 
@@ -694,12 +711,12 @@ static __inline__ void USBHostHUBEvent_Transfer_GotPortStatus( USB_HUB_DEVICE_IN
             USBHostHUBClearFeature(infoHUB, FS_C_PORT_CONNECTION, infoHUB->currentPortNumber, STATE_HUB_WAIT_CLEAR_C_PORT_CONNECT);
         } else {
             // device is disable
-            infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+            _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
         }
 
     } else {
         // no more changed bit
-        infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+        _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
 
     }
 }
@@ -765,7 +782,7 @@ static __inline__ bool USBHostHUBEvent_Transfer( uint8_t address, void *data, ui
 #ifdef DEBUG_ENABLE
             UART_PutStringHexU8( "HUB status: ", infoHUB->buffer[0] );
 #endif
-            infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+            _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
             break;
 
         case STATE_HUB_WAIT_GET_PORT_STATUS:
@@ -799,12 +816,12 @@ static __inline__ bool USBHostHUBEvent_Transfer( uint8_t address, void *data, ui
             //    
             if (infoHUB->currentPortStatus & (PS_PORT_CONNECTION | PS_PORT_ENABLE | PS_PORT_POWER) == (PS_PORT_CONNECTION | PS_PORT_ENABLE | PS_PORT_POWER)) {
                 // Next: Set the device on the port
-                infoHUB->state = STATE_HUB_REQ_PORT_SETTING_DEVICE;
+                _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_PORT_SETTING_DEVICE);
             } else {
                 // Next: detach on the port
                 USBHost_DetachDeviceOnHUB(infoHUB->deviceAddress, infoHUB->portInfo[infoHUB->currentPortNumber].deviceAddress);
                 infoHUB->portInfo[infoHUB->currentPortNumber].deviceAddress = 0;
-                infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+                _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
             }
             break;
             
@@ -814,14 +831,14 @@ static __inline__ bool USBHostHUBEvent_Transfer( uint8_t address, void *data, ui
             UART_PutStringHexU8( "PORT Disconnect: ", infoHUB->currentPortNumber );
 #endif
             infoHUB->portInfo[infoHUB->currentPortNumber].deviceAddress = 0;
-            infoHUB->state = STATE_HUB_REQ_GET_STATUS_CHANGE;
+            _USBHostHUB_SetState(infoHUB, STATE_HUB_REQ_GET_STATUS_CHANGE);
             break;
 
          case STATE_HUB_WAIT_COMMAND:
             //
             // Clear/set feature
             //
-            infoHUB->state = infoHUB->param.nextState;
+            _USBHostHUB_SetState(infoHUB, infoHUB->param.nextState);
             loop = 1; // process next state if it exists in this function
             break;
         default:
@@ -844,6 +861,7 @@ static __inline__ bool USBHostHUBEvent_UnsupportedDevice( uint8_t address )
     UART_PutStringHexU8( "HUB: Unsupported device on port ", infoHUB->currentPortNumber );
 #endif
    USBHostHUBClearFeature(infoHUB, FS_PORT_ENABLE, infoHUB->currentPortNumber, STATE_HUB_WAIT_CLEAR_PORT_CONNECT);
+   return true;
 }
 
 // *****************************************************************************
@@ -9,7 +9,7 @@
 #ifndef USB_HOST_HUB_H
 #define	USB_HOST_HUB_H
 
-#include <xc.h>
+#include "hal.h"
 #include "usb_common.h"
 
 // *****************************************************************************
@@ -22,11 +22,12 @@ please contact mla_licensing@microchip.com
 #ifndef _USB_HOST_LOCAL_
 #define _USB_HOST_LOCAL_
 
-#include <xc.h>
+#include "hal.h"
 #include "common.h"
 #include "usb_hal_local.h"
 #include "usb_struct_config_list.h"
 #include "usb_struct_interface.h"
+#include "../boot_trace.h"
 
 #ifdef Simulator
 //#define DEBUG_ENABLE 1
@@ -484,12 +485,19 @@ typedef struct
 
 #define _USB_InitErrorCounters()        { numCommandTries   = USB_NUM_COMMAND_TRIES; }
 #define _USB_SetErrorCode(obj,x)        { (obj).errorCode = x; }
-#define _USB_SetHoldState()             { usbHostState = STATE_HOLDING; }
-#define _USB_SetRunningState()          { usbHostState = STATE_RUNNING; }
-#define _USB_SetNextState()             { usbHostState = (usbHostState & STATE_MASK) + NEXT_STATE; }
-#define _USB_SetNextSubState()          { usbHostState = (usbHostState & (STATE_MASK | SUBSTATE_MASK)) + NEXT_SUBSTATE; }
-#define _USB_SetNextSubSubState()       { usbHostState =  usbHostState + NEXT_SUBSUBSTATE; }
-#define _USB_SetPreviousSubSubState()   { usbHostState =  usbHostState - NEXT_SUBSUBSTATE; }
+// Every change of usbHostState goes through _USB_SetHostState, so that the
+// boot trace logs each state, not only the last one of a main loop pass.
+#ifdef BOOT_TRACE_ENABLE
+#define _USB_SetHostState(x)            { usbHostState = (x); BOOT_TRACE_State(BOOT_TRACE_HOST, 0, usbHostState); }
+#else
+#define _USB_SetHostState(x)            { usbHostState = (x); }
+#endif
+#define _USB_SetHoldState()             _USB_SetHostState(STATE_HOLDING)
+#define _USB_SetRunningState()          _USB_SetHostState(STATE_RUNNING)
+#define _USB_SetNextState()             _USB_SetHostState((usbHostState & STATE_MASK) + NEXT_STATE)
+#define _USB_SetNextSubState()          _USB_SetHostState((usbHostState & (STATE_MASK | SUBSTATE_MASK)) + NEXT_SUBSTATE)
+#define _USB_SetNextSubSubState()       _USB_SetHostState(usbHostState + NEXT_SUBSUBSTATE)
+#define _USB_SetPreviousSubSubState()   _USB_SetHostState(usbHostState - NEXT_SUBSUBSTATE)
 #define _USB_SetTransferErrorState(x)   { x->transferState = (x->transferState & TSTATE_MASK) | TSUBSTATE_ERROR; }
 
 
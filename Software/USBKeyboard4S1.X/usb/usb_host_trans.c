@@ -48,7 +48,20 @@ please contact mla_licensing@microchip.com
 // If we allow multiple control transactions during a frame and a NAK is
 // generated, we don't get TRNIF.  So we will allow only one control transaction
 // per frame.
-#define ONE_CONTROL_TRANSACTION_PER_FRAME
+// Retries are disabled in U1EP0 (see _USB_SendToken), so a NAK gives TRNIF.
+// Control transactions are sent until one is NAK'd or the frame budget is
+// used up.
+//#define ONE_CONTROL_TRANSACTION_PER_FRAME
+
+// Frame budget in full speed bit times.  The last part of the frame is kept
+// for the SOF threshold (U1SOF), which stops the SIE at the end of the frame.
+#define USB_FRAME_BIT_TIMES             12000
+#define USB_FRAME_BUDGET                (USB_FRAME_BIT_TIMES - USB_SOF_THRESHOLD_64 * 8)
+
+// Bit times of a transaction with n data bytes, with bit stuffing and
+// the protocol overhead (USB 2.0 5.11.3), in full speed bit times.
+#define USB_FS_TRANSACTION_BIT_TIMES(n) (112 + ((uint16_t)(n) * 28) / 3)
+#define USB_LS_TRANSACTION_BIT_TIMES(n) (800 + (uint16_t)(n) * 76)
 
 //******************************************************************************
 //******************************************************************************
@@ -108,6 +121,23 @@ void _USB_SendToken( USB_DEVICE_INFO *pDeviceInfo, USB_ENDPOINT_INFO *pEndpointI
 #define _USB_SetDATA01(ep, x)             { ep->status.bfNextDATA01 = x; }
 #define _USB_SetNextTransferState(ep)     { ep->transferState++; }
 
+/****************************************************************************/
+static uint16_t _USB_TransactionBitTimes( USB_DEVICE_INFO *pDeviceInfo, USB_ENDPOINT_INFO *pEndpointInfo )
+{
+    if (pDeviceInfo->deviceSpeed & 0x40)
+    {
+        // low speed
+        return USB_LS_TRANSACTION_BIT_TIMES(pEndpointInfo->wMaxPacketSize);
+    }
+    return USB_FS_TRANSACTION_BIT_TIMES(pEndpointInfo->wMaxPacketSize);
+}
+
+/****************************************************************************/
+static __inline__ bool _USB_FrameHasRoom( USB_DEVICE_INFO *pDeviceInfo, USB_ENDPOINT_INFO *pEndpointInfo )
+{
+    return (usbBusInfo.wFrameBitTimes + _USB_TransactionBitTimes( pDeviceInfo, pEndpointInfo ) <= USB_FRAME_BUDGET);
+}
+
 /****************************************************************************/
 /****************************************************************************/
 void USBTrans_Init( void )
@@ -133,6 +163,19 @@ void USBTrans_ClearInterruptEndpointStatus( void )
     }
 }
 
+/****************************************************************************/
+void USBTrans_DropDeviceTransfers( USB_DEVICE_INFO *deviceInfo )
+{
+    // The device is detached and its endpoint information is freed next,
+    // so the scheduler must not continue a transfer on it.
+    if (usbBusInfo.flags.bfControlRequestProcessing && pTargetControlDeviceInfo == deviceInfo) {
+        usbBusInfo.flags.bfControlRequestProcessing = 0;
+    }
+    if (usbBusInfo.flags.bfInterruptRequestProcessing && pTargetInterruptDeviceInfo == deviceInfo) {
+        usbBusInfo.flags.bfInterruptRequestProcessing = 0;
+    }
+}
+
 /****************************************************************************/
 static __inline__ void _USB_FindNextToken_Control_SendToken( uint8_t token, uint8_t dts )
 {
@@ -324,6 +367,12 @@ static __inline__ bool _USB_FindNextToken_Control( void )
         DEBUG_PutString("New Ctrl Token\r\n");
 #endif
     }
+    if (!_USB_FrameHasRoom( pTargetControlDeviceInfo, pTargetControlEndpointInfo ))
+    {
+        // continue in the next frame
+        usbBusInfo.flags.bfControlTransfersDone = 1;
+        return true;
+    }
     // Look for any control transfers.
 //  if (_USB_FindServiceEndpoint_ForControl())
 //  {
@@ -660,7 +709,8 @@ static __inline__ bool _USB_FindNextToken_Interrupt_ReadWrite( uint8_t token )
 }
 
 /****************************************************************************/
-static __inline__ bool _USB_FindNextToken_Interrupt( void )
+/* priority : USB_PERIODIC_PRIORITY_HIGH: keyboard only  USB_PERIODIC_PRIORITY_LOW: all */
+static __inline__ bool _USB_FindNextToken_Interrupt( uint8_t priority )
 {
     USB_TRANSFER_DATA *item = NULL;
 
@@ -673,24 +723,51 @@ static __inline__ bool _USB_FindNextToken_Interrupt( void )
 //        return true;
 //    }
 
-    if (!usbBusInfo.flags.bfInterruptRequestProcessing) {
-        item = StructTransferInterruptQueueGet();
-        if (!item) {
-            // no request found
-            return true;
-        }
-        pTargetInterruptEndpointInfo = item->endpointInfo;
-        pTargetInterruptDeviceInfo = item->deviceInfo;
-        usbBusInfo.flags.bfInterruptRequestProcessing = 1;
+    // Serve all due requests in this frame, one after another.
+    while (1)
+    {
+        if (!usbBusInfo.flags.bfInterruptRequestProcessing) {
+            item = StructTransferInterruptQueueGet(priority);
+            if (!item) {
+                // no request found
+                return true;
+            }
+            pTargetInterruptEndpointInfo = item->endpointInfo;
+            pTargetInterruptDeviceInfo = item->deviceInfo;
+            usbBusInfo.flags.bfInterruptRequestProcessing = 1;
 #ifdef DEBUG_ENABLE
-        DEBUG_PutStringHexU8( "New Interrupt EPAddr: ", item->endpointInfo->bEndpointAddress ); 
-        DEBUG_PutStringHexU8( "dataSize: ", item->endpointInfo->dataCountMax ); 
-#endif
-    }
+            DEBUG_PutStringHexU8( "New Interrupt EPAddr: ", item->endpointInfo->bEndpointAddress ); 
+            DEBUG_PutStringHexU8( "dataSize: ", item->endpointInfo->dataCountMax ); 
+#endif
+        } else {
+            // A hub request in progress is left to the pass of all requests,
+            // so that the control transfers are not delayed behind it.
+            if (priority == USB_PERIODIC_PRIORITY_HIGH &&
+                pTargetInterruptEndpointInfo->bPriority != USB_PERIODIC_PRIORITY_HIGH)
+            {
+                return true;
+            }
+            // A NAK'd OUT is tried again in the next frame, as IN is polled
+            // once in a frame, and the other requests go on.
+            if (pTargetInterruptEndpointInfo->transferState == (TSTATE_INTERRUPT_WRITE | TSUBSTATE_INTERRUPT_RW_DATA) &&
+                pTargetInterruptEndpointInfo->status.bfLastTransferNAKd)
+            {
+                usbBusInfo.flags.bfInterruptRequestProcessing = 0;
+                if (!StructTransferInterruptQueueDefer( pTargetInterruptDeviceInfo, pTargetInterruptEndpointInfo ))
+                {
+                    _USB_FindNextToken_Interrupt_Complete( TSUBSTATE_ERROR );
+                }
+                continue;
+            }
+        }
+
+        // Look for any interrupt operations.
+        if (!_USB_FrameHasRoom( pTargetInterruptDeviceInfo, pTargetInterruptEndpointInfo ))
+        {
+            break;
+        }
+        StructPeriodicScheduleServe(pTargetInterruptEndpointInfo);
 
-    // Look for any interrupt operations.
-    if (pTargetInterruptEndpointInfo->status.bfIntervalCountIsZero != 0)
-    {
         switch (pTargetInterruptEndpointInfo->transferState & TSTATE_MASK)
         {
             case TSTATE_INTERRUPT_READ:
@@ -711,7 +788,7 @@ static __inline__ bool _USB_FindNextToken_Interrupt( void )
         }
     }
 
-    // If we've gone through all the endpoints, we do not have any more interrupt transfers.
+    // The current transfer waits for the next frame.
     usbBusInfo.flags.bfInterruptTransfersDone = 1;
 
     return true;
@@ -960,8 +1037,17 @@ void USB_FindNextToken( void )
         return;
     }
 
-    // We will handle control transfers first.  We only allow one control
-    // transfer per frame.
+#ifdef USB_SUPPORT_INTERRUPT_TRANSFERS
+    // Keyboard input comes first, so that a key is not delayed behind
+    // enumeration, hub requests or LED reports.
+    if (!_USB_FindNextToken_Interrupt(USB_PERIODIC_PRIORITY_HIGH))
+    {
+        return;
+    }
+#endif
+
+    // We will handle control transfers next.  They are sent until the
+    // frame budget is used up or the device NAKs.
     if (!_USB_FindNextToken_Control())
     {
         return;
@@ -993,7 +1079,8 @@ void USB_FindNextToken( void )
 #endif
 
 #ifdef USB_SUPPORT_INTERRUPT_TRANSFERS
-    if (!_USB_FindNextToken_Interrupt())
+    // Hub status change and the rest.
+    if (!_USB_FindNextToken_Interrupt(USB_PERIODIC_PRIORITY_LOW))
     {
         return;
     }
@@ -1120,8 +1207,11 @@ void USB_InitControlReadWrite( bool is_write
                                     of data buffer pointers pointed to by
                                     pData.
 
-  Returns:
-    None
+  Return Values:
+    USB_SUCCESS                 - Transfer started successfully.
+    USB_ENDPOINT_NOT_SCHEDULED  - The interrupt request could not be queued,
+                                    the endpoint has no slot in the periodic
+                                    schedule and the unscheduled queue is full.
 
   Remarks:
     * Control reads should use the routine _USB_InitControlRead().  Since
@@ -1133,7 +1223,7 @@ void USB_InitControlReadWrite( bool is_write
         reaches 0.
   ***************************************************************************/
 
-void USB_InitReadWrite( bool is_write
+uint8_t USB_InitReadWrite( bool is_write
     , USB_DEVICE_INFO *deviceInfo
     , USB_ENDPOINT_INFO *pEndpoint
     , uint8_t *pData, uint16_t size )
@@ -1152,7 +1242,12 @@ void USB_InitReadWrite( bool is_write
 #ifdef USB_SUPPORT_INTERRUPT_TRANSFERS
         USB_TRANSFERS_CASE(USB_TRANSFER_TYPE_INTERRUPT)
             pEndpoint->transferState            = TSTATE_INTERRUPT_READ;
-            StructTransferInterruptQueueAdd( deviceInfo, pEndpoint );
+            if (!StructTransferInterruptQueueAdd( deviceInfo, pEndpoint ))
+            {
+                // No slot and no room in the queue of unscheduled requests.
+                pEndpoint->transferState        = TSTATE_IDLE;
+                return USB_ENDPOINT_NOT_SCHEDULED;
+            }
             USB_TRANSFERS_BREAK;
 #endif
 #ifdef USB_SUPPORT_ISOCHRONOUS_TRANSFERS
@@ -1175,6 +1270,8 @@ void USB_InitReadWrite( bool is_write
 
     // Set the flag last so all the parameters are set for an interrupt.
     pEndpoint->status.bfTransferComplete    = 0;
+
+    return USB_SUCCESS;
 }
 
 /****************************************************************************
@@ -1230,7 +1327,7 @@ void _USB_SendToken( USB_DEVICE_INFO *pDeviceInfo, USB_ENDPOINT_INFO *pEndpointI
     // Start transaction
     U1EP0 = temp;
     U1ADDR = (pDeviceInfo->deviceAddress | (pDeviceInfo->deviceSpeed << 1));
-    U1TOK = (tokenType << 4) | (pEndpointInfo->bEndpointAddress & 0xF);
+    USBHALSendToken( (tokenType << 4) | (pEndpointInfo->bEndpointAddress & 0xF) );
 #ifdef DEBUG_ENABLE
     if (pEndpointInfo->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_CONTROL) {
         DEBUG_PutStringHexU8("SendEP0:", U1EP0);
@@ -1241,6 +1338,9 @@ void _USB_SendToken( USB_DEVICE_INFO *pDeviceInfo, USB_ENDPOINT_INFO *pEndpointI
     // Set current transfer type
     currentTransferType = pEndpointInfo->bmAttributes.bfTransferType;
 
+    // Count the transaction in the frame budget
+    usbBusInfo.wFrameBitTimes += _USB_TransactionBitTimes( pDeviceInfo, pEndpointInfo );
+
     // Lock out anyone from writing another token until this one has finished.
 //    U1CONbits.TOKBUSY = 1;
     usbBusInfo.flags.bfTokenAlreadyWritten = 1;
@@ -1587,6 +1687,11 @@ static void USB_HostInterrupt_Transfer_NAK(USB_ENDPOINT_INFO *pEndpointInfo, BDT
             // the DATA portion, they are allowed to retry a fixed
             // number of times.
             USB_HostInterrupt_Transfer_NAK_Timeout(pEndpointInfo);
+            // The device is busy, retry in the next frame.
+            if (pEndpointInfo->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_CONTROL)
+            {
+                usbBusInfo.flags.bfControlTransfersDone = 1;
+            }
             break;
 
 #ifdef USB_SUPPORT_INTERRUPT_TRANSFERS
@@ -1657,8 +1762,8 @@ static void USB_HostInterrupt_Transfer_Error(USB_ENDPOINT_INFO *pEndpointInfo, B
 
         // Avoid the error interrupt code, because we are going to
         // find another token to send.
-        U1EIR = 0xFF;
-        U1IR  = U1IE_INTERRUPT_ERROR;
+        USBHALClearErrors( 0xFF );
+        USBHALClearStatus( U1IE_INTERRUPT_ERROR );
     }
     else
     {
@@ -1684,13 +1789,8 @@ static USB_ENDPOINT_INFO *_USBTrans_GetEndpointByCurrentTransferType( void )
 }
 
 /****************************************************************************/
-void USB_HostInterrupt_Transfer( void )
+void USB_HostInterrupt_Transfer( __U1STATbits_t copyU1STATbits )
 {
-#if defined(__PIC32__)
-    __U1STATbits_t      copyU1STATbits;
-#else
-    #error "Need structure name for copyU1STATbits."
-#endif
 //    uint16_t            packetSize;
     BDT_ENTRY           *pBDT;
 
@@ -1707,9 +1807,7 @@ void USB_HostInterrupt_Transfer( void )
     DEBUG_Flush();
 #endif
 
-    copyU1STATbits = U1STATbits;    // Read the status register before clearing the flag.
-
-    U1IR = U1IE_INTERRUPT_TRANSFER;  // Clear the interrupt by writing a '1' to the flag.
+    // U1STAT was read and the flag was cleared by USB_HostInterruptHandler.
 
 #ifdef DEBUG_ENABLE
     uint8_t bdt_type = 0;
@@ -1797,39 +1895,44 @@ void USB_HostInterrupt_Transfer( void )
 }
 
 /****************************************************************************/
-void USB_HostInterrupt_SOF( void )
+void USB_HostInterrupt_SOF( uint16_t frames )
 {
 #if defined(USB_ENABLE_SOF_EVENT) && defined(USB_HOST_APP_DATA_EVENT_HANDLER)
     //Notify ping all client drivers of SOF event (address, event, data, sizeof_data)
     _USB_NotifyDataClients(0, EVENT_SOF, NULL, 0);
 #endif
 
-    U1IR = U1IE_INTERRUPT_SOF; // Clear the interrupt by writing a '1' to the flag.
-
 //    if (delaySOFCount > 0) {
 //        delaySOFCount--;
 //        return;
 //    }
 
-    // decrease interval timer
-    USBHost_DecreaseInterval();
+    // advance the periodic schedule of interrupt endpoints
+    StructPeriodicScheduleFrame(frames);
+
+    // decrease interval timer for each frame passed
+    while (frames--)
+    {
+        USBHost_DecreaseInterval();
+    }
 
     usbBusInfo.flags.bfControlTransfersDone     = 0;
     usbBusInfo.flags.bfInterruptTransfersDone   = 0;
     usbBusInfo.flags.bfIsochronousTransfersDone = 0;
     usbBusInfo.flags.bfBulkTransfersDone        = 0;
     //usbBusInfo.dBytesSentInFrame                = 0;
+    usbBusInfo.wFrameBitTimes                   = 0;
     usbBusInfo.lastBulkTransaction              = 0;
 
     USB_FindNextToken();
 }
 
 /****************************************************************************/
-void USB_HostInterrupt_Error( void )
+void USB_HostInterrupt_Error( uint8_t copyU1EIR )
 {
 #if defined (DEBUG_ENABLE)
     DEBUG_PutString("#E:");
-    DEBUG_PutHexU8( U1EIR );
+    DEBUG_PutHexU8( copyU1EIR );
 #endif
     USB_ENDPOINT_INFO *pEndpointInfo = _USBTrans_GetEndpointByCurrentTransferType();
 
@@ -1854,22 +1957,22 @@ void USB_HostInterrupt_Error( void )
             // We have too many errors.
 
             // Check U1EIR for the appropriate error codes to return
-            if (U1EIRbits.BTSEF)
+            if (copyU1EIR & _U1EIR_BTSEF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_BIT_STUFF;
-            if (U1EIRbits.DMAEF)
+            if (copyU1EIR & _U1EIR_DMAEF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_DMA;
-            if (U1EIRbits.BTOEF)
+            if (copyU1EIR & _U1EIR_BTOEF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_TIMEOUT;
-            if (U1EIRbits.DFN8EF)
+            if (copyU1EIR & _U1EIR_DFN8EF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_DATA_FIELD;
-            if (U1EIRbits.CRC16EF)
+            if (copyU1EIR & _U1EIR_CRC16EF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_CRC16;
-            if (U1EIRbits.EOFEF)
+            if (copyU1EIR & _U1EIR_EOFEF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_END_OF_FRAME;
-            if (U1EIRbits.PIDEF)
+            if (copyU1EIR & _U1EIR_PIDEF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_PID_CHECK;
 #if defined(__PIC32__)
-            if (U1EIRbits.BMXEF)
+            if (copyU1EIR & _U1EIR_BMXEF_MASK)
                 pEndpointInfo->bErrorCode = USB_ENDPOINT_ERROR_BMX;
 #endif
 
@@ -1879,8 +1982,7 @@ void USB_HostInterrupt_Error( void )
         }
     }
 
-    U1EIR = 0xFF;   // Clear the interrupts by writing '1' to the flags.
-    U1IR = U1IE_INTERRUPT_ERROR; // Clear the interrupt by writing a '1' to the flag.
+    // U1EIR and the flag were cleared by USB_HostInterruptHandler.
 }
 
 /*************************************************************************
@@ -56,6 +56,7 @@ typedef struct _USB_BUS_INFO
         uint16_t           val;                                //
     }                      flags;                              //
 //  volatile uint32_t      dBytesSentInFrame;                  // The number of bytes sent during the current frame. Isochronous use only.
+    volatile uint16_t      wFrameBitTimes;                     // Full speed bit times used by the tokens in the current frame.
     volatile uint8_t       lastBulkTransaction;                // The last bulk transaction sent.
     volatile uint8_t       countBulkTransactions;              // The number of active bulk transactions.
 } USB_BUS_INFO;
@@ -65,15 +66,16 @@ typedef struct _USB_BUS_INFO
 void USBTrans_Init( void );
 void USBTrans_ClearControlEndpointStatus( void );
 void USBTrans_ClearInterruptEndpointStatus( void );
+void USBTrans_DropDeviceTransfers( USB_DEVICE_INFO *deviceInfo );
 
 void USB_InitControlReadWrite( bool is_write, USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *pEndpoint
     , SETUP_PKT *pControlData, uint16_t controlSize, uint8_t *pData, uint16_t size );
-void USB_InitReadWrite( bool is_write, USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *pEndpoint
+uint8_t USB_InitReadWrite( bool is_write, USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *pEndpoint
     , uint8_t *pData, uint16_t size );
 
-void USB_HostInterrupt_Transfer( void );
-void USB_HostInterrupt_SOF( void );
-void USB_HostInterrupt_Error( void );
+void USB_HostInterrupt_Transfer( __U1STATbits_t copyU1STATbits );
+void USB_HostInterrupt_SOF( uint16_t frames );
+void USB_HostInterrupt_Error( uint8_t copyU1EIR );
 
 void _USB_ClearBDT( void );
 void _USB_SetBDT( USB_ENDPOINT_INFO *pEndpoint, uint8_t  direction );
@@ -0,0 +1,243 @@
+/** @file usb_pool.c
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Fixed size memory pools used instead of the heap
+ *
+ *  Each pool has blocks of the same size and a bitmap of used blocks.
+ *  A request is served from the smallest pool that has a free block,
+ *  or from the heap when no pool has one.
+ */
+
+#include "common.h"
+#include "usb_pool.h"
+#include "usb_struct_interface.h"
+#include "usb_struct_config_list.h"
+#include "usb_ch9.h"
+#include "uart.h"
+#include <stdlib.h>
+
+#ifdef USB_STATIC_POOL
+
+// The other list nodes and the device descriptor must fit in a small block.
+_Static_assert(sizeof(USB_INTERFACE_INFO) <= USB_POOL_SMALL_SIZE, "USB_INTERFACE_INFO does not fit in a small block.");
+_Static_assert(sizeof(USB_INTERFACE_SETTING_INFO) <= USB_POOL_SMALL_SIZE, "USB_INTERFACE_SETTING_INFO does not fit in a small block.");
+_Static_assert(sizeof(USB_CONFIGURATION) <= USB_POOL_SMALL_SIZE, "USB_CONFIGURATION does not fit in a small block.");
+_Static_assert(sizeof(USB_DEVICE_DESCRIPTOR) <= USB_POOL_SMALL_SIZE, "USB_DEVICE_DESCRIPTOR does not fit in a small block.");
+_Static_assert(USB_POOL_SMALL_SIZE < USB_POOL_MEDIUM_SIZE && USB_POOL_MEDIUM_SIZE < USB_POOL_LARGE_SIZE, "USB pool sizes must grow.");
+
+typedef struct _USB_POOL
+{
+    uint8_t    *memory;     // first block
+    uint16_t    size;       // size of a block
+    uint8_t     count;      // number of blocks
+    uint8_t     peak;       // maximum number of used blocks
+    uint8_t     used;       // number of used blocks
+    uint32_t    bitmap[USB_POOL_BITMAP_WORDS];  // bit n of word w: block w*32+n is used
+} USB_POOL;
+
+static uint64_t usbPoolSmall[USB_POOL_SMALL_COUNT * USB_POOL_SMALL_SIZE / 8];
+static uint64_t usbPoolMedium[USB_POOL_MEDIUM_COUNT * USB_POOL_MEDIUM_SIZE / 8];
+static uint64_t usbPoolLarge[USB_POOL_LARGE_COUNT * USB_POOL_LARGE_SIZE / 8];
+
+static USB_POOL usbPools[] = {
+    { (uint8_t *)usbPoolSmall,  USB_POOL_SMALL_SIZE,  USB_POOL_SMALL_COUNT,  0, 0, { 0 } },
+    { (uint8_t *)usbPoolMedium, USB_POOL_MEDIUM_SIZE, USB_POOL_MEDIUM_COUNT, 0, 0, { 0 } },
+    { (uint8_t *)usbPoolLarge,  USB_POOL_LARGE_SIZE,  USB_POOL_LARGE_COUNT,  0, 0, { 0 } },
+};
+
+#define USB_POOL_NUMS   (sizeof(usbPools) / sizeof(usbPools[0]))
+
+#ifndef USB_POOL_NO_HEAP
+static uint8_t usbPoolHeapUsed;     // number of blocks taken from the heap
+static uint8_t usbPoolHeapPeak;     // maximum number of them
+#endif
+
+/****************************************************************************
+  Function:
+    void *USBPool_Alloc( size_t size )
+
+  Description:
+    This function gets a block which has the specified size at least.
+
+  Precondition:
+    None
+
+  Parameters:
+    size_t size - size of memory
+
+  Returns:
+    pointer of the block, or NULL if no block is available
+
+  Remarks:
+    Call this only from the main loop. When no pool has a free block,
+    the memory is taken from the heap unless USB_POOL_NO_HEAP is defined.
+  ***************************************************************************/
+void *USBPool_Alloc( size_t size )
+{
+    void *ptr;
+
+    for(uint8_t i=0; i<USB_POOL_NUMS; i++) {
+        USB_POOL *pool = &usbPools[i];
+        uint32_t freeBits;
+        uint8_t n;
+
+        if (size > pool->size) continue;
+        if (pool->used >= pool->count) continue;
+
+        for(uint8_t w=0; w<USB_POOL_BITMAP_WORDS; w++) {
+            freeBits = ~pool->bitmap[w];
+            if (freeBits == 0) continue;
+
+            n = w * 32 + __builtin_ctz(freeBits);
+            pool->bitmap[w] |= freeBits & -freeBits;
+            pool->used++;
+            if (pool->peak < pool->used) pool->peak = pool->used;
+
+            return pool->memory + (uint32_t)pool->size * n;
+        }
+    }
+
+#ifndef USB_POOL_NO_HEAP
+    ptr = malloc(size);
+    if (ptr != NULL) {
+        usbPoolHeapUsed++;
+        if (usbPoolHeapPeak < usbPoolHeapUsed) usbPoolHeapPeak = usbPoolHeapUsed;
+    }
+#else
+    ptr = NULL;
+#endif
+    return ptr;
+}
+
+/****************************************************************************
+  Function:
+    void USBPool_Free( void *ptr )
+
+  Description:
+    This function returns the block to its pool.
+
+  Precondition:
+    None
+
+  Parameters:
+    void *ptr - pointer of the block got by USBPool_Alloc
+
+  Returns:
+    None
+
+  Remarks:
+    NULL is ignored. A pointer out of the pools is returned to the heap.
+  ***************************************************************************/
+void USBPool_Free( void *ptr )
+{
+    uint8_t *p = (uint8_t *)ptr;
+    uint32_t n;
+
+    if (p == NULL) return;
+
+    for(uint8_t i=0; i<USB_POOL_NUMS; i++) {
+        USB_POOL *pool = &usbPools[i];
+
+        if (p >= pool->memory && p < pool->memory + (uint32_t)pool->size * pool->count) {
+            n = (p - pool->memory) / pool->size;
+            if (pool->bitmap[n / 32] & ((uint32_t)1 << (n % 32))) {
+                pool->bitmap[n / 32] &= ~((uint32_t)1 << (n % 32));
+                pool->used--;
+            }
+            return;
+        }
+    }
+
+#ifndef USB_POOL_NO_HEAP
+    free(ptr);
+    usbPoolHeapUsed--;
+#endif
+}
+
+/****************************************************************************
+  Function:
+    bool USBPool_GetUsage( uint8_t index, USB_POOL_USAGE *usage )
+
+  Description:
+    This function gets the usage of a pool.
+
+  Precondition:
+    None
+
+  Parameters:
+    uint8_t index           - pool number, 0 is the smallest
+    USB_POOL_USAGE *usage   - usage is stored here
+
+  Returns:
+    true  - the usage is stored
+    false - no pool has the number
+
+  Remarks:
+    The number after the last pool is the heap, whose size and count are 0.
+  ***************************************************************************/
+bool USBPool_GetUsage( uint8_t index, USB_POOL_USAGE *usage )
+{
+    USB_POOL *pool;
+
+#ifndef USB_POOL_NO_HEAP
+    if (index == USB_POOL_NUMS) {
+        usage->size = 0;
+        usage->count = 0;
+        usage->used = usbPoolHeapUsed;
+        usage->peak = usbPoolHeapPeak;
+        return true;
+    }
+#endif
+    if (index >= USB_POOL_NUMS) return false;
+
+    pool = &usbPools[index];
+    usage->size = pool->size;
+    usage->count = pool->count;
+    usage->used = pool->used;
+    usage->peak = pool->peak;
+    return true;
+}
+
+#ifndef HAL_SIM
+/****************************************************************************
+  Function:
+    void USBPool_PutReport( void )
+
+  Description:
+    This function prints the RAM budget and the usage of each pool.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Not in the host build, which has no UART.
+  ***************************************************************************/
+void USBPool_PutReport( void )
+{
+    UART_PutStringHexU16( "USB pool total: ", USB_POOL_TOTAL_SIZE );
+    for(uint8_t i=0; i<USB_POOL_NUMS; i++) {
+        USB_POOL *pool = &usbPools[i];
+
+        UART_PutStringHexU16( " block size: ", pool->size );
+        UART_PutStringHexU8( "  count: ", pool->count );
+        UART_PutStringHexU8( "  used: ", pool->used );
+        UART_PutStringHexU8( "  peak: ", pool->peak );
+        UART_Flush();
+    }
+#ifndef USB_POOL_NO_HEAP
+    UART_PutStringHexU8( " heap used: ", usbPoolHeapUsed );
+    UART_PutStringHexU8( "  peak: ", usbPoolHeapPeak );
+    UART_Flush();
+#endif
+}
+#endif /* !HAL_SIM */
+
+#endif /* USB_STATIC_POOL */
@@ -0,0 +1,98 @@
+/** @file usb_pool.h
+ *
+ *  @author Sasaji
+ *  @date 2026/10/17
+ *
+ *  @brief Fixed size memory pools used instead of the heap
+ *
+ *  Enabled by USB_STATIC_POOL in common.h.
+ *  USB_MALLOC / USB_FREE are mapped to USBPool_Alloc / USBPool_Free,
+ *  so the memory footprint never grows over attach and detach cycles.
+ *  The pools are sized for the devices below. A device over its share
+ *  (e.g. a keyboard with 3 interfaces) takes the blocks left by the others,
+ *  then blocks of a larger pool, and when the pools are used up, the rest
+ *  from the heap; with USB_POOL_NO_HEAP defined, the enumeration fails with
+ *  EVENT_OUT_OF_MEMORY instead.
+ */
+
+#ifndef USB_POOL_H
+#define	USB_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "usb_config.h"
+
+#ifdef USB_STATIC_POOL
+
+// Devices holding memory at once: hubs, HID devices and one under enumeration
+#define USB_POOL_DEVICES        (USB_MAX_HUB_DEVICES + USB_MAX_HID_DEVICES + 1)
+
+// Interfaces and endpoints (other than EP0) of a device held in the pool.
+// A composite keyboard has a boot keyboard and a consumer control interface.
+#ifndef USB_POOL_INTERFACES_PER_DEVICE
+    #define USB_POOL_INTERFACES_PER_DEVICE  2
+#endif
+#ifndef USB_POOL_ENDPOINTS_PER_DEVICE
+    #define USB_POOL_ENDPOINTS_PER_DEVICE   2
+#endif
+
+// Small blocks: list nodes (endpoint, interface, setting, configuration),
+// class interface details, device descriptor, hub port table.
+// A block holds the largest list node (USB_ENDPOINT_INFO, aligned to 8);
+// usb_pool.c and the class drivers check that the others fit.
+// A device takes the configuration and the device descriptor, an interface
+// and a setting and class details for each interface, and the endpoints;
+// a hub takes its port table instead of the second interface.
+// One more block is for EP0.
+#define USB_POOL_SMALL_PER_DEVICE   (2 + USB_POOL_INTERFACES_PER_DEVICE * 3 + USB_POOL_ENDPOINTS_PER_DEVICE)
+#define USB_POOL_SMALL_SIZE     ((sizeof(USB_ENDPOINT_INFO) + 7) & ~(size_t)7)
+#define USB_POOL_SMALL_COUNT    (USB_POOL_DEVICES * USB_POOL_SMALL_PER_DEVICE + 1)
+
+// Medium blocks: EP0 data, configuration descriptor, hub buffer.
+// A configuration descriptor over the medium size takes a large block.
+#ifndef USB_POOL_MEDIUM_SIZE
+    #define USB_POOL_MEDIUM_SIZE    128
+#endif
+#define USB_POOL_MEDIUM_COUNT   (USB_POOL_DEVICES * 2)
+
+// Large blocks: HID report descriptor and its parsed data,
+// and one for a configuration descriptor over the medium size.
+// A longer report descriptor is taken from the heap.
+#ifndef USB_POOL_LARGE_SIZE
+    #define USB_POOL_LARGE_SIZE     512
+#endif
+#define USB_POOL_LARGE_COUNT    (USB_MAX_HID_DEVICES * 2 + 1)
+
+#if (USB_POOL_SMALL_COUNT > 255) || (USB_POOL_MEDIUM_COUNT > 255) || (USB_POOL_LARGE_COUNT > 255)
+    #error "Number of blocks in a USB pool must be 255 or less."
+#endif
+
+// Words of the bitmap of used blocks, enough for the largest pool
+#define USB_POOL_MAX_COUNT      (USB_POOL_SMALL_COUNT > USB_POOL_MEDIUM_COUNT \
+                                ? (USB_POOL_SMALL_COUNT > USB_POOL_LARGE_COUNT ? USB_POOL_SMALL_COUNT : USB_POOL_LARGE_COUNT) \
+                                : (USB_POOL_MEDIUM_COUNT > USB_POOL_LARGE_COUNT ? USB_POOL_MEDIUM_COUNT : USB_POOL_LARGE_COUNT))
+#define USB_POOL_BITMAP_WORDS   ((USB_POOL_MAX_COUNT + 31) / 32)
+
+// RAM budget of all pools in bytes
+#define USB_POOL_TOTAL_SIZE     (USB_POOL_SMALL_SIZE * USB_POOL_SMALL_COUNT \
+                                + USB_POOL_MEDIUM_SIZE * USB_POOL_MEDIUM_COUNT \
+                                + USB_POOL_LARGE_SIZE * USB_POOL_LARGE_COUNT)
+
+// Usage of a pool, or of the heap (size and count are 0)
+typedef struct _USB_POOL_USAGE
+{
+    uint16_t    size;       // size of a block
+    uint8_t     count;      // number of blocks
+    uint8_t     used;       // number of used blocks
+    uint8_t     peak;       // maximum number of used blocks
+} USB_POOL_USAGE;
+
+void *USBPool_Alloc( size_t size );
+void USBPool_Free( void *ptr );
+bool USBPool_GetUsage( uint8_t index, USB_POOL_USAGE *usage );
+void USBPool_PutReport( void );
+
+#endif /* USB_STATIC_POOL */
+
+#endif	/* USB_POOL_H */
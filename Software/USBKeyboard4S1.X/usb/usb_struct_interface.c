@@ -10,9 +10,20 @@
 #include "common.h"
 #include "usb_struct_interface.h"
 #include "usb_host_local.h"
+#include "usb_struct_queue.h"
 #include <string.h>
 #include "uart.h"
 
+// Periodic endpoints of the current settings of all devices, walked every frame.
+static USB_ENDPOINT_INFO *usbActiveEndpoints[USB_ACTIVE_ENDPOINT_MAX];
+static uint8_t usbActiveEndpointCount = 0;
+// Periodic endpoints of the current settings which found the index full.
+static uint8_t usbActiveEndpointMissed = 0;
+
+static void _USB_ActiveEndpoints_Add( USB_INTERFACE_SETTING_INFO *pSetting );
+static void _USB_ActiveEndpoints_Remove( USB_ENDPOINT_INFO *pEndpoint );
+static void _USB_ActiveEndpoints_RemoveSetting( USB_INTERFACE_SETTING_INFO *pSetting );
+
 /****************************************************************************
   Function:
     void _USB_EndpointList_Clear( USB_ENDPOINT_INFO **ppEndpoint )
@@ -39,6 +50,8 @@ void _USB_EndpointList_Clear( USB_ENDPOINT_INFO **ppEndpoint )
     while ((*ppEndpoint) != NULL)
     {
         pNextEndpoint = (*ppEndpoint)->next;
+        _USB_ActiveEndpoints_Remove( (*ppEndpoint) );
+        StructPeriodicScheduleClose( (*ppEndpoint) );
         USB_FREE_AND_CLEAR( (*ppEndpoint) );
         (*ppEndpoint) = pNextEndpoint;
     }
@@ -206,6 +219,51 @@ USB_ENDPOINT_INFO *USB_InterfaceList_FindEndpoint( USB_INTERFACE_INFO *pInterfac
     return NULL;
 }
 
+/****************************************************************************
+  Function:
+    void USB_InterfaceList_MapEndpoints( )
+
+  Description:
+    This function makes the map of the endpoints in the current settings
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_INTERFACE_INFO * - pointer of interface list
+    USB_ENDPOINT_INFO ** - map which has USB_ENDPOINT_MAP_SIZE entries
+
+  Returns:
+    None
+
+  Remarks:
+    Call this when the list or a current setting is changed.
+    The map is cleared if the list is empty.
+  ***************************************************************************/
+void USB_InterfaceList_MapEndpoints( USB_INTERFACE_INFO *pInterfaceList, USB_ENDPOINT_INFO **pEndpointMap )
+{
+    USB_ENDPOINT_INFO *pEndpoint;
+
+    memset(pEndpointMap, 0, sizeof(USB_ENDPOINT_INFO *) * USB_ENDPOINT_MAP_SIZE);
+
+    while (pInterfaceList)
+    {
+        if (pInterfaceList->pCurrentSetting)
+        {
+            pEndpoint = pInterfaceList->pCurrentSetting->pEndpointList;
+            while (pEndpoint)
+            {
+                if (USB_ENDPOINT_MAP_HAS(pEndpoint->bEndpointAddress))
+                {
+                    pEndpointMap[USB_ENDPOINT_MAP_INDEX(pEndpoint->bEndpointAddress)] = pEndpoint;
+                }
+                pEndpoint = pEndpoint->next;
+            }
+        }
+        pInterfaceList = pInterfaceList->next;
+    }
+}
+
 /****************************************************************************
   Function:
     void USB_InterfaceList_SetData0( )
@@ -249,10 +307,11 @@ void USB_InterfaceList_SetData0( USB_INTERFACE_INFO *pInterfaceList )
 
 /****************************************************************************
   Function:
-    void USB_InterfaceList_DecreaseInterval( )
+    void USB_InterfaceList_Activate( )
 
   Description:
-    This function searches the endpoint in the list
+    This function puts the endpoints of the current settings in the list
+                into the active endpoint index
 
   Precondition:
     None
@@ -263,9 +322,254 @@ void USB_InterfaceList_SetData0( USB_INTERFACE_INFO *pInterfaceList )
   Returns:
     None
 
+  Remarks:
+    Call this when a configuration is parsed. The endpoints are removed
+    from the index by USB_InterfaceList_Clear().
+  ***************************************************************************/
+void USB_InterfaceList_Activate( USB_INTERFACE_INFO *pInterfaceList )
+{
+    while (pInterfaceList)
+    {
+        _USB_ActiveEndpoints_Add(pInterfaceList->pCurrentSetting);
+        pInterfaceList = pInterfaceList->next;
+    }
+}
+
+/****************************************************************************
+  Function:
+    void _USB_ActiveEndpoints_Add( USB_INTERFACE_SETTING_INFO *pSetting )
+
+  Description:
+    This function adds the periodic endpoints of the setting to the active
+                endpoint index
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_INTERFACE_SETTING_INFO * - pointer of interface setting
+
+  Returns:
+    None
+
+  Remarks:
+    Only interrupt and isochronous endpoints need the per frame update.
+    Endpoints already added are ignored. An endpoint which finds the index
+    full is marked missed, and the interface lists are walked every frame
+    until it is removed. An interrupt endpoint added takes a slot of the
+    periodic schedule if one is free.
+  ***************************************************************************/
+static void _USB_ActiveEndpoints_Add( USB_INTERFACE_SETTING_INFO *pSetting )
+{
+    USB_ENDPOINT_INFO *pEndpoint;
+
+    if (pSetting == NULL) return;
+
+    pEndpoint = pSetting->pEndpointList;
+    for(; pEndpoint; pEndpoint = pEndpoint->next)
+    {
+#ifdef USB_SUPPORT_ISOCHRONOUS_TRANSFERS
+        if (pEndpoint->bmAttributes.bfTransferType != USB_TRANSFER_TYPE_INTERRUPT
+         && pEndpoint->bmAttributes.bfTransferType != USB_TRANSFER_TYPE_ISOCHRONOUS) {
+            continue;
+        }
+#else
+        if (pEndpoint->bmAttributes.bfTransferType != USB_TRANSFER_TYPE_INTERRUPT) {
+            continue;
+        }
+#endif
+        if (pEndpoint->bIndexed != USB_ENDPOINT_INDEX_NONE) {
+            continue;
+        }
+        if (usbActiveEndpointCount >= USB_ACTIVE_ENDPOINT_MAX) {
+#ifdef DEBUG_ENABLE
+            DEBUG_PutStringHexU8("Active endpoint index full EP:", pEndpoint->bEndpointAddress);
+#endif
+            pEndpoint->bIndexed = USB_ENDPOINT_INDEX_MISSED;
+            usbActiveEndpointMissed++;
+        } else {
+            pEndpoint->bIndexed = USB_ENDPOINT_INDEX_IN;
+            usbActiveEndpoints[usbActiveEndpointCount++] = pEndpoint;
+        }
+        if (pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_INTERRUPT) {
+            // When no slot is free, the endpoint is polled by the interval count.
+            StructPeriodicScheduleOpen(pEndpoint, pEndpoint->bPriority);
+        }
+    }
+}
+
+/****************************************************************************
+  Function:
+    void _USB_ActiveEndpoints_Remove( USB_ENDPOINT_INFO *pEndpoint )
+
+  Description:
+    This function removes the endpoint from the active endpoint index
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_ENDPOINT_INFO * - pointer of endpoint
+
+  Returns:
+    None
+
+  Remarks:
+    The slot of the periodic schedule is released.
+    The last entry is moved to the hole, so the order is not kept.
+  ***************************************************************************/
+static void _USB_ActiveEndpoints_Remove( USB_ENDPOINT_INFO *pEndpoint )
+{
+    switch (pEndpoint->bIndexed)
+    {
+        case USB_ENDPOINT_INDEX_IN:
+            for(uint8_t i=0; i<usbActiveEndpointCount; i++) {
+                if (usbActiveEndpoints[i] == pEndpoint) {
+                    usbActiveEndpointCount--;
+                    usbActiveEndpoints[i] = usbActiveEndpoints[usbActiveEndpointCount];
+                    usbActiveEndpoints[usbActiveEndpointCount] = NULL;
+                    break;
+                }
+            }
+            break;
+        case USB_ENDPOINT_INDEX_MISSED:
+            usbActiveEndpointMissed--;
+            break;
+        default:
+            return;
+    }
+    pEndpoint->bIndexed = USB_ENDPOINT_INDEX_NONE;
+    StructPeriodicScheduleClose(pEndpoint);
+}
+
+/****************************************************************************
+  Function:
+    void _USB_ActiveEndpoints_RemoveSetting( USB_INTERFACE_SETTING_INFO *pSetting )
+
+  Description:
+    This function removes the endpoints of the setting from the active
+                endpoint index
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_INTERFACE_SETTING_INFO * - pointer of interface setting
+
+  Returns:
+    None
+
   Remarks:
     None
   ***************************************************************************/
+static void _USB_ActiveEndpoints_RemoveSetting( USB_INTERFACE_SETTING_INFO *pSetting )
+{
+    USB_ENDPOINT_INFO *pEndpoint;
+
+    for(pEndpoint = pSetting->pEndpointList; pEndpoint; pEndpoint = pEndpoint->next)
+    {
+        _USB_ActiveEndpoints_Remove(pEndpoint);
+    }
+}
+
+/****************************************************************************
+  Function:
+    void _USB_Endpoint_DecreaseInterval( USB_ENDPOINT_INFO *pEndpoint )
+
+  Description:
+    This function updates the per frame status of an endpoint
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_ENDPOINT_INFO * - pointer of endpoint
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+static __inline__ void _USB_Endpoint_DecreaseInterval( USB_ENDPOINT_INFO *pEndpoint )
+{
+    // Decrement the interval count of the isochronous endpoints and
+    // of the interrupt endpoints which found no slot of the periodic
+    // schedule; the others are polled by the schedule.
+    if (pEndpoint->bPeriod == 0)
+    {
+        if (pEndpoint->wIntervalCount != 0)
+        {
+            pEndpoint->wIntervalCount--;
+        }
+        pEndpoint->status.bfIntervalCountIsZero = 0;
+        if (pEndpoint->wIntervalCount == 0)
+        {
+            pEndpoint->wIntervalCount = pEndpoint->wInterval;
+            pEndpoint->status.bfIntervalCountIsZero = 1;
+        }
+    }
+
+    #ifndef ALLOW_MULTIPLE_NAKS_PER_FRAME
+        pEndpoint->status.bfLastTransferNAKd = 0;
+    #endif
+}
+
+/****************************************************************************
+  Function:
+    bool USB_ActiveEndpoints_DecreaseInterval( )
+
+  Description:
+    This function updates the per frame status of the active endpoints
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    true  - all periodic endpoints of the current settings are updated
+    false - some endpoints found the index full, nothing is updated;
+            call USB_InterfaceList_DecreaseInterval() for each device
+
+  Remarks:
+    Called every SOF. Only the active endpoint index is walked, so the cost
+    does not depend on the number of devices, interfaces and settings.
+  ***************************************************************************/
+bool USB_ActiveEndpoints_DecreaseInterval( void )
+{
+    if (usbActiveEndpointMissed)
+    {
+        return false;
+    }
+    for(uint8_t i=0; i<usbActiveEndpointCount; i++)
+    {
+        _USB_Endpoint_DecreaseInterval(usbActiveEndpoints[i]);
+    }
+    return true;
+}
+
+/****************************************************************************
+  Function:
+    void USB_InterfaceList_DecreaseInterval( )
+
+  Description:
+    This function updates the per frame status of the periodic endpoints
+                in the current settings of the list
+
+  Precondition:
+    None
+
+  Parameters:
+    USB_INTERFACE_INFO * - pointer of interface list
+
+  Returns:
+    None
+
+  Remarks:
+    Used while the active endpoint index is full.
+  ***************************************************************************/
 void USB_InterfaceList_DecreaseInterval( USB_INTERFACE_INFO *pInterfaceList )
 {
     USB_ENDPOINT_INFO *pEndpoint;
@@ -277,28 +581,10 @@ void USB_InterfaceList_DecreaseInterval( USB_INTERFACE_INFO *pInterfaceList )
             pEndpoint = pInterfaceList->pCurrentSetting->pEndpointList;
             while (pEndpoint)
             {
-                // Decrement the interval count of all active interrupt and isochronous endpoints.
-                if ((pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_INTERRUPT)
-#ifdef USB_SUPPORT_ISOCHRONOUS_TRANSFERS
-                    || (pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS)
-#endif
-                ) {
-                    if (pEndpoint->wIntervalCount != 0)
-                    {
-                        pEndpoint->wIntervalCount--;
-                    }
-                    pEndpoint->status.bfIntervalCountIsZero = 0;
-                    if (pEndpoint->wIntervalCount == 0)
-                    {
-                        pEndpoint->wIntervalCount = pEndpoint->wInterval;
-                        pEndpoint->status.bfIntervalCountIsZero = 1;
-                    }
+                if (pEndpoint->bIndexed != USB_ENDPOINT_INDEX_NONE)
+                {
+                    _USB_Endpoint_DecreaseInterval(pEndpoint);
                 }
-
-                #ifndef ALLOW_MULTIPLE_NAKS_PER_FRAME
-                    pEndpoint->status.bfLastTransferNAKd = 0;
-                #endif
-
                 pEndpoint = pEndpoint->next;
             }
         }
@@ -366,6 +652,8 @@ uint8_t USB_InterfaceList_CheckInterface( USB_INTERFACE_INFO *pInterfaceList, ui
     }
 
     // Set the pointer to the new setting.
+    _USB_ActiveEndpoints_RemoveSetting(pInterfaceList->pCurrentSetting);
+    _USB_ActiveEndpoints_Add(pSetting);
     pInterfaceList->pCurrentSetting = pSetting;
     
     return 1;
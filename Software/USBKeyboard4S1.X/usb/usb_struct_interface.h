@@ -13,6 +13,32 @@
 #include "common.h"
 #include "usb_common.h"
 #include "usb_ch9.h"
+#include "usb_config.h"
+
+// Interrupt and isochronous endpoints of a device in the active endpoint index.
+// A composite keyboard has two interfaces with an IN and an OUT endpoint each.
+#ifndef USB_ACTIVE_ENDPOINTS_PER_DEVICE
+    #define USB_ACTIVE_ENDPOINTS_PER_DEVICE 4
+#endif
+// Maximum number of endpoints in the active endpoint index: hubs, HID devices
+// and one under enumeration. The endpoints which find it full are updated by
+// walking the interface lists of all devices instead.
+#ifndef USB_ACTIVE_ENDPOINT_MAX
+    #define USB_ACTIVE_ENDPOINT_MAX ((USB_MAX_HUB_DEVICES + USB_MAX_HID_DEVICES + 1) * USB_ACTIVE_ENDPOINTS_PER_DEVICE)
+#endif
+
+// Endpoint numbers 1 to USB_ENDPOINT_MAP_NUMS are found from the endpoint map
+// without walking the interface list
+#ifndef USB_ENDPOINT_MAP_NUMS
+    #define USB_ENDPOINT_MAP_NUMS   8
+#endif
+#define USB_ENDPOINT_MAP_SIZE   (USB_ENDPOINT_MAP_NUMS * 2)
+#define USB_ENDPOINT_MAP_INDEX(endpoint)    ((((endpoint) & 0x0f) - 1) * 2 + ((endpoint) >> 7))
+#define USB_ENDPOINT_MAP_HAS(endpoint)      ((((endpoint) & 0x0f) != 0) && (((endpoint) & 0x0f) <= USB_ENDPOINT_MAP_NUMS))
+
+#define USB_ENDPOINT_INDEX_NONE     0   // Not in a current setting, or not periodic
+#define USB_ENDPOINT_INDEX_IN       1   // In the active endpoint index
+#define USB_ENDPOINT_INDEX_MISSED   2   // In a current setting, but the index was full
 
 // *****************************************************************************
 /* Useful Data Structure
@@ -73,6 +99,12 @@ typedef struct _USB_ENDPOINT_INFO
     volatile uint8_t        bErrorCode;                     // If bfError is set, this indicates the reason
     volatile uint16_t       countNAKs;                      // Count of NAK's of current transaction.
     uint16_t                timeoutNAKs;                    // Count of NAK's for a timeout, if bfNAKTimeoutEnabled.
+    uint8_t                 bPeriod;                        // Period in the periodic schedule (0: not scheduled)
+    uint8_t                 bPhase;                         // First frame in the periodic schedule
+    uint8_t                 bPriority;                      // Priority in the periodic schedule
+    uint8_t                 bServedFrame;                   // Frame count when the endpoint was last polled
+    uint8_t                 bSlot;                          // Slot of the request in the periodic schedule
+    uint8_t                 bIndexed;                       // USB_ENDPOINT_INDEX_xxx, in the active endpoint index or not
 #ifdef DEBUG_ENABLE
     uint16_t                debugInfo;                      // for debug
 #endif
@@ -118,7 +150,10 @@ void USB_InterfaceList_Clear( USB_INTERFACE_INFO **pInterfaceList );
 USB_ENDPOINT_INFO *USB_InterfaceList_FindEndpointEx( USB_INTERFACE_INFO *pInterfaceList, uint8_t interface, uint8_t setting, uint8_t endpoint );
 USB_ENDPOINT_INFO *USB_InterfaceList_FindEndpoint( USB_INTERFACE_INFO *pInterfaceList, uint8_t endpoint );
 void USB_InterfaceList_SetData0( USB_INTERFACE_INFO *pInterfaceList );
+void USB_InterfaceList_Activate( USB_INTERFACE_INFO *pInterfaceList );
 void USB_InterfaceList_DecreaseInterval( USB_INTERFACE_INFO *pInterfaceList );
+bool USB_ActiveEndpoints_DecreaseInterval( void );
+void USB_InterfaceList_MapEndpoints( USB_INTERFACE_INFO *pInterfaceList, USB_ENDPOINT_INFO **pEndpointMap );
 uint8_t USB_InterfaceList_CheckInterface( USB_INTERFACE_INFO *pInterfaceList, uint16_t wIndex, uint16_t wValue );
 
 #endif	/* USB_STRUCT_INTERFACE_H */
@@ -41,25 +41,41 @@ ISR that need to be synchronized to the USB event tasks loop (see
 USB_EVENT_DATA, above).  See "struct_queue.h" for usage and operations.
 */
 #if defined( USB_ENABLE_TRANSFER_EVENT )
-#ifndef USB_EVENT_QUEUE_DEPTH
-    #define USB_EVENT_QUEUE_DEPTH   4       // Default depth of 4 events
+#if (USB_EVENT_QUEUE_DEPTH & (USB_EVENT_QUEUE_DEPTH - 1)) || (USB_EVENT_QUEUE_DEPTH > 128)
+    #error "USB_EVENT_QUEUE_DEPTH must be power of 2 and 128 or less."
 #endif
 
+/* Single producer / single consumer ring.
+ * head is written only by the producer, the transfer completion in
+ * USB_HostInterruptTasks(), and tail only by the consumer,
+ * StructEventQueueProcess(). Both run in the main loop, except that the
+ * producer runs in the USB ISR with USB_HOST_TASKS_IN_ISR; the ring is
+ * right in both cases, so no interrupt masking is needed.
+ * Both indexes run freely and are masked when the buffer is accessed.
+ * An entry is released before the client is called back, so an endpoint
+ * restarted from the callback never holds two entries, and the ring never
+ * overflows with USB_EVENT_QUEUE_MIN entries or more (see usb_struct_queue.h).
+ * tools/usb_queue_stress.c runs the two sides on two threads.
+ */
 typedef struct _usb_event_queue
 {
-    int             head;
-    int             tail;
-    int             count;
-    USB_EVENT_DATA  buffer[USB_EVENT_QUEUE_DEPTH];
+    volatile uint8_t    head;           // producer index
+    volatile uint8_t    tail;           // consumer index
+    uint8_t             highWatermark;  // maximum number of queued events
+    uint16_t            overflows;      // number of events lost by full queue
+    USB_EVENT_DATA      buffer[USB_EVENT_QUEUE_DEPTH];
 
 } USB_EVENT_QUEUE;
 
-static USB_EVENT_QUEUE              usbEventQueue;                           // Queue of USB events used to synchronize ISR to main tasks loop.
+static USB_EVENT_QUEUE              usbEventQueue;                           // Queue of USB events used to synchronize transfer completion to main tasks loop.
 
 /****************************************************************************/
 void StructEventQueueInit(void)
 {
-    StructQueueInit(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
+    usbEventQueue.head = 0;
+    usbEventQueue.tail = 0;
+    usbEventQueue.highWatermark = 0;
+    usbEventQueue.overflows = 0;
 }
 
 /****************************************************************************/
@@ -75,11 +91,14 @@ void StructEventQueueAdd(
     uint8_t                 clientDriver        // INTERNAL USE ONLY - Client driver index for sending the event.
 )
 {
-    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
+    uint8_t head = usbEventQueue.head;
+    uint8_t count = (uint8_t)(head - usbEventQueue.tail);
+
+    if (count < USB_EVENT_QUEUE_DEPTH)
     {
         USB_EVENT_DATA *data;
 
-        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
+        data = &usbEventQueue.buffer[head & (USB_EVENT_QUEUE_DEPTH - 1)];
         data->event = event;
         data->deviceInfo                    = (USB_DEVICE_INFO *)deviceInfo;
         data->TransferData.dataCount        = dataCount;
@@ -88,10 +107,20 @@ void StructEventQueueAdd(
         data->TransferData.bEndpointAddress = bEndpointAddress;
         data->TransferData.bmAttributes.val = bmAttributes.val;
         data->TransferData.clientDriver     = clientDriver;
+
+        // publish the entry after it is filled
+        __sync_synchronize();
+        usbEventQueue.head = head + 1;
+
+        count++;
+        if (usbEventQueue.highWatermark < count) {
+            usbEventQueue.highWatermark = count;
+        }
     }
     else
     {
         endpointInfo->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+        usbEventQueue.overflows++;
     }
 }
 
@@ -130,36 +159,41 @@ void StructEventQueueAdd_Error(USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *e
 /****************************************************************************/
 void StructEventQueueProcess(void)
 {
-    USB_EVENT_DATA *item;
-#if defined( __PIC32__ )
-    uint32_t interrupt_mask;
-#else
-    #error "Cannot save interrupt status"
-#endif
+    USB_EVENT_DATA item;
+    uint8_t tail = usbEventQueue.tail;
 
-    while (StructQueueIsNotEmpty(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
+    while (tail != usbEventQueue.head)
     {
-        item = StructQueuePeekTail(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
+        item = usbEventQueue.buffer[tail & (USB_EVENT_QUEUE_DEPTH - 1)];
 
-        switch(item->event)
+        // release the entry after it is copied, before the client restarts
+        // the transfer in the callback
+        __sync_synchronize();
+        tail++;
+        usbEventQueue.tail = tail;
+
+        switch(item.event)
         {
             case EVENT_TRANSFER:
             case EVENT_BUS_ERROR:
-                _USB_NotifyClients( item->deviceInfo, item->event, &item->TransferData, sizeof(HOST_TRANSFER_DATA) );
+                _USB_NotifyClients( item.deviceInfo, item.event, &item.TransferData, sizeof(HOST_TRANSFER_DATA) );
                 break;
             default:
                 break;
         }
+    }
+}
 
-        // Guard against USB interrupts
-        interrupt_mask = U1IE;
-        U1IE = 0;
-
-        item = StructQueueRemove(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
+/****************************************************************************/
+uint8_t StructEventQueueHighWatermark(void)
+{
+    return usbEventQueue.highWatermark;
+}
 
-        // Re-enable USB interrupts
-        U1IE = interrupt_mask;
-    }
+/****************************************************************************/
+uint16_t StructEventQueueOverflows(void)
+{
+    return usbEventQueue.overflows;
 }
 #endif /* USB_ENABLE_TRANSFER_EVENT */
 
@@ -225,6 +259,25 @@ USB_TRANSFER_DATA *StructTransferControlQueueGet(void)
 }
 
 // *****************************************************************************
+/* Periodic Schedule
+
+ * Each opened interrupt endpoint gets a period (power of 2 frames, not longer
+ * than wInterval) and a phase in a table of USB_PERIODIC_FRAMES frames,
+ * like the periodic frame list of EHCI, and owns a slot for its request.
+ * A queued request sets the bit of its slot in every frame of the endpoint,
+ * so the due requests of the current frame are found by one table lookup.
+ * When the SOF task runs late and several frames pass at once, the requests
+ * due in the skipped frames are marked late and polled in the current one.
+ * Slots are taken by the endpoints of the current settings only (see
+ * usb_struct_interface.c). An endpoint which finds no slot free is not
+ * refused: its request goes to the small queue of unscheduled requests,
+ * which is scanned by the valid flag and polled when the interval count
+ * of the endpoint is zero, as the stack did before the schedule.
+*/
+#if (USB_PERIODIC_SLOTS > 8)
+    #error "USB_PERIODIC_SLOTS must be 8 or less for the periodic schedule."
+#endif
+
 typedef struct _usb_transfer_interrupt_queue
 {
     int                valid;
@@ -232,46 +285,302 @@ typedef struct _usb_transfer_interrupt_queue
 
 } USB_TRANSFER_INTERRUPT_QUEUE;
 
-static USB_TRANSFER_INTERRUPT_QUEUE usbTransferInterruptQueue[USB_TRANSFER_QUEUE_DEPTH];
+static USB_TRANSFER_INTERRUPT_QUEUE usbTransferInterruptQueue[USB_PERIODIC_SLOTS];
+
+static uint8_t usbPeriodicTable[USB_PERIODIC_FRAMES];   // bit n: request in slot n is due in the frame
+static uint8_t usbPeriodicLoad[USB_PERIODIC_FRAMES];    // number of opened endpoints polled in the frame
+static uint8_t usbPeriodicHighSlots;                    // bit n: request in slot n has high priority
+static uint8_t usbPeriodicOpenSlots;                    // bit n: slot n is owned by an opened endpoint
+static uint8_t usbPeriodicLateSlots;                    // bit n: request in slot n missed its frame
+static uint8_t usbPeriodicFrame;                        // current frame count (free running)
+
+static USB_TRANSFER_INTERRUPT_QUEUE usbTransferInterruptScan[USB_TRANSFER_QUEUE_DEPTH];   // requests of unscheduled endpoints
 
 /****************************************************************************/
-void StructTransferInterruptQueueInit(void)
+static USB_TRANSFER_INTERRUPT_QUEUE *_StructTransferInterruptScanFind(USB_ENDPOINT_INFO *endpointInfo)
 {
-    memset(&usbTransferInterruptQueue, 0, sizeof(USB_TRANSFER_INTERRUPT_QUEUE));
+    for(int i=0; i<USB_TRANSFER_QUEUE_DEPTH; i++) {
+        USB_TRANSFER_INTERRUPT_QUEUE *p = &usbTransferInterruptScan[i];
+        if (p->valid && p->buffer.endpointInfo == endpointInfo) {
+            return p;
+        }
+    }
+    return NULL;
 }
 
 /****************************************************************************/
-void StructTransferInterruptQueueAdd(
+static bool _StructTransferInterruptScanAdd(
     USB_DEVICE_INFO             *deviceInfo,        // Device information
     USB_ENDPOINT_INFO           *endpointInfo       // Endpoint information
 )
 {
+    if (_StructTransferInterruptScanFind(endpointInfo)) {
+        return false;
+    }
     for(int i=0; i<USB_TRANSFER_QUEUE_DEPTH; i++) {
-        USB_TRANSFER_INTERRUPT_QUEUE *p = &usbTransferInterruptQueue[i];
+        USB_TRANSFER_INTERRUPT_QUEUE *p = &usbTransferInterruptScan[i];
         if (!p->valid) {
             p->buffer.deviceInfo = (USB_DEVICE_INFO *)deviceInfo;
             p->buffer.endpointInfo = endpointInfo;
             p->valid = 1;
-            break;
+            return true;
         }
     }
+    return false;
 }
 
 /****************************************************************************/
-USB_TRANSFER_DATA *StructTransferInterruptQueueGet(void)
+/* priority : USB_PERIODIC_PRIORITY_HIGH: high only, LOW: any */
+static USB_TRANSFER_DATA *_StructTransferInterruptScanGet(uint8_t priority)
 {
-    USB_TRANSFER_DATA *item = NULL;
-
     for(int i=0; i<USB_TRANSFER_QUEUE_DEPTH; i++) {
-        USB_TRANSFER_INTERRUPT_QUEUE *p = &usbTransferInterruptQueue[i];
+        USB_TRANSFER_INTERRUPT_QUEUE *p = &usbTransferInterruptScan[i];
+        USB_ENDPOINT_INFO *endpointInfo = p->buffer.endpointInfo;
         if (!p->valid) continue;
-        if (p->buffer.endpointInfo->status.bfIntervalCountIsZero) {
-            item = &p->buffer;
+        if (priority == USB_PERIODIC_PRIORITY_HIGH && endpointInfo->bPriority != USB_PERIODIC_PRIORITY_HIGH) continue;
+        if (endpointInfo->status.bfIntervalCountIsZero && endpointInfo->bServedFrame != usbPeriodicFrame) {
+            StructPeriodicScheduleServe(endpointInfo);
             p->valid = 0;
-            break;
+            return &p->buffer;
         }
     }
-    return item;
+    return NULL;
+}
+
+/****************************************************************************/
+static void _StructTransferInterruptQueueRemove(int i)
+{
+    USB_ENDPOINT_INFO *endpointInfo = usbTransferInterruptQueue[i].buffer.endpointInfo;
+
+    for(uint8_t f=endpointInfo->bPhase; f<USB_PERIODIC_FRAMES; f+=endpointInfo->bPeriod) {
+        usbPeriodicTable[f] &= ~(1 << i);
+    }
+    usbPeriodicHighSlots &= ~(1 << i);
+    usbPeriodicLateSlots &= ~(1 << i);
+    usbTransferInterruptQueue[i].valid = 0;
+}
+
+/****************************************************************************/
+bool StructPeriodicScheduleOpen(
+    USB_ENDPOINT_INFO           *endpointInfo,      // Endpoint information
+    uint8_t                     priority            // USB_PERIODIC_PRIORITY_HIGH or LOW
+)
+{
+    uint8_t period = 1;
+    uint8_t phase = 0;
+    uint8_t minLoad = 0xff;
+    uint8_t slot;
+
+    endpointInfo->bPeriod = 0;
+    endpointInfo->bPriority = priority;
+    endpointInfo->bServedFrame = usbPeriodicFrame - 1;
+
+    // every opened endpoint owns a slot, so that its request is never dropped
+    for(slot=0; slot<USB_PERIODIC_SLOTS; slot++) {
+        if (!(usbPeriodicOpenSlots & (1 << slot))) break;
+    }
+    if (slot >= USB_PERIODIC_SLOTS) {
+#ifdef DEBUG_ENABLE
+        DEBUG_PutStringHexU8("Periodic schedule full EP:", endpointInfo->bEndpointAddress);
+#endif
+        return false;
+    }
+
+    // round down the interval to power of 2
+    while ((period < USB_PERIODIC_FRAMES) && ((uint16_t)(period << 1) <= endpointInfo->wInterval))
+    {
+        period <<= 1;
+    }
+
+    // select the phase whose busiest frame is the least loaded
+    for(uint8_t p=0; p<period; p++) {
+        uint8_t load = 0;
+        for(uint8_t f=p; f<USB_PERIODIC_FRAMES; f+=period) {
+            if (load < usbPeriodicLoad[f]) load = usbPeriodicLoad[f];
+        }
+        if (load < minLoad) {
+            minLoad = load;
+            phase = p;
+        }
+    }
+    for(uint8_t f=phase; f<USB_PERIODIC_FRAMES; f+=period) {
+        usbPeriodicLoad[f]++;
+    }
+    usbPeriodicOpenSlots |= (1 << slot);
+
+    endpointInfo->bPeriod = period;
+    endpointInfo->bPhase = phase;
+    endpointInfo->bSlot = slot;
+    return true;
+}
+
+/****************************************************************************/
+void StructPeriodicScheduleClose(
+    USB_ENDPOINT_INFO           *endpointInfo       // Endpoint information
+)
+{
+    uint8_t period = endpointInfo->bPeriod;
+    uint8_t slot = endpointInfo->bSlot;
+    USB_TRANSFER_INTERRUPT_QUEUE *p;
+
+    if (!period) {
+        // drop the request of the unscheduled endpoint being freed
+        p = _StructTransferInterruptScanFind(endpointInfo);
+        if (p) p->valid = 0;
+        return;
+    }
+
+    for(uint8_t f=endpointInfo->bPhase; f<USB_PERIODIC_FRAMES; f+=period) {
+        if (usbPeriodicLoad[f]) usbPeriodicLoad[f]--;
+    }
+    // drop the request of the endpoint being freed
+    if (usbTransferInterruptQueue[slot].valid) {
+        _StructTransferInterruptQueueRemove(slot);
+    }
+    usbPeriodicOpenSlots &= ~(1 << slot);
+    endpointInfo->bPeriod = 0;
+}
+
+/****************************************************************************/
+void StructPeriodicScheduleFrame(uint16_t frames)
+{
+    uint8_t f;
+
+    if (!frames) return;
+
+    // the requests due in the frames skipped are late
+    if (frames > USB_PERIODIC_FRAMES) {
+        for(f=0; f<USB_PERIODIC_FRAMES; f++) {
+            usbPeriodicLateSlots |= usbPeriodicTable[f];
+        }
+    } else {
+        for(f=1; f<frames; f++) {
+            usbPeriodicLateSlots |= usbPeriodicTable[(uint8_t)(usbPeriodicFrame + f) & (USB_PERIODIC_FRAMES - 1)];
+        }
+    }
+    usbPeriodicFrame += (uint8_t)frames;
+}
+
+/****************************************************************************/
+void StructPeriodicScheduleServe(USB_ENDPOINT_INFO *endpointInfo)
+{
+    endpointInfo->bServedFrame = usbPeriodicFrame;
+}
+
+/****************************************************************************/
+void StructTransferInterruptQueueInit(void)
+{
+    memset(usbTransferInterruptQueue, 0, sizeof(usbTransferInterruptQueue));
+    memset(usbTransferInterruptScan, 0, sizeof(usbTransferInterruptScan));
+    memset(usbPeriodicTable, 0, sizeof(usbPeriodicTable));
+    memset(usbPeriodicLoad, 0, sizeof(usbPeriodicLoad));
+    usbPeriodicHighSlots = 0;
+    usbPeriodicOpenSlots = 0;
+    usbPeriodicLateSlots = 0;
+    usbPeriodicFrame = 0;
+}
+
+/****************************************************************************/
+bool StructTransferInterruptQueueAdd(
+    USB_DEVICE_INFO             *deviceInfo,        // Device information
+    USB_ENDPOINT_INFO           *endpointInfo       // Endpoint information
+)
+{
+    uint8_t period = endpointInfo->bPeriod;
+    uint8_t i = endpointInfo->bSlot;
+    USB_TRANSFER_INTERRUPT_QUEUE *p = &usbTransferInterruptQueue[i];
+
+    if (!period) {
+        // no slot was free when the endpoint was opened
+        if (_StructTransferInterruptScanAdd(deviceInfo, endpointInfo)) {
+            return true;
+        }
+#ifdef DEBUG_ENABLE
+        DEBUG_PutStringHexU8("Periodic request dropped EP:", endpointInfo->bEndpointAddress);
+#endif
+        return false;
+    }
+    if (p->valid) {
+#ifdef DEBUG_ENABLE
+        DEBUG_PutStringHexU8("Periodic request dropped EP:", endpointInfo->bEndpointAddress);
+#endif
+        return false;
+    }
+
+    // not polled for a long time, keep the frame count from wrapping around
+    if ((uint8_t)(usbPeriodicFrame - endpointInfo->bServedFrame) > period) {
+        endpointInfo->bServedFrame = usbPeriodicFrame - period;
+    }
+
+    p->buffer.deviceInfo = (USB_DEVICE_INFO *)deviceInfo;
+    p->buffer.endpointInfo = endpointInfo;
+    p->valid = 1;
+    for(uint8_t f=endpointInfo->bPhase; f<USB_PERIODIC_FRAMES; f+=period) {
+        usbPeriodicTable[f] |= (1 << i);
+    }
+    if (endpointInfo->bPriority == USB_PERIODIC_PRIORITY_HIGH) {
+        usbPeriodicHighSlots |= (1 << i);
+    }
+    return true;
+}
+
+/****************************************************************************/
+/* Put back a request polled in this frame, it is polled again in the next
+ * frame as a late one.
+ */
+bool StructTransferInterruptQueueDefer(
+    USB_DEVICE_INFO             *deviceInfo,        // Device information
+    USB_ENDPOINT_INFO           *endpointInfo       // Endpoint information
+)
+{
+    if (!StructTransferInterruptQueueAdd(deviceInfo, endpointInfo)) {
+        return false;
+    }
+    if (endpointInfo->bPeriod) {
+        usbPeriodicLateSlots |= (1 << endpointInfo->bSlot);
+    } else {
+        // the interval count becomes zero in the next frame
+        endpointInfo->wIntervalCount = 1;
+    }
+    return true;
+}
+
+/****************************************************************************/
+USB_TRANSFER_DATA *StructTransferInterruptQueueGet(
+    uint8_t                     priority            // USB_PERIODIC_PRIORITY_HIGH: high only, LOW: any
+)
+{
+    uint8_t due = usbPeriodicTable[usbPeriodicFrame & (USB_PERIODIC_FRAMES - 1)] | usbPeriodicLateSlots;
+    USB_TRANSFER_INTERRUPT_QUEUE *p;
+    USB_TRANSFER_DATA *item;
+    int i;
+
+    // an endpoint is polled once in a frame, even if the next request
+    // is queued while the frame is still running; a late bit is kept,
+    // so that a deferred request is polled in the next frame
+    for(uint8_t bits=due; bits; bits&=(bits - 1)) {
+        i = __builtin_ctz(bits);
+        if (usbTransferInterruptQueue[i].buffer.endpointInfo->bServedFrame == usbPeriodicFrame) {
+            due &= ~(1 << i);
+        }
+    }
+
+    // keyboard first, hub status change polling next,
+    // the scheduled requests before the unscheduled ones of the same priority
+    if (due & usbPeriodicHighSlots) {
+        due &= usbPeriodicHighSlots;
+    } else {
+        item = _StructTransferInterruptScanGet(USB_PERIODIC_PRIORITY_HIGH);
+        if (item || priority == USB_PERIODIC_PRIORITY_HIGH) return item;
+        if (!due) return _StructTransferInterruptScanGet(USB_PERIODIC_PRIORITY_LOW);
+    }
+
+    i = __builtin_ctz(due);
+    p = &usbTransferInterruptQueue[i];
+    StructPeriodicScheduleServe(p->buffer.endpointInfo);
+    _StructTransferInterruptQueueRemove(i);
+
+    return &p->buffer;
 }
 
 /*************************************************************************
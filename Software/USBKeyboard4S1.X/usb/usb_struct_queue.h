@@ -309,10 +309,33 @@ please contact mla_licensing@microchip.com
  * Event Queue
  *************************************************************************/
 
+// An endpoint has one transfer in flight, so the completions waiting in the
+// queue are at most one for each open endpoint, the periodic ones in the
+// active endpoint index and EP0. Endpoints which find the index full are not
+// counted, their events may be lost (StructEventQueueOverflows()).
+#define USB_EVENT_QUEUE_MIN     (USB_ACTIVE_ENDPOINT_MAX + 1)
+#ifndef USB_EVENT_QUEUE_DEPTH
+    #if   USB_EVENT_QUEUE_MIN <= 4
+        #define USB_EVENT_QUEUE_DEPTH   4
+    #elif USB_EVENT_QUEUE_MIN <= 8
+        #define USB_EVENT_QUEUE_DEPTH   8
+    #elif USB_EVENT_QUEUE_MIN <= 16
+        #define USB_EVENT_QUEUE_DEPTH   16
+    #elif USB_EVENT_QUEUE_MIN <= 32
+        #define USB_EVENT_QUEUE_DEPTH   32
+    #elif USB_EVENT_QUEUE_MIN <= 64
+        #define USB_EVENT_QUEUE_DEPTH   64
+    #else
+        #define USB_EVENT_QUEUE_DEPTH   128
+    #endif
+#endif
+
 void StructEventQueueInit(void);
 void StructEventQueueAdd_Success(USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *endpointInfo);
 void StructEventQueueAdd_Error(USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *endpointInfo);
 void StructEventQueueProcess(void);
+uint8_t StructEventQueueHighWatermark(void);
+uint16_t StructEventQueueOverflows(void);
 
 /*************************************************************************
  * Transfer Queue
@@ -322,9 +345,22 @@ void StructTransferControlQueueInit(void);
 void StructTransferControlQueueAdd(USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *endpointInfo);
 USB_TRANSFER_DATA *StructTransferControlQueueGet(void);
 
+#define USB_PERIODIC_FRAMES         32  // Number of frames in the periodic schedule (power of 2)
+#ifndef USB_PERIODIC_SLOTS
+#define USB_PERIODIC_SLOTS          8   // Number of interrupt endpoints in the periodic schedule (8 or less)
+#endif
+#define USB_PERIODIC_PRIORITY_HIGH  0   // Keyboard and other devices
+#define USB_PERIODIC_PRIORITY_LOW   1   // Hub status change
+
+bool StructPeriodicScheduleOpen(USB_ENDPOINT_INFO *endpointInfo, uint8_t priority);
+void StructPeriodicScheduleClose(USB_ENDPOINT_INFO *endpointInfo);
+void StructPeriodicScheduleFrame(uint16_t frames);
+void StructPeriodicScheduleServe(USB_ENDPOINT_INFO *endpointInfo);
+
 void StructTransferInterruptQueueInit(void);
-void StructTransferInterruptQueueAdd(USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *endpointInfo);
-USB_TRANSFER_DATA *StructTransferInterruptQueueGet(void);
+bool StructTransferInterruptQueueAdd(USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *endpointInfo);
+bool StructTransferInterruptQueueDefer(USB_DEVICE_INFO *deviceInfo, USB_ENDPOINT_INFO *endpointInfo);
+USB_TRANSFER_DATA *StructTransferInterruptQueueGet(uint8_t priority);
 
 #endif // STRUCT_QUEUE_H
 /*************************************************************************